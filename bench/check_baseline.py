@@ -0,0 +1,90 @@
+"""Runs every benchmark in this directory with `loxpp --bench` on both backends and
+compares the median times against baseline.json. Fails if any benchmark got slower
+than its baseline by more than the threshold.
+
+usage: check_baseline.py LOXPP [--threshold FRACTION] [--iterations N] [--update]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+import generate
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+BASELINE_PATH = os.path.join(BENCH_DIR, "baseline.json")
+BACKENDS = ["tree", "closure"]
+GENERATED = "generated.lox"
+
+
+def benchmarks(work_dir):
+    scripts = sorted(name for name in os.listdir(BENCH_DIR) if name.endswith(".lox"))
+    paths = {name: os.path.join(BENCH_DIR, name) for name in scripts}
+
+    generated = os.path.join(work_dir, GENERATED)
+    with open(generated, "w") as output:
+        output.write(generate.generate(3000))
+    paths[GENERATED] = generated
+    return paths
+
+
+def run(loxpp, backend, path, iterations):
+    command = [loxpp, f"--backend={backend}", "--iterations", str(iterations), "--warmup", "1", "--json", "--bench", path]
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.exit(f"{' '.join(command)} failed with exit code {result.returncode}:\n{result.stderr}")
+    return json.loads(result.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("loxpp")
+    parser.add_argument("--threshold", type=float, default=0.3,
+                        help="how much slower than its baseline a benchmark may get, as a fraction")
+    parser.add_argument("--iterations", type=int, default=10)
+    parser.add_argument("--work-dir", default=BENCH_DIR, help="where to write the generated benchmark")
+    parser.add_argument("--update", action="store_true", help="record the results as the new baseline")
+    args = parser.parse_args()
+
+    baseline = {}
+    if os.path.exists(BASELINE_PATH):
+        with open(BASELINE_PATH) as baseline_file:
+            baseline = json.load(baseline_file)
+
+    results = {}
+    regressions = []
+    for name, path in benchmarks(args.work_dir).items():
+        for backend in BACKENDS:
+            result = run(args.loxpp, backend, path, args.iterations)
+            results.setdefault(name, {})[backend] = {"median_ms": round(result["median_ms"], 3)}
+
+            expected = baseline.get(name, {}).get(backend, {}).get("median_ms")
+            if expected is None:
+                status = "new"
+            else:
+                change = result["median_ms"] / expected - 1
+                status = f"{change:+.1%}"
+                if change > args.threshold:
+                    status += "  REGRESSION"
+                    regressions.append(f"{name} ({backend})")
+            print(f"{name:20} {backend:8} median {result['median_ms']:9.3f} ms  "
+                  f"p99 {result['p99_ms']:9.3f} ms  {status}")
+
+    if args.update:
+        with open(BASELINE_PATH, "w") as baseline_file:
+            json.dump(results, baseline_file, indent=4, sort_keys=True)
+            baseline_file.write("\n")
+        print(f"Wrote {BASELINE_PATH}.")
+        return 0
+
+    if regressions:
+        print(f"\033[91mSlower than baseline by more than {args.threshold:.0%}\033[0m: {', '.join(regressions)}")
+        return 1
+    print(f"\033[92mNo benchmark is more than {args.threshold:.0%} slower than its baseline.\033[0m")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
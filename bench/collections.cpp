@@ -0,0 +1,78 @@
+// What lists.lox and maps.lox do, written with the standard library, to compare the
+// interpreter's lists and maps against. Prints how long each phase took, and the same
+// results as the scripts.
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    /// @brief Prints how long has passed since `start`, and restarts it.
+    void lap(const char* phase, Clock::time_point& start) {
+        auto now = Clock::now();
+        std::printf("%-16s %8.2f ms\n", phase, std::chrono::duration<double, std::milli>(now - start).count());
+        start = now;
+    }
+
+    void lists() {
+        constexpr int count = 1000000;
+        auto start = Clock::now();
+        auto values = std::vector<float>();
+        for (int i = 0; i < count; ++i)
+            values.push_back(static_cast<float>(i));
+        lap("list append", start);
+
+        int odd = 0;
+        for (int i = 0; i < count; ++i) {
+            if (values[i] > 499999) ++odd;
+        }
+        lap("list index", start);
+
+        int seen = 0;
+        for (auto value : values) {
+            if (value < 500000) ++seen;
+        }
+        lap("list iterate", start);
+        std::printf("%zu %d %d\n", values.size(), odd, seen);
+    }
+
+    void maps() {
+        const char digits[] = "0123456789";
+        auto start = Clock::now();
+        auto values = std::unordered_map<std::string, float>();
+        float count = 0;
+        for (int i = 0; i < 1000000; ++i) {
+            auto key = std::string(6, '0');
+            for (int place = 5, rest = i; place >= 0; --place, rest /= 10)
+                key[place] = digits[rest % 10];
+            values[key] = count++;
+        }
+        lap("map insert", start);
+
+        auto keys = std::vector<std::string>();
+        keys.reserve(values.size());
+        for (const auto& [key, value] : values)
+            keys.push_back(key);
+        int found = 0;
+        for (const auto& key : keys) {
+            if (values[key] < 500000) ++found;
+        }
+        lap("map lookup", start);
+
+        int seen = 0;
+        for (const auto& entry : values) {
+            (void)entry;
+            ++seen;
+        }
+        lap("map iterate", start);
+        std::printf("%zu %d %d %g\n", values.size(), found, seen, values["999999"]);
+    }
+}
+
+int main() {
+    lists();
+    maps();
+}
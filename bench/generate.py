@@ -0,0 +1,41 @@
+"""Writes a large, deterministic Lox program, so the benchmarks cover scanning,
+parsing and resolving as well as running.
+
+usage: generate.py OUTPUT [--functions N]
+"""
+
+import argparse
+
+
+def function(index):
+    return f"""fun fn{index}(a, b) {{
+    var total = a * {index % 7 + 1} + b;
+    if (total > {index}) {{
+        total = total - {index};
+    }} else {{
+        total = total + {index % 13};
+    }}
+    for (var i = 0; i < 3; i = i + 1) {{
+        total = total + i * (a - b) / {index % 5 + 1};
+    }}
+    return total;
+}}
+"""
+
+
+def generate(count):
+    parts = [function(i) for i in range(count)]
+    parts.append("var result = 0;\n")
+    for i in range(count):
+        parts.append(f"result = result + fn{i}({i % 17}, {i % 11});\n")
+    parts.append("print result;\n")
+    return "".join(parts)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("output")
+    parser.add_argument("--functions", type=int, default=3000)
+    args = parser.parse_args()
+    with open(args.output, "w") as output:
+        output.write(generate(args.functions))
@@ -0,0 +1,51 @@
+"""Runs a benchmark with `loxpp --bench` on 1, 2, 4, ... threads, up to the number of
+hardware threads, and reports how much faster each is than one thread. Only
+`parallel for` loops use more than one thread.
+
+usage: scaling.py LOXPP [SCRIPT] [--backend tree|closure] [--iterations N] [--max-threads N]
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def run(loxpp, backend, path, threads, iterations):
+    command = [loxpp, f"--backend={backend}", f"--threads={threads}", "--iterations", str(iterations),
+               "--warmup", "1", "--json", "--bench", path]
+    result = subprocess.run(command, capture_output=True, text=True)
+    if result.returncode != 0:
+        sys.exit(f"{' '.join(command)} failed with exit code {result.returncode}:\n{result.stderr}")
+    return json.loads(result.stdout)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("loxpp")
+    parser.add_argument("script", nargs="?", default=os.path.join(BENCH_DIR, "parallel.lox"))
+    parser.add_argument("--backend", choices=["tree", "closure"], default="closure")
+    parser.add_argument("--iterations", type=int, default=5)
+    parser.add_argument("--max-threads", type=int, default=os.cpu_count() or 1)
+    args = parser.parse_args()
+
+    counts = []
+    threads = 1
+    while threads < args.max_threads:
+        counts.append(threads)
+        threads *= 2
+    counts.append(args.max_threads)
+
+    single = None
+    for threads in counts:
+        median = run(args.loxpp, args.backend, args.script, threads, args.iterations)["median_ms"]
+        single = single or median
+        print(f"{threads:3} threads  median {median:9.3f} ms  speedup {single / median:5.2f}x")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
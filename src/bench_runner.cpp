@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <vector>
+#include <sys/resource.h>
+#include "bench_runner.hpp"
+#include "lox.hpp"
+#include "perf_counters.hpp"
+#include "scanner/Scanner.hpp"
+#include "parser/Parser.hpp"
+
+using interpreter::Backend;
+using interpreter::Interpreter;
+
+namespace {
+    struct Run {
+        double m_milliseconds { 0 };
+        std::optional<u64> m_instructions;
+        int m_exit_code { 0 };
+        std::string m_errors;
+    };
+
+    /// @brief Runs the script once, from scanning to the end of the program, as
+    /// `loxpp file` would, but printing nowhere.
+    Run run_once(const std::string& source, Backend backend) {
+        auto run = Run();
+        auto discarded = std::ostream(nullptr);
+        auto errors = std::ostringstream();
+
+        lox::clear_errors();
+        lox::set_error_output(errors);
+        auto start = lox::perf::read();
+        {
+            // The interpreter comes first so it outlives the AST charged to its memory account.
+            auto lox_interpreter = Interpreter();
+            lox_interpreter.set_backend(backend);
+            lox_interpreter.set_output(discarded);
+            auto memory_scope = lox::MemoryAccount::Scope(lox_interpreter.memory());
+
+            auto parser = parser::Parser(scanner::Scanner(source).tokenize());
+            auto ast = parser.parse();
+            if (!lox::had_error())
+                lox_interpreter.interpret(std::move(ast));
+        }
+        auto end = lox::perf::read();
+        run.m_milliseconds = (end[lox::perf::Time] - start[lox::perf::Time]) / 1e6;
+        if (lox::perf::available(lox::perf::Instructions))
+            run.m_instructions = end[lox::perf::Instructions] - start[lox::perf::Instructions];
+
+        run.m_exit_code = lox::had_error() ? 65 : lox::had_runtime_error() ? 70 : 0;
+        run.m_errors = errors.str();
+        lox::set_error_output(std::cerr);
+        lox::clear_errors();
+        return run;
+    }
+
+    /// @return The smallest value that `percent` percent of `sorted` are at or below.
+    template <typename T>
+    T percentile(const std::vector<T>& sorted, double percent) {
+        auto rank = static_cast<u64>(std::ceil(percent / 100 * sorted.size()));
+        return sorted[std::clamp<u64>(rank, 1, sorted.size()) - 1];
+    }
+
+    /// @return The peak resident set size of this process, in kilobytes.
+    u64 peak_rss_kb() {
+        auto usage = rusage {};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<u64>(usage.ru_maxrss);
+    }
+
+    void write_json_string(std::ostream& output, const std::string& text) {
+        output << '"';
+        for (auto c : text) {
+            if (c == '"' || c == '\\') output << '\\';
+            output << c;
+        }
+        output << '"';
+    }
+}
+
+int lox::run_bench(const std::string& path, const BenchOptions& options) {
+    auto input = std::ifstream(path, std::ios::binary);
+    if (!input) {
+        std::cerr << "Could not read benchmark '" << path << "'.\n";
+        return 66;
+    }
+    auto contents = std::ostringstream();
+    contents << input.rdbuf();
+    auto source = contents.str();
+
+    lox::perf::open();
+    auto times = std::vector<double>();
+    auto instructions = std::vector<u64>();
+    for (u32 i = 0; i < options.m_warmup + options.m_iterations; ++i) {
+        auto run = run_once(source, options.m_backend);
+        if (run.m_exit_code != 0) {
+            std::cerr << run.m_errors;
+            return run.m_exit_code;
+        }
+        if (i < options.m_warmup) continue;
+
+        times.push_back(run.m_milliseconds);
+        if (run.m_instructions) instructions.push_back(*run.m_instructions);
+    }
+
+    std::sort(times.begin(), times.end());
+    std::sort(instructions.begin(), instructions.end());
+    auto min = times.front();
+    auto median = percentile(times, 50);
+    auto p99 = percentile(times, 99);
+    auto backend = options.m_backend == Backend::Closure ? "closure" : "tree";
+
+    if (options.m_json) {
+        std::cout << "{\"script\":";
+        write_json_string(std::cout, path);
+        std::cout << ",\"backend\":\"" << backend << "\",\"iterations\":" << times.size()
+                  << ",\"min_ms\":" << min << ",\"median_ms\":" << median << ",\"p99_ms\":" << p99
+                  << ",\"instructions\":";
+        if (instructions.empty())
+            std::cout << "null";
+        else
+            std::cout << percentile(instructions, 50);
+        std::cout << ",\"peak_rss_kb\":" << peak_rss_kb() << "}\n";
+        return 0;
+    }
+
+    std::cout << path << " (" << backend << ", " << times.size() << " runs)\n"
+              << "min: " << min << " ms\n"
+              << "median: " << median << " ms\n"
+              << "p99: " << p99 << " ms\n"
+              << "instructions: ";
+    if (instructions.empty())
+        std::cout << "not counted (" << lox::perf::unavailable_reason() << ")\n";
+    else
+        std::cout << percentile(instructions, 50) << '\n';
+    std::cout << "peak RSS: " << peak_rss_kb() << " KB\n";
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef LOX_BENCH_RUNNER_HPP
+#define LOX_BENCH_RUNNER_HPP
+
+#include <string>
+#include "interpreter/Interpreter.hpp"
+
+namespace lox {
+    struct BenchOptions {
+        interpreter::Backend m_backend { interpreter::Backend::TreeWalker };
+        u32 m_iterations { 10 };
+
+        /// @brief Runs made before timing starts, so caches and the allocator are warm.
+        u32 m_warmup { 1 };
+
+        /// @brief Print the results as one JSON object instead of a line of text.
+        bool m_json { false };
+    };
+
+    /// @brief Runs the script at `path` `m_warmup + m_iterations` times in this process,
+    /// each time from source with a new interpreter and with its output thrown away, and
+    /// prints the minimum, median and 99th percentile wall time of the timed runs, the
+    /// instructions the median run retired on this thread if `lox::perf` can count them,
+    /// and the process's peak resident set size.
+    /// @return The exit code for `loxpp --bench`: 0, or the script's own exit code if
+    /// it failed.
+    int run_bench(const std::string& path, const BenchOptions& options);
+}
+
+#endif
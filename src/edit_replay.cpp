@@ -0,0 +1,106 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <sstream>
+#include <vector>
+#include "edit_replay.hpp"
+#include "lox.hpp"
+#include "parser/FlatAst.hpp"
+#include "parser/IncrementalParser.hpp"
+#include "parser/Parser.hpp"
+#include "scanner/Scanner.hpp"
+
+namespace {
+    struct Edit {
+        u64 m_offset;
+        u64 m_length;
+        std::string m_text;
+    };
+
+    /// @return The edit on `line`, or nothing if it is not one.
+    std::optional<Edit> parse_edit(const std::string& line) {
+        auto edit = Edit();
+        auto input = std::istringstream(line);
+        if (!(input >> edit.m_offset >> edit.m_length)) return std::nullopt;
+        if (input.peek() == ' ') input.get();
+
+        auto escaped = std::string(std::istreambuf_iterator<char>(input), {});
+        for (u64 i = 0; i < escaped.size(); ++i) {
+            if (escaped[i] != '\\' || i + 1 == escaped.size()) {
+                edit.m_text += escaped[i];
+            } else {
+                edit.m_text += escaped[++i] == 'n' ? '\n' : escaped[i];
+            }
+        }
+        return edit;
+    }
+
+    /// @return Whether the program `parser` holds matches a full parse of `source`, or
+    /// nothing if `source` has syntax errors, so there is nothing to compare with.
+    std::optional<bool> matches_full_parse(const parser::IncrementalParser& parser, const std::string& source) {
+        auto full = parser::Parser(scanner::Scanner(source).tokenize()).parse();
+        if (lox::had_error()) return std::nullopt;
+
+        auto statements = std::vector<const parser::Statement*>();
+        auto first_lines = std::vector<u32>();
+        for (const auto& top_level : parser.program()) {
+            statements.push_back(top_level.m_statement);
+            first_lines.push_back(top_level.m_first_line);
+        }
+        return parser::FlatAst::flatten(full) == parser::FlatAst::flatten(statements, first_lines);
+    }
+}
+
+int lox::replay_edits(const std::string& edits_path, const std::string& script_path) {
+    auto script = std::ifstream(script_path, std::ios::binary);
+    auto edits = std::ifstream(edits_path);
+    if (!script || !edits) {
+        std::cerr << "Could not read '" << (script ? edits_path : script_path) << "'.\n";
+        return 66;
+    }
+    auto contents = std::ostringstream();
+    contents << script.rdbuf();
+    auto source = contents.str();
+
+    // Most edits leave syntax errors behind for a while, which are expected here.
+    auto errors = std::ostringstream();
+    lox::set_error_output(errors);
+
+    auto parser = parser::IncrementalParser(source);
+    u64 applied = 0, checked = 0, reparsed = 0, reused = 0;
+    bool passed = true;
+    auto line = std::string();
+    while (std::getline(edits, line)) {
+        auto edit = parse_edit(line);
+        if (!edit || edit->m_offset > source.size() || edit->m_length > source.size() - edit->m_offset) {
+            lox::set_error_output(std::cerr);
+            std::cerr << "Edit " << applied + 1 << " is not an edit of the text.\n";
+            return 65;
+        }
+
+        ++applied;
+        source.replace(edit->m_offset, edit->m_length, edit->m_text);
+        lox::clear_errors();
+        parser.edit(edit->m_offset, edit->m_length, edit->m_text);
+        reparsed += parser.last_edit().m_reparsed_declarations;
+        reused += parser.last_edit().m_reused_declarations;
+
+        lox::clear_errors();
+        auto matched = matches_full_parse(parser, source);
+        if (parser.source() != source) matched = false;
+        if (!matched.has_value()) continue;
+
+        ++checked;
+        if (!*matched) {
+            std::cout << "Edit " << applied << " left a program that differs from a full parse.\n";
+            passed = false;
+        }
+    }
+
+    lox::clear_errors();
+    lox::set_error_output(std::cerr);
+    std::cout << "Replayed " << applied << " edits and checked " << checked << ": re-parsed "
+              << reparsed << " declarations and reused " << reused << ".\n";
+    return passed ? 0 : 1;
+}
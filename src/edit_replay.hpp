@@ -0,0 +1,21 @@
+#ifndef LOX_EDIT_REPLAY_HPP
+#define LOX_EDIT_REPLAY_HPP
+
+#include <string>
+
+namespace lox {
+    /// @brief Loads the script at `script_path` into a `parser::IncrementalParser` and
+    /// applies the edits listed in `edits_path` to it one at a time, as an editor would.
+    /// After each edit that leaves the script without syntax errors, checks that the
+    /// program matches a full re-parse of the edited text, lines included, then prints
+    /// how many edits were checked and how much of the program they re-parsed.
+    ///
+    /// Each line of `edits_path` is one edit: the byte offset, the number of bytes
+    /// replaced and the text replacing them, separated by single spaces, with newlines
+    /// and backslashes in the text written as `\n` and `\\`.
+    /// @return The exit code for `loxpp --replay-edits`: 0 if every check passed, 1 if
+    /// one did not, 65 for an edit outside the text and 66 if a file could not be read.
+    int replay_edits(const std::string& edits_path, const std::string& script_path);
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include <algorithm>
+#include "Budget.hpp"
+
+using namespace interpreter;
+
+void Budget::set_timeout(std::chrono::nanoseconds timeout) {
+    m_timed = true;
+    m_deadline = std::chrono::steady_clock::now() + timeout;
+    m_timer = std::jthread([this, timeout](std::stop_token stop) {
+        auto lock = std::unique_lock(m_mutex);
+        m_wake.wait_for(lock, stop, timeout, [] { return false; });
+        if (!stop.stop_requested()) m_expired.store(true, std::memory_order_relaxed);
+    });
+}
+
+u64 Budget::take() {
+    if (m_expired.load(std::memory_order_relaxed)) {
+        m_ran_out.store(true, std::memory_order_relaxed);
+        return 0;
+    }
+
+    // Without a limit to keep to, a thread only comes back to check the deadline.
+    auto steps = m_steps.load(std::memory_order_relaxed);
+    if (steps == UNLIMITED) return m_timed ? CHUNK : UNLIMITED;
+
+    u64 taken;
+    do {
+        taken = std::min(steps, CHUNK);
+        if (taken == 0) {
+            m_ran_out.store(true, std::memory_order_relaxed);
+            return 0;
+        }
+    } while (!m_steps.compare_exchange_weak(steps, steps - taken, std::memory_order_relaxed));
+    return taken;
+}
+
+void Budget::give_back(u64 steps) {
+    if (steps == 0 || m_steps.load(std::memory_order_relaxed) == UNLIMITED) return;
+    m_steps.fetch_add(steps, std::memory_order_relaxed);
+}
+
+std::optional<std::chrono::nanoseconds> Budget::time_left() const {
+    if (!m_timed) return std::nullopt;
+    return std::max(m_deadline - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+}
+
+bool Budget::out_of_time() {
+    if (!m_timed || std::chrono::steady_clock::now() < m_deadline) return false;
+    m_expired.store(true, std::memory_order_relaxed);
+    m_ran_out.store(true, std::memory_order_relaxed);
+    return true;
+}
@@ -0,0 +1,131 @@
+#ifndef LOX_BUDGET_HPP
+#define LOX_BUDGET_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include "../util_types.hpp"
+
+namespace interpreter {
+    inline constexpr const char* OUT_OF_STEPS = "Out of steps.";
+    inline constexpr const char* OUT_OF_TIME = "Out of time.";
+
+    /// @brief How long a program may run: a number of steps, and a deadline. A step is
+    /// one iteration of a loop or one call of a Lox function, so every way a program can
+    /// run on takes them.
+    ///
+    /// Threads do not count each step here. Each takes steps in chunks into a `Fuel` of
+    /// its own and counts them down there, so the shared counter is only touched once
+    /// per `CHUNK` steps. That is also when the deadline is checked: a timer thread sets
+    /// a flag once it has passed. Set the limits before the program starts.
+    class Budget {
+    public:
+        static constexpr u64 UNLIMITED = std::numeric_limits<u64>::max();
+
+        /// @brief The most steps a thread takes at a time while there is a limit to keep
+        /// to. A limited budget can run out with up to this many steps still unused in
+        /// each of the other threads.
+        static constexpr u64 CHUNK = 1 << 16;
+
+    private:
+        /// @brief The steps no thread has taken yet.
+        std::atomic<u64> m_steps { UNLIMITED };
+
+        std::atomic<bool> m_expired { false };
+        std::atomic<bool> m_ran_out { false };
+        bool m_timed { false };
+        std::chrono::steady_clock::time_point m_deadline {};
+
+        std::mutex m_mutex;
+        std::condition_variable_any m_wake;
+
+        // Declared last, so the timer is stopped and joined before anything it uses goes.
+        std::jthread m_timer;
+
+    public:
+        void set_max_steps(u64 steps) {
+            m_steps.store(steps, std::memory_order_relaxed);
+        }
+
+        /// @brief Starts the clock: once `timeout` has passed, the program fails at its
+        /// next check.
+        void set_timeout(std::chrono::nanoseconds timeout);
+
+        /// @return How many steps the calling thread may take before asking again, or 0
+        /// if the budget has run out.
+        u64 take();
+
+        /// @brief Returns steps a thread took but did not use.
+        void give_back(u64 steps);
+
+        /// @return How long is left until the deadline, or nothing if there is none.
+        std::optional<std::chrono::nanoseconds> time_left() const;
+
+        /// @brief Checks the deadline itself rather than waiting for the timer thread, for
+        /// code that waits outside the interpreter's loops, like the tasks waiting on I/O.
+        /// @return Whether it has passed, in which case the budget has run out.
+        bool out_of_time();
+
+        /// @brief Whether the program has run out of steps or time.
+        bool ran_out() const {
+            return m_ran_out.load(std::memory_order_relaxed);
+        }
+
+        /// @brief The runtime error to report once the budget has run out.
+        const char* error() const {
+            return m_expired.load(std::memory_order_relaxed) ? OUT_OF_TIME : OUT_OF_STEPS;
+        }
+    };
+
+    /// @brief The steps one thread has taken from a `Budget` and not yet used.
+    class Fuel {
+    private:
+        Budget* m_budget;
+        u64 m_left { 0 };
+
+    public:
+        explicit Fuel(Budget& budget) : m_budget(&budget) {}
+        Fuel(const Fuel&) = delete;
+        Fuel& operator=(const Fuel&) = delete;
+
+        ~Fuel() {
+            m_budget->give_back(m_left);
+        }
+
+        Budget& budget() const {
+            return *m_budget;
+        }
+
+        /// @brief Takes steps from `budget` from now on, giving back those left of the
+        /// one used so far.
+        void draw_from(Budget& budget) {
+            m_budget->give_back(std::exchange(m_left, 0));
+            m_budget = &budget;
+        }
+
+        /// @brief Uses up one step.
+        /// @return False if the budget has run out.
+        bool step() {
+            if (m_left != 0) [[likely]] {
+                --m_left;
+                return true;
+            }
+            return refill();
+        }
+
+    private:
+        [[gnu::cold, gnu::noinline]] bool refill() {
+            m_left = m_budget->take();
+            if (m_left == 0) return false;
+            --m_left;
+            return true;
+        }
+    };
+}
+
+#endif
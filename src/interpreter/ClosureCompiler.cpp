@@ -0,0 +1,1047 @@
+#include <iostream>
+#include <variant>
+#include <functional>
+#include <utility>
+#include "ClosureCompiler.hpp"
+#include "Collections.hpp"
+#include "../parser/FlatAst.hpp"
+#include "Interpreter.hpp"
+#include "Natives.hpp"
+#include "ParallelFor.hpp"
+#include "Values.hpp"
+#include "../lox.hpp"
+#include "../trace.hpp"
+
+using namespace interpreter;
+using namespace parser;
+
+using scanner::TokenType;
+
+// Expression runtimes. Each one is the whole behaviour of a node, chosen at compile time.
+
+static LoxValue run_constant(const CompiledExpr& expr, ClosureContext&) {
+    return expr.m_constant;
+}
+
+static LoxValue run_global(const CompiledExpr& expr, ClosureContext& context) {
+    auto value = context.m_globals.get(static_cast<u32>(expr.m_slot));
+    if (!value) return context.fail(*expr.m_token, UNDEFINED_VARIABLE);
+    return *value;
+}
+
+static LoxValue run_local(const CompiledExpr& expr, ClosureContext& context) {
+    return context.m_scopes[expr.m_slot];
+}
+
+static LoxValue run_captured(const CompiledExpr& expr, ClosureContext& context) {
+    return context.m_scopes.captured(expr.m_depth, expr.m_slot);
+}
+
+static LoxValue run_assign_global(const CompiledExpr& expr, ClosureContext& context) {
+    auto value = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    if (!context.m_globals.assign(static_cast<u32>(expr.m_slot), value)) {
+        auto defined = context.m_globals.get(static_cast<u32>(expr.m_slot));
+        return context.fail(*expr.m_token, defined ? PARALLEL_ASSIGNMENT : UNASSIGNABLE_VARIABLE);
+    }
+    return value;
+}
+
+static LoxValue run_assign_local(const CompiledExpr& expr, ClosureContext& context) {
+    auto value = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    context.m_scopes[expr.m_slot] = value;
+    return value;
+}
+
+static LoxValue run_assign_captured(const CompiledExpr& expr, ClosureContext& context) {
+    auto value = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto environment = context.m_scopes.enclosing(expr.m_depth);
+    if (in_parallel_worker() && !environment->m_worker) [[unlikely]] return context.fail(*expr.m_token, PARALLEL_ASSIGNMENT);
+    environment->values()[expr.m_slot] = value;
+    return value;
+}
+
+/// @brief Runs `expr` while keeping `held` reachable. See `Interpreter::evaluate_holding`.
+static LoxValue evaluate_holding(const LoxValue& held, const CompiledExpr& expr, ClosureContext& context) {
+    if (!is_object(held)) return expr(context);
+
+    auto top = context.m_scopes.top();
+    context.m_scopes.push_value(held);
+    auto value = expr(context);
+    context.m_scopes.truncate(top);
+    return value;
+}
+
+static LoxValue run_negate(const CompiledExpr& expr, ClosureContext& context) {
+    auto argument = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto number = std::get_if<float>(&argument);
+    if (!number) return context.fail(*expr.m_token, NUMBER_OPERAND);
+    return -*number;
+}
+
+static LoxValue run_typed_negate(const CompiledExpr& expr, ClosureContext& context) {
+    auto argument = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    return -as_number(argument);
+}
+
+static LoxValue run_not(const CompiledExpr& expr, ClosureContext& context) {
+    auto argument = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    return !is_truthy(argument);
+}
+
+static LoxValue run_unknown_unary(const CompiledExpr& expr, ClosureContext& context) {
+    (*expr.m_first)(context);
+    if (context.failed()) return {};
+    return context.fail(*expr.m_token, "Unknown unary operator.");
+}
+
+static LoxValue run_add(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto right = evaluate_holding(left, *expr.m_second, context);
+    if (context.failed()) return {};
+    auto sum = attempt_addition(left, right, context.m_heap);
+    if (!sum) return context.fail(*expr.m_token, addition_error(left, right));
+    return std::move(*sum);
+}
+
+/// @brief Evaluates both operands of an arithmetic or comparison node and applies `Operation`
+/// to them, once both are known to be numbers.
+template <typename Operation>
+static LoxValue run_numeric(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto right = (*expr.m_second)(context);
+    if (context.failed()) return {};
+
+    auto left_number = std::get_if<float>(&left);
+    auto right_number = std::get_if<float>(&right);
+    if (!left_number || !right_number) return context.fail(*expr.m_token, NUMBER_OPERANDS);
+    return Operation()(*left_number, *right_number);
+}
+
+/// @brief `run_numeric` for operands the type inference proved are numbers.
+template <typename Operation>
+static LoxValue run_typed(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto right = (*expr.m_second)(context);
+    if (context.failed()) return {};
+    return Operation()(as_number(left), as_number(right));
+}
+
+static LoxValue run_divide(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto right = (*expr.m_second)(context);
+    if (context.failed()) return {};
+
+    auto left_number = std::get_if<float>(&left);
+    auto right_number = std::get_if<float>(&right);
+    if (!left_number || !right_number) return context.fail(*expr.m_token, NUMBER_OPERANDS);
+    if (*right_number == 0) return context.fail(*expr.m_token, DIVISION_BY_ZERO);
+    return *left_number / *right_number;
+}
+
+static LoxValue run_equal(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto right = evaluate_holding(left, *expr.m_second, context);
+    if (context.failed()) return {};
+    return is_equal(left, right);
+}
+
+static LoxValue run_not_equal(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto right = evaluate_holding(left, *expr.m_second, context);
+    if (context.failed()) return {};
+    return !is_equal(left, right);
+}
+
+static LoxValue run_unknown_binary(const CompiledExpr& expr, ClosureContext& context) {
+    (*expr.m_first)(context);
+    if (context.failed()) return {};
+    (*expr.m_second)(context);
+    if (context.failed()) return {};
+    return context.fail(*expr.m_token, "Unknown binary operator.");
+}
+
+static LoxValue run_ternary(const CompiledExpr& expr, ClosureContext& context) {
+    auto condition = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    if (is_truthy(condition))
+        return (*expr.m_second)(context);
+    else
+        return (*expr.m_third)(context);
+}
+
+static LoxValue run_or(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed() || is_truthy(left)) return left;
+    return (*expr.m_second)(context);
+}
+
+static LoxValue run_and(const CompiledExpr& expr, ClosureContext& context) {
+    auto left = (*expr.m_first)(context);
+    if (context.failed() || !is_truthy(left)) return left;
+    return (*expr.m_second)(context);
+}
+
+static LoxValue call_function(const ObjFunction& function, u64 base, u64 count, const CompiledExpr& expr, ClosureContext& context) {
+    const auto& decl = *function.m_compiled;
+    auto arity = decl.m_declaration->m_function->m_params.size();
+    if (count != arity) return context.fail(*expr.m_token, arity_error(arity, count));
+    if (!context.m_fuel.step()) [[unlikely]] return context.fail(*expr.m_token, context.m_fuel.budget().error());
+    if (!context.m_scopes.enter(base, function.m_closure)) return context.fail(*expr.m_token, STACK_OVERFLOW);
+
+    context.m_scopes.push(decl.m_slot_count - 1 - count);
+    if (decl.m_captured_count > 0) {
+        auto& environment = context.m_scopes.environment();
+        environment = context.m_heap.environment(environment, decl.m_captured_count);
+        for (auto [slot, index] : decl.m_declaration->m_function->m_captured_params)
+            environment->values()[index] = context.m_scopes[slot];
+        if (!within_memory_limit() && !context.reclaim_memory()) {
+            context.m_scopes.leave();
+            return context.fail(*expr.m_token, OUT_OF_MEMORY);
+        }
+    }
+
+    auto status = ExecStatus::Normal;
+    for (const auto& stmt : decl.m_statements) {
+        status = stmt(context);
+        if (status != ExecStatus::Normal) break;
+        if (!context.safe_point()) [[unlikely]] {
+            status = ExecStatus::Error;
+            context.fail(*expr.m_token, OUT_OF_MEMORY);
+            break;
+        }
+    }
+
+    // See `Interpreter::call_function`.
+    if (decl.m_declaration->m_function->m_kind == FunctionKind::Initializer && status != ExecStatus::Error) {
+        auto instance = context.m_scopes[0];
+        context.m_scopes.leave();
+        return instance;
+    }
+
+    context.m_scopes.leave();
+    if (status == ExecStatus::Error) return {};
+    return std::exchange(context.m_return_value, LoxValue {});
+}
+
+static LoxValue call_native(const ObjNative& native, u64 base, u64 count, const CompiledExpr& expr, ClosureContext& context) {
+    if (count != native.m_arity) return context.fail(*expr.m_token, arity_error(native.m_arity, count));
+
+    auto native_call = NativeCall { context.m_scopes.values(base + 1, count), context.m_heap, context.m_tasks };
+    auto result = native.m_function(native_call);
+    context.m_scopes.truncate(base);
+    if (native_call.m_error) return context.fail(*expr.m_token, native_call.m_error);
+    return result;
+}
+
+// Forced inline, as it is into `finish_call` by itself while that is its only caller.
+[[gnu::always_inline]] static inline LoxValue call_value(const LoxValue& callee, u64 base, u64 count, const CompiledExpr& expr, ClosureContext& context) {
+    if (auto function = std::get_if<ObjFunction*>(&callee))
+        return call_function(**function, base, count, expr, context);
+    if (auto native = std::get_if<ObjNative*>(&callee))
+        return call_native(**native, base, count, expr, context);
+
+    if (auto bound = std::get_if<ObjBoundMethod*>(&callee)) {
+        context.m_scopes.at(base) = (*bound)->m_receiver;
+        return call_function(*(*bound)->m_method, base, count, expr, context);
+    }
+
+    if (auto klass = std::get_if<ObjClass*>(&callee)) {
+        auto instance = context.m_heap.instance(**klass);
+        context.m_scopes.at(base) = instance;
+        if (!within_memory_limit() && !context.reclaim_memory()) return context.fail(*expr.m_token, OUT_OF_MEMORY);
+        if ((*klass)->m_initializer)
+            return call_function(*(*klass)->m_initializer, base, count, expr, context);
+        if (count != 0) return context.fail(*expr.m_token, arity_error(0, count));
+        context.m_scopes.truncate(base);
+        return instance;
+    }
+
+    return context.fail(*expr.m_token, NOT_CALLABLE);
+}
+
+LoxValue ClosureContext::call(const LoxValue& callee, u64 base, u64 count, const scanner::Token& token) {
+    auto site = CompiledExpr();
+    site.m_token = &token;
+    return call_value(callee, base, count, site, *this);
+}
+
+/// @brief Pushes the arguments of `expr` and calls `callee`, already pushed at `base`.
+static LoxValue finish_call(LoxValue callee, u64 base, const CompiledExpr& expr, ClosureContext& context) {
+    for (const auto& argument : expr.m_arguments) {
+        auto value = argument(context);
+        if (context.failed()) return {};
+        context.m_scopes.push_value(value);
+    }
+    return call_value(callee, base, expr.m_arguments.size(), expr, context);
+}
+
+static LoxValue run_call(const CompiledExpr& expr, ClosureContext& context) {
+    auto callee = (*expr.m_first)(context);
+    if (context.failed()) return {};
+
+    // Like the tree walker, the callee and arguments become the first slots of the new frame.
+    auto base = context.m_scopes.top();
+    context.m_scopes.push_value(callee);
+    return finish_call(callee, base, expr, context);
+}
+
+/// @brief A variable holding `super` or `this`, which is never global.
+static LoxValue& local(i32 slot, i32 depth, ClosureContext& context) {
+    if (depth == NOT_CAPTURED) return context.m_scopes[slot];
+    return context.m_scopes.captured(depth, slot);
+}
+
+static LoxValue run_get(const CompiledExpr& expr, ClosureContext& context) {
+    auto object = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto instance = std::get_if<ObjInstance*>(&object);
+    if (!instance) return context.fail(*expr.m_token, NOT_AN_INSTANCE);
+
+    auto entry = find_property(*expr.m_cache, **instance, expr.m_token->lexeme());
+    if (entry.m_method) {
+        auto bound = context.m_heap.bound_method(**instance, *entry.m_method);
+        if (!within_memory_limit() && !context.reclaim_memory(bound)) return context.fail(*expr.m_token, OUT_OF_MEMORY);
+        return bound;
+    }
+    if (entry.m_index == Shape::NOT_FOUND) return context.fail(*expr.m_token, undefined_property_error(expr.m_token->lexeme()));
+    return (*instance)->m_fields[entry.m_index];
+}
+
+static LoxValue run_set(const CompiledExpr& expr, ClosureContext& context) {
+    auto object = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto instance = std::get_if<ObjInstance*>(&object);
+    if (!instance) return context.fail(*expr.m_token, NOT_AN_INSTANCE_FIELD);
+    auto value = evaluate_holding(object, *expr.m_second, context);
+    if (context.failed()) return {};
+
+    if (in_parallel_worker()) [[unlikely]] return context.fail(*expr.m_token, PARALLEL_FIELD);
+    auto entry = find_field(*expr.m_cache, context.m_heap, **instance, expr.m_token->lexeme());
+    if (!store_field(**instance, entry, value, context.m_heap)) return context.fail(*expr.m_token, OUT_OF_MEMORY);
+    return value;
+}
+
+static LoxValue run_super(const CompiledExpr& expr, ClosureContext& context) {
+    auto superclass = std::get<ObjClass*>(local(expr.m_slot, expr.m_depth, context));
+    auto method = superclass->find_method(expr.m_token->lexeme());
+    if (!method) return context.fail(*expr.m_token, undefined_property_error(expr.m_token->lexeme()));
+    auto receiver = std::get<ObjInstance*>(local(expr.m_second->m_slot, expr.m_second->m_depth, context));
+    auto bound = context.m_heap.bound_method(*receiver, *method);
+    if (!within_memory_limit() && !context.reclaim_memory(bound)) return context.fail(*expr.m_token, OUT_OF_MEMORY);
+    return bound;
+}
+
+/// @brief A list literal, whose elements are `m_arguments`.
+static LoxValue run_list(const CompiledExpr& expr, ClosureContext& context) {
+    auto base = context.m_scopes.top();
+    for (const auto& element : expr.m_arguments) {
+        auto value = element(context);
+        if (context.failed()) {
+            context.m_scopes.truncate(base);
+            return {};
+        }
+        context.m_scopes.push_value(value);
+    }
+
+    auto list = context.m_heap.list(context.m_scopes.values(base, expr.m_arguments.size()));
+    context.m_scopes.truncate(base);
+    if (!list) return context.fail(*expr.m_token, OUT_OF_MEMORY);
+    return list;
+}
+
+static LoxValue run_index(const CompiledExpr& expr, ClosureContext& context) {
+    auto object = (*expr.m_first)(context);
+    if (context.failed()) return {};
+    auto index = evaluate_holding(object, *expr.m_second, context);
+    if (context.failed()) return {};
+
+    if (auto value = read_index(object, index)) return *value;
+    return context.fail(*expr.m_token, index_error(object, index));
+}
+
+static LoxValue run_index_set(const CompiledExpr& expr, ClosureContext& context) {
+    auto& scopes = context.m_scopes;
+    auto top = scopes.top();
+    scopes.push_value((*expr.m_first)(context));
+    if (context.failed()) {
+        scopes.truncate(top);
+        return {};
+    }
+    scopes.push_value((*expr.m_second)(context));
+    auto value = context.failed() ? LoxValue() : (*expr.m_third)(context);
+    auto object = scopes.at(top);
+    auto index = scopes.at(top + 1);
+    scopes.truncate(top);
+    if (context.failed()) return {};
+
+    if (auto error = store_index(context.m_heap, object, index, value)) return context.fail(*expr.m_token, error);
+    return value;
+}
+
+/// @brief A call of a property, whose callee is compiled to `run_get`. A method is called
+/// straight off its receiver, like the tree walker's `Interpreter::invoke`.
+static LoxValue run_invoke(const CompiledExpr& expr, ClosureContext& context) {
+    const auto& get = *expr.m_first;
+    auto object = (*get.m_first)(context);
+    if (context.failed()) return {};
+    auto instance = std::get_if<ObjInstance*>(&object);
+    if (!instance) return context.fail(*get.m_token, NOT_AN_INSTANCE);
+
+    auto entry = find_property(*get.m_cache, **instance, get.m_token->lexeme());
+    auto base = context.m_scopes.top();
+    if (entry.m_method) {
+        context.m_scopes.push_value(object);
+        return finish_call(entry.m_method, base, expr, context);
+    }
+
+    if (entry.m_index == Shape::NOT_FOUND) return context.fail(*get.m_token, undefined_property_error(get.m_token->lexeme()));
+    auto field = (*instance)->m_fields[entry.m_index];
+    context.m_scopes.push_value(field);
+    return finish_call(field, base, expr, context);
+}
+
+/// @brief A call of a superclass method, whose callee is compiled to `run_super`.
+static LoxValue run_invoke_super(const CompiledExpr& expr, ClosureContext& context) {
+    const auto& super = *expr.m_first;
+    auto superclass = std::get<ObjClass*>(local(super.m_slot, super.m_depth, context));
+    auto method = superclass->find_method(super.m_token->lexeme());
+    if (!method) return context.fail(*super.m_token, undefined_property_error(super.m_token->lexeme()));
+
+    auto base = context.m_scopes.top();
+    context.m_scopes.push_value(local(super.m_second->m_slot, super.m_second->m_depth, context));
+    return finish_call(method, base, expr, context);
+}
+
+// Statement runtimes.
+
+static ExecStatus run_expr_stmt(const CompiledStmt& stmt, ClosureContext& context) {
+    (*stmt.m_expr)(context);
+    return context.failed() ? ExecStatus::Error : ExecStatus::Normal;
+}
+
+static ExecStatus run_print(const CompiledStmt& stmt, ClosureContext& context) {
+    auto value = (*stmt.m_expr)(context);
+    if (context.failed()) return ExecStatus::Error;
+    context.m_output << stringify(value) << '\n';
+    return ExecStatus::Normal;
+}
+
+bool ClosureContext::reclaim_memory() {
+    if (!m_heap.collects()) return false;
+    m_heap.collect(m_globals, m_scopes);
+    return within_memory_limit();
+}
+
+bool ClosureContext::reclaim_memory(const LoxValue& made) {
+    auto handle = m_heap.hold(made);
+    auto reclaimed = reclaim_memory();
+    m_heap.release(handle);
+    return reclaimed;
+}
+
+static ExecStatus run_global_decl(const CompiledStmt& stmt, ClosureContext& context) {
+    auto initializer = stmt.m_expr ? (*stmt.m_expr)(context) : LoxValue { std::monostate {} };
+    if (context.failed()) return ExecStatus::Error;
+    context.m_globals.define(stmt.m_token->lexeme(), std::move(initializer));
+    if (within_memory_limit() || context.reclaim_memory()) return ExecStatus::Normal;
+    context.fail(*stmt.m_token, OUT_OF_MEMORY);
+    return ExecStatus::Error;
+}
+
+static ExecStatus run_local_decl(const CompiledStmt& stmt, ClosureContext& context) {
+    context.m_scopes[stmt.m_slot] = std::monostate {};
+    return ExecStatus::Normal;
+}
+
+static ExecStatus run_initialized_local_decl(const CompiledStmt& stmt, ClosureContext& context) {
+    auto initializer = (*stmt.m_expr)(context);
+    if (context.failed()) return ExecStatus::Error;
+    context.m_scopes[stmt.m_slot] = std::move(initializer);
+    return ExecStatus::Normal;
+}
+
+static ExecStatus run_captured_decl(const CompiledStmt& stmt, ClosureContext& context) {
+    auto initializer = stmt.m_expr ? (*stmt.m_expr)(context) : LoxValue { std::monostate {} };
+    if (context.failed()) return ExecStatus::Error;
+    context.m_scopes.captured(0, stmt.m_slot) = initializer;
+    return ExecStatus::Normal;
+}
+
+/// @brief Stores a declared function or class where the `Resolver` put it.
+static ExecStatus define(const CompiledStmt& stmt, const LoxValue& value, ClosureContext& context) {
+    if (stmt.m_slot == GLOBAL_SLOT) {
+        context.m_globals.define(stmt.m_token->lexeme(), value);
+        if (within_memory_limit() || context.reclaim_memory()) return ExecStatus::Normal;
+        context.fail(*stmt.m_token, OUT_OF_MEMORY);
+        return ExecStatus::Error;
+    }
+
+    local(stmt.m_slot, stmt.m_depth, context) = value;
+    return ExecStatus::Normal;
+}
+
+static ExecStatus run_function_decl(const CompiledStmt& stmt, ClosureContext& context) {
+    auto function = context.m_heap.function(*stmt.m_declaration, &stmt, context.m_scopes.environment());
+    if (!within_memory_limit() && !context.reclaim_memory(function)) {
+        context.fail(*stmt.m_token, OUT_OF_MEMORY);
+        return ExecStatus::Error;
+    }
+    return define(stmt, function, context);
+}
+
+static ExecStatus run_class_decl(const CompiledStmt& stmt, ClosureContext& context) {
+    const auto& klass = *stmt.m_class->m_class;
+    ObjClass* superclass = nullptr;
+    if (stmt.m_expr) {
+        auto value = (*stmt.m_expr)(context);
+        if (context.failed()) return ExecStatus::Error;
+        auto super = std::get_if<ObjClass*>(&value);
+        if (!super) {
+            context.fail(*stmt.m_expr->m_token, SUPERCLASS_NOT_A_CLASS);
+            return ExecStatus::Error;
+        }
+        superclass = *super;
+    }
+
+    auto& scopes = context.m_scopes;
+    scopes.push(stmt.m_slot_count);
+    if (stmt.m_captured_count > 0)
+        scopes.environment() = context.m_heap.environment(scopes.environment(), stmt.m_captured_count);
+    if (superclass)
+        local(klass.m_super_slot, klass.m_super_depth, context) = superclass;
+
+    auto methods = std::vector<ObjFunction*>();
+    methods.reserve(stmt.m_statements.size());
+    for (const auto& method : stmt.m_statements)
+        methods.push_back(context.m_heap.function(*method.m_declaration, &method, scopes.environment()));
+    auto object = context.m_heap.klass(*stmt.m_class, superclass, methods);
+
+    if (stmt.m_captured_count > 0)
+        scopes.environment() = scopes.environment()->m_enclosing;
+    scopes.pop(stmt.m_slot_count);
+    if (!within_memory_limit() && !context.reclaim_memory(object)) {
+        context.fail(*stmt.m_token, OUT_OF_MEMORY);
+        return ExecStatus::Error;
+    }
+    return define(stmt, object, context);
+}
+
+static ExecStatus run_return(const CompiledStmt& stmt, ClosureContext& context) {
+    context.m_return_value = (*stmt.m_expr)(context);
+    return context.failed() ? ExecStatus::Error : ExecStatus::Return;
+}
+
+static ExecStatus run_return_nil(const CompiledStmt&, ClosureContext&) {
+    return ExecStatus::Return;
+}
+
+/// @brief A block some of whose variables are captured, which live in a new environment.
+static ExecStatus run_block_with_environment(const CompiledStmt& stmt, ClosureContext& context) {
+    auto& scopes = context.m_scopes;
+    scopes.push(stmt.m_slot_count);
+    scopes.environment() = context.m_heap.environment(scopes.environment(), stmt.m_captured_count);
+    if (!within_memory_limit() && !context.reclaim_memory()) {
+        scopes.environment() = scopes.environment()->m_enclosing;
+        scopes.pop(stmt.m_slot_count);
+        return context.out_of_memory(stmt.m_line);
+    }
+
+    auto status = ExecStatus::Normal;
+    for (const auto& inner : stmt.m_statements) {
+        status = inner(context);
+        if (status != ExecStatus::Normal) break;
+        if (!context.safe_point()) [[unlikely]] {
+            status = context.out_of_memory(stmt.m_line);
+            break;
+        }
+    }
+
+    scopes.environment() = scopes.environment()->m_enclosing;
+    scopes.pop(stmt.m_slot_count);
+    return status;
+}
+
+static ExecStatus run_block(const CompiledStmt& stmt, ClosureContext& context) {
+    context.m_scopes.push(stmt.m_slot_count);
+    for (const auto& inner : stmt.m_statements) {
+        auto status = inner(context);
+        if (status == ExecStatus::Normal && !context.safe_point()) [[unlikely]]
+            status = context.out_of_memory(stmt.m_line);
+        if (status != ExecStatus::Normal) {
+            context.m_scopes.pop(stmt.m_slot_count);
+            return status;
+        }
+    }
+    context.m_scopes.pop(stmt.m_slot_count);
+    return ExecStatus::Normal;
+}
+
+static ExecStatus run_if(const CompiledStmt& stmt, ClosureContext& context) {
+    auto condition = (*stmt.m_expr)(context);
+    if (context.failed()) return ExecStatus::Error;
+    if (is_truthy(condition))
+        return (*stmt.m_body)(context);
+    return ExecStatus::Normal;
+}
+
+static ExecStatus run_if_else(const CompiledStmt& stmt, ClosureContext& context) {
+    auto condition = (*stmt.m_expr)(context);
+    if (context.failed()) return ExecStatus::Error;
+    if (is_truthy(condition))
+        return (*stmt.m_body)(context);
+    else
+        return (*stmt.m_alternative)(context);
+}
+
+static ExecStatus run_while(const CompiledStmt& stmt, ClosureContext& context) {
+    auto span = lox::trace::Span("while");
+    while (true) {
+        auto condition = (*stmt.m_expr)(context);
+        if (context.failed()) return ExecStatus::Error;
+        if (!is_truthy(condition)) return ExecStatus::Normal;
+
+        auto status = (*stmt.m_body)(context);
+        if (status != ExecStatus::Normal) return status;
+        if (!context.safe_point()) [[unlikely]] return context.out_of_memory(stmt.m_line);
+        if (!context.m_fuel.step()) [[unlikely]] return context.out_of_budget(stmt.m_line);
+    }
+}
+
+static ExecStatus run_for(const CompiledStmt& stmt, ClosureContext& context) {
+    auto span = lox::trace::Span("for");
+    if (stmt.m_alternative) {
+        auto status = (*stmt.m_alternative)(context);
+        if (status != ExecStatus::Normal) return status;
+    }
+
+    // Like the tree walker, a `for` loop without a condition never runs its body.
+    if (!stmt.m_expr) return ExecStatus::Normal;
+
+    while (true) {
+        auto condition = (*stmt.m_expr)(context);
+        if (context.failed()) return ExecStatus::Error;
+        if (!is_truthy(condition)) return ExecStatus::Normal;
+
+        auto status = (*stmt.m_body)(context);
+        if (status != ExecStatus::Normal) return status;
+        if (!context.safe_point()) [[unlikely]] return context.out_of_memory(stmt.m_line);
+        if (!context.m_fuel.step()) [[unlikely]] return context.out_of_budget(stmt.m_line);
+
+        if (stmt.m_update) {
+            (*stmt.m_update)(context);
+            if (context.failed()) return ExecStatus::Error;
+        }
+    }
+}
+
+/// @brief A `parallel for`. `m_expr` only holds its start, limit and step, and is never run itself.
+static ExecStatus run_parallel_for(const CompiledStmt& stmt, ClosureContext& context) {
+    const auto& bounds = *stmt.m_expr;
+    auto start = (*bounds.m_first)(context);
+    if (context.failed()) return ExecStatus::Error;
+    auto limit = (*bounds.m_second)(context);
+    if (context.failed()) return ExecStatus::Error;
+    auto step = (*bounds.m_third)(context);
+    if (context.failed()) return ExecStatus::Error;
+
+    auto parent = ParallelFor::Parent { context.m_globals, context.m_scopes, nullptr, context.m_output, context.m_error, context.m_fuel.budget() };
+    const auto& body = *stmt.m_body;
+    return ParallelFor(*stmt.m_parallel, parent, [&body](Interpreter& worker) {
+        return worker.execute(body);
+    }).run(start, limit, step);
+}
+
+static ExecStatus run_for_in(const CompiledStmt& stmt, ClosureContext& context) {
+    auto span = lox::trace::Span("for in");
+    auto iterable = (*stmt.m_expr)(context);
+    if (context.failed()) return ExecStatus::Error;
+    if (!Iteration::can_iterate(iterable)) {
+        context.fail(*stmt.m_token, NOT_ITERABLE);
+        return ExecStatus::Error;
+    }
+
+    const auto& scope = *stmt.m_scope;
+    auto& scopes = context.m_scopes;
+    scopes.push(scope.m_slot_count);
+    scopes[scope.m_iterable_slot] = iterable;
+    auto enclosing = scopes.environment();
+    auto iteration = Iteration(iterable);
+
+    auto status = ExecStatus::Normal;
+    while (auto element = iteration.next()) {
+        if (scope.m_captured_count > 0)
+            scopes.environment() = context.m_heap.environment(enclosing, scope.m_captured_count);
+        local(scope.m_slot, scope.m_depth, context) = *element;
+        if (scope.m_captured_count > 0 && !within_memory_limit() && !context.reclaim_memory()) {
+            status = ExecStatus::Error;
+            context.fail(*stmt.m_token, OUT_OF_MEMORY);
+            break;
+        }
+
+        status = (*stmt.m_body)(context);
+        if (status != ExecStatus::Normal) break;
+        if (!context.safe_point()) [[unlikely]] {
+            status = ExecStatus::Error;
+            context.fail(*stmt.m_token, OUT_OF_MEMORY);
+            break;
+        }
+        if (!context.m_fuel.step()) [[unlikely]] {
+            status = ExecStatus::Error;
+            context.fail(*stmt.m_token, context.m_fuel.budget().error());
+            break;
+        }
+    }
+
+    scopes.environment() = enclosing;
+    scopes.pop(scope.m_slot_count);
+    return status;
+}
+
+// Compilation.
+
+ExecStatus CompiledProgram::run(ClosureContext& context, const std::vector<std::unique_ptr<Statement>>& source) const {
+    for (u64 i = 0; i < m_statements.size(); ++i) {
+        auto span = lox::trace::Span(to_string(kind_of(*source[i])));
+        auto status = m_statements[i](context);
+        if (status != ExecStatus::Normal) return status;
+        context.safe_point();
+    }
+    return ExecStatus::Normal;
+}
+
+CompiledProgram ClosureCompiler::compile(const std::vector<std::unique_ptr<Statement>>& program) {
+    auto statements = std::vector<CompiledStmt>();
+    statements.reserve(program.size());
+    for (const auto& stmt : program)
+        statements.push_back(compile(*stmt));
+
+    return CompiledProgram(std::move(statements));
+}
+
+CompiledStmt ClosureCompiler::compile(const Statement& stmt) {
+    return std::visit([this](auto&& s) -> CompiledStmt {
+        return compile_stmt(s);
+    }, stmt.m_stmt);
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile(const Expr& expr) {
+    return std::visit([this](auto&& e) -> std::unique_ptr<CompiledExpr> {
+        return compile_expr(e);
+    }, expr.m_node);
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const ExprStmt& stmt) {
+    auto compiled = CompiledStmt { run_expr_stmt };
+    compiled.m_expr = compile(*stmt.m_expr);
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const PrintStmt& stmt) {
+    auto compiled = CompiledStmt { run_print };
+    compiled.m_expr = compile(*stmt.m_expr);
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const VariableDecl& decl) {
+    auto compiled = CompiledStmt { run_global_decl };
+    compiled.m_token = &decl.m_name;
+    compiled.m_slot = decl.m_slot;
+    if (decl.m_initializer.has_value())
+        compiled.m_expr = compile(*decl.m_initializer.value());
+
+    if (decl.m_slot != GLOBAL_SLOT && decl.m_depth != NOT_CAPTURED)
+        compiled.m_function = run_captured_decl;
+    else if (decl.m_slot != GLOBAL_SLOT)
+        compiled.m_function = compiled.m_expr ? run_initialized_local_decl : run_local_decl;
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const FunctionDecl& decl) {
+    auto compiled = CompiledStmt { run_function_decl };
+    compiled.m_token = &decl.m_name;
+    compiled.m_declaration = &decl;
+    compiled.m_slot = decl.m_slot;
+    compiled.m_depth = decl.m_depth;
+    compiled.m_slot_count = decl.m_function->m_frame_size;
+    compiled.m_captured_count = decl.m_function->m_captured_count;
+    compiled.m_statements.reserve(decl.m_function->m_body.size());
+    for (const auto& stmt : decl.m_function->m_body)
+        compiled.m_statements.push_back(compile(*stmt));
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const ReturnStmt& stmt) {
+    if (!stmt.m_value.has_value()) return CompiledStmt { run_return_nil };
+
+    auto compiled = CompiledStmt { run_return };
+    compiled.m_expr = compile(*stmt.m_value.value());
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const ClassDecl& decl) {
+    const auto& klass = *decl.m_class;
+    auto compiled = CompiledStmt { run_class_decl };
+    compiled.m_token = &decl.m_name;
+    compiled.m_class = &decl;
+    compiled.m_slot = decl.m_slot;
+    compiled.m_depth = decl.m_depth;
+    compiled.m_slot_count = klass.m_slot_count;
+    compiled.m_captured_count = klass.m_captured_count;
+    if (klass.m_superclass.has_value())
+        compiled.m_expr = compile(*klass.m_superclass.value());
+    compiled.m_statements.reserve(klass.m_methods.size());
+    for (const auto& method : klass.m_methods)
+        compiled.m_statements.push_back(compile_stmt(method));
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const Block& block) {
+    auto compiled = CompiledStmt { block.m_captured_count > 0 ? run_block_with_environment : run_block };
+    compiled.m_slot_count = block.m_slot_count;
+    compiled.m_captured_count = block.m_captured_count;
+    compiled.m_line = block.m_line;
+    compiled.m_statements.reserve(block.m_statements.size());
+    for (const auto& stmt : block.m_statements)
+        compiled.m_statements.push_back(compile(*stmt));
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const IfStmt& stmt) {
+    auto compiled = CompiledStmt { run_if };
+    compiled.m_expr = compile(*stmt.m_condition);
+    compiled.m_body = std::make_unique<CompiledStmt>(compile(*stmt.m_then_clause));
+    if (stmt.m_else_clause.has_value()) {
+        compiled.m_function = run_if_else;
+        compiled.m_alternative = std::make_unique<CompiledStmt>(compile(*stmt.m_else_clause.value()));
+    }
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const WhileLoop& loop) {
+    auto compiled = CompiledStmt { run_while };
+    compiled.m_line = loop.m_line;
+    compiled.m_expr = compile(*loop.m_condition);
+    compiled.m_body = std::make_unique<CompiledStmt>(compile(*loop.m_body));
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const ForLoop& loop) {
+    if (loop.m_parallel) {
+        const auto& variable = std::get<VariableDecl>(loop.m_initializer.value()->m_stmt);
+        const auto& condition = std::get<Binary>(loop.m_condition.value()->m_node);
+        const auto& increment = std::get<Binary>(std::get<Assign>(loop.m_update.value()->m_node).m_value->m_node);
+
+        auto compiled = CompiledStmt { run_parallel_for };
+        compiled.m_expr = std::make_unique<CompiledExpr>();
+        compiled.m_expr->m_first = compile(*variable.m_initializer.value());
+        compiled.m_expr->m_second = compile(*condition.m_right);
+        compiled.m_expr->m_third = compile(*increment.m_right);
+        compiled.m_body = std::make_unique<CompiledStmt>(compile(*loop.m_body));
+        compiled.m_parallel = loop.m_parallel.get();
+        return compiled;
+    }
+
+    auto compiled = CompiledStmt { run_for };
+    compiled.m_line = loop.m_line;
+    if (loop.m_initializer.has_value())
+        compiled.m_alternative = std::make_unique<CompiledStmt>(compile(*loop.m_initializer.value()));
+    if (loop.m_condition.has_value())
+        compiled.m_expr = compile(*loop.m_condition.value());
+    if (loop.m_update.has_value())
+        compiled.m_update = compile(*loop.m_update.value());
+    compiled.m_body = std::make_unique<CompiledStmt>(compile(*loop.m_body));
+    return compiled;
+}
+
+CompiledStmt ClosureCompiler::compile_stmt(const ForInLoop& loop) {
+    auto compiled = CompiledStmt { run_for_in };
+    compiled.m_expr = compile(*loop.m_iterable);
+    compiled.m_body = std::make_unique<CompiledStmt>(compile(*loop.m_body));
+    compiled.m_token = &loop.m_name;
+    compiled.m_scope = loop.m_scope.get();
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Literal& literal) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_constant });
+    compiled->m_constant = m_heap.constant(literal);
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Variable& identifier) {
+    auto function = identifier.m_slot == GLOBAL_SLOT ? run_global : run_local;
+    if (identifier.m_depth != NOT_CAPTURED) function = run_captured;
+
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { function });
+    compiled->m_token = &identifier.m_name;
+    compiled->m_slot = function == run_global ? static_cast<i32>(m_globals.slot(identifier.m_name.lexeme())) : identifier.m_slot;
+    compiled->m_depth = identifier.m_depth;
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Unary& unary) {
+    CompiledExpr::Function function;
+    auto typed = unary.m_operand_type == StaticType::Number;
+    switch (unary.m_operator.type()) {
+        case TokenType::Minus: function = typed ? run_typed_negate : run_negate; break;
+        case TokenType::Bang: function = run_not; break;
+        default: function = run_unknown_unary; break;
+    }
+
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { function });
+    compiled->m_first = compile(*unary.m_argument);
+    compiled->m_token = &unary.m_operator;
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Binary& binary) {
+    CompiledExpr::Function function;
+    switch (binary.m_operator.type()) {
+        case TokenType::Plus: function = run_add; break;
+        case TokenType::Minus: function = run_numeric<std::minus<float>>; break;
+        case TokenType::Star: function = run_numeric<std::multiplies<float>>; break;
+        case TokenType::Slash: function = run_divide; break;
+        case TokenType::Less: function = run_numeric<std::less<float>>; break;
+        case TokenType::LessEqual: function = run_numeric<std::less_equal<float>>; break;
+        case TokenType::Greater: function = run_numeric<std::greater<float>>; break;
+        case TokenType::GreaterEqual: function = run_numeric<std::greater_equal<float>>; break;
+        case TokenType::EqualEqual: function = run_equal; break;
+        case TokenType::BangEqual: function = run_not_equal; break;
+        default: function = run_unknown_binary; break;
+    }
+
+    if (binary.m_operand_type == StaticType::Number) {
+        switch (binary.m_operator.type()) {
+            case TokenType::Plus: function = run_typed<std::plus<float>>; break;
+            case TokenType::Minus: function = run_typed<std::minus<float>>; break;
+            case TokenType::Star: function = run_typed<std::multiplies<float>>; break;
+            case TokenType::Less: function = run_typed<std::less<float>>; break;
+            case TokenType::LessEqual: function = run_typed<std::less_equal<float>>; break;
+            case TokenType::Greater: function = run_typed<std::greater<float>>; break;
+            case TokenType::GreaterEqual: function = run_typed<std::greater_equal<float>>; break;
+            case TokenType::EqualEqual: function = run_typed<std::equal_to<float>>; break;
+            case TokenType::BangEqual: function = run_typed<std::not_equal_to<float>>; break;
+            default: break;
+        }
+    }
+
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { function });
+    compiled->m_first = compile(*binary.m_left);
+    compiled->m_second = compile(*binary.m_right);
+    compiled->m_token = &binary.m_operator;
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Ternary& ternary) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_ternary });
+    compiled->m_first = compile(*ternary.m_condition);
+    compiled->m_second = compile(*ternary.m_success);
+    compiled->m_third = compile(*ternary.m_failure);
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Assign& assign) {
+    auto function = assign.m_slot == GLOBAL_SLOT ? run_assign_global : run_assign_local;
+    if (assign.m_depth != NOT_CAPTURED) function = run_assign_captured;
+
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { function });
+    compiled->m_first = compile(*assign.m_value);
+    compiled->m_token = &assign.m_name;
+    compiled->m_slot = function == run_assign_global ? static_cast<i32>(m_globals.slot(assign.m_name.lexeme())) : assign.m_slot;
+    compiled->m_depth = assign.m_depth;
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Grouping& grouping) {
+    // Parentheses only matter to the parser, so they compile away entirely.
+    return compile(*grouping.m_inner_expr);
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Logical& logical) {
+    auto function = logical.m_operator.type() == TokenType::Or ? run_or : run_and;
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { function });
+    compiled->m_first = compile(*logical.m_left);
+    compiled->m_second = compile(*logical.m_right);
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Call& call) {
+    auto function = run_call;
+    if (std::holds_alternative<Get>(call.m_callee->m_node)) function = run_invoke;
+    if (std::holds_alternative<Super>(call.m_callee->m_node)) function = run_invoke_super;
+
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { function });
+    compiled->m_first = compile(*call.m_callee);
+    compiled->m_token = &call.m_paren;
+    compiled->m_arguments.reserve(call.m_arguments.size());
+    for (const auto& argument : call.m_arguments)
+        compiled->m_arguments.push_back(std::move(*compile(*argument)));
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Get& get) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_get });
+    compiled->m_first = compile(*get.m_object);
+    compiled->m_token = &get.m_name;
+    compiled->m_cache = std::make_unique<InlineCache>();
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Set& set) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_set });
+    compiled->m_first = compile(*set.m_object);
+    compiled->m_second = compile(*set.m_value);
+    compiled->m_token = &set.m_name;
+    compiled->m_cache = std::make_unique<InlineCache>();
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Super& super) {
+    // `m_second` only records where `this` is; it is read directly, never run.
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_super });
+    compiled->m_token = &super.m_method;
+    compiled->m_slot = super.m_slot;
+    compiled->m_depth = super.m_depth;
+    compiled->m_second = std::make_unique<CompiledExpr>(CompiledExpr { run_local });
+    compiled->m_second->m_slot = super.m_this_slot;
+    compiled->m_second->m_depth = super.m_this_depth;
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const ListLiteral& list) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_list });
+    compiled->m_token = &list.m_bracket;
+    compiled->m_arguments.reserve(list.m_elements.size());
+    for (const auto& element : list.m_elements)
+        compiled->m_arguments.push_back(std::move(*compile(*element)));
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const Index& index) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_index });
+    compiled->m_first = compile(*index.m_object);
+    compiled->m_second = compile(*index.m_index);
+    compiled->m_token = &index.m_bracket;
+    return compiled;
+}
+
+std::unique_ptr<CompiledExpr> ClosureCompiler::compile_expr(const IndexSet& set) {
+    auto compiled = std::make_unique<CompiledExpr>(CompiledExpr { run_index_set });
+    compiled->m_first = compile(*set.m_object);
+    compiled->m_second = compile(*set.m_index);
+    compiled->m_third = compile(*set.m_value);
+    compiled->m_token = &set.m_bracket;
+    return compiled;
+}
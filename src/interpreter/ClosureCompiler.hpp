@@ -0,0 +1,201 @@
+#ifndef LOX_CLOSURE_COMPILER_HPP
+#define LOX_CLOSURE_COMPILER_HPP
+
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "../parser/statements.hpp"
+#include "../scanner/Token.hpp"
+#include "Environment.hpp"
+#include "ScopeStack.hpp"
+#include "Heap.hpp"
+#include "Values.hpp"
+#include "EventLoop.hpp"
+#include "ExecStatus.hpp"
+#include "InlineCache.hpp"
+#include "Budget.hpp"
+#include "../lox.hpp"
+
+namespace interpreter {
+    /// @brief The state a compiled program runs against. It refers to the same
+    /// globals and frame stack as the tree walker, so both backends see the same variables.
+    /// Errors are reported the same way too: recorded in `m_error`, then unwound by
+    /// statements returning `ExecStatus::Error`.
+    struct ClosureContext {
+        Environment& m_globals;
+        ScopeStack& m_scopes;
+        Heap& m_heap;
+        std::optional<lox::RuntimeError>& m_error;
+        std::ostream& m_output;
+        EventLoop& m_tasks;
+        Fuel& m_fuel;
+
+        /// @brief See `Interpreter::m_return_value`.
+        LoxValue m_return_value {};
+
+        bool failed() const {
+            return m_error.has_value();
+        }
+
+        /// @brief Runs a collection if one is due. See `Interpreter::safe_point`.
+        bool safe_point() {
+            if (!m_heap.wants_collection()) [[likely]] return true;
+            m_heap.collect(m_globals, m_scopes);
+            return within_memory_limit();
+        }
+
+        /// @brief See `Interpreter::reclaim_memory`.
+        [[gnu::cold, gnu::noinline]] bool reclaim_memory();
+        [[gnu::cold, gnu::noinline]] bool reclaim_memory(const LoxValue& made);
+
+        /// @brief Calls `callee` from outside any compiled code, as a task is. The callee
+        /// and its `count` arguments must already be pushed, from `base`. A call that can't
+        /// be made at all fails at `token`.
+        LoxValue call(const LoxValue& callee, u64 base, u64 count, const scanner::Token& token);
+
+        [[gnu::cold, gnu::noinline]] LoxValue fail(const scanner::Token& token, const char* message) {
+            m_error.emplace(token, message);
+            return std::monostate {};
+        }
+
+        [[gnu::cold, gnu::noinline]] LoxValue fail(const scanner::Token& token, const std::string& message) {
+            m_error.emplace(token, message);
+            return std::monostate {};
+        }
+
+        /// @brief See `Interpreter::out_of_budget`.
+        [[gnu::cold, gnu::noinline]] ExecStatus out_of_budget(int line) {
+            m_error.emplace(scanner::Token(scanner::TokenType::Identifier, line, ""), m_fuel.budget().error());
+            return ExecStatus::Error;
+        }
+
+        /// @brief See `Interpreter::out_of_memory`.
+        [[gnu::cold, gnu::noinline]] ExecStatus out_of_memory(int line) {
+            m_error.emplace(scanner::Token(scanner::TokenType::Identifier, line, ""), OUT_OF_MEMORY);
+            return ExecStatus::Error;
+        }
+    };
+
+    /// @brief An expression converted into a direct call. The operation, and any
+    /// literal value or name it needs, is decided once by `ClosureCompiler`.
+    struct CompiledExpr {
+        using Function = LoxValue (*)(const CompiledExpr&, ClosureContext&);
+
+        Function m_function { nullptr };
+        std::unique_ptr<CompiledExpr> m_first;
+        std::unique_ptr<CompiledExpr> m_second;
+        std::unique_ptr<CompiledExpr> m_third;
+        std::vector<CompiledExpr> m_arguments;
+        LoxValue m_constant {};
+        const scanner::Token* m_token { nullptr };
+
+        /// @brief For a global, its slot in the `Environment`, looked up at compile time.
+        i32 m_slot { parser::GLOBAL_SLOT };
+        i32 m_depth { parser::NOT_CAPTURED };
+
+        /// @brief The inline cache of a property access.
+        std::unique_ptr<InlineCache> m_cache;
+
+        LoxValue operator()(ClosureContext& context) const {
+            return m_function(*this, context);
+        }
+    };
+
+    /// @brief A statement converted into a direct call. See `CompiledExpr`.
+    struct CompiledStmt {
+        using Function = ExecStatus (*)(const CompiledStmt&, ClosureContext&);
+
+        Function m_function { nullptr };
+        std::unique_ptr<CompiledExpr> m_expr;
+        std::unique_ptr<CompiledExpr> m_update;
+        std::unique_ptr<CompiledStmt> m_body;
+        std::unique_ptr<CompiledStmt> m_alternative;
+        std::vector<CompiledStmt> m_statements;
+        const scanner::Token* m_token { nullptr };
+        const parser::FunctionDecl* m_declaration { nullptr };
+        const parser::ClassDecl* m_class { nullptr };
+        i32 m_slot { parser::GLOBAL_SLOT };
+        i32 m_depth { parser::NOT_CAPTURED };
+        u32 m_slot_count { 0 };
+        u32 m_captured_count { 0 };
+
+        /// @brief For a `while` or `for` loop, the line of its keyword.
+        int m_line { 0 };
+
+        /// @brief For a `parallel for`, what makes it one.
+        const parser::Parallel* m_parallel { nullptr };
+
+        /// @brief For a `for in` loop, where its variable and the value it loops over go.
+        const parser::LoopScope* m_scope { nullptr };
+
+        ExecStatus operator()(ClosureContext& context) const {
+            return m_function(*this, context);
+        }
+    };
+
+    /// @brief The result of compiling a whole program. Tokens are referenced, not
+    /// copied, so the AST it was compiled from must outlive it. Functions refer to their
+    /// compiled declarations, so it must live as long as they do too.
+    class CompiledProgram {
+    private:
+        std::vector<CompiledStmt> m_statements;
+
+    public:
+        CompiledProgram(std::vector<CompiledStmt>&& statements) : m_statements(std::move(statements)) {}
+
+        /// @param source The statements it was compiled from, to name each one in a trace.
+        ExecStatus run(ClosureContext& context, const std::vector<std::unique_ptr<parser::Statement>>& source) const;
+    };
+
+    /// @brief Converts an AST into a tree of pre-bound function pointers, so running it
+    /// needs no `std::visit`, virtual call or operator `switch` per node.
+    class ClosureCompiler {
+    private:
+        Heap& m_heap;
+        Environment& m_globals;
+
+    public:
+        /// @param heap Where the strings of literals are put. The compiled program must
+        /// run before the heap's constants are cleared.
+        /// @param globals Where the globals the program names are given their slots.
+        ClosureCompiler(Heap& heap, Environment& globals) : m_heap(heap), m_globals(globals) {}
+
+        CompiledProgram compile(const std::vector<std::unique_ptr<parser::Statement>>& program);
+
+    private:
+        CompiledStmt compile(const parser::Statement& stmt);
+        std::unique_ptr<CompiledExpr> compile(const parser::Expr& expr);
+
+        CompiledStmt compile_stmt(const parser::ExprStmt& stmt);
+        CompiledStmt compile_stmt(const parser::PrintStmt& stmt);
+        CompiledStmt compile_stmt(const parser::VariableDecl& decl);
+        CompiledStmt compile_stmt(const parser::Block& block);
+        CompiledStmt compile_stmt(const parser::IfStmt& stmt);
+        CompiledStmt compile_stmt(const parser::WhileLoop& loop);
+        CompiledStmt compile_stmt(const parser::ForLoop& loop);
+        CompiledStmt compile_stmt(const parser::FunctionDecl& decl);
+        CompiledStmt compile_stmt(const parser::ReturnStmt& stmt);
+        CompiledStmt compile_stmt(const parser::ClassDecl& decl);
+        CompiledStmt compile_stmt(const parser::ForInLoop& loop);
+
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Literal& literal);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Variable& identifier);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Unary& unary);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Binary& binary);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Ternary& ternary);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Assign& assign);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Grouping& grouping);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Logical& logical);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Call& call);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Get& get);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Set& set);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Super& super);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::ListLiteral& list);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::Index& index);
+        std::unique_ptr<CompiledExpr> compile_expr(const parser::IndexSet& set);
+    };
+}
+
+#endif
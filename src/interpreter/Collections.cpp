@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include "Collections.hpp"
+#include "ParallelFor.hpp"
+#include "Values.hpp"
+
+using namespace interpreter;
+
+namespace {
+    constexpr u64 MIN_LIST_CAPACITY = 8;
+    constexpr u32 MIN_MAP_CAPACITY = 4;
+
+    /// @brief The most entries a map has room for, so the index of an entry fits in the
+    /// lower half of a slot without reaching the markers.
+    constexpr u64 MAX_MAP_CAPACITY = 1u << 30;
+
+    constexpr u64 NOT_FOUND = ~u64(0);
+
+    /// @brief Spreads every bit of `value` over the whole hash, with the finalizer of
+    /// MurmurHash3, so keys that differ only in their high bits, like most numbers and
+    /// pointers, still land in different slots.
+    u32 mix(u64 value) {
+        value ^= value >> 33;
+        value *= 0xff51afd7ed558ccdull;
+        value ^= value >> 33;
+        value *= 0xc4ceb9fe1a85ec53ull;
+        value ^= value >> 33;
+        return static_cast<u32>(value);
+    }
+
+    u64 slot_of(u32 hash, u32 index) {
+        return static_cast<u64>(hash) << 32 | index;
+    }
+
+    u64 slot_mask(const ObjMap& map) {
+        return static_cast<u64>(map.m_capacity) * 2 - 1;
+    }
+
+    /// @return The position of the slot of `key` in the slots of `map`, or `NOT_FOUND`.
+    u64 find_slot(const ObjMap& map, const LoxValue& key, u32 hash) {
+        if (map.m_capacity == 0) return NOT_FOUND;
+
+        // There are twice as many slots as entries, so the probe always reaches an empty one.
+        auto slots = map.slots();
+        auto mask = slot_mask(map);
+        for (auto position = hash & mask;; position = (position + 1) & mask) {
+            auto slot = slots[position];
+            if (slot == ObjMap::EMPTY_SLOT) return NOT_FOUND;
+            if (slot != ObjMap::REMOVED_SLOT && static_cast<u32>(slot >> 32) == hash
+                && is_equal(map.m_entries[static_cast<u32>(slot)].m_key, key))
+                return position;
+        }
+    }
+
+    /// @brief Points the first free slot on the probe of `hash` at entry `index`.
+    void insert_slot(ObjMap& map, u32 hash, u32 index) {
+        auto slots = map.slots();
+        auto mask = slot_mask(map);
+        auto position = hash & mask;
+        while (slots[position] != ObjMap::EMPTY_SLOT && slots[position] != ObjMap::REMOVED_SLOT)
+            position = (position + 1) & mask;
+        slots[position] = slot_of(hash, index);
+    }
+
+    /// @return The position of the element of a list or array of `length` that `index`
+    /// refers to, or nothing if it refers to none.
+    std::optional<u64> element_position(const LoxValue& index, u64 length) {
+        auto number = std::get_if<float>(&index);
+        if (!number || std::floor(*number) != *number || *number < 0 || *number >= length) return std::nullopt;
+        return static_cast<u64>(*number);
+    }
+}
+
+u32 interpreter::hash_key(const LoxValue& key) {
+    if (auto string = std::get_if<ObjString*>(&key)) return (*string)->m_hash;
+    if (auto number = std::get_if<float>(&key)) {
+        // -0 equals 0, so it must hash the same.
+        auto value = *number == 0 ? 0.0f : *number;
+        return mix(std::bit_cast<u32>(value));
+    }
+    if (auto boolean = std::get_if<bool>(&key)) return mix(*boolean ? 2 : 1);
+
+    return std::visit([](auto&& v) -> u32 {
+        if constexpr (std::is_pointer_v<std::decay_t<decltype(v)>>)
+            return mix(reinterpret_cast<std::uintptr_t>(v));
+        else
+            return 0;
+    }, static_cast<const LoxValue::variant&>(key));
+}
+
+bool interpreter::is_valid_key(const LoxValue& key) {
+    if (std::holds_alternative<std::monostate>(key)) return false;
+    auto number = std::get_if<float>(&key);
+    return !number || !std::isnan(*number);
+}
+
+LoxValue* interpreter::map_find(const ObjMap& map, const LoxValue& key) {
+    auto position = find_slot(map, key, hash_key(key));
+    if (position == NOT_FOUND) return nullptr;
+    return &map.m_entries[static_cast<u32>(map.slots()[position])].m_value;
+}
+
+bool interpreter::map_set(Heap& heap, ObjMap& map, const LoxValue& key, const LoxValue& value) {
+    auto hash = hash_key(key);
+    if (auto position = find_slot(map, key, hash); position != NOT_FOUND) {
+        map.m_entries[static_cast<u32>(map.slots()[position])].m_value = value;
+        return true;
+    }
+
+    if (map.m_used == map.m_capacity) {
+        // Entries only move when the map grows, which is when removed ones are squeezed
+        // out, unless a loop is running over it. Half of the new room is kept free, so a
+        // map that keeps adding and removing keys does not resize every few changes.
+        auto live = static_cast<u64>(map.m_iterating > 0 ? map.m_used : map.m_count);
+        auto capacity = std::bit_ceil(std::max<u64>(MIN_MAP_CAPACITY, live * 2));
+        if (capacity > MAX_MAP_CAPACITY || !heap.resize(map, static_cast<u32>(capacity))) return false;
+    }
+
+    auto index = map.m_used++;
+    map.m_entries[index] = MapEntry { key, value };
+    insert_slot(map, hash, index);
+    ++map.m_count;
+    return true;
+}
+
+std::optional<LoxValue> interpreter::map_remove(ObjMap& map, const LoxValue& key) {
+    auto position = find_slot(map, key, hash_key(key));
+    if (position == NOT_FOUND) return std::nullopt;
+
+    auto& slot = map.slots()[position];
+    auto& entry = map.m_entries[static_cast<u32>(slot)];
+    auto value = entry.m_value;
+    entry = MapEntry {};
+    slot = ObjMap::REMOVED_SLOT;
+    --map.m_count;
+    return value;
+}
+
+void interpreter::index_entries(ObjMap& map) {
+    std::fill_n(map.slots(), static_cast<u64>(map.m_capacity) * 2, ObjMap::EMPTY_SLOT);
+    for (u32 i = 0; i < map.m_used; ++i) {
+        const auto& key = map.m_entries[i].m_key;
+        if (!std::holds_alternative<std::monostate>(key)) insert_slot(map, hash_key(key), i);
+    }
+}
+
+bool interpreter::list_append(Heap& heap, ObjList& list, const LoxValue& value) {
+    if (list.m_count == list.m_capacity && !heap.reserve(list, std::max(MIN_LIST_CAPACITY, list.m_capacity * 2)))
+        return false;
+    list.m_items[list.m_count++] = value;
+    return true;
+}
+
+std::optional<LoxValue> interpreter::read_index(const LoxValue& object, const LoxValue& index) {
+    if (auto list = std::get_if<ObjList*>(&object)) {
+        auto position = element_position(index, (*list)->m_count);
+        if (!position) return std::nullopt;
+        return (*list)->m_items[*position];
+    }
+    if (auto map = std::get_if<ObjMap*>(&object)) {
+        auto value = map_find(**map, index);
+        return value ? *value : LoxValue();
+    }
+    if (auto array = std::get_if<ObjArray*>(&object)) {
+        auto position = element_position(index, (*array)->m_length);
+        if (!position) return std::nullopt;
+        return (*array)->m_data[*position];
+    }
+    return std::nullopt;
+}
+
+const char* interpreter::index_error(const LoxValue& object, const LoxValue&) {
+    if (std::holds_alternative<ObjList*>(object)) return LIST_INDEX;
+    if (std::holds_alternative<ObjArray*>(object)) return ARRAY_INDEX;
+    return NOT_INDEXABLE;
+}
+
+// Lists, maps and arrays are shared with the workers of a `parallel for` like the fields
+// of objects are, so a worker only changes those it made itself.
+const char* interpreter::store_index(Heap& heap, const LoxValue& object, const LoxValue& index, const LoxValue& value) {
+    if (auto list = std::get_if<ObjList*>(&object)) {
+        if (in_parallel_worker() && !(*list)->m_worker) return PARALLEL_LIST;
+        auto position = element_position(index, (*list)->m_count);
+        if (!position) return LIST_INDEX;
+        (*list)->m_items[*position] = value;
+        return nullptr;
+    }
+    if (auto map = std::get_if<ObjMap*>(&object)) {
+        if (in_parallel_worker() && !(*map)->m_worker) return PARALLEL_MAP;
+        if (!is_valid_key(index)) return INVALID_KEY;
+        return map_set(heap, **map, index, value) ? nullptr : OUT_OF_MEMORY;
+    }
+    if (auto array = std::get_if<ObjArray*>(&object)) {
+        if (in_parallel_worker() && !(*array)->m_worker) return PARALLEL_ARRAY;
+        auto position = element_position(index, (*array)->m_length);
+        if (!position) return ARRAY_INDEX;
+        auto number = std::get_if<float>(&value);
+        if (!number) return ARRAY_ELEMENT;
+        (*array)->m_data[*position] = *number;
+        return nullptr;
+    }
+    return NOT_INDEXABLE;
+}
+
+Iteration::Iteration(const LoxValue& iterable) : m_iterable(iterable) {
+    // A worker can't change a map it did not make, so it has no need to count itself,
+    // and must not write to the map anyway.
+    if (auto map = std::get_if<ObjMap*>(&iterable); map && (!in_parallel_worker() || (*map)->m_worker)) {
+        m_map = *map;
+        ++m_map->m_iterating;
+    }
+}
+
+Iteration::~Iteration() {
+    if (m_map) --m_map->m_iterating;
+}
+
+std::optional<LoxValue> Iteration::next() {
+    if (auto list = std::get_if<ObjList*>(&m_iterable)) {
+        if (m_position >= (*list)->m_count) return std::nullopt;
+        return (*list)->m_items[m_position++];
+    }
+    if (auto array = std::get_if<ObjArray*>(&m_iterable)) {
+        if (m_position >= (*array)->m_length) return std::nullopt;
+        return (*array)->m_data[m_position++];
+    }
+
+    auto map = std::get<ObjMap*>(m_iterable);
+    while (m_position < map->m_used) {
+        const auto& key = map->m_entries[m_position++].m_key;
+        if (!std::holds_alternative<std::monostate>(key)) return key;
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,96 @@
+#ifndef LOX_COLLECTIONS_HPP
+#define LOX_COLLECTIONS_HPP
+
+#include <optional>
+#include <string_view>
+#include "../util_types.hpp"
+#include "Heap.hpp"
+#include "Object.hpp"
+
+namespace interpreter {
+    inline constexpr const char* NOT_INDEXABLE = "Only lists, maps and arrays can be indexed.";
+    inline constexpr const char* NOT_ITERABLE = "Can only loop over lists, maps and arrays.";
+    inline constexpr const char* LIST_INDEX = "The index must be a whole number less than the list's length.";
+    inline constexpr const char* ARRAY_INDEX = "The index must be a whole number less than the array's length.";
+    inline constexpr const char* ARRAY_ELEMENT = "The value must be a number.";
+    inline constexpr const char* INVALID_KEY = "A map key can't be nil or NaN.";
+    inline constexpr const char* PARALLEL_LIST = "Can't change a list created outside a parallel loop.";
+    inline constexpr const char* PARALLEL_MAP = "Can't change a map created outside a parallel loop.";
+    inline constexpr const char* PARALLEL_ARRAY = "Can't change an array created outside a parallel loop.";
+
+    /// @brief The FNV-1a hash of `chars`. Passing the hash of one string as `hash`
+    /// continues it, giving the hash of the two joined.
+    inline u32 hash_chars(std::string_view chars, u32 hash = 2166136261u) {
+        for (auto c : chars) {
+            hash ^= static_cast<u8>(c);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    /// @brief The hash of a map key, consistent with `is_equal`: strings hash by their
+    /// characters, numbers by value, and everything else by identity.
+    u32 hash_key(const LoxValue& key);
+
+    /// @brief Whether `key` can be a key of a map: anything but `nil`, and NaN, which
+    /// equals nothing.
+    bool is_valid_key(const LoxValue& key);
+
+    /// @return The value of `key` in `map`, or `nullptr` if it has none.
+    LoxValue* map_find(const ObjMap& map, const LoxValue& key);
+
+    /// @brief Sets the value of `key`, which must be a valid key, in `map`.
+    /// @return False, leaving the map as it was, if the map would not fit in memory.
+    bool map_set(Heap& heap, ObjMap& map, const LoxValue& key, const LoxValue& value);
+
+    /// @brief Removes `key` from `map`.
+    /// @return The value it had, or nothing if it had none.
+    std::optional<LoxValue> map_remove(ObjMap& map, const LoxValue& key);
+
+    /// @brief Fills the slots of `map` from its entries, for a map whose entries just moved.
+    void index_entries(ObjMap& map);
+
+    /// @return False, leaving the list as it was, if the list would not fit in memory.
+    bool list_append(Heap& heap, ObjList& list, const LoxValue& value);
+
+    /// @brief `object[index]`. A key a map doesn't have reads as `nil`.
+    /// @return The value, or nothing if `object` can't be indexed by `index`; `index_error`
+    /// says why.
+    std::optional<LoxValue> read_index(const LoxValue& object, const LoxValue& index);
+
+    /// @brief Why `read_index` gave up on these operands.
+    const char* index_error(const LoxValue& object, const LoxValue& index);
+
+    /// @brief `object[index] = value`.
+    /// @return The message of the runtime error to report, or `nullptr` if it worked.
+    const char* store_index(Heap& heap, const LoxValue& object, const LoxValue& index, const LoxValue& value);
+
+    /// @brief A `for in` loop's position in a list, array or map. A list's items are read
+    /// up to however many it has at each step, so items appended by the loop are reached
+    /// too. A map's keys come in the order they were added; while the loop runs, the map
+    /// keeps its removed entries in place, so the position stays valid.
+    class Iteration {
+    private:
+        LoxValue m_iterable;
+        u64 m_position { 0 };
+
+        /// @brief The map being looped over, if it counts this loop in `m_iterating`.
+        ObjMap* m_map { nullptr };
+
+    public:
+        explicit Iteration(const LoxValue& iterable);
+        Iteration(const Iteration&) = delete;
+        Iteration& operator=(const Iteration&) = delete;
+        ~Iteration();
+
+        static bool can_iterate(const LoxValue& value) {
+            return std::holds_alternative<ObjList*>(value) || std::holds_alternative<ObjMap*>(value)
+                || std::holds_alternative<ObjArray*>(value);
+        }
+
+        /// @return The next item, or nothing once there are none left.
+        std::optional<LoxValue> next();
+    };
+}
+
+#endif
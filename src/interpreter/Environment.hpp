@@ -1,44 +1,144 @@
 #ifndef LOX_ENVIRONMENT_HPP
 #define LOX_ENVIRONMENT_HPP
 
-#include <map>
+#include <functional>
 #include <string>
-#include "../parser/statements.hpp"
+#include <string_view>
+#include <vector>
+#include "../memory.hpp"
+#include "../scanner/Token.hpp"
+#include "Object.hpp"
+#include "../util_types.hpp"
 
 namespace interpreter {
+    /// @brief The global scope. Variables declared inside blocks are resolved to
+    /// slots on the `ScopeStack` instead, so they never reach this table.
+    ///
+    /// Every name the program mentions as a global gets a slot the first time it is
+    /// looked up, defined or not, and keeps it for the life of the interpreter;
+    /// redefining a global reuses its slot. The values sit in one dense array, so a
+    /// variable that has cached its slot reads and writes it with an index and a check
+    /// that it has been defined. Names are found by an open-addressing index with linear
+    /// probing over precomputed hashes, which only has to be searched once per site.
     class Environment {
+    public:
+        using Name = std::basic_string<char, std::char_traits<char>, lox::AccountingAllocator<char>>;
+
     private:
-        std::map<std::string, parser::LoxValue> m_values {};
-        std::shared_ptr<Environment> m_enclosing;
+        static constexpr u32 EMPTY = ~u32 { 0 };
+        static constexpr u32 INITIAL_BUCKETS = 64;
+
+        /// @brief `ReadOnly` globals can be read but not assigned, like those of the
+        /// workers of a `parallel for`, which must not change what other iterations see.
+        enum class State : u8 { Undefined, Defined, ReadOnly };
+
+        struct Slot {
+            LoxValue m_value {};
+            State m_state { State::Undefined };
+        };
+
+        struct Key {
+            Name m_name;
+            u64 m_hash;
+        };
+
+        std::vector<Slot, lox::AccountingAllocator<Slot>> m_slots;
+        std::vector<Key, lox::AccountingAllocator<Key>> m_keys;
+
+        /// @brief Slot numbers, or `EMPTY`. A power of two in size and never more than
+        /// half full, so probes stay short.
+        std::vector<u32, lox::AccountingAllocator<u32>> m_buckets;
 
     public:
-        Environment() : m_enclosing { nullptr } {}
-        Environment(std::shared_ptr<Environment> enclosing) : m_enclosing(enclosing) {}
+        Environment() : m_buckets(INITIAL_BUCKETS, EMPTY) {}
 
-        void define(const std::string& name, const parser::LoxValue& value) {
-            m_values[name] = value;
+        /// @return The slot of `name`, adding an undefined one if it has none yet.
+        u32 slot(std::string_view name) {
+            auto hash = hash_of(name);
+            auto mask = m_buckets.size() - 1;
+            for (auto bucket = hash & mask;; bucket = (bucket + 1) & mask) {
+                auto slot = m_buckets[bucket];
+                if (slot == EMPTY) break;
+                if (m_keys[slot].m_hash == hash && m_keys[slot].m_name == name) return slot;
+            }
+
+            auto slot = static_cast<u32>(m_slots.size());
+            m_slots.emplace_back();
+            m_keys.push_back(Key { Name(name), hash });
+            if (m_keys.size() * 2 > m_buckets.size())
+                rehash(m_buckets.size() * 2);
+            else
+                insert(slot);
+            return slot;
         }
 
-        void assign(const scanner::Token& name, parser::LoxValue value) {
-            if (m_values.count(name.lexeme()) != 0) {
-                m_values[name.lexeme()] = value;
-                return;
-            }
+        void define(u32 slot, LoxValue value) {
+            m_slots[slot] = Slot { std::move(value), State::Defined };
+        }
+
+        void define(std::string_view name, LoxValue value) {
+            define(slot(name), std::move(value));
+        }
+
+        /// @return Whether the global in `slot` was defined and not read-only, and so
+        /// could be assigned to.
+        bool assign(u32 slot, LoxValue value) {
+            auto& entry = m_slots[slot];
+            if (entry.m_state != State::Defined) return false;
+            entry.m_value = std::move(value);
+            return true;
+        }
 
-            if (m_enclosing != nullptr) {
-                m_enclosing->assign(name, value);
-                return;
+        bool assign(const scanner::Token& name, LoxValue value) {
+            return assign(slot(name.lexeme()), std::move(value));
+        }
+
+        /// @return The value of the global in `slot`, or `nullptr` if it was never defined.
+        const LoxValue* get(u32 slot) const {
+            auto& entry = m_slots[slot];
+            return entry.m_state != State::Undefined ? &entry.m_value : nullptr;
+        }
+
+        const LoxValue* get(const scanner::Token& name) {
+            return get(slot(name.lexeme()));
+        }
+
+        /// @brief Makes every global defined so far read-only. Defining one again makes it
+        /// assignable.
+        void freeze() {
+            for (auto& entry : m_slots) {
+                if (entry.m_state == State::Defined) entry.m_state = State::ReadOnly;
             }
+        }
+
+        /// @brief How many slots there are, defined or not. Slots are numbered from zero.
+        u32 size() const {
+            return static_cast<u32>(m_slots.size());
+        }
+
+        std::string_view name(u32 slot) const {
+            return m_keys[slot].m_name;
+        }
+
+    private:
+        static u64 hash_of(std::string_view name) {
+            return std::hash<std::string_view> {}(name);
+        }
 
-            throw lox::RuntimeError(name, "Variable does not exist.");
+        void insert(u32 slot) {
+            auto mask = m_buckets.size() - 1;
+            auto bucket = m_keys[slot].m_hash & mask;
+            while (m_buckets[bucket] != EMPTY)
+                bucket = (bucket + 1) & mask;
+            m_buckets[bucket] = slot;
         }
 
-        const parser::LoxValue& get(const scanner::Token& name) {
-            if (m_values.count(name.lexeme()) != 0) return m_values[name.lexeme()];
-            if (m_enclosing != nullptr) return m_enclosing->get(name);
-            throw lox::RuntimeError(name, "Variable not defined.");
+        void rehash(u64 bucket_count) {
+            m_buckets.assign(bucket_count, EMPTY);
+            for (u32 slot = 0; slot < m_keys.size(); ++slot)
+                insert(slot);
         }
     };
 }
 
-#endif
\ No newline at end of file
+#endif
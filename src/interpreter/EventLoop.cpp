@@ -0,0 +1,335 @@
+#include <cerrno>
+#include <limits>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "EventLoop.hpp"
+#include "Interpreter.hpp"
+#include "Values.hpp"
+#include "../trace.hpp"
+
+extern char** environ;
+
+using namespace interpreter;
+
+using scanner::Token;
+using scanner::TokenType;
+
+/// @brief Suspends a read until its file has something to read, or has been closed at
+/// the other end. Resumes with 0, or the `errno` of watching the file if it can't be.
+struct EventLoop::Readable {
+    EventLoop& m_loop;
+    int m_fd;
+    int m_error { 0 };
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> operation) {
+        if (m_loop.m_epoll < 0) m_loop.m_epoll = epoll_create1(EPOLL_CLOEXEC);
+
+        auto event = epoll_event {};
+        event.events = EPOLLIN | EPOLLONESHOT;
+        event.data.ptr = operation.address();
+        if (epoll_ctl(m_loop.m_epoll, EPOLL_CTL_MOD, m_fd, &event) != 0
+            && (errno != ENOENT || epoll_ctl(m_loop.m_epoll, EPOLL_CTL_ADD, m_fd, &event) != 0)) {
+            m_error = errno;
+            return false;
+        }
+
+        ++m_loop.m_watched;
+        return true;
+    }
+
+    int await_resume() const noexcept {
+        return m_error;
+    }
+};
+
+/// @brief Suspends a read until the loop has given everything else a turn.
+struct EventLoop::Yield {
+    EventLoop& m_loop;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> operation) {
+        m_loop.m_resumable.push_back(operation);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+/// @brief Suspends a read until it may open a file, which it then must close with
+/// `close_file`.
+struct EventLoop::OpenSlot {
+    EventLoop& m_loop;
+
+    bool await_ready() const noexcept {
+        if (m_loop.m_open_files == MAX_OPEN_FILES) return false;
+        ++m_loop.m_open_files;
+        return true;
+    }
+
+    void await_suspend(std::coroutine_handle<> operation) {
+        m_loop.m_waiting_to_open.push_back(operation);
+    }
+
+    void await_resume() const noexcept {}
+};
+
+/// @brief A file a read has opened, and the command writing to it, if any. Closing it
+/// kills a command that has not finished yet.
+class EventLoop::File {
+private:
+    EventLoop& m_loop;
+    pid_t m_command { -1 };
+
+public:
+    int m_fd { -1 };
+
+    explicit File(EventLoop& loop) : m_loop(loop) {}
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    ~File() {
+        if (m_fd >= 0) close(m_fd);
+        if (m_command > 0) {
+            kill(m_command, SIGKILL);
+            waitpid(m_command, nullptr, 0);
+        }
+        m_loop.close_file();
+    }
+
+    void open(const std::string& path) {
+        m_fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    }
+
+    /// @brief Starts `/bin/sh -c command`, with its standard output piped to this file and
+    /// its standard input empty.
+    void run(std::string command) {
+        int pipe[2];
+        if (pipe2(pipe, O_CLOEXEC) != 0) return;
+        fcntl(pipe[0], F_SETFL, O_NONBLOCK);
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, pipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        char shell[] = "sh";
+        char flag[] = "-c";
+        char* arguments[] = { shell, flag, command.data(), nullptr };
+        auto started = posix_spawn(&m_command, "/bin/sh", &actions, nullptr, arguments, environ) == 0;
+        posix_spawn_file_actions_destroy(&actions);
+
+        close(pipe[1]);
+        if (started) {
+            m_fd = pipe[0];
+        } else {
+            close(pipe[0]);
+            m_command = -1;
+        }
+    }
+
+    /// @brief Waits for the command to exit, once it has closed its output.
+    void finish() {
+        if (m_command > 0) waitpid(m_command, nullptr, 0);
+        m_command = -1;
+    }
+};
+
+EventLoop::Operation::promise_type::~promise_type() {
+    if (m_callback != NO_CALLBACK) m_loop->m_heap.release(m_callback);
+}
+
+void EventLoop::Operation::promise_type::return_value(std::optional<std::string> result) {
+    m_loop->m_ready.push_back(Ready { m_callback, true, std::move(result) });
+    m_callback = NO_CALLBACK;
+}
+
+EventLoop::EventLoop(Heap& heap) : m_heap(heap) {}
+
+EventLoop::~EventLoop() {
+    cancel();
+    if (m_epoll >= 0) close(m_epoll);
+}
+
+void EventLoop::spawn(const LoxValue& callback) {
+    m_ready.push_back(Ready { m_heap.hold(callback), false, std::nullopt });
+}
+
+void EventLoop::read_file(std::string path, const LoxValue& callback) {
+    start(read(std::move(path), false), callback);
+}
+
+void EventLoop::read_command(std::string command, const LoxValue& callback) {
+    start(read(std::move(command), true), callback);
+}
+
+void EventLoop::start(Operation operation, const LoxValue& callback) {
+    auto& promise = operation.m_handle.promise();
+    promise.m_loop = this;
+    promise.m_callback = m_heap.hold(callback);
+    m_operations.insert(operation.m_handle.address());
+    m_resumable.push_back(operation.m_handle);
+}
+
+EventLoop::Operation EventLoop::read(std::string source, bool command) {
+    co_await OpenSlot { *this };
+    auto file = File(*this);
+    if (command)
+        file.run(std::move(source));
+    else
+        file.open(source);
+    if (file.m_fd < 0) co_return std::nullopt;
+
+    struct stat status;
+    if (fstat(file.m_fd, &status) != 0 || S_ISDIR(status.st_mode)) co_return std::nullopt;
+    auto regular = S_ISREG(status.st_mode);
+
+    if (!m_buffer) m_buffer = std::make_unique<char[]>(CHUNK_SIZE);
+    auto contents = std::string();
+    for (;;) {
+        // A pipe may not have had a writer yet, and reads as empty until it has, so it
+        // is read only once `epoll` says there is something to read.
+        if (!regular) {
+            auto error = co_await Readable { *this, file.m_fd };
+            // Files `epoll` can't watch, like `/dev/null`, never block either.
+            if (error == EPERM)
+                regular = true;
+            else if (error != 0)
+                co_return std::nullopt;
+        }
+
+        auto count = ::read(file.m_fd, m_buffer.get(), CHUNK_SIZE);
+        if (count == 0) break;
+        if (count > 0)
+            contents.append(m_buffer.get(), count);
+        else if (errno != EAGAIN && errno != EINTR)
+            co_return std::nullopt;
+
+        if (regular) co_await Yield { *this };
+    }
+
+    file.finish();
+    co_return contents;
+}
+
+void EventLoop::resume(std::coroutine_handle<> operation) {
+    operation.resume();
+    if (!operation.done()) return;
+    m_operations.erase(operation.address());
+    operation.destroy();
+}
+
+void EventLoop::close_file() {
+    if (m_waiting_to_open.empty()) {
+        --m_open_files;
+        return;
+    }
+
+    // The slot goes straight to the read that has waited longest.
+    m_resumable.push_back(m_waiting_to_open.front());
+    m_waiting_to_open.pop_front();
+}
+
+void EventLoop::poll(int timeout) {
+    if (m_watched == 0) return;
+
+    epoll_event events[64];
+    auto count = epoll_wait(m_epoll, events, std::size(events), timeout);
+    for (int i = 0; i < count; ++i) {
+        --m_watched;
+        resume(std::coroutine_handle<>::from_address(events[i].data.ptr));
+    }
+}
+
+std::optional<EventLoop::Task> EventLoop::next(Budget& budget) {
+    for (;;) {
+        if (budget.out_of_time()) return std::nullopt;
+
+        // Every read that can go on does, once, before each task, so a stream of ready
+        // tasks does not starve them.
+        for (auto count = m_resumable.size(); count > 0; --count) {
+            auto operation = m_resumable.front();
+            m_resumable.pop_front();
+            resume(operation);
+        }
+        if (m_ready.empty() && m_resumable.empty() && m_watched > 0) {
+            // Waking a millisecond late at most, so the deadline has passed by then.
+            auto span = lox::trace::Span("wait for I/O");
+            auto left = budget.time_left();
+            auto milliseconds = left ? std::chrono::ceil<std::chrono::milliseconds>(*left).count() : -1;
+            poll(static_cast<int>(std::min<i64>(milliseconds, std::numeric_limits<int>::max())));
+        } else {
+            poll(0);
+        }
+
+        if (!m_ready.empty()) {
+            auto ready = std::move(m_ready.front());
+            m_ready.pop_front();
+            return Task { m_heap.release(ready.m_callback), ready.m_takes_result, std::move(ready.m_result) };
+        }
+        if (m_resumable.empty() && m_watched == 0) return std::nullopt;
+    }
+}
+
+void EventLoop::cancel() {
+    // Destroying a read closes its file, which hands its slot to a waiting read, so the
+    // queues are only cleared once every read is gone.
+    for (auto address : m_operations)
+        std::coroutine_handle<>::from_address(address).destroy();
+    m_operations.clear();
+    m_resumable.clear();
+    m_waiting_to_open.clear();
+    m_watched = 0;
+    m_open_files = 0;
+
+    for (const auto& ready : m_ready)
+        m_heap.release(ready.m_callback);
+    m_ready.clear();
+}
+
+// Defined here rather than with the visitors, as having it in their translation unit
+// changes what GCC inlines into them, and made the tree walker several percent slower.
+void Interpreter::run_tasks() {
+    // Nothing is left of the calls that started the tasks, so that is where the errors
+    // of calling them would be reported; `Natives` checks them beforehand instead.
+    static const auto task_token = Token(TokenType::Identifier, 0, "task");
+
+    while (auto task = m_tasks.next(m_fuel.budget())) {
+        auto span = lox::trace::Span("task");
+        auto base = m_scopes.top();
+        m_scopes.push_value(task->m_callback);
+        if (task->m_takes_result)
+            m_scopes.push_value(task->m_result ? LoxValue(m_heap.string(*task->m_result)) : LoxValue());
+        auto count = m_scopes.top() - base - 1;
+
+        if (!within_memory_limit()) {
+            fail(task_token, OUT_OF_MEMORY);
+        } else if (m_backend == Backend::Closure) {
+            auto context = ClosureContext { m_globals, m_scopes, m_heap, m_error, *m_output, m_tasks, m_fuel };
+            context.call(task->m_callback, base, count, task_token);
+        } else {
+            call_value(task->m_callback, base, count, task_token);
+        }
+
+        if (failed() || !safe_point()) {
+            if (!failed()) fail(task_token, OUT_OF_MEMORY);
+            report_error();
+            return;
+        }
+    }
+
+    // The loop only stops with tasks left when it runs out of time.
+    if (!m_tasks.idle()) {
+        fail(task_token, m_fuel.budget().error());
+        report_error();
+    }
+}
@@ -0,0 +1,162 @@
+#ifndef LOX_EVENT_LOOP_HPP
+#define LOX_EVENT_LOOP_HPP
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include "../memory.hpp"
+#include "../util_types.hpp"
+#include "Budget.hpp"
+#include "Heap.hpp"
+#include "Object.hpp"
+
+namespace interpreter {
+    /// @brief Runs the tasks a program starts with `spawn`, `readfile` and `shell`, on the
+    /// interpreter's own thread, once the code that started them has finished.
+    ///
+    /// A task is a call of a Lox function, and runs to completion. Starting a read never
+    /// blocks: it goes on in the background, and the function given with it is called as
+    /// a new task once everything has been read. So a program waiting on many files and
+    /// commands waits on all of them at once, and runs whichever task is ready first.
+    ///
+    /// Each read is a C++ coroutine that suspends whenever its file has nothing to give.
+    /// Pipes, terminals and other files that can block are watched with `epoll`. Regular
+    /// files never block, so their reads suspend after every chunk instead, letting the
+    /// other reads and the ready tasks take turns. A pending read costs its coroutine
+    /// frame, under 400 bytes, and what it has read so far. At most `MAX_OPEN_FILES` are
+    /// open at once; the rest wait for one of those to finish before opening theirs.
+    ///
+    /// Functions waiting to be called are held on the `Heap`, so a collection keeps them.
+    class EventLoop {
+    public:
+        static constexpr u32 MAX_OPEN_FILES = 256;
+        static constexpr u64 CHUNK_SIZE = 64 * 1024;
+
+        /// @brief A task ready to run: a call of `m_callback`, with `m_result` as its one
+        /// argument if `m_takes_result`, or `nil` if there is no result.
+        struct Task {
+            LoxValue m_callback;
+            bool m_takes_result;
+            std::optional<std::string> m_result;
+        };
+
+        /// @brief A read in progress. It starts suspended, is resumed only by the loop, and
+        /// makes the task of its callback ready when it returns.
+        struct Operation {
+            struct promise_type {
+                EventLoop* m_loop { nullptr };
+
+                /// @brief The `Heap::hold` handle of the function to call with the result.
+                u32 m_callback { NO_CALLBACK };
+
+                ~promise_type();
+
+                Operation get_return_object() {
+                    return Operation { std::coroutine_handle<promise_type>::from_promise(*this) };
+                }
+
+                std::suspend_always initial_suspend() noexcept { return {}; }
+                std::suspend_always final_suspend() noexcept { return {}; }
+                void return_value(std::optional<std::string> result);
+                void unhandled_exception() noexcept { std::terminate(); }
+
+                static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+                static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
+            };
+
+            std::coroutine_handle<promise_type> m_handle;
+        };
+
+    private:
+        static constexpr u32 NO_CALLBACK = 0xFFFF'FFFF;
+
+        struct Ready {
+            u32 m_callback;
+            bool m_takes_result;
+            std::optional<std::string> m_result;
+        };
+
+        Heap& m_heap;
+
+        /// @brief Made the first time a read waits on it, so an interpreter that never
+        /// reads, like a worker of a `parallel for`, costs no descriptor.
+        int m_epoll { -1 };
+
+        std::deque<Ready> m_ready;
+
+        /// @brief Reads that can go on without waiting for their file.
+        std::deque<std::coroutine_handle<>> m_resumable;
+
+        /// @brief Reads waiting for fewer than `MAX_OPEN_FILES` to be open.
+        std::deque<std::coroutine_handle<>> m_waiting_to_open;
+
+        /// @brief Every read that has not finished, so `cancel` can destroy them.
+        std::unordered_set<void*> m_operations;
+
+        /// @brief How many reads are waiting on `m_epoll`.
+        u32 m_watched { 0 };
+
+        u32 m_open_files { 0 };
+
+        /// @brief Where every read reads a chunk before appending it to its result, so a
+        /// read only ever holds what it has actually read.
+        std::unique_ptr<char[]> m_buffer;
+
+    public:
+        explicit EventLoop(Heap& heap);
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+        ~EventLoop();
+
+        /// @brief Queues a call of `callback`, which takes no arguments.
+        void spawn(const LoxValue& callback);
+
+        /// @brief Starts reading the file at `path`, then queues a call of `callback` with
+        /// its contents, or with `nil` if it can't be read.
+        void read_file(std::string path, const LoxValue& callback);
+
+        /// @brief Starts `command` with `/bin/sh`, then queues a call of `callback` with
+        /// what it wrote to its standard output, or with `nil` if it couldn't start.
+        void read_command(std::string command, const LoxValue& callback);
+
+        /// @brief Waits until a task is ready, letting the reads in progress go on meanwhile,
+        /// but not past the deadline of `budget`.
+        /// @return The task, or nothing once there are no tasks left and no reads that
+        /// could make one, or once the deadline has passed.
+        std::optional<Task> next(Budget& budget);
+
+        /// @brief Drops every queued task and stops every read, for a program that failed.
+        void cancel();
+
+        bool idle() const {
+            return m_ready.empty() && m_operations.empty();
+        }
+
+    private:
+        struct Readable;
+        struct Yield;
+        struct OpenSlot;
+        class File;
+
+        /// @brief Reads the file at `source`, or the output of `source` run as a command.
+        Operation read(std::string source, bool command);
+
+        void start(Operation operation, const LoxValue& callback);
+
+        /// @brief Resumes `operation` and destroys it if it has finished.
+        void resume(std::coroutine_handle<> operation);
+
+        /// @brief Resumes the reads whose files `epoll` says are ready.
+        /// @param timeout How many milliseconds to wait for one, or -1 to wait as long as it
+        /// takes, as `epoll_wait` has it.
+        void poll(int timeout);
+
+        void close_file();
+    };
+}
+
+#endif
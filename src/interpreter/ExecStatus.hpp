@@ -0,0 +1,21 @@
+#ifndef LOX_EXEC_STATUS_HPP
+#define LOX_EXEC_STATUS_HPP
+
+#include "../util_types.hpp"
+
+namespace interpreter {
+    /// @brief How a statement finished. Anything other than `Normal` makes the enclosing
+    /// statements stop and hand the status outward, instead of throwing a C++ exception.
+    enum class ExecStatus : u32 {
+        Normal,
+
+        /// @brief A runtime error was recorded and the program must stop.
+        Error,
+
+        /// @brief A `return` statement ran. Its value is waiting in the interpreter until
+        /// the call it ends picks it up.
+        Return
+    };
+}
+
+#endif
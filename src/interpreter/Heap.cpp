@@ -0,0 +1,396 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <type_traits>
+#include "Heap.hpp"
+#include "Collections.hpp"
+#include "ParallelFor.hpp"
+#include "../trace.hpp"
+
+using namespace interpreter;
+using parser::LoxString;
+
+Heap::~Heap() {
+    free_all();
+}
+
+void Heap::free_all() {
+    while (m_objects) {
+        auto next = m_objects->m_next;
+        free(m_objects);
+        m_objects = next;
+    }
+    m_bytes = 0;
+    m_constants.clear();
+}
+
+void* Heap::allocate(u64 bytes, ObjKind kind) {
+    auto object = static_cast<Obj*>(lox::allocate_accounted(bytes));
+    object->m_next = m_objects;
+    object->m_kind = kind;
+    object->m_marked = false;
+    m_objects = object;
+    m_bytes += bytes;
+    return object;
+}
+
+ObjString* Heap::string(std::string_view text) {
+    auto string = static_cast<ObjString*>(allocate(sizeof(ObjString) + text.size() + 1, ObjKind::String));
+    string->m_hash = hash_chars(text);
+    string->m_length = text.size();
+    auto chars = const_cast<char*>(string->chars());
+    std::memcpy(chars, text.data(), text.size());
+    chars[text.size()] = '\0';
+    return string;
+}
+
+ObjString* Heap::concatenate(const ObjString& left, const ObjString& right) {
+    auto length = left.m_length + right.m_length;
+    auto account = lox::MemoryAccount::current();
+    if (account && !account->fits(sizeof(ObjString) + length + 1)) return nullptr;
+
+    auto string = static_cast<ObjString*>(allocate(sizeof(ObjString) + length + 1, ObjKind::String));
+    string->m_hash = hash_chars(right.view(), left.m_hash);
+    string->m_length = length;
+    auto chars = const_cast<char*>(string->chars());
+    std::memcpy(chars, left.chars(), left.m_length);
+    std::memcpy(chars + left.m_length, right.chars(), right.m_length);
+    chars[length] = '\0';
+    return string;
+}
+
+ObjEnvironment* Heap::environment(ObjEnvironment* enclosing, u32 count) {
+    auto environment = static_cast<ObjEnvironment*>(
+        allocate(sizeof(ObjEnvironment) + count * sizeof(LoxValue), ObjKind::Environment));
+    environment->m_enclosing = enclosing;
+    environment->m_count = count;
+    environment->m_worker = in_parallel_worker();
+    std::uninitialized_fill_n(environment->values(), count, LoxValue {});
+    m_stats.m_environments++;
+    return environment;
+}
+
+ObjFunction* Heap::function(const parser::FunctionDecl& declaration, const CompiledStmt* compiled, ObjEnvironment* closure) {
+    auto function = static_cast<ObjFunction*>(allocate(sizeof(ObjFunction), ObjKind::Function));
+    function->m_declaration = &declaration;
+    function->m_compiled = compiled;
+    function->m_closure = closure;
+    return function;
+}
+
+ObjNative* Heap::native(const char* name, u32 arity, NativeFn function) {
+    auto native = static_cast<ObjNative*>(allocate(sizeof(ObjNative), ObjKind::Native));
+    native->m_function = function;
+    native->m_arity = arity;
+    native->m_name = name;
+    return native;
+}
+
+ObjClass* Heap::klass(const parser::ClassDecl& declaration, ObjClass* superclass, std::span<ObjFunction* const> methods) {
+    auto klass = static_cast<ObjClass*>(
+        allocate(sizeof(ObjClass) + methods.size() * sizeof(ObjFunction*), ObjKind::Class));
+    klass->m_declaration = &declaration;
+    klass->m_superclass = superclass;
+    klass->m_shape = &m_shapes.emplace_back();
+    klass->m_field_capacity = 0;
+    klass->m_method_count = methods.size();
+    std::copy(methods.begin(), methods.end(), klass->methods());
+    klass->m_initializer = klass->find_method("init");
+    return klass;
+}
+
+ObjInstance* Heap::instance(ObjClass& klass) {
+    auto instance = static_cast<ObjInstance*>(allocate(sizeof(ObjInstance), ObjKind::Instance));
+    instance->m_class = &klass;
+    instance->m_shape = klass.m_shape;
+    instance->m_fields = nullptr;
+    instance->m_capacity = 0;
+
+    // Instances of a class tend to end up with the same fields, so room for as many as
+    // earlier ones got is made now rather than grown into one field at a time.
+    if (klass.m_field_capacity > 0) {
+        instance->m_fields = static_cast<LoxValue*>(lox::allocate_accounted(klass.m_field_capacity * sizeof(LoxValue)));
+        instance->m_capacity = klass.m_field_capacity;
+        m_bytes += instance->m_capacity * sizeof(LoxValue);
+    }
+    return instance;
+}
+
+ObjBoundMethod* Heap::bound_method(ObjInstance& receiver, ObjFunction& method) {
+    auto bound = static_cast<ObjBoundMethod*>(allocate(sizeof(ObjBoundMethod), ObjKind::BoundMethod));
+    bound->m_receiver = &receiver;
+    bound->m_method = &method;
+    return bound;
+}
+
+ObjArray* Heap::array(u64 length) {
+    auto bytes = length * sizeof(float);
+    auto account = lox::MemoryAccount::current();
+    if (account && !account->fits(sizeof(ObjArray) + bytes)) return nullptr;
+
+    auto array = static_cast<ObjArray*>(allocate(sizeof(ObjArray), ObjKind::Array));
+    array->m_worker = in_parallel_worker();
+    array->m_length = length;
+    array->m_data = static_cast<float*>(lox::allocate_accounted_aligned(bytes, ObjArray::ALIGNMENT));
+    std::fill_n(array->m_data, length, 0.0f);
+    m_bytes += bytes;
+    return array;
+}
+
+ObjList* Heap::list(std::span<const LoxValue> items) {
+    auto bytes = items.size() * sizeof(LoxValue);
+    auto account = lox::MemoryAccount::current();
+    if (account && !account->fits(sizeof(ObjList) + bytes)) return nullptr;
+
+    auto list = static_cast<ObjList*>(allocate(sizeof(ObjList), ObjKind::List));
+    list->m_worker = in_parallel_worker();
+    list->m_count = items.size();
+    list->m_capacity = items.size();
+    list->m_items = nullptr;
+    if (!items.empty()) {
+        list->m_items = static_cast<LoxValue*>(lox::allocate_accounted(bytes));
+        std::uninitialized_copy(items.begin(), items.end(), list->m_items);
+        m_bytes += bytes;
+    }
+    return list;
+}
+
+ObjMap* Heap::map() {
+    auto map = static_cast<ObjMap*>(allocate(sizeof(ObjMap), ObjKind::Map));
+    map->m_worker = in_parallel_worker();
+    map->m_iterating = 0;
+    map->m_count = 0;
+    map->m_used = 0;
+    map->m_capacity = 0;
+    map->m_entries = nullptr;
+    return map;
+}
+
+bool Heap::reserve(ObjList& list, u64 capacity) {
+    auto added = (capacity - list.m_capacity) * sizeof(LoxValue);
+    auto account = lox::MemoryAccount::current();
+    if (account && !account->fits(added)) return false;
+
+    auto items = static_cast<LoxValue*>(lox::allocate_accounted(capacity * sizeof(LoxValue)));
+    std::uninitialized_copy_n(list.m_items, list.m_count, items);
+    if (list.m_items) lox::deallocate_accounted(list.m_items);
+
+    m_bytes += added;
+    list.m_items = items;
+    list.m_capacity = capacity;
+    return true;
+}
+
+bool Heap::resize(ObjMap& map, u32 capacity) {
+    constexpr u64 ENTRY_BYTES = sizeof(MapEntry) + 2 * sizeof(u64);
+    auto account = lox::MemoryAccount::current();
+    if (account && capacity > map.m_capacity && !account->fits((capacity - map.m_capacity) * ENTRY_BYTES))
+        return false;
+
+    auto entries = static_cast<MapEntry*>(lox::allocate_accounted(capacity * ENTRY_BYTES));
+    u32 used = 0;
+    for (u32 i = 0; i < map.m_used; ++i) {
+        const auto& entry = map.m_entries[i];
+        if (map.m_iterating == 0 && std::holds_alternative<std::monostate>(entry.m_key)) continue;
+        new (&entries[used++]) MapEntry(entry);
+    }
+    if (map.m_entries) lox::deallocate_accounted(map.m_entries);
+
+    m_bytes += (static_cast<u64>(capacity) - map.m_capacity) * ENTRY_BYTES;
+    map.m_entries = entries;
+    map.m_capacity = capacity;
+    map.m_used = used;
+    index_entries(map);
+    return true;
+}
+
+const Shape* Heap::transition(const Shape& shape, std::string_view name) {
+    if (auto next = shape.transition(name)) return next;
+    auto next = &m_shapes.emplace_back(shape, name);
+    shape.add_transition(name, next);
+    return next;
+}
+
+void Heap::reshape(ObjInstance& instance, const Shape* shape) {
+    auto old_count = instance.m_shape->field_count();
+    auto count = shape->field_count();
+    if (count > instance.m_capacity) {
+        auto capacity = std::max(count, instance.m_capacity * 2);
+        auto fields = static_cast<LoxValue*>(lox::allocate_accounted(capacity * sizeof(LoxValue)));
+        std::uninitialized_copy_n(instance.m_fields, old_count, fields);
+        if (instance.m_fields) lox::deallocate_accounted(instance.m_fields);
+
+        m_bytes += (capacity - instance.m_capacity) * sizeof(LoxValue);
+        instance.m_fields = fields;
+        instance.m_capacity = capacity;
+    }
+
+    std::uninitialized_fill(instance.m_fields + old_count, instance.m_fields + count, LoxValue {});
+    instance.m_shape = shape;
+    instance.m_class->m_field_capacity = std::max(instance.m_class->m_field_capacity, count);
+}
+
+LoxValue Heap::string_constant(const parser::Literal& literal) {
+    auto text = std::get_if<LoxString>(&literal.m_value);
+    if (!text) return std::monostate {};
+
+    auto& string = m_constants[&literal];
+    if (!string) string = this->string(*text);
+    return string;
+}
+
+u64 Heap::size_of(const Obj* object) {
+    switch (object->m_kind) {
+        case ObjKind::String:
+            return sizeof(ObjString) + static_cast<const ObjString*>(object)->m_length + 1;
+        case ObjKind::Environment:
+            return sizeof(ObjEnvironment) + static_cast<const ObjEnvironment*>(object)->m_count * sizeof(LoxValue);
+        case ObjKind::Function:
+            return sizeof(ObjFunction);
+        case ObjKind::Native:
+            return sizeof(ObjNative);
+        case ObjKind::Class:
+            return sizeof(ObjClass) + static_cast<const ObjClass*>(object)->m_method_count * sizeof(ObjFunction*);
+        case ObjKind::Instance:
+            return sizeof(ObjInstance) + static_cast<const ObjInstance*>(object)->m_capacity * sizeof(LoxValue);
+        case ObjKind::BoundMethod:
+            return sizeof(ObjBoundMethod);
+        case ObjKind::Array:
+            return sizeof(ObjArray) + static_cast<const ObjArray*>(object)->m_length * sizeof(float);
+        case ObjKind::List:
+            return sizeof(ObjList) + static_cast<const ObjList*>(object)->m_capacity * sizeof(LoxValue);
+        case ObjKind::Map:
+            return sizeof(ObjMap) + static_cast<const ObjMap*>(object)->m_capacity * (sizeof(MapEntry) + 2 * sizeof(u64));
+    }
+    return sizeof(Obj);
+}
+
+void Heap::free(Obj* object) {
+    if (object->m_kind == ObjKind::Instance) {
+        auto fields = static_cast<ObjInstance*>(object)->m_fields;
+        if (fields) lox::deallocate_accounted(fields);
+    } else if (object->m_kind == ObjKind::Array) {
+        lox::deallocate_accounted_aligned(static_cast<ObjArray*>(object)->m_data, ObjArray::ALIGNMENT);
+    } else if (object->m_kind == ObjKind::List) {
+        lox::deallocate_accounted(static_cast<ObjList*>(object)->m_items);
+    } else if (object->m_kind == ObjKind::Map) {
+        lox::deallocate_accounted(static_cast<ObjMap*>(object)->m_entries);
+    }
+    lox::deallocate_accounted(object);
+}
+
+void Heap::mark(Obj* object) {
+    if (!object || object->m_marked) return;
+    object->m_marked = true;
+
+    // Strings, natives and arrays refer to nothing, so only objects with references need
+    // tracing later.
+    if (object->m_kind != ObjKind::String && object->m_kind != ObjKind::Native && object->m_kind != ObjKind::Array)
+        m_gray.push_back(object);
+}
+
+void Heap::mark(const LoxValue& value) {
+    std::visit([this](auto&& v) {
+        if constexpr (std::is_pointer_v<std::decay_t<decltype(v)>>) mark(v);
+    }, static_cast<const LoxValue::variant&>(value));
+}
+
+void Heap::trace(Obj* object) {
+    if (object->m_kind == ObjKind::Environment) {
+        auto environment = static_cast<ObjEnvironment*>(object);
+        mark(environment->m_enclosing);
+        for (u32 i = 0; i < environment->m_count; ++i)
+            mark(environment->values()[i]);
+    } else if (object->m_kind == ObjKind::Function) {
+        mark(static_cast<ObjFunction*>(object)->m_closure);
+    } else if (object->m_kind == ObjKind::Class) {
+        auto klass = static_cast<ObjClass*>(object);
+        mark(klass->m_superclass);
+        for (u32 i = 0; i < klass->m_method_count; ++i)
+            mark(klass->methods()[i]);
+    } else if (object->m_kind == ObjKind::Instance) {
+        auto instance = static_cast<ObjInstance*>(object);
+        mark(instance->m_class);
+        for (u32 i = 0; i < instance->m_shape->field_count(); ++i)
+            mark(instance->m_fields[i]);
+    } else if (object->m_kind == ObjKind::BoundMethod) {
+        auto bound = static_cast<ObjBoundMethod*>(object);
+        mark(bound->m_receiver);
+        mark(bound->m_method);
+    } else if (object->m_kind == ObjKind::List) {
+        auto list = static_cast<ObjList*>(object);
+        for (u64 i = 0; i < list->m_count; ++i)
+            mark(list->m_items[i]);
+    } else if (object->m_kind == ObjKind::Map) {
+        // Removed entries are `nil` through and through, so marking them is harmless.
+        auto map = static_cast<ObjMap*>(object);
+        for (u32 i = 0; i < map->m_used; ++i) {
+            mark(map->m_entries[i].m_key);
+            mark(map->m_entries[i].m_value);
+        }
+    }
+}
+
+void Heap::sweep() {
+    auto link = &m_objects;
+    while (*link) {
+        auto object = *link;
+        if (object->m_marked) {
+            object->m_marked = false;
+            link = &object->m_next;
+            continue;
+        }
+
+        *link = object->m_next;
+        auto size = size_of(object);
+        m_bytes -= size;
+        m_stats.m_freed_bytes += size;
+        free(object);
+    }
+}
+
+void Heap::limit_collection(const lox::MemoryAccount* account) {
+    if (!m_collects || !account || account->limit() == lox::MemoryAccount::UNLIMITED) return;
+
+    // A program already over its limit collects at the next safe point.
+    auto headroom = account->within_limit() ? account->limit() - account->live_bytes() : 0;
+    m_next_collection = std::min(m_next_collection, m_bytes + headroom / 2);
+}
+
+void Heap::collect(const Environment& globals, const ScopeStack& scopes) {
+    auto span = lox::trace::Span("collect");
+    auto start = std::chrono::steady_clock::now();
+
+    for (u32 slot = 0; slot < globals.size(); ++slot) {
+        if (auto value = globals.get(slot)) mark(*value);
+    }
+    for (const auto& value : scopes.live())
+        mark(value);
+    mark(scopes.environment());
+    for (const auto& frame : scopes.frames())
+        mark(frame.m_environment);
+    for (const auto& [literal, string] : m_constants)
+        mark(string);
+    for (const auto& value : m_held)
+        mark(value);
+
+    while (!m_gray.empty()) {
+        auto object = m_gray.back();
+        m_gray.pop_back();
+        trace(object);
+    }
+
+    sweep();
+
+    // A program still over its limit fails at its next safe point; collecting again
+    // before the heap grows would only find the same live objects.
+    m_next_collection = std::max<u64>(m_bytes * m_growth_factor, MINIMUM_THRESHOLD);
+    auto account = lox::MemoryAccount::current();
+    if (account && account->within_limit()) limit_collection(account);
+
+    auto pause = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    m_stats.m_collections++;
+    m_stats.m_total_pause_us += pause;
+    m_stats.m_max_pause_us = std::max(m_stats.m_max_pause_us, pause);
+    lox::trace::counter("heap bytes", m_bytes);
+}
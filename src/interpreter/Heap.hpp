@@ -0,0 +1,198 @@
+#ifndef LOX_HEAP_HPP
+#define LOX_HEAP_HPP
+
+#include <deque>
+#include <limits>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../parser/statements.hpp"
+#include "Object.hpp"
+#include "Environment.hpp"
+#include "ScopeStack.hpp"
+#include "Shape.hpp"
+
+namespace interpreter {
+    /// @brief Owns every object a program creates and frees the unreachable ones with a
+    /// mark-sweep collection.
+    ///
+    /// The roots are the globals, the live slots of the frame stack, the environments of
+    /// the running calls, the strings made for literals and the values `hold` keeps. Values
+    /// held in C++ locals are not roots, so collections only happen at safe points between
+    /// statements. A value that must survive a call made before it is used, like the left
+    /// operand of `a + f()`, is pushed onto the frame stack for the duration. Allocating
+    /// never collects by itself.
+    ///
+    /// Shapes are not objects: they are kept until the heap itself goes away.
+    ///
+    /// After each collection the next one is scheduled for when the heap has grown by
+    /// `growth_factor` times what survived, or halfway to the memory limit if that is
+    /// sooner, so garbage does not push a program over its limit. The first one is
+    /// scheduled the same way, from when the limit is set.
+    class Heap {
+    public:
+        static constexpr u64 MINIMUM_THRESHOLD = 1 << 20;
+
+        struct Stats {
+            u64 m_collections { 0 };
+            u64 m_freed_bytes { 0 };
+            double m_total_pause_us { 0 };
+            double m_max_pause_us { 0 };
+
+            /// @brief How many environments for captured variables have been created.
+            u64 m_environments { 0 };
+        };
+
+    private:
+        Obj* m_objects { nullptr };
+        u64 m_bytes { 0 };
+        u64 m_next_collection { MINIMUM_THRESHOLD };
+        bool m_collects { true };
+        double m_growth_factor { 2.0 };
+        std::unordered_map<const parser::Literal*, ObjString*> m_constants;
+        std::vector<Obj*> m_gray;
+        std::deque<Shape, lox::AccountingAllocator<Shape>> m_shapes;
+        Stats m_stats;
+
+        /// @brief The values `hold` keeps, indexed by handle. Released handles are `nil`
+        /// and listed in `m_free_held` for reuse.
+        std::vector<LoxValue> m_held;
+        std::vector<u32> m_free_held;
+
+    public:
+        Heap() = default;
+        Heap(const Heap&) = delete;
+        Heap& operator=(const Heap&) = delete;
+        ~Heap();
+
+        /// @brief Copies `text` into a new string.
+        ObjString* string(std::string_view text);
+
+        /// @return The joined string, or `nullptr` if it would not fit in the memory limit.
+        ObjString* concatenate(const ObjString& left, const ObjString& right);
+
+        /// @brief A new environment of `count` variables, all `nil`.
+        ObjEnvironment* environment(ObjEnvironment* enclosing, u32 count);
+
+        ObjFunction* function(const parser::FunctionDecl& declaration, const CompiledStmt* compiled, ObjEnvironment* closure);
+        ObjNative* native(const char* name, u32 arity, NativeFn function);
+
+        /// @brief A new class with `methods`, whose instances start with a new root shape.
+        ObjClass* klass(const parser::ClassDecl& declaration, ObjClass* superclass, std::span<ObjFunction* const> methods);
+
+        /// @brief A new instance of `klass`, with no fields yet.
+        ObjInstance* instance(ObjClass& klass);
+
+        ObjBoundMethod* bound_method(ObjInstance& receiver, ObjFunction& method);
+
+        /// @brief A new array of `length` zeros.
+        /// @return The array, or `nullptr` if it would not fit in the memory limit.
+        ObjArray* array(u64 length);
+
+        /// @brief A new list of `items`.
+        /// @return The list, or `nullptr` if it would not fit in the memory limit.
+        ObjList* list(std::span<const LoxValue> items);
+
+        /// @brief A new map, with no keys and no room for any yet.
+        ObjMap* map();
+
+        /// @brief Makes room for `capacity` items in `list`, which has room for fewer.
+        /// @return False, leaving the list as it was, if that would not fit in the memory limit.
+        bool reserve(ObjList& list, u64 capacity);
+
+        /// @brief Moves the entries of `map` to a block with room for `capacity`, which must
+        /// fit them, squeezing out the removed ones unless a loop is running over the map.
+        /// @return False, leaving the map as it was, if that would not fit in the memory limit.
+        bool resize(ObjMap& map, u32 capacity);
+
+        /// @brief The shape `shape` becomes by adding field `name`, made the first time it is needed.
+        const Shape* transition(const Shape& shape, std::string_view name);
+
+        /// @brief Moves `instance` to `shape`, a descendant of its current one, making room
+        /// for the fields that adds. The new fields start out `nil`.
+        void reshape(ObjInstance& instance, const Shape* shape);
+
+        /// @brief The runtime value of a literal. Each string literal is copied onto the
+        /// heap once, then shared for as long as the heap. The AST must live as long too.
+        LoxValue constant(const parser::Literal& literal) {
+            if (auto number = std::get_if<float>(&literal.m_value)) return *number;
+            if (auto boolean = std::get_if<bool>(&literal.m_value)) return *boolean;
+            return string_constant(literal);
+        }
+
+        /// @brief Keeps `value` alive until it is released, for a value only C++ refers to,
+        /// like the function of a task that has yet to run.
+        /// @return The handle to release it with.
+        u32 hold(const LoxValue& value) {
+            if (m_free_held.empty()) {
+                m_held.push_back(value);
+                return m_held.size() - 1;
+            }
+            auto handle = m_free_held.back();
+            m_free_held.pop_back();
+            m_held[handle] = value;
+            return handle;
+        }
+
+        /// @return The value held by `handle`, which no longer keeps it alive.
+        LoxValue release(u32 handle) {
+            auto value = std::exchange(m_held[handle], LoxValue {});
+            m_free_held.push_back(handle);
+            return value;
+        }
+
+        bool wants_collection() const {
+            return m_bytes >= m_next_collection;
+        }
+
+        /// @brief Whether `collect` may run. See `disable_collection`.
+        bool collects() const {
+            return m_collects;
+        }
+
+        void collect(const Environment& globals, const ScopeStack& scopes);
+
+        /// @brief Brings the next collection forward to halfway from what `account` holds
+        /// to its limit, if that is sooner. Called after each collection that leaves the
+        /// account within its limit, and whenever the limit changes.
+        void limit_collection(const lox::MemoryAccount* account);
+
+        /// @brief Never collects again, for a heap whose values are not all reachable from
+        /// its own roots, like a worker's of a `parallel for`. Free them with `free_all`.
+        void disable_collection() {
+            m_collects = false;
+            m_next_collection = std::numeric_limits<u64>::max();
+        }
+
+        /// @brief Frees every object, reachable or not. Shapes are kept.
+        void free_all();
+
+        /// @brief How much the heap may grow, relative to what survived, before the next
+        /// collection. Must be greater than 1.
+        void set_growth_factor(double factor) {
+            m_growth_factor = factor;
+        }
+
+        u64 bytes() const {
+            return m_bytes;
+        }
+
+        const Stats& stats() const {
+            return m_stats;
+        }
+
+    private:
+        LoxValue string_constant(const parser::Literal& literal);
+        void* allocate(u64 bytes, ObjKind kind);
+        void mark(const LoxValue& value);
+        void mark(Obj* object);
+        void trace(Obj* object);
+        void sweep();
+        static u64 size_of(const Obj* object);
+        static void free(Obj* object);
+    };
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef LOX_INLINE_CACHE_HPP
+#define LOX_INLINE_CACHE_HPP
+
+#include <array>
+#include "Shape.hpp"
+#include "../util_types.hpp"
+
+namespace interpreter {
+    struct ObjFunction;
+
+    /// @brief What one property access in the program found for the shapes it has seen.
+    /// A hit turns the access into a comparison against each cached shape followed by an
+    /// indexed load or store, instead of a search of the shape's fields and the class's
+    /// methods.
+    ///
+    /// Most sites only ever see one shape. Up to `MAX_ENTRIES` are remembered; a site
+    /// that sees more stops caching and keeps taking the slow path.
+    class InlineCache {
+    public:
+        static constexpr u32 MAX_ENTRIES = 4;
+
+        struct Entry {
+            const Shape* m_shape;
+
+            /// @brief For an assignment, the shape the instance has afterwards, which is a
+            /// child of `m_shape` if the assignment adds the field. For a read, `m_shape`.
+            const Shape* m_next_shape;
+
+            /// @brief The method the property names, or `nullptr` if it names a field.
+            ObjFunction* m_method;
+
+            u32 m_index;
+        };
+
+    private:
+        std::array<Entry, MAX_ENTRIES> m_entries {};
+        u32 m_count { 0 };
+
+    public:
+        const Entry* find(const Shape* shape) const {
+            for (u32 i = 0; i < m_count; ++i) {
+                if (m_entries[i].m_shape == shape) return &m_entries[i];
+            }
+            return nullptr;
+        }
+
+        void add(const Entry& entry) {
+            if (m_count < MAX_ENTRIES) m_entries[m_count++] = entry;
+        }
+    };
+}
+
+#endif
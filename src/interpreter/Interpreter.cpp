@@ -2,8 +2,15 @@
 #include <variant>
 #include <functional>
 #include <cmath>
+#include <utility>
 #include "Interpreter.hpp"
+#include "Collections.hpp"
+#include "Natives.hpp"
+#include "ParallelFor.hpp"
+#include "Values.hpp"
 #include "../lox.hpp"
+#include "../parser/FlatAst.hpp"
+#include "../trace.hpp"
 
 using namespace interpreter;
 using namespace parser;
@@ -11,209 +18,588 @@ using namespace parser;
 using scanner::Token;
 using scanner::TokenType;
 
-bool Interpreter::is_truthy(const LoxValue& value) {
-    return std::visit([](auto&& v) -> bool {
-        using ValueType = std::decay_t<decltype(v)>;
+Interpreter::Interpreter() {
+    auto memory_scope = lox::MemoryAccount::Scope(m_memory);
+    define_natives(m_globals, m_heap);
+    m_heap.limit_collection(&m_memory);
+}
+
+void Interpreter::allow_shell() {
+    auto memory_scope = lox::MemoryAccount::Scope(m_memory);
+    define_shell(m_globals, m_heap);
+}
 
-        if constexpr (std::is_empty_v<ValueType>) 
-            return false;
+Interpreter::Interpreter(const Environment& globals, const std::deque<InlineCache>* caches) : m_globals(globals) {
+    m_globals.freeze();
+    if (caches) m_caches = *caches;
+    m_heap.disable_collection();
+}
 
-        if constexpr (std::is_same_v<ValueType, bool>) 
-            return static_cast<bool>(v);
+void Interpreter::interpret(std::vector<std::unique_ptr<Statement>>&& program) {
+    auto memory_scope = lox::MemoryAccount::Scope(m_memory);
+    auto span = lox::trace::Span("interpret");
+    const auto& statements = m_programs.emplace_back(std::move(program));
+    run(statements);
+    run_tasks();
+    lox::trace::counter("environments", m_heap.stats().m_environments);
+}
 
-        return true;
-    }, value);
+void Interpreter::interpret_part(std::vector<std::unique_ptr<Statement>>&& part) {
+    auto memory_scope = lox::MemoryAccount::Scope(m_memory);
+    auto span = lox::trace::Span("interpret");
+    const auto& statements = m_programs.emplace_back(std::move(part));
+    run(statements);
 }
 
-static void check_number_operand(const Token& operation, const LoxValue& operand) {
-    std::visit([&operation](auto&& arg) {
-        using ArgType = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<ArgType, float>) {
+void Interpreter::finish() {
+    auto memory_scope = lox::MemoryAccount::Scope(m_memory);
+    run_tasks();
+    lox::trace::counter("environments", m_heap.stats().m_environments);
+}
+
+void Interpreter::run(const std::vector<std::unique_ptr<Statement>>& statements) {
+    if (m_backend == Backend::Closure) {
+        auto context = ClosureContext { m_globals, m_scopes, m_heap, m_error, *m_output, m_tasks, m_fuel };
+        const auto& compiled = compile(statements);
+        if (compiled.run(context, statements) == ExecStatus::Error)
+            report_error();
+        return;
+    }
+
+    for (const auto& stmt : statements) {
+        auto stmt_span = lox::trace::Span(to_string(kind_of(*stmt)));
+        if (execute(*stmt) == ExecStatus::Error) {
+            report_error();
             return;
-        } else {
-            throw lox::RuntimeError(operation, "Expected a number.");
         }
-    }, operand);
+        safe_point();
+    }
 }
 
-LoxValue Interpreter::visit(const Unary& unary) {
-    auto operation = unary.m_operator.type();
-    auto argument = evaluate(*unary.m_argument);
+ExecStatus Interpreter::execute(const CompiledStmt& stmt) {
+    auto context = ClosureContext { m_globals, m_scopes, m_heap, m_error, *m_output, m_tasks, m_fuel };
+    return stmt(context);
+}
 
-    switch (operation) {
-        case TokenType::Minus: { 
-            check_number_operand(unary.m_operator, argument);
-            auto number = std::get<float>(argument);
-            return -number;
-        }
+const CompiledProgram& Interpreter::compile(const std::vector<std::unique_ptr<Statement>>& statements) {
+    auto span = lox::trace::Span("compile");
+    return m_compiled.emplace_back(ClosureCompiler(m_heap, m_globals).compile(statements));
+}
 
-        case TokenType::Bang: { 
-            return !is_truthy(argument);
-        }
+LoxValue Interpreter::fail(const Token& token, const char* message) {
+    m_error.emplace(token, message);
+    return std::monostate {};
+}
 
-        default: {
-            throw std::runtime_error(std::string("Unknown unary operator: ") + unary.m_operator.lexeme());
-        }
-    }
+LoxValue Interpreter::fail(const Token& token, const std::string& message) {
+    m_error.emplace(token, message);
+    return std::monostate {};
 }
 
-static void check_number_operands(const Token& operation, const LoxValue& left, const LoxValue& right) {
-    std::visit([&operation](auto&& lv, auto&& rv) {
-        using LType = std::decay_t<decltype(lv)>;
-        using RType = std::decay_t<decltype(rv)>;
-        if constexpr (std::is_same_v<LType, float> && std::is_same_v<RType, float>) {
-            return;
-        } else {
-            throw lox::RuntimeError(operation, std::string("Can't add ") + typeid(LType).name() + " to " + typeid(RType).name() + ".");
-        }
-    }, left, right);
+ExecStatus Interpreter::out_of_budget(int line) {
+    m_error.emplace(Token(TokenType::Identifier, line, ""), m_fuel.budget().error());
+    return ExecStatus::Error;
 }
 
-LoxValue Interpreter::attempt_addition(const LoxValue& left, const LoxValue& right) {
-    auto visitor = [](auto&& lv, auto&& rv) -> LoxValue {
-        using LType = std::decay_t<decltype(lv)>;
-        using RType = std::decay_t<decltype(rv)>;
+ExecStatus Interpreter::out_of_memory(int line) {
+    m_error.emplace(Token(TokenType::Identifier, line, ""), OUT_OF_MEMORY);
+    return ExecStatus::Error;
+}
 
-        if constexpr (!std::is_same_v<LType, RType>)
-            throw std::runtime_error(std::string("Can't add ") + typeid(LType).name() + " to " + typeid(RType).name() + ".");
+InlineCache& Interpreter::new_cache(u32& index) {
+    if (in_parallel_worker()) {
+        thread_local auto scratch = InlineCache();
+        scratch = InlineCache();
+        return scratch;
+    }
 
-        if constexpr (std::is_same_v<LType, RType> && std::is_same_v<LType, float>)
-            return static_cast<float>(lv) + static_cast<float>(rv);
+    index = m_caches.size();
+    return m_caches.emplace_back();
+}
+
+u32 Interpreter::find_global(const Token& name, u32& slot) {
+    auto found = m_globals.slot(name.lexeme());
+    if (!in_parallel_worker()) slot = found;
+    return found;
+}
+
+LoxValue Interpreter::evaluate_rooted(const LoxValue& held, const Expr& expr) {
+    auto top = m_scopes.top();
+    m_scopes.push_value(held);
+    auto value = evaluate(expr);
+    m_scopes.truncate(top);
+    return value;
+}
 
-        if constexpr (std::is_same_v<LType, RType> && std::is_same_v<LType, std::string>)
-            return static_cast<std::string>(lv) + static_cast<std::string>(rv);
+ExecStatus Interpreter::execute_profiled(const Statement& stmt) {
+    auto previous = m_profile->enter(static_cast<u32>(kind_of(stmt)));
+    auto status = visit_stmt(stmt);
+    m_profile->leave(previous);
+    return status;
+}
 
-        throw std::runtime_error(std::string("Can't add ") + typeid(LType).name() + " to " + typeid(RType).name() + ".");
-    };
+LoxValue Interpreter::evaluate_profiled(const Expr& expr) {
+    auto previous = m_profile->enter(static_cast<u32>(kind_of(expr)));
+    auto value = visit_expr(expr);
+    m_profile->leave(previous);
+    return value;
+}
 
-    return std::visit(visitor, left, right);
+bool Interpreter::reclaim_memory() {
+    if (!m_heap.collects()) return false;
+    m_heap.collect(m_globals, m_scopes);
+    return within_memory_limit();
 }
 
-bool Interpreter::is_equal(const LoxValue& left, const LoxValue& right) {
-    return std::visit([](auto&& lv, auto&& rv) -> bool {
-        using LType = std::decay_t<decltype(lv)>;
-        using RType = std::decay_t<decltype(rv)>;
+bool Interpreter::reclaim_memory(const LoxValue& made) {
+    auto handle = m_heap.hold(made);
+    auto reclaimed = reclaim_memory();
+    m_heap.release(handle);
+    return reclaimed;
+}
 
-        if constexpr (std::is_empty_v<LType> && std::is_empty_v<RType>)
-            return true;
-        else if constexpr (std::is_empty_v<LType>)
-            return false;
-        else if constexpr (std::is_same_v<LType, RType>)
-            return lv == rv;
+ExecStatus Interpreter::define(const Token& name, i32 slot, i32 depth, LoxValue value) {
+    if (slot != GLOBAL_SLOT) {
+        if (depth == NOT_CAPTURED)
+            m_scopes[slot] = value;
         else
-            return false;
-        
-    }, left, right);
+            m_scopes.captured(depth, slot) = value;
+        return ExecStatus::Normal;
+    }
+
+    m_globals.define(name.lexeme(), value);
+    if (within_memory_limit() || reclaim_memory()) return ExecStatus::Normal;
+    fail(name, OUT_OF_MEMORY);
+    return ExecStatus::Error;
 }
 
-LoxValue Interpreter::visit(const Binary& binary) {
-    auto operation = binary.m_operator.type();
-    auto left = evaluate(*binary.m_left);
-    auto right = evaluate(*binary.m_right);
+LoxValue Interpreter::visit(const Unary& unary) {
+    auto operation = unary.m_operator.type();
+    auto argument = evaluate(*unary.m_argument);
+    if (failed()) return {};
+    if (operation == TokenType::Minus && unary.m_operand_type == StaticType::Number)
+        return -as_number(argument);
 
     switch (operation) {
-        case TokenType::Plus: {
-            check_number_operands(binary.m_operator, left, right);
-            return attempt_addition(left, right);
-        }
-
         case TokenType::Minus: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            return left_number - right_number;
+            auto number = std::get_if<float>(&argument);
+            if (!number) return fail(unary.m_operator, NUMBER_OPERAND);
+            return -*number;
         }
 
-        case TokenType::Star: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            return left_number * right_number;
+        case TokenType::Bang: {
+            return !is_truthy(argument);
         }
 
-        case TokenType::Slash: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            if (right_number == 0) throw std::runtime_error("Division by 0.");
-            return left_number / right_number;
+        default: {
+            return fail(unary.m_operator, "Unknown unary operator.");
         }
+    }
+}
 
-        case TokenType::Less: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            return left_number < right_number;
+LoxValue Interpreter::visit(const Binary& binary) {
+    auto operation = binary.m_operator.type();
+    auto left = evaluate(*binary.m_left);
+    if (failed()) return {};
+    auto right = evaluate_holding(left, *binary.m_right);
+    if (failed()) return {};
+
+    // Operands the type inference proved are numbers go straight to the operation.
+    if (binary.m_operand_type == StaticType::Number) {
+        auto left_number = as_number(left);
+        auto right_number = as_number(right);
+        switch (operation) {
+            case TokenType::Plus: return left_number + right_number;
+            case TokenType::Minus: return left_number - right_number;
+            case TokenType::Star: return left_number * right_number;
+            case TokenType::Less: return left_number < right_number;
+            case TokenType::LessEqual: return left_number <= right_number;
+            case TokenType::Greater: return left_number > right_number;
+            case TokenType::GreaterEqual: return left_number >= right_number;
+            case TokenType::EqualEqual: return left_number == right_number;
+            case TokenType::BangEqual: return left_number != right_number;
+            default: break;
         }
+    }
 
-        case TokenType::LessEqual: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            return left_number <= right_number;
+    switch (operation) {
+        case TokenType::Plus: {
+            auto sum = attempt_addition(left, right, m_heap);
+            if (!sum) return fail(binary.m_operator, addition_error(left, right));
+            return std::move(*sum);
         }
 
-        case TokenType::Greater: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            return left_number > right_number;
-        }
+        case TokenType::EqualEqual: return is_equal(left, right);
+        case TokenType::BangEqual: return !is_equal(left, right);
+        case TokenType::Comma: return fail(binary.m_operator, "Unknown binary operator.");
+
+        default: break;
+    }
 
-        case TokenType::GreaterEqual: {
-            auto left_number = std::get<float>(left);
-            auto right_number = std::get<float>(right);
-            return left_number >= right_number;
+    auto left_number = std::get_if<float>(&left);
+    auto right_number = std::get_if<float>(&right);
+    if (!left_number || !right_number) return fail(binary.m_operator, NUMBER_OPERANDS);
+
+    switch (operation) {
+        case TokenType::Minus: return *left_number - *right_number;
+        case TokenType::Star: return *left_number * *right_number;
+
+        case TokenType::Slash: {
+            if (*right_number == 0) return fail(binary.m_operator, DIVISION_BY_ZERO);
+            return *left_number / *right_number;
         }
 
-        case TokenType::EqualEqual: return is_equal(left, right);
-        case TokenType::BangEqual: return !is_equal(left, right);
+        case TokenType::Less: return *left_number < *right_number;
+        case TokenType::LessEqual: return *left_number <= *right_number;
+        case TokenType::Greater: return *left_number > *right_number;
+        case TokenType::GreaterEqual: return *left_number >= *right_number;
 
         default: {
-            throw lox::RuntimeError(binary.m_operator, "Unknown binary operator.");
+            return fail(binary.m_operator, "Unknown binary operator.");
         }
     }
 }
 
 LoxValue Interpreter::visit(const Ternary& ternary) {
     auto condition = evaluate(*ternary.m_condition);
+    if (failed()) return {};
     if (is_truthy(condition))
         return evaluate(*ternary.m_success);
     else
         return evaluate(*ternary.m_failure);
 }
 
-void Interpreter::visit(const ExprStmt& stmt) {
-    auto value = evaluate(*stmt.m_expr);
+ExecStatus Interpreter::visit(const ExprStmt& stmt) {
+    evaluate(*stmt.m_expr);
+    return failed() ? ExecStatus::Error : ExecStatus::Normal;
 }
 
-static std::string stringify(const LoxValue& value) {
-    return std::visit([](auto&& v) -> std::string {
-        using T = std::decay_t<decltype(v)>;
-        if constexpr (std::is_empty_v<T>)
-            return std::string("nil");
-        else if constexpr (std::is_same_v<T, std::string>)
-            return v;
-        else if constexpr (std::is_same_v<T, bool>)
-            return (v ? "true" : "false");
-        else if constexpr (std::is_same_v<T, float>)
-            return std::floor(v) == v ? std::to_string(int(v)) : std::to_string(v);
-        else
-            return std::to_string(v);
-    }, value);
-}
-
-void Interpreter::visit(const PrintStmt& stmt) {
+ExecStatus Interpreter::visit(const PrintStmt& stmt) {
     auto value = evaluate(*stmt.m_expr);
-    std::cout << stringify(value) << '\n';
+    if (failed()) return ExecStatus::Error;
+    *m_output << stringify(value) << '\n';
+    return ExecStatus::Normal;
 }
 
-void Interpreter::visit(const VariableDecl& decl) {
+ExecStatus Interpreter::visit(const VariableDecl& decl) {
     LoxValue initializer { std::monostate{} };
-    
-    if (decl.m_initializer.has_value())
+
+    if (decl.m_initializer.has_value()) {
         initializer = evaluate(*decl.m_initializer.value());
+        if (failed()) return ExecStatus::Error;
+    }
+
+    if (decl.m_slot != GLOBAL_SLOT && decl.m_depth == NOT_CAPTURED) {
+        m_scopes[decl.m_slot] = initializer;
+        return ExecStatus::Normal;
+    }
+    return define(decl.m_name, decl.m_slot, decl.m_depth, initializer);
+}
+
+ExecStatus Interpreter::visit(const FunctionDecl& decl) {
+    auto function = m_heap.function(decl, nullptr, m_scopes.environment());
+    if (!within_memory_limit() && !reclaim_memory(function)) {
+        fail(decl.m_name, OUT_OF_MEMORY);
+        return ExecStatus::Error;
+    }
+    return define(decl.m_name, decl.m_slot, decl.m_depth, function);
+}
+
+ExecStatus Interpreter::visit(const ReturnStmt& stmt) {
+    if (stmt.m_value.has_value()) {
+        m_return_value = evaluate(*stmt.m_value.value());
+        if (failed()) return ExecStatus::Error;
+    }
+    return ExecStatus::Return;
+}
+
+ExecStatus Interpreter::visit(const ClassDecl& decl) {
+    const auto& klass = *decl.m_class;
+    ObjClass* superclass = nullptr;
+    if (klass.m_superclass.has_value()) {
+        const auto& expr = *klass.m_superclass.value();
+        auto value = evaluate(expr);
+        if (failed()) return ExecStatus::Error;
+        auto super = std::get_if<ObjClass*>(&value);
+        if (!super) {
+            fail(std::get<Variable>(expr.m_node).m_name, SUPERCLASS_NOT_A_CLASS);
+            return ExecStatus::Error;
+        }
+        superclass = *super;
+    }
+
+    // The methods close over the scope that holds `super`, if the class has one.
+    m_scopes.push(klass.m_slot_count);
+    if (klass.m_captured_count > 0)
+        m_scopes.environment() = m_heap.environment(m_scopes.environment(), klass.m_captured_count);
+    if (superclass)
+        local(klass.m_super_slot, klass.m_super_depth) = superclass;
+
+    auto methods = std::vector<ObjFunction*>();
+    methods.reserve(klass.m_methods.size());
+    for (const auto& method : klass.m_methods)
+        methods.push_back(m_heap.function(method, nullptr, m_scopes.environment()));
+    auto object = m_heap.klass(decl, superclass, methods);
+
+    if (klass.m_captured_count > 0)
+        m_scopes.environment() = m_scopes.environment()->m_enclosing;
+    m_scopes.pop(klass.m_slot_count);
+    if (!within_memory_limit() && !reclaim_memory(object)) {
+        fail(decl.m_name, OUT_OF_MEMORY);
+        return ExecStatus::Error;
+    }
+    return define(decl.m_name, decl.m_slot, decl.m_depth, object);
+}
+
+LoxValue Interpreter::visit(const Get& get) {
+    auto object = evaluate(*get.m_object);
+    if (failed()) return {};
+    auto instance = std::get_if<ObjInstance*>(&object);
+    if (!instance) return fail(get.m_name, NOT_AN_INSTANCE);
+
+    auto entry = find_property(cache(get.m_cache), **instance, get.m_name.lexeme());
+    if (entry.m_method) {
+        auto bound = m_heap.bound_method(**instance, *entry.m_method);
+        if (!within_memory_limit() && !reclaim_memory(bound)) return fail(get.m_name, OUT_OF_MEMORY);
+        return bound;
+    }
+    if (entry.m_index == Shape::NOT_FOUND) return fail(get.m_name, undefined_property_error(get.m_name.lexeme()));
+    return (*instance)->m_fields[entry.m_index];
+}
+
+LoxValue Interpreter::visit(const Set& set) {
+    auto object = evaluate(*set.m_object);
+    if (failed()) return {};
+    auto instance = std::get_if<ObjInstance*>(&object);
+    if (!instance) return fail(set.m_name, NOT_AN_INSTANCE_FIELD);
+    auto value = evaluate_holding(object, *set.m_value);
+    if (failed()) return {};
+
+    // Looked up only now, since evaluating the value may have added fields to the instance.
+    if (in_parallel_worker()) [[unlikely]] return fail(set.m_name, PARALLEL_FIELD);
+    auto entry = find_field(cache(set.m_cache), m_heap, **instance, set.m_name.lexeme());
+    if (!store_field(**instance, entry, value, m_heap)) return fail(set.m_name, OUT_OF_MEMORY);
+    return value;
+}
+
+LoxValue Interpreter::visit(const Super& super) {
+    auto superclass = std::get<ObjClass*>(local(super.m_slot, super.m_depth));
+    auto method = superclass->find_method(super.m_method.lexeme());
+    if (!method) return fail(super.m_method, undefined_property_error(super.m_method.lexeme()));
+    auto receiver = std::get<ObjInstance*>(local(super.m_this_slot, super.m_this_depth));
+    auto bound = m_heap.bound_method(*receiver, *method);
+    if (!within_memory_limit() && !reclaim_memory(bound)) return fail(super.m_method, OUT_OF_MEMORY);
+    return bound;
+}
+
+LoxValue Interpreter::visit(const ListLiteral& list) {
+    // The elements wait on the frame stack, where the collector sees them, until the
+    // list is made from them there.
+    auto base = m_scopes.top();
+    for (const auto& element : list.m_elements) {
+        auto value = evaluate(*element);
+        if (failed()) {
+            m_scopes.truncate(base);
+            return {};
+        }
+        m_scopes.push_value(value);
+    }
+
+    auto made = m_heap.list(m_scopes.values(base, list.m_elements.size()));
+    m_scopes.truncate(base);
+    if (!made) return fail(list.m_bracket, OUT_OF_MEMORY);
+    return made;
+}
+
+LoxValue Interpreter::visit(const Index& index) {
+    auto object = evaluate(*index.m_object);
+    if (failed()) return {};
+    auto key = evaluate_holding(object, *index.m_index);
+    if (failed()) return {};
+
+    if (auto value = read_index(object, key)) return *value;
+    return fail(index.m_bracket, index_error(object, key));
+}
+
+LoxValue Interpreter::visit(const IndexSet& set) {
+    auto top = m_scopes.top();
+    m_scopes.push_value(evaluate(*set.m_object));
+    if (failed()) {
+        m_scopes.truncate(top);
+        return {};
+    }
+    m_scopes.push_value(evaluate(*set.m_index));
+    auto value = failed() ? LoxValue() : evaluate(*set.m_value);
+    auto object = m_scopes.at(top);
+    auto key = m_scopes.at(top + 1);
+    m_scopes.truncate(top);
+    if (failed()) return {};
+
+    if (auto error = store_index(m_heap, object, key, value)) return fail(set.m_bracket, error);
+    return value;
+}
+
+LoxValue Interpreter::visit(const Call& call) {
+    if (auto get = std::get_if<Get>(&call.m_callee->m_node)) return invoke(*get, call);
+    if (auto super = std::get_if<Super>(&call.m_callee->m_node)) return invoke(*super, call);
+
+    auto callee = evaluate(*call.m_callee);
+    if (failed()) return {};
+
+    // The callee and arguments go straight onto the frame stack, where they become the
+    // first slots of the new frame and the collector sees them while later arguments run.
+    auto base = m_scopes.top();
+    m_scopes.push_value(callee);
+    return finish_call(callee, base, call);
+}
+
+LoxValue Interpreter::invoke(const Get& get, const Call& call) {
+    auto object = evaluate(*get.m_object);
+    if (failed()) return {};
+    auto instance = std::get_if<ObjInstance*>(&object);
+    if (!instance) return fail(get.m_name, NOT_AN_INSTANCE);
+
+    auto entry = find_property(cache(get.m_cache), **instance, get.m_name.lexeme());
+    auto base = m_scopes.top();
+    if (entry.m_method) {
+        // The receiver goes where a bound method would put it, so no bound method is made.
+        m_scopes.push_value(object);
+        return finish_call(entry.m_method, base, call);
+    }
+
+    if (entry.m_index == Shape::NOT_FOUND) return fail(get.m_name, undefined_property_error(get.m_name.lexeme()));
+    auto field = (*instance)->m_fields[entry.m_index];
+    m_scopes.push_value(field);
+    return finish_call(field, base, call);
+}
+
+LoxValue Interpreter::invoke(const Super& super, const Call& call) {
+    auto superclass = std::get<ObjClass*>(local(super.m_slot, super.m_depth));
+    auto method = superclass->find_method(super.m_method.lexeme());
+    if (!method) return fail(super.m_method, undefined_property_error(super.m_method.lexeme()));
 
-    m_environment->define(decl.m_name.lexeme(), initializer);
+    auto base = m_scopes.top();
+    m_scopes.push_value(local(super.m_this_slot, super.m_this_depth));
+    return finish_call(method, base, call);
+}
+
+LoxValue Interpreter::finish_call(LoxValue callee, u64 base, const Call& call) {
+    for (const auto& argument : call.m_arguments) {
+        auto value = evaluate(*argument);
+        if (failed()) return {};
+        m_scopes.push_value(value);
+    }
+    return call_value(callee, base, call.m_arguments.size(), call.m_paren);
+}
+
+LoxValue Interpreter::call_value(const LoxValue& callee, u64 base, u64 count, const Token& paren) {
+    if (auto function = std::get_if<ObjFunction*>(&callee))
+        return call_function(**function, base, count, paren);
+    if (auto native = std::get_if<ObjNative*>(&callee))
+        return call_native(**native, base, count, paren);
+
+    if (auto bound = std::get_if<ObjBoundMethod*>(&callee)) {
+        m_scopes.at(base) = (*bound)->m_receiver;
+        return call_function(*(*bound)->m_method, base, count, paren);
+    }
+
+    if (auto klass = std::get_if<ObjClass*>(&callee)) {
+        // The new instance is the receiver of its initializer.
+        auto instance = m_heap.instance(**klass);
+        m_scopes.at(base) = instance;
+        if (!within_memory_limit() && !reclaim_memory()) return fail(paren, OUT_OF_MEMORY);
+        if ((*klass)->m_initializer)
+            return call_function(*(*klass)->m_initializer, base, count, paren);
+        if (count != 0) return fail(paren, arity_error(0, count));
+        m_scopes.truncate(base);
+        return instance;
+    }
+
+    return fail(paren, NOT_CALLABLE);
+}
+
+LoxValue Interpreter::call_function(const ObjFunction& function, u64 base, u64 count, const Token& paren) {
+    const auto& decl = *function.m_declaration->m_function;
+    if (count != decl.m_params.size())
+        return fail(paren, arity_error(decl.m_params.size(), count));
+    if (!m_fuel.step()) [[unlikely]]
+        return fail(paren, m_fuel.budget().error());
+    if (!m_scopes.enter(base, function.m_closure))
+        return fail(paren, STACK_OVERFLOW);
+
+    m_scopes.push(decl.m_frame_size - 1 - count);
+    if (decl.m_captured_count > 0) {
+        auto& environment = m_scopes.environment();
+        environment = m_heap.environment(environment, decl.m_captured_count);
+        for (auto [slot, index] : decl.m_captured_params)
+            environment->values()[index] = m_scopes[slot];
+        if (!within_memory_limit() && !reclaim_memory()) {
+            m_scopes.leave();
+            return fail(paren, OUT_OF_MEMORY);
+        }
+    }
+
+    auto status = ExecStatus::Normal;
+    for (const auto& stmt : decl.m_body) {
+        status = execute(*stmt);
+        if (status != ExecStatus::Normal) break;
+        if (!safe_point()) [[unlikely]] {
+            status = ExecStatus::Error;
+            fail(paren, OUT_OF_MEMORY);
+            break;
+        }
+    }
+
+    // An initializer always returns its instance, whatever `return` it ran.
+    if (decl.m_kind == FunctionKind::Initializer && status != ExecStatus::Error) {
+        auto instance = m_scopes[0];
+        m_scopes.leave();
+        return instance;
+    }
+
+    m_scopes.leave();
+    if (status == ExecStatus::Error) return {};
+    return std::exchange(m_return_value, LoxValue {});
+}
+
+LoxValue Interpreter::call_native(const ObjNative& native, u64 base, u64 count, const Token& paren) {
+    if (count != native.m_arity)
+        return fail(paren, arity_error(native.m_arity, count));
+
+    auto native_call = NativeCall { m_scopes.values(base + 1, count), m_heap, m_tasks };
+    auto result = native.m_function(native_call);
+    m_scopes.truncate(base);
+    if (native_call.m_error) return fail(paren, native_call.m_error);
+    return result;
+}
+
+LoxValue Interpreter::visit(const Variable& identifier) {
+    if (identifier.m_slot != GLOBAL_SLOT) {
+        if (identifier.m_depth == NOT_CAPTURED) return m_scopes[identifier.m_slot];
+        return m_scopes.captured(identifier.m_depth, identifier.m_slot);
+    }
+
+    auto value = m_globals.get(global(identifier.m_name, identifier.m_global));
+    if (!value) return fail(identifier.m_name, UNDEFINED_VARIABLE);
+    return *value;
 }
 
 LoxValue Interpreter::visit(const Assign& assign) {
     auto value = evaluate(*assign.m_value);
-    m_environment->assign(assign.m_name, value);
+    if (failed()) return {};
+
+    if (assign.m_slot != GLOBAL_SLOT && assign.m_depth != NOT_CAPTURED) {
+        auto environment = m_scopes.enclosing(assign.m_depth);
+        if (in_parallel_worker() && !environment->m_worker) [[unlikely]] return fail(assign.m_name, PARALLEL_ASSIGNMENT);
+        environment->values()[assign.m_slot] = value;
+    } else if (assign.m_slot != GLOBAL_SLOT) {
+        m_scopes[assign.m_slot] = value;
+    } else {
+        // Only the globals of a worker of a `parallel for` can be defined yet unassignable.
+        auto slot = global(assign.m_name, assign.m_global);
+        if (!m_globals.assign(slot, value))
+            return fail(assign.m_name, m_globals.get(slot) ? PARALLEL_ASSIGNMENT : UNASSIGNABLE_VARIABLE);
+    }
     return value;
 }
 
@@ -221,29 +607,47 @@ LoxValue Interpreter::visit(const Grouping& grouping) {
     return evaluate(*grouping.m_inner_expr);
 }
 
-void Interpreter::visit(const Block& block) {
-    auto previous = m_environment;
-    try {
-        m_environment = std::make_shared<Environment>(previous);
-        for (const auto& stmt : block.m_statements)
-            execute(*stmt);
-        m_environment = previous;
-    } catch (const lox::RuntimeError& error) {
-        m_environment = previous;
-        throw error;
+ExecStatus Interpreter::visit(const Block& block) {
+    m_scopes.push(block.m_slot_count);
+    if (block.m_captured_count > 0) {
+        m_scopes.environment() = m_heap.environment(m_scopes.environment(), block.m_captured_count);
+        if (!within_memory_limit() && !reclaim_memory()) {
+            m_scopes.environment() = m_scopes.environment()->m_enclosing;
+            m_scopes.pop(block.m_slot_count);
+            return out_of_memory(block.m_line);
+        }
     }
+
+    auto status = ExecStatus::Normal;
+    for (const auto& stmt : block.m_statements) {
+        status = execute(*stmt);
+        if (status != ExecStatus::Normal) break;
+        if (!safe_point()) [[unlikely]] {
+            status = out_of_memory(block.m_line);
+            break;
+        }
+    }
+
+    if (block.m_captured_count > 0)
+        m_scopes.environment() = m_scopes.environment()->m_enclosing;
+    m_scopes.pop(block.m_slot_count);
+    return status;
 }
 
-void Interpreter::visit(const IfStmt& stmt) {
+ExecStatus Interpreter::visit(const IfStmt& stmt) {
     auto condition_result = evaluate(*stmt.m_condition);
+    if (failed()) return ExecStatus::Error;
+
     if (is_truthy(condition_result))
-        execute(*stmt.m_then_clause);
+        return execute(*stmt.m_then_clause);
     else if (stmt.m_else_clause.has_value())
-        execute(*stmt.m_else_clause.value());
+        return execute(*stmt.m_else_clause.value());
+    return ExecStatus::Normal;
 }
 
-parser::LoxValue Interpreter::visit(const Logical& logical) {
+LoxValue Interpreter::visit(const Logical& logical) {
     auto left = evaluate(*logical.m_left);
+    if (failed()) return {};
     auto op_type = logical.m_operator.type();
 
     if (op_type == TokenType::Or && is_truthy(left))
@@ -255,22 +659,112 @@ parser::LoxValue Interpreter::visit(const Logical& logical) {
     return evaluate(*logical.m_right);
 }
 
-void Interpreter::visit(const WhileLoop& loop) {
-    while (is_truthy(evaluate(*loop.m_condition)))
-        execute(*loop.m_body);
+ExecStatus Interpreter::visit(const WhileLoop& loop) {
+    auto span = lox::trace::Span("while");
+    while (true) {
+        auto condition = evaluate(*loop.m_condition);
+        if (failed()) return ExecStatus::Error;
+        if (!is_truthy(condition)) return ExecStatus::Normal;
+
+        auto status = execute(*loop.m_body);
+        if (status != ExecStatus::Normal) return status;
+        if (!safe_point()) [[unlikely]] return out_of_memory(loop.m_line);
+        if (!m_fuel.step()) [[unlikely]] return out_of_budget(loop.m_line);
+    }
 }
 
-void Interpreter::visit(const ForLoop& loop) {
+ExecStatus Interpreter::visit(const ForLoop& loop) {
+    if (loop.m_parallel) [[unlikely]] return run_parallel(loop);
+
+    auto span = lox::trace::Span("for");
     bool has_initializer = loop.m_initializer.has_value();
     bool has_condition = loop.m_condition.has_value();
     bool has_update = loop.m_update.has_value();
 
-    if (has_initializer)
-        execute(*loop.m_initializer.value());
+    if (has_initializer) {
+        auto status = execute(*loop.m_initializer.value());
+        if (status != ExecStatus::Normal) return status;
+    }
+
+    while (has_condition) {
+        auto condition = evaluate(*loop.m_condition.value());
+        if (failed()) return ExecStatus::Error;
+        if (!is_truthy(condition)) break;
+
+        auto status = execute(*loop.m_body);
+        if (status != ExecStatus::Normal) return status;
+        if (!safe_point()) [[unlikely]] return out_of_memory(loop.m_line);
+        if (!m_fuel.step()) [[unlikely]] return out_of_budget(loop.m_line);
 
-    while (has_condition && is_truthy(evaluate(*loop.m_condition.value()))) {
-        execute(*loop.m_body);
-        if (has_update)
+        if (has_update) {
             evaluate(*loop.m_update.value());
+            if (failed()) return ExecStatus::Error;
+        }
+    }
+
+    return ExecStatus::Normal;
+}
+
+ExecStatus Interpreter::visit(const ForInLoop& loop) {
+    auto span = lox::trace::Span("for in");
+    auto iterable = evaluate(*loop.m_iterable);
+    if (failed()) return ExecStatus::Error;
+    if (!Iteration::can_iterate(iterable)) {
+        fail(loop.m_name, NOT_ITERABLE);
+        return ExecStatus::Error;
     }
-}
\ No newline at end of file
+
+    const auto& scope = *loop.m_scope;
+    m_scopes.push(scope.m_slot_count);
+    m_scopes[scope.m_iterable_slot] = iterable;
+    auto enclosing = m_scopes.environment();
+    auto iteration = Iteration(iterable);
+
+    auto status = ExecStatus::Normal;
+    while (auto element = iteration.next()) {
+        if (scope.m_captured_count > 0)
+            m_scopes.environment() = m_heap.environment(enclosing, scope.m_captured_count);
+        local(scope.m_slot, scope.m_depth) = *element;
+        if (scope.m_captured_count > 0 && !within_memory_limit() && !reclaim_memory()) {
+            status = ExecStatus::Error;
+            fail(loop.m_name, OUT_OF_MEMORY);
+            break;
+        }
+
+        status = execute(*loop.m_body);
+        if (status != ExecStatus::Normal) break;
+        if (!safe_point()) [[unlikely]] {
+            status = ExecStatus::Error;
+            fail(loop.m_name, OUT_OF_MEMORY);
+            break;
+        }
+        if (!m_fuel.step()) [[unlikely]] {
+            status = ExecStatus::Error;
+            fail(loop.m_name, m_fuel.budget().error());
+            break;
+        }
+    }
+
+    m_scopes.environment() = enclosing;
+    m_scopes.pop(scope.m_slot_count);
+    return status;
+}
+
+ExecStatus Interpreter::run_parallel(const ForLoop& loop) {
+    const auto& variable = std::get<VariableDecl>(loop.m_initializer.value()->m_stmt);
+    const auto& condition = std::get<Binary>(loop.m_condition.value()->m_node);
+    const auto& increment = std::get<Binary>(std::get<Assign>(loop.m_update.value()->m_node).m_value->m_node);
+
+    auto start = evaluate(*variable.m_initializer.value());
+    if (failed()) return ExecStatus::Error;
+    auto limit = evaluate(*condition.m_right);
+    if (failed()) return ExecStatus::Error;
+    auto step = evaluate(*increment.m_right);
+    if (failed()) return ExecStatus::Error;
+
+    auto parent = ParallelFor::Parent { m_globals, m_scopes, &m_caches, *m_output, m_error, m_fuel.budget() };
+    const auto& body = *loop.m_body;
+    return ParallelFor(*loop.m_parallel, parent, [&body](Interpreter& worker) {
+        return worker.execute(body);
+    }).run(start, limit, step);
+}
@@ -1,63 +1,301 @@
 #ifndef INTERPRETER_HPP
 #define INTERPRETER_HPP
 
+#include <deque>
 #include <variant>
 #include <map>
+#include <iostream>
+#include <optional>
 #include <string>
 #include <vector>
 #include "../parser/statements.hpp"
+#include "../lox.hpp"
+#include "../perf_counters.hpp"
 #include "Environment.hpp"
+#include "ScopeStack.hpp"
+#include "Heap.hpp"
+#include "Values.hpp"
+#include "EventLoop.hpp"
+#include "ExecStatus.hpp"
+#include "ClosureCompiler.hpp"
+#include "InlineCache.hpp"
+#include "Budget.hpp"
 
 namespace interpreter {
+    /// @brief Selects how `Interpreter::interpret` executes a program.
+    enum class Backend {
+        /// @brief Walk the AST directly through the visitors.
+        TreeWalker,
+
+        /// @brief Convert the AST into pre-bound closures once, then run those.
+        Closure
+    };
+
     /// @brief Performs a tree walk on a given AST, executing each statement along the way.
-    class Interpreter : parser::Expr::Visitor<parser::LoxValue>, parser::Statement::Visitor<void> {
+    ///
+    /// Runtime errors are not thrown. An expression that fails records the error with
+    /// `fail` and returns `nil`, every caller checks `failed()` after evaluating a
+    /// subexpression, and statements pass `ExecStatus::Error` outward until `interpret`
+    /// reports it.
+    class Interpreter : public parser::Expr::Visitor<Interpreter, LoxValue>, public parser::Statement::Visitor<Interpreter, ExecStatus> {
+        friend class ParallelFor;
+
     private:
-        std::shared_ptr<Environment> m_environment { std::make_shared<Environment>() };
-        bool is_truthy(const parser::LoxValue& value);
-        bool is_equal(const parser::LoxValue& left, const parser::LoxValue& right);
-        parser::LoxValue attempt_addition(const parser::LoxValue& left, const parser::LoxValue& right);
+        // Declared first so it outlives the values charged to it.
+        lox::MemoryAccount m_memory;
+        Heap m_heap;
+
+        Environment m_globals;
+        ScopeStack m_scopes;
+        Backend m_backend { Backend::TreeWalker };
+        std::optional<lox::RuntimeError> m_error;
+        std::ostream* m_output { &std::cout };
+
+        /// @brief Where the tree walker charges the work of each kind of node, if anywhere.
+        lox::perf::Profile* m_profile { nullptr };
+
+        /// @brief The value of the `return` statement being unwound, until its call takes it.
+        LoxValue m_return_value {};
+
+        /// @brief Every program run so far. Functions one declares can still be called by
+        /// later ones, e.g. in the REPL, so their ASTs and compiled code are kept.
+        std::vector<std::vector<std::unique_ptr<parser::Statement>>> m_programs;
+        std::vector<CompiledProgram> m_compiled;
+
+        /// @brief The inline caches of the property accesses that have run, indexed by
+        /// their `m_cache`. A deque, so a cache stays put while later ones are added.
+        std::deque<InlineCache> m_caches;
+
+        /// @brief The tasks the programs have started, which `interpret` runs once its
+        /// program is done.
+        EventLoop m_tasks { m_heap };
+
+        Budget m_budget;
+
+        /// @brief The steps this interpreter has taken from `m_budget`, or from its
+        /// parent's, for a worker.
+        Fuel m_fuel { m_budget };
 
     public:
-        void interpret(const std::vector<std::unique_ptr<parser::Statement>>& program) {
-            try {
-                for (const auto& stmt : program) {
-                    execute(*stmt);
-                }
-            } catch (lox::RuntimeError& error) {
-                lox::runtime_error(error);
-            }
+        /// @brief Creates an interpreter with the native functions already defined.
+        Interpreter();
+
+        void set_backend(Backend backend) {
+            m_backend = backend;
+        }
+
+        Backend backend() const {
+            return m_backend;
+        }
+
+        /// @brief Sends what `print` writes to `output` instead of standard output.
+        void set_output(std::ostream& output) {
+            m_output = &output;
+        }
+
+        /// @brief What this interpreter has allocated, and the limit it runs under. Make it
+        /// current with `lox::MemoryAccount::Scope` while parsing to charge the AST to it too.
+        /// Set the limit with `set_memory_limit`, so collections keep to it.
+        lox::MemoryAccount& memory() {
+            return m_memory;
+        }
+
+        /// @brief Defines the `shell` native, which scripts can't call otherwise.
+        void allow_shell();
+
+        void set_memory_limit(u64 bytes) {
+            m_memory.set_limit(bytes);
+            m_heap.limit_collection(&m_memory);
+        }
+
+        Environment& globals() {
+            return m_globals;
+        }
+
+        Heap& heap() {
+            return m_heap;
+        }
+
+        /// @brief How many steps the programs may take, and for how long they may run.
+        Budget& budget() {
+            return m_budget;
+        }
+
+        void interpret(std::vector<std::unique_ptr<parser::Statement>>&& program);
+
+        /// @brief Runs the next part of a program that is handed over a piece at a time,
+        /// like `interpret` but leaving the tasks it starts waiting. Call `finish` once the
+        /// last part has run.
+        void interpret_part(std::vector<std::unique_ptr<parser::Statement>>&& part);
+
+        /// @brief Runs the tasks the parts given to `interpret_part` started.
+        void finish();
+
+        /// @brief Charges the work of each statement and expression the tree walker runs
+        /// to a label of `profile` numbered by its `parser::NodeKind`, or stops if `nullptr`.
+        void set_profile(lox::perf::Profile* profile) {
+            m_profile = profile;
         }
 
-        void execute(const parser::Statement& stmt) {
-            visit_stmt(stmt);
+        ExecStatus execute(const parser::Statement& stmt) {
+            if (m_profile) [[unlikely]] return execute_profiled(stmt);
+            return visit_stmt(stmt);
         }
 
-        parser::LoxValue evaluate(const parser::Expr& expr) {
+        LoxValue evaluate(const parser::Expr& expr) {
+            if (m_profile) [[unlikely]] return evaluate_profiled(expr);
             return visit_expr(expr);
         }
 
-        void visit(const parser::ExprStmt& stmt) override;
-        void visit(const parser::PrintStmt& stmt) override;
-        void visit(const parser::VariableDecl& decl) override;
-        void visit(const parser::Block& block) override;
-        void visit(const parser::IfStmt& stmt) override;
-        void visit(const parser::WhileLoop& loop) override;
-        void visit(const parser::ForLoop& loop) override;
-        
-        parser::LoxValue visit(const parser::Unary& unary) override;
-        parser::LoxValue visit(const parser::Binary& binary) override;
-        parser::LoxValue visit(const parser::Ternary& ternary) override;
-        parser::LoxValue visit(const parser::Assign& assign) override;
-        parser::LoxValue visit(const parser::Grouping& grouping) override;
-        parser::LoxValue visit(const parser::Logical& logical) override;
+        /// @brief Runs a statement compiled for the closure backend against this interpreter.
+        ExecStatus execute(const CompiledStmt& stmt);
 
-        parser::LoxValue visit(const parser::Literal& literal) override {
-            return literal.m_value;
+        ExecStatus visit(const parser::ExprStmt& stmt);
+        ExecStatus visit(const parser::PrintStmt& stmt);
+        ExecStatus visit(const parser::VariableDecl& decl);
+        ExecStatus visit(const parser::Block& block);
+        ExecStatus visit(const parser::IfStmt& stmt);
+        ExecStatus visit(const parser::WhileLoop& loop);
+        ExecStatus visit(const parser::ForLoop& loop);
+        ExecStatus visit(const parser::FunctionDecl& decl);
+        ExecStatus visit(const parser::ReturnStmt& stmt);
+        ExecStatus visit(const parser::ClassDecl& decl);
+        ExecStatus visit(const parser::ForInLoop& loop);
+
+        LoxValue visit(const parser::Unary& unary);
+        LoxValue visit(const parser::Binary& binary);
+        LoxValue visit(const parser::Ternary& ternary);
+        LoxValue visit(const parser::Assign& assign);
+        LoxValue visit(const parser::Grouping& grouping);
+        LoxValue visit(const parser::Logical& logical);
+        LoxValue visit(const parser::Variable& identifier);
+        LoxValue visit(const parser::Call& call);
+        LoxValue visit(const parser::Get& get);
+        LoxValue visit(const parser::Set& set);
+        LoxValue visit(const parser::Super& super);
+        LoxValue visit(const parser::ListLiteral& list);
+        LoxValue visit(const parser::Index& index);
+        LoxValue visit(const parser::IndexSet& set);
+
+        LoxValue visit(const parser::Literal& literal) {
+            return m_heap.constant(literal);
+        }
+
+    private:
+        /// @brief Creates a worker for a `parallel for`: see `ParallelFor`. It starts with
+        /// read-only copies of `globals` and of `caches`, if any, and never collects.
+        Interpreter(const Environment& globals, const std::deque<InlineCache>* caches);
+
+        /// @brief Runs a program `interpret` has taken ownership of with the chosen backend.
+        void run(const std::vector<std::unique_ptr<parser::Statement>>& statements);
+
+        /// @brief Runs tasks until there are none left, or one fails. Defined in
+        /// EventLoop.cpp.
+        void run_tasks();
+
+        const CompiledProgram& compile(const std::vector<std::unique_ptr<parser::Statement>>& statements);
+
+        /// @brief Runs a collection if one is due. Only called between statements, where
+        /// every live value is in a variable.
+        /// @return False if the collection left the program over its memory limit. Loops,
+        /// blocks, calls and tasks then fail with `OUT_OF_MEMORY`. Top-level statements have
+        /// no line to fail at, so the program goes on until something it allocates next
+        /// checks the limit.
+        bool safe_point() {
+            if (!m_heap.wants_collection()) [[likely]] return true;
+            m_heap.collect(m_globals, m_scopes);
+            return within_memory_limit();
         }
 
-        parser::LoxValue visit(const parser::Variable& identifier) override {
-            return m_environment->get(identifier.m_name);
+        /// @brief Collects now, for a statement that went over the memory limit once every
+        /// value it made was in a variable, in case garbage is what took it over.
+        /// @return Whether that brought the interpreter back within its limit.
+        [[gnu::cold, gnu::noinline]] bool reclaim_memory();
+
+        /// @brief `reclaim_memory` for an object just made that no variable holds yet,
+        /// which the collection keeps alive.
+        [[gnu::cold, gnu::noinline]] bool reclaim_memory(const LoxValue& made);
+
+        bool failed() const {
+            return m_error.has_value();
+        }
+
+        /// @brief Evaluates `expr` while keeping `held` reachable, for a value that is used
+        /// after `expr` runs and so must survive any collection a call in it triggers.
+        LoxValue evaluate_holding(const LoxValue& held, const parser::Expr& expr) {
+            if (!is_object(held)) return evaluate(expr);
+            return evaluate_rooted(held, expr);
+        }
+
+        LoxValue evaluate_rooted(const LoxValue& held, const parser::Expr& expr);
+
+        [[gnu::cold, gnu::noinline]] ExecStatus execute_profiled(const parser::Statement& stmt);
+        [[gnu::cold, gnu::noinline]] LoxValue evaluate_profiled(const parser::Expr& expr);
+
+        /// @brief A local variable, in the current frame or captured.
+        LoxValue& local(i32 slot, i32 depth) {
+            if (depth == parser::NOT_CAPTURED) return m_scopes[slot];
+            return m_scopes.captured(depth, slot);
+        }
+
+        /// @brief Stores a newly declared variable or function where the `Resolver` put it.
+        ExecStatus define(const scanner::Token& name, i32 slot, i32 depth, LoxValue value);
+
+        /// @brief The inline cache of a property access, made the first time it runs.
+        InlineCache& cache(u32& index) {
+            if (index == parser::NO_CACHE) [[unlikely]] return new_cache(index);
+            return m_caches[index];
+        }
+
+        /// @brief Makes the cache of an access running for the first time. The workers of a
+        /// `parallel for` share the AST, so they get a cache that is not kept instead.
+        [[gnu::cold, gnu::noinline]] InlineCache& new_cache(u32& index);
+
+        /// @brief The slot of global `name`, looked up the first time the access runs.
+        u32 global(const scanner::Token& name, u32& slot) {
+            if (slot == parser::NO_CACHE) [[unlikely]] return find_global(name, slot);
+            return slot;
+        }
+
+        /// @brief Looks up the slot of a global, and caches it unless the AST is shared with
+        /// other threads, whose slots may differ.
+        [[gnu::cold, gnu::noinline]] u32 find_global(const scanner::Token& name, u32& slot);
+
+        /// @brief Runs a `parallel for`. Kept out of `visit` so the usual loop stays small.
+        [[gnu::noinline]] ExecStatus run_parallel(const parser::ForLoop& loop);
+
+        /// @brief Calls a method straight off its receiver, without binding it first.
+        LoxValue invoke(const parser::Get& get, const parser::Call& call);
+        LoxValue invoke(const parser::Super& super, const parser::Call& call);
+
+        /// @brief Pushes the arguments of `call` and calls whatever was pushed at `base`.
+        LoxValue finish_call(LoxValue callee, u64 base, const parser::Call& call);
+
+        LoxValue call_value(const LoxValue& callee, u64 base, u64 count, const scanner::Token& paren);
+        LoxValue call_function(const ObjFunction& function, u64 base, u64 count, const scanner::Token& paren);
+        LoxValue call_native(const ObjNative& native, u64 base, u64 count, const scanner::Token& paren);
+
+        /// @brief Records a runtime error. Returns `nil` so expressions can `return fail(...)`.
+        /// Kept out of line so the error path adds nothing to the size of the hot visitors.
+        [[gnu::cold, gnu::noinline]] LoxValue fail(const scanner::Token& token, const char* message);
+        [[gnu::cold, gnu::noinline]] LoxValue fail(const scanner::Token& token, const std::string& message);
+
+        /// @brief Fails at `line` once the budget has run out, for a loop that has no
+        /// token to report an error at.
+        [[gnu::cold, gnu::noinline]] ExecStatus out_of_budget(int line);
+
+        /// @brief Fails at `line` with `OUT_OF_MEMORY`, for a loop or block that went over
+        /// the memory limit. See `out_of_budget`.
+        [[gnu::cold, gnu::noinline]] ExecStatus out_of_memory(int line);
+
+        /// @brief Reports the error recorded, and drops the tasks that have yet to run.
+        void report_error() {
+            m_scopes.reset();
+            m_return_value = {};
+            m_tasks.cancel();
+            lox::runtime_error(*m_error);
+            m_error.reset();
         }
     };
 }
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <atomic>
+#include "Kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOX_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+using namespace interpreter;
+
+namespace {
+    // The scalar kernels also finish off the elements that don't fill a whole vector.
+
+    void fill_scalar(float* data, u64 length, float value) {
+        std::fill_n(data, length, value);
+    }
+
+    void scale_scalar(float* data, u64 length, float factor) {
+        for (u64 i = 0; i < length; ++i)
+            data[i] *= factor;
+    }
+
+    void add_scalar(float* data, const float* other, u64 length) {
+        for (u64 i = 0; i < length; ++i)
+            data[i] += other[i];
+    }
+
+    void mul_scalar(float* data, const float* other, u64 length) {
+        for (u64 i = 0; i < length; ++i)
+            data[i] *= other[i];
+    }
+
+    double sum_scalar(const float* data, u64 length) {
+        double total = 0;
+        for (u64 i = 0; i < length; ++i)
+            total += data[i];
+        return total;
+    }
+
+    double dot_scalar(const float* left, const float* right, u64 length) {
+        double total = 0;
+        for (u64 i = 0; i < length; ++i)
+            total += static_cast<double>(left[i]) * right[i];
+        return total;
+    }
+
+    /// @return The smaller of `value` and `least`, or `least` if either is NaN, which is
+    /// what `minps` does, so every set of kernels skips NaN the same way.
+    float min_of(float value, float least) {
+        return value < least ? value : least;
+    }
+
+    float max_of(float value, float greatest) {
+        return value > greatest ? value : greatest;
+    }
+
+    float min_scalar(const float* data, u64 length) {
+        auto least = data[0];
+        for (u64 i = 1; i < length; ++i)
+            least = min_of(data[i], least);
+        return least;
+    }
+
+    float max_scalar(const float* data, u64 length) {
+        auto greatest = data[0];
+        for (u64 i = 1; i < length; ++i)
+            greatest = max_of(data[i], greatest);
+        return greatest;
+    }
+
+    constexpr ArrayKernels SCALAR_KERNELS = {
+        "scalar", fill_scalar, scale_scalar, add_scalar, mul_scalar, sum_scalar, dot_scalar, min_scalar, max_scalar,
+    };
+
+#ifdef LOX_X86_KERNELS
+    // SSE2 is part of x86-64, so these need no check. Sums keep four accumulators so the
+    // additions of one vector don't wait on those of the one before.
+
+    void fill_sse2(float* data, u64 length, float value) {
+        auto values = _mm_set1_ps(value);
+        u64 i = 0;
+        for (; i + 4 <= length; i += 4)
+            _mm_storeu_ps(data + i, values);
+        fill_scalar(data + i, length - i, value);
+    }
+
+    void scale_sse2(float* data, u64 length, float factor) {
+        auto factors = _mm_set1_ps(factor);
+        u64 i = 0;
+        for (; i + 4 <= length; i += 4)
+            _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), factors));
+        scale_scalar(data + i, length - i, factor);
+    }
+
+    void add_sse2(float* data, const float* other, u64 length) {
+        u64 i = 0;
+        for (; i + 4 <= length; i += 4)
+            _mm_storeu_ps(data + i, _mm_add_ps(_mm_loadu_ps(data + i), _mm_loadu_ps(other + i)));
+        add_scalar(data + i, other + i, length - i);
+    }
+
+    void mul_sse2(float* data, const float* other, u64 length) {
+        u64 i = 0;
+        for (; i + 4 <= length; i += 4)
+            _mm_storeu_ps(data + i, _mm_mul_ps(_mm_loadu_ps(data + i), _mm_loadu_ps(other + i)));
+        mul_scalar(data + i, other + i, length - i);
+    }
+
+    /// @brief The four floats of a vector, as two vectors of doubles.
+    struct Widened {
+        __m128d m_low;
+        __m128d m_high;
+    };
+
+    inline Widened widen_sse2(__m128 values) {
+        return { _mm_cvtps_pd(values), _mm_cvtps_pd(_mm_movehl_ps(values, values)) };
+    }
+
+    inline double total_sse2(__m128d first, __m128d second) {
+        auto total = _mm_add_pd(first, second);
+        return _mm_cvtsd_f64(_mm_add_sd(total, _mm_unpackhi_pd(total, total)));
+    }
+
+    double sum_sse2(const float* data, u64 length) {
+        __m128d totals[4] = { _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd() };
+        u64 i = 0;
+        for (; i + 8 <= length; i += 8) {
+            auto [first, second] = widen_sse2(_mm_loadu_ps(data + i));
+            auto [third, fourth] = widen_sse2(_mm_loadu_ps(data + i + 4));
+            totals[0] = _mm_add_pd(totals[0], first);
+            totals[1] = _mm_add_pd(totals[1], second);
+            totals[2] = _mm_add_pd(totals[2], third);
+            totals[3] = _mm_add_pd(totals[3], fourth);
+        }
+        auto total = total_sse2(_mm_add_pd(totals[0], totals[1]), _mm_add_pd(totals[2], totals[3]));
+        return total + sum_scalar(data + i, length - i);
+    }
+
+    double dot_sse2(const float* left, const float* right, u64 length) {
+        __m128d totals[2] = { _mm_setzero_pd(), _mm_setzero_pd() };
+        u64 i = 0;
+        for (; i + 4 <= length; i += 4) {
+            auto [left_low, left_high] = widen_sse2(_mm_loadu_ps(left + i));
+            auto [right_low, right_high] = widen_sse2(_mm_loadu_ps(right + i));
+            totals[0] = _mm_add_pd(totals[0], _mm_mul_pd(left_low, right_low));
+            totals[1] = _mm_add_pd(totals[1], _mm_mul_pd(left_high, right_high));
+        }
+        return total_sse2(totals[0], totals[1]) + dot_scalar(left + i, right + i, length - i);
+    }
+
+    float min_sse2(const float* data, u64 length) {
+        auto least = _mm_set1_ps(data[0]);
+        u64 i = 1;
+        for (; i + 4 <= length; i += 4)
+            least = _mm_min_ps(_mm_loadu_ps(data + i), least);
+
+        // Every lane started from the first element, so they are all NaN or none is.
+        float lanes[4];
+        _mm_storeu_ps(lanes, least);
+        auto result = lanes[0];
+        for (auto lane : lanes)
+            result = min_of(lane, result);
+        for (; i < length; ++i)
+            result = min_of(data[i], result);
+        return result;
+    }
+
+    float max_sse2(const float* data, u64 length) {
+        auto greatest = _mm_set1_ps(data[0]);
+        u64 i = 1;
+        for (; i + 4 <= length; i += 4)
+            greatest = _mm_max_ps(_mm_loadu_ps(data + i), greatest);
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, greatest);
+        auto result = lanes[0];
+        for (auto lane : lanes)
+            result = max_of(lane, result);
+        for (; i < length; ++i)
+            result = max_of(data[i], result);
+        return result;
+    }
+
+    constexpr ArrayKernels SSE2_KERNELS = {
+        "sse2", fill_sse2, scale_sse2, add_sse2, mul_sse2, sum_sse2, dot_sse2, min_sse2, max_sse2,
+    };
+
+#define LOX_AVX2 __attribute__((target("avx2")))
+
+    LOX_AVX2 void fill_avx2(float* data, u64 length, float value) {
+        auto values = _mm256_set1_ps(value);
+        u64 i = 0;
+        for (; i + 8 <= length; i += 8)
+            _mm256_storeu_ps(data + i, values);
+        fill_scalar(data + i, length - i, value);
+    }
+
+    LOX_AVX2 void scale_avx2(float* data, u64 length, float factor) {
+        auto factors = _mm256_set1_ps(factor);
+        u64 i = 0;
+        for (; i + 8 <= length; i += 8)
+            _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), factors));
+        scale_scalar(data + i, length - i, factor);
+    }
+
+    LOX_AVX2 void add_avx2(float* data, const float* other, u64 length) {
+        u64 i = 0;
+        for (; i + 8 <= length; i += 8)
+            _mm256_storeu_ps(data + i, _mm256_add_ps(_mm256_loadu_ps(data + i), _mm256_loadu_ps(other + i)));
+        add_scalar(data + i, other + i, length - i);
+    }
+
+    LOX_AVX2 void mul_avx2(float* data, const float* other, u64 length) {
+        u64 i = 0;
+        for (; i + 8 <= length; i += 8)
+            _mm256_storeu_ps(data + i, _mm256_mul_ps(_mm256_loadu_ps(data + i), _mm256_loadu_ps(other + i)));
+        mul_scalar(data + i, other + i, length - i);
+    }
+
+    LOX_AVX2 inline double total_avx2(__m256d totals) {
+        auto halves = _mm_add_pd(_mm256_castpd256_pd128(totals), _mm256_extractf128_pd(totals, 1));
+        return _mm_cvtsd_f64(_mm_add_sd(halves, _mm_unpackhi_pd(halves, halves)));
+    }
+
+    LOX_AVX2 double sum_avx2(const float* data, u64 length) {
+        __m256d totals[4] = { _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd(), _mm256_setzero_pd() };
+        u64 i = 0;
+        for (; i + 16 <= length; i += 16) {
+            totals[0] = _mm256_add_pd(totals[0], _mm256_cvtps_pd(_mm_loadu_ps(data + i)));
+            totals[1] = _mm256_add_pd(totals[1], _mm256_cvtps_pd(_mm_loadu_ps(data + i + 4)));
+            totals[2] = _mm256_add_pd(totals[2], _mm256_cvtps_pd(_mm_loadu_ps(data + i + 8)));
+            totals[3] = _mm256_add_pd(totals[3], _mm256_cvtps_pd(_mm_loadu_ps(data + i + 12)));
+        }
+        auto total = _mm256_add_pd(_mm256_add_pd(totals[0], totals[1]), _mm256_add_pd(totals[2], totals[3]));
+        return total_avx2(total) + sum_scalar(data + i, length - i);
+    }
+
+    LOX_AVX2 double dot_avx2(const float* left, const float* right, u64 length) {
+        __m256d totals[2] = { _mm256_setzero_pd(), _mm256_setzero_pd() };
+        u64 i = 0;
+        for (; i + 8 <= length; i += 8) {
+            auto first = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(left + i)), _mm256_cvtps_pd(_mm_loadu_ps(right + i)));
+            auto second = _mm256_mul_pd(_mm256_cvtps_pd(_mm_loadu_ps(left + i + 4)), _mm256_cvtps_pd(_mm_loadu_ps(right + i + 4)));
+            totals[0] = _mm256_add_pd(totals[0], first);
+            totals[1] = _mm256_add_pd(totals[1], second);
+        }
+        return total_avx2(_mm256_add_pd(totals[0], totals[1])) + dot_scalar(left + i, right + i, length - i);
+    }
+
+    LOX_AVX2 float min_avx2(const float* data, u64 length) {
+        auto least = _mm256_set1_ps(data[0]);
+        u64 i = 1;
+        for (; i + 8 <= length; i += 8)
+            least = _mm256_min_ps(_mm256_loadu_ps(data + i), least);
+
+        float lanes[8];
+        _mm256_storeu_ps(lanes, least);
+        auto result = lanes[0];
+        for (auto lane : lanes)
+            result = min_of(lane, result);
+        for (; i < length; ++i)
+            result = min_of(data[i], result);
+        return result;
+    }
+
+    LOX_AVX2 float max_avx2(const float* data, u64 length) {
+        auto greatest = _mm256_set1_ps(data[0]);
+        u64 i = 1;
+        for (; i + 8 <= length; i += 8)
+            greatest = _mm256_max_ps(_mm256_loadu_ps(data + i), greatest);
+
+        float lanes[8];
+        _mm256_storeu_ps(lanes, greatest);
+        auto result = lanes[0];
+        for (auto lane : lanes)
+            result = max_of(lane, result);
+        for (; i < length; ++i)
+            result = max_of(data[i], result);
+        return result;
+    }
+
+#undef LOX_AVX2
+
+    constexpr ArrayKernels AVX2_KERNELS = {
+        "avx2", fill_avx2, scale_avx2, add_avx2, mul_avx2, sum_avx2, dot_avx2, min_avx2, max_avx2,
+    };
+#endif
+
+    /// @return The kernels called `name`, or `nullptr` if this CPU can't run them.
+    const ArrayKernels* find_kernels(std::string_view name) {
+        if (name == SCALAR_KERNELS.m_name) return &SCALAR_KERNELS;
+#ifdef LOX_X86_KERNELS
+        if (name == SSE2_KERNELS.m_name) return &SSE2_KERNELS;
+        if (name == AVX2_KERNELS.m_name && __builtin_cpu_supports("avx2")) return &AVX2_KERNELS;
+#endif
+        return nullptr;
+    }
+
+    const ArrayKernels* best_kernels() {
+        for (auto name : { "avx2", "sse2" }) {
+            if (auto kernels = find_kernels(name)) return kernels;
+        }
+        return &SCALAR_KERNELS;
+    }
+
+    /// @brief Picked on first use, which may be on several threads of a `parallel for` at
+    /// once; they all pick the same.
+    std::atomic<const ArrayKernels*> selected_ { nullptr };
+}
+
+const ArrayKernels& interpreter::array_kernels() {
+    auto kernels = selected_.load(std::memory_order_relaxed);
+    if (!kernels) [[unlikely]] {
+        kernels = best_kernels();
+        selected_.store(kernels, std::memory_order_relaxed);
+    }
+    return *kernels;
+}
+
+bool interpreter::set_array_kernels(std::string_view name) {
+    auto kernels = find_kernels(name);
+    if (kernels) selected_.store(kernels, std::memory_order_relaxed);
+    return kernels != nullptr;
+}
@@ -0,0 +1,44 @@
+#ifndef LOX_KERNELS_HPP
+#define LOX_KERNELS_HPP
+
+#include <string_view>
+#include "../util_types.hpp"
+
+namespace interpreter {
+    /// @brief The loops behind the natives that work on whole arrays, each built for
+    /// AVX2, for SSE2 and as plain scalar code. The best set the CPU supports is picked
+    /// the first time one is needed.
+    ///
+    /// Elementwise results are the same whichever set runs. Sums and dot products add up
+    /// in double precision, in an order that depends on the vector width, so they can
+    /// differ in the last bits of the `float` they are rounded to.
+    struct ArrayKernels {
+        const char* m_name;
+        void (*m_fill)(float* data, u64 length, float value);
+        void (*m_scale)(float* data, u64 length, float factor);
+
+        /// @brief Adds `other` to `data`, element by element.
+        void (*m_add)(float* data, const float* other, u64 length);
+
+        /// @brief Multiplies `data` by `other`, element by element.
+        void (*m_mul)(float* data, const float* other, u64 length);
+
+        double (*m_sum)(const float* data, u64 length);
+        double (*m_dot)(const float* left, const float* right, u64 length);
+
+        /// @brief The smallest element of a non-empty array. An element that is NaN is
+        /// skipped, unless it is the first.
+        float (*m_min)(const float* data, u64 length);
+
+        /// @brief The largest element of a non-empty array, skipping NaN like `m_min`.
+        float (*m_max)(const float* data, u64 length);
+    };
+
+    const ArrayKernels& array_kernels();
+
+    /// @brief Uses the kernels called `name`, `avx2`, `sse2` or `scalar`, from now on.
+    /// @return Whether there are kernels by that name this CPU can run.
+    bool set_array_kernels(std::string_view name);
+}
+
+#endif
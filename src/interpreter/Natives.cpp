@@ -0,0 +1,362 @@
+#include <chrono>
+#include <cmath>
+#include <optional>
+#include <vector>
+#include "Natives.hpp"
+#include "Collections.hpp"
+#include "Kernels.hpp"
+#include "ParallelFor.hpp"
+#include "Values.hpp"
+
+using namespace interpreter;
+
+namespace {
+    const auto start_time = std::chrono::steady_clock::now();
+
+    /// @brief Past this, not every index of an array could be told apart as a `float`.
+    constexpr float MAX_ARRAY_LENGTH = 16777216.0f;
+
+    /// @brief Seconds since the program started. Measured from the start rather than the
+    /// epoch, so a float stays precise to well under a millisecond for the first hour.
+    LoxValue clock(NativeCall&) {
+        return std::chrono::duration<float>(std::chrono::steady_clock::now() - start_time).count();
+    }
+
+    /// @return How many arguments `value` must be called with, or nothing if it can't be.
+    std::optional<u64> arity_of(const LoxValue& value) {
+        if (auto function = std::get_if<ObjFunction*>(&value))
+            return (*function)->m_declaration->m_function->m_params.size();
+        if (auto bound = std::get_if<ObjBoundMethod*>(&value))
+            return (*bound)->m_method->m_declaration->m_function->m_params.size();
+        if (auto native = std::get_if<ObjNative*>(&value))
+            return (*native)->m_arity;
+        if (auto klass = std::get_if<ObjClass*>(&value)) {
+            auto initializer = (*klass)->m_initializer;
+            return initializer ? initializer->m_declaration->m_function->m_params.size() : 0;
+        }
+        return std::nullopt;
+    }
+
+    /// @return Whether a task calling `callback` with `arity` arguments can start, having
+    /// set the error if not. A task is checked when it starts, as nothing is left of the
+    /// call that started it by the time it runs.
+    bool check_task(NativeCall& call, const LoxValue& callback, u64 arity) {
+        // A worker's heap, and the function with it, is gone before any task could run.
+        if (in_parallel_worker()) {
+            call.m_error = "Can't start a task inside a parallel loop.";
+            return false;
+        }
+        if (arity_of(callback) != arity) {
+            call.m_error = arity == 0 ? "Expected a function that takes no arguments." : "Expected a function that takes one argument.";
+            return false;
+        }
+        return true;
+    }
+
+    /// @brief Calls `callback` as a task of its own, once the code calling `spawn` is done.
+    LoxValue spawn(NativeCall& call) {
+        const auto& callback = call.m_arguments[0];
+        if (check_task(call, callback, 0)) call.m_tasks.spawn(callback);
+        return {};
+    }
+
+    /// @brief Reads a whole file without waiting for it, then calls the function given
+    /// with its contents, or with `nil` if it can't be read.
+    LoxValue readfile(NativeCall& call) {
+        auto path = std::get_if<ObjString*>(&call.m_arguments[0]);
+        if (!path) {
+            call.m_error = "The path must be a string.";
+            return {};
+        }
+        const auto& callback = call.m_arguments[1];
+        if (check_task(call, callback, 1)) call.m_tasks.read_file(std::string((*path)->view()), callback);
+        return {};
+    }
+
+    /// @brief Runs a shell command without waiting for it, then calls the function given
+    /// with everything it printed, or with `nil` if it couldn't start.
+    LoxValue shell(NativeCall& call) {
+        auto command = std::get_if<ObjString*>(&call.m_arguments[0]);
+        if (!command) {
+            call.m_error = "The command must be a string.";
+            return {};
+        }
+        const auto& callback = call.m_arguments[1];
+        if (check_task(call, callback, 1)) call.m_tasks.read_command(std::string((*command)->view()), callback);
+        return {};
+    }
+
+    /// @return The array argument `index`, or `nullptr`, having set the error, if it is not one.
+    ObjArray* array_argument(NativeCall& call, u64 index) {
+        auto array = std::get_if<ObjArray*>(&call.m_arguments[index]);
+        if (!array) {
+            call.m_error = "Expected an array.";
+            return nullptr;
+        }
+        return *array;
+    }
+
+    /// @return The array argument `index`, if this thread may change it, having set the
+    /// error if not. Arrays are shared with the workers of a `parallel for` like the
+    /// fields of objects are, so they only change those they made themselves.
+    ObjArray* mutable_array_argument(NativeCall& call, u64 index) {
+        auto array = array_argument(call, index);
+        if (array && in_parallel_worker() && !array->m_worker) {
+            call.m_error = PARALLEL_ARRAY;
+            return nullptr;
+        }
+        return array;
+    }
+
+    std::optional<float> number_argument(NativeCall& call, u64 index) {
+        auto number = std::get_if<float>(&call.m_arguments[index]);
+        if (!number) {
+            call.m_error = ARRAY_ELEMENT;
+            return std::nullopt;
+        }
+        return *number;
+    }
+
+    /// @return The element of `array` that argument `index` refers to, having set the
+    /// error if there is none.
+    float* element_argument(NativeCall& call, ObjArray& array, u64 index) {
+        auto position = std::get_if<float>(&call.m_arguments[index]);
+        if (!position || std::floor(*position) != *position || *position < 0 || *position >= array.m_length) {
+            call.m_error = ARRAY_INDEX;
+            return nullptr;
+        }
+        return array.m_data + static_cast<u64>(*position);
+    }
+
+    bool check_same_length(NativeCall& call, const ObjArray& left, const ObjArray& right) {
+        if (left.m_length == right.m_length) return true;
+        call.m_error = "The arrays must have the same length.";
+        return false;
+    }
+
+    /// @brief A new array of the given length, filled with zeros.
+    LoxValue array(NativeCall& call) {
+        auto length = std::get_if<float>(&call.m_arguments[0]);
+        if (!length || std::floor(*length) != *length || !(*length >= 0 && *length <= MAX_ARRAY_LENGTH)) {
+            call.m_error = "The length of an array must be a whole number from 0 to 16777216.";
+            return {};
+        }
+        auto array = call.m_heap.array(static_cast<u64>(*length));
+        if (!array) {
+            call.m_error = OUT_OF_MEMORY;
+            return {};
+        }
+        return array;
+    }
+
+    /// @brief How many characters a string, elements an array or list, or keys a map has.
+    LoxValue length(NativeCall& call) {
+        const auto& value = call.m_arguments[0];
+        if (auto string = std::get_if<ObjString*>(&value)) return static_cast<float>((*string)->m_length);
+        if (auto array = std::get_if<ObjArray*>(&value)) return static_cast<float>((*array)->m_length);
+        if (auto list = std::get_if<ObjList*>(&value)) return static_cast<float>((*list)->m_count);
+        if (auto map = std::get_if<ObjMap*>(&value)) return static_cast<float>((*map)->m_count);
+        call.m_error = "Expected a string, an array, a list or a map.";
+        return {};
+    }
+
+    LoxValue get(NativeCall& call) {
+        auto array = array_argument(call, 0);
+        if (!array) return {};
+        auto element = element_argument(call, *array, 1);
+        return element ? LoxValue(*element) : LoxValue();
+    }
+
+    /// @brief Sets an element of an array, and returns the value it was set to.
+    LoxValue set(NativeCall& call) {
+        auto array = mutable_array_argument(call, 0);
+        if (!array) return {};
+        auto element = element_argument(call, *array, 1);
+        auto value = element ? number_argument(call, 2) : std::nullopt;
+        if (!value) return {};
+        *element = *value;
+        return *value;
+    }
+
+    // The natives changing a whole array change it in place, and return it.
+
+    LoxValue fill(NativeCall& call) {
+        auto array = mutable_array_argument(call, 0);
+        auto value = array ? number_argument(call, 1) : std::nullopt;
+        if (!value) return {};
+        array_kernels().m_fill(array->m_data, array->m_length, *value);
+        return array;
+    }
+
+    LoxValue scale(NativeCall& call) {
+        auto array = mutable_array_argument(call, 0);
+        auto factor = array ? number_argument(call, 1) : std::nullopt;
+        if (!factor) return {};
+        array_kernels().m_scale(array->m_data, array->m_length, *factor);
+        return array;
+    }
+
+    LoxValue add(NativeCall& call) {
+        auto array = mutable_array_argument(call, 0);
+        auto other = array ? array_argument(call, 1) : nullptr;
+        if (!other || !check_same_length(call, *array, *other)) return {};
+        array_kernels().m_add(array->m_data, other->m_data, array->m_length);
+        return array;
+    }
+
+    LoxValue mul(NativeCall& call) {
+        auto array = mutable_array_argument(call, 0);
+        auto other = array ? array_argument(call, 1) : nullptr;
+        if (!other || !check_same_length(call, *array, *other)) return {};
+        array_kernels().m_mul(array->m_data, other->m_data, array->m_length);
+        return array;
+    }
+
+    LoxValue sum(NativeCall& call) {
+        auto array = array_argument(call, 0);
+        if (!array) return {};
+        return static_cast<float>(array_kernels().m_sum(array->m_data, array->m_length));
+    }
+
+    LoxValue dot(NativeCall& call) {
+        auto left = array_argument(call, 0);
+        auto right = left ? array_argument(call, 1) : nullptr;
+        if (!right || !check_same_length(call, *left, *right)) return {};
+        return static_cast<float>(array_kernels().m_dot(left->m_data, right->m_data, left->m_length));
+    }
+
+    /// @brief The smallest element of an array, or `nil` if it is empty.
+    LoxValue min(NativeCall& call) {
+        auto array = array_argument(call, 0);
+        if (!array || array->m_length == 0) return {};
+        return array_kernels().m_min(array->m_data, array->m_length);
+    }
+
+    /// @brief The largest element of an array, or `nil` if it is empty.
+    LoxValue max(NativeCall& call) {
+        auto array = array_argument(call, 0);
+        if (!array || array->m_length == 0) return {};
+        return array_kernels().m_max(array->m_data, array->m_length);
+    }
+
+    /// @return The list argument `index`, if this thread may change it, having set the
+    /// error if not. See `mutable_array_argument`.
+    ObjList* mutable_list_argument(NativeCall& call, u64 index) {
+        auto list = std::get_if<ObjList*>(&call.m_arguments[index]);
+        if (!list) {
+            call.m_error = "Expected a list.";
+            return nullptr;
+        }
+        if (in_parallel_worker() && !(*list)->m_worker) {
+            call.m_error = PARALLEL_LIST;
+            return nullptr;
+        }
+        return *list;
+    }
+
+    ObjMap* map_argument(NativeCall& call, u64 index) {
+        auto map = std::get_if<ObjMap*>(&call.m_arguments[index]);
+        if (!map) {
+            call.m_error = "Expected a map.";
+            return nullptr;
+        }
+        return *map;
+    }
+
+    /// @brief A new map with no keys. Maps have no literal, as `{` starts a block.
+    LoxValue map(NativeCall& call) {
+        return call.m_heap.map();
+    }
+
+    /// @brief Adds a value to the end of a list.
+    LoxValue append(NativeCall& call) {
+        auto list = mutable_list_argument(call, 0);
+        if (list && !list_append(call.m_heap, *list, call.m_arguments[1])) call.m_error = OUT_OF_MEMORY;
+        return {};
+    }
+
+    /// @brief Removes the last value of a list, and returns it.
+    LoxValue pop(NativeCall& call) {
+        auto list = mutable_list_argument(call, 0);
+        if (!list) return {};
+        if (list->m_count == 0) {
+            call.m_error = "Can't pop from an empty list.";
+            return {};
+        }
+        return list->m_items[--list->m_count];
+    }
+
+    /// @brief Whether a map has a key.
+    LoxValue has(NativeCall& call) {
+        auto map = map_argument(call, 0);
+        return map ? LoxValue(map_find(*map, call.m_arguments[1]) != nullptr) : LoxValue();
+    }
+
+    /// @brief Removes a key from a map, and returns the value it had, or `nil` if it had none.
+    LoxValue remove(NativeCall& call) {
+        auto map = map_argument(call, 0);
+        if (!map) return {};
+        if (in_parallel_worker() && !map->m_worker) {
+            call.m_error = PARALLEL_MAP;
+            return {};
+        }
+        return map_remove(*map, call.m_arguments[1]).value_or(LoxValue());
+    }
+
+    /// @brief A new list of the keys of a map, in the order they were added.
+    LoxValue keys(NativeCall& call) {
+        auto map = map_argument(call, 0);
+        if (!map) return {};
+
+        auto keys = std::vector<LoxValue>();
+        keys.reserve(map->m_count);
+        for (u32 i = 0; i < map->m_used; ++i) {
+            if (!std::holds_alternative<std::monostate>(map->m_entries[i].m_key)) keys.push_back(map->m_entries[i].m_key);
+        }
+        auto list = call.m_heap.list(keys);
+        if (!list) {
+            call.m_error = OUT_OF_MEMORY;
+            return {};
+        }
+        return list;
+    }
+
+    constexpr NativeDefinition NATIVES[] = {
+        { "clock", 0, clock },
+        { "spawn", 1, spawn },
+        { "readfile", 2, readfile },
+        { "array", 1, array },
+        { "length", 1, length },
+        { "get", 2, get },
+        { "set", 3, set },
+        { "fill", 2, fill },
+        { "scale", 2, scale },
+        { "add", 2, add },
+        { "mul", 2, mul },
+        { "sum", 1, sum },
+        { "dot", 2, dot },
+        { "min", 1, min },
+        { "max", 1, max },
+        { "map", 0, map },
+        { "append", 2, append },
+        { "pop", 1, pop },
+        { "has", 2, has },
+        { "remove", 2, remove },
+        { "keys", 1, keys },
+    };
+
+    constexpr NativeDefinition SHELL = { "shell", 2, shell };
+}
+
+std::span<const NativeDefinition> interpreter::natives() {
+    return NATIVES;
+}
+
+void interpreter::define_natives(Environment& globals, Heap& heap) {
+    for (const auto& native : natives())
+        globals.define(native.m_name, heap.native(native.m_name, native.m_arity, native.m_function));
+}
+
+void interpreter::define_shell(Environment& globals, Heap& heap) {
+    globals.define(SHELL.m_name, heap.native(SHELL.m_name, SHELL.m_arity, SHELL.m_function));
+}
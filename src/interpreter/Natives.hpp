@@ -0,0 +1,40 @@
+#ifndef LOX_NATIVES_HPP
+#define LOX_NATIVES_HPP
+
+#include <span>
+#include "Object.hpp"
+#include "Environment.hpp"
+#include "Heap.hpp"
+#include "EventLoop.hpp"
+
+namespace interpreter {
+    /// @brief What a native function is called with. The arguments are a view of the
+    /// caller's frame, so calling a native copies nothing.
+    struct NativeCall {
+        std::span<const LoxValue> m_arguments;
+        Heap& m_heap;
+
+        /// @brief Where natives that start tasks queue them.
+        EventLoop& m_tasks;
+
+        /// @brief Set by a native that fails, to the message of the runtime error to report.
+        const char* m_error { nullptr };
+    };
+
+    struct NativeDefinition {
+        const char* m_name;
+        u32 m_arity;
+        NativeFn m_function;
+    };
+
+    /// @brief Every native function but `shell`, which each interpreter defines as a global.
+    std::span<const NativeDefinition> natives();
+
+    void define_natives(Environment& globals, Heap& heap);
+
+    /// @brief Defines `shell`, which runs any command it is given, so is left out unless
+    /// whoever runs the script asks for it.
+    void define_shell(Environment& globals, Heap& heap);
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef LOX_OBJECT_HPP
+#define LOX_OBJECT_HPP
+
+#include <string_view>
+#include <variant>
+#include "../util_types.hpp"
+
+namespace parser {
+    struct ClassDecl;
+    struct FunctionDecl;
+}
+
+namespace interpreter {
+    class Shape;
+    struct CompiledStmt;
+    struct NativeCall;
+    struct ObjFunction;
+    struct ObjNative;
+    struct ObjClass;
+    struct ObjInstance;
+    struct ObjBoundMethod;
+    struct ObjArray;
+    struct ObjList;
+    struct ObjMap;
+
+    enum class ObjKind : u8 { String, Environment, Function, Native, Class, Instance, BoundMethod, Array, List, Map };
+
+    /// @brief The header of every object on the garbage-collected `Heap`. Objects are
+    /// allocated with their payload directly after the header and are never moved.
+    struct Obj {
+        Obj* m_next;
+        ObjKind m_kind;
+        bool m_marked { false };
+    };
+
+    /// @brief An immutable string. Its characters follow the object, with a terminating `'\0'`.
+    struct ObjString : Obj {
+        /// @brief The hash of the characters, worked out once when the string is made so
+        /// that maps never hash a key twice. See `hash_chars`.
+        u32 m_hash;
+
+        u64 m_length;
+
+        const char* chars() const {
+            return reinterpret_cast<const char*>(this + 1);
+        }
+
+        std::string_view view() const {
+            return std::string_view(chars(), m_length);
+        }
+    };
+
+    /// @brief A value at runtime. Strings live on the heap, so copying a value never
+    /// allocates and never needs a destructor.
+    ///
+    /// The copy constructor is spelled out, rather than left trivial, so values are returned
+    /// through memory. As a trivial 16-byte type, GCC builds each returned value on the stack
+    /// one member at a time and then reloads it whole, which stalls store forwarding in every
+    /// visitor and made the tree walker twice as slow.
+    struct LoxValue : std::variant<std::monostate, float, bool, ObjString*, ObjFunction*, ObjNative*,
+                                   ObjClass*, ObjInstance*, ObjBoundMethod*, ObjArray*, ObjList*, ObjMap*> {
+        using variant::variant;
+
+        LoxValue() = default;
+        LoxValue(const LoxValue& other) : variant(static_cast<const variant&>(other)) {}
+        LoxValue& operator=(const LoxValue& other) = default;
+    };
+
+    /// @brief Whether a value refers to an object on the heap.
+    inline bool is_object(const LoxValue& value) {
+        return !std::holds_alternative<std::monostate>(value) && !std::holds_alternative<float>(value)
+            && !std::holds_alternative<bool>(value);
+    }
+
+    /// @brief Variables that outlive the block declaring them, e.g. once a closure captures
+    /// them. The values follow the object, and `m_enclosing` links to the next scope out.
+    struct ObjEnvironment : Obj {
+        ObjEnvironment* m_enclosing;
+        u32 m_count;
+
+        /// @brief Whether a worker of a `parallel for` made it, and so may assign to it.
+        bool m_worker;
+
+        LoxValue* values() {
+            return reinterpret_cast<LoxValue*>(this + 1);
+        }
+
+        const LoxValue* values() const {
+            return reinterpret_cast<const LoxValue*>(this + 1);
+        }
+    };
+
+    /// @brief A function declared by a program, together with the environment it was
+    /// declared in. The declaration belongs to an AST the interpreter keeps alive.
+    struct ObjFunction : Obj {
+        const parser::FunctionDecl* m_declaration;
+
+        /// @brief The compiled declaration when running on the closure backend, else `nullptr`.
+        const CompiledStmt* m_compiled;
+
+        ObjEnvironment* m_closure;
+    };
+
+    /// @brief Implements a native function. The arguments are in `call`; a native that
+    /// fails sets `call.m_error` and its result is ignored.
+    using NativeFn = LoxValue (*)(NativeCall& call);
+
+    struct ObjNative : Obj {
+        NativeFn m_function;
+        u32 m_arity;
+        const char* m_name;
+    };
+
+    /// @brief A class. Its methods follow the object, in declaration order; inherited
+    /// ones are found through `m_superclass`.
+    struct ObjClass : Obj {
+        const parser::ClassDecl* m_declaration;
+        ObjClass* m_superclass;
+
+        /// @brief The shape every new instance starts with.
+        const Shape* m_shape;
+
+        /// @brief The `init` method, declared or inherited, or `nullptr`.
+        ObjFunction* m_initializer;
+
+        /// @brief The most fields any instance has had, which new instances reserve room
+        /// for up front.
+        u32 m_field_capacity;
+
+        u32 m_method_count;
+
+        ObjFunction** methods() {
+            return reinterpret_cast<ObjFunction**>(this + 1);
+        }
+
+        ObjFunction* const* methods() const {
+            return reinterpret_cast<ObjFunction* const*>(this + 1);
+        }
+
+        /// @return The method called `name`, declared or inherited, or `nullptr`.
+        ObjFunction* find_method(std::string_view name) const;
+    };
+
+    /// @brief An instance of a class. Its fields are stored in the order `m_shape` gives
+    /// them, in an array that grows as fields are added.
+    struct ObjInstance : Obj {
+        ObjClass* m_class;
+        const Shape* m_shape;
+        LoxValue* m_fields;
+        u32 m_capacity;
+    };
+
+    /// @brief A method read off an instance, which remembers the instance to call it on.
+    struct ObjBoundMethod : Obj {
+        ObjInstance* m_receiver;
+        ObjFunction* m_method;
+    };
+
+    /// @brief A fixed-length array of numbers, stored unboxed in one block aligned to
+    /// `ALIGNMENT`, so the natives working on whole arrays can run vector kernels over it.
+    struct ObjArray : Obj {
+        static constexpr u64 ALIGNMENT = 64;
+
+        /// @brief Whether a worker of a `parallel for` made it, and so may change it.
+        bool m_worker;
+
+        u64 m_length;
+        float* m_data;
+    };
+
+    /// @brief A list of values, stored contiguously in an array that doubles in size
+    /// whenever it is full, so appending takes amortized constant time.
+    struct ObjList : Obj {
+        /// @brief Whether a worker of a `parallel for` made it, and so may change it.
+        bool m_worker;
+
+        u64 m_count;
+        u64 m_capacity;
+        LoxValue* m_items;
+    };
+
+    /// @brief A key of a map and its value. The key of one that was removed is `nil`.
+    struct MapEntry {
+        LoxValue m_key;
+        LoxValue m_value;
+    };
+
+    /// @brief A hash map from any value but `nil` and NaN to any value, which keeps its
+    /// keys in the order they were added.
+    ///
+    /// The entries are stored in that order, in an array. The table finding them is a
+    /// separate open-addressing table of twice as many 64-bit slots, probed linearly: each
+    /// slot holds the hash of a key in its upper half and the index of its entry in the
+    /// lower half, so a probe only reads an entry whose hash matched. Both live in one
+    /// block: `m_capacity` entries, then `2 * m_capacity` slots.
+    ///
+    /// Removing a key leaves a hole in the entries and a tombstone in its slot, until the
+    /// map next grows and squeezes them out. It does not while a `for in` loop is running
+    /// over it, so the loop's position stays put.
+    struct ObjMap : Obj {
+        static constexpr u64 EMPTY_SLOT = ~u64(0);
+        static constexpr u64 REMOVED_SLOT = ~u64(1);
+
+        /// @brief Whether a worker of a `parallel for` made it, and so may change it.
+        bool m_worker;
+
+        /// @brief How many `for in` loops are running over it.
+        u32 m_iterating;
+
+        /// @brief How many keys it has.
+        u32 m_count;
+
+        /// @brief How many entries have been used, counting those since removed.
+        u32 m_used;
+
+        /// @brief How many entries there is room for. Zero or a power of two.
+        u32 m_capacity;
+
+        MapEntry* m_entries;
+
+        u64* slots() const {
+            return reinterpret_cast<u64*>(m_entries + m_capacity);
+        }
+    };
+}
+
+#endif
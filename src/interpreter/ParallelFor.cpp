@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include "ParallelFor.hpp"
+#include "Interpreter.hpp"
+#include "Values.hpp"
+#include "../trace.hpp"
+
+using namespace interpreter;
+using parser::GLOBAL_SLOT;
+using parser::NOT_CAPTURED;
+using scanner::TokenType;
+
+namespace {
+    std::atomic<u32> threads_ { 0 };
+
+    /// @brief Threads kept waiting between loops, so a loop inside a hot function does
+    /// not pay for starting threads each time it runs. One loop uses them at a time; a
+    /// loop that finds them busy runs on its own thread.
+    class WorkerPool {
+    private:
+        std::mutex m_mutex;
+        std::condition_variable_any m_wake;
+        std::condition_variable m_finished;
+        const std::function<void(u32)>* m_job { nullptr };
+
+        /// @brief Counts the jobs started, so a thread takes part in each one at most once.
+        u64 m_generation { 0 };
+
+        /// @brief The indices of the current job not yet taken run from `m_next` up to `m_last`.
+        u32 m_next { 0 };
+        u32 m_last { 0 };
+
+        /// @brief How many of the indices taken are still running.
+        u32 m_running { 0 };
+
+        /// @brief Held by the loop using the pool.
+        std::mutex m_busy;
+
+        // Declared last, so the threads are stopped and joined before anything they use goes.
+        std::vector<std::jthread> m_threads;
+
+    public:
+        static WorkerPool& shared() {
+            static auto pool = WorkerPool();
+            return pool;
+        }
+
+        /// @brief Runs `job(0)` to `job(count - 1)` at the same time, the first on the
+        /// calling thread, and returns once they have all finished. If the pool is busy,
+        /// only `job(0)` runs.
+        void run(u32 count, const std::function<void(u32)>& job) {
+            if (count <= 1 || !m_busy.try_lock()) {
+                job(0);
+                return;
+            }
+            auto busy = std::lock_guard(m_busy, std::adopt_lock);
+
+            {
+                auto lock = std::lock_guard(m_mutex);
+                while (m_threads.size() < count - 1)
+                    m_threads.emplace_back([this](std::stop_token stop) { serve(stop); });
+                m_job = &job;
+                m_next = 1;
+                m_last = count - 1;
+                m_running = count - 1;
+                ++m_generation;
+            }
+            m_wake.notify_all();
+
+            job(0);
+
+            auto lock = std::unique_lock(m_mutex);
+            m_finished.wait(lock, [this] { return m_running == 0; });
+            m_job = nullptr;
+        }
+
+    private:
+        WorkerPool() = default;
+
+        void serve(std::stop_token stop) {
+            u64 seen = 0;
+            auto lock = std::unique_lock(m_mutex);
+            while (m_wake.wait(lock, stop, [&] { return m_generation != seen && m_next <= m_last; })) {
+                seen = m_generation;
+                auto index = m_next++;
+                auto job = m_job;
+
+                lock.unlock();
+                (*job)(index);
+                lock.lock();
+
+                if (--m_running == 0) m_finished.notify_one();
+            }
+        }
+    };
+
+    /// @return What a reduction with `operation` starts from, and what it combines with.
+    float identity(TokenType operation) {
+        return operation == TokenType::Star ? 1.0f : 0.0f;
+    }
+
+    float combine(TokenType operation, float left, float right) {
+        return operation == TokenType::Star ? left * right : left + right;
+    }
+}
+
+namespace interpreter {
+    /// @brief The blocks each thread of a loop has left to run, as a range of block
+    /// indices. A thread takes blocks from the front of its own range; one whose range is
+    /// empty steals the back half of the first other range that is not. Each range has
+    /// its own lock, on its own cache line, and no thread ever holds two locks.
+    class WorkQueues {
+    private:
+        struct alignas(64) Range {
+            std::mutex m_mutex;
+            u64 m_begin { 0 };
+            u64 m_end { 0 };
+        };
+
+        std::unique_ptr<Range[]> m_ranges;
+        u32 m_count;
+
+    public:
+        WorkQueues(u32 threads, u64 blocks) : m_ranges(new Range[threads]), m_count(threads) {
+            for (u32 i = 0; i < threads; ++i) {
+                m_ranges[i].m_begin = blocks * i / threads;
+                m_ranges[i].m_end = blocks * (i + 1) / threads;
+            }
+        }
+
+        /// @return The next block for thread `thread` to run, or nothing once every block
+        /// has been taken.
+        std::optional<u64> take(u32 thread) {
+            auto& own = m_ranges[thread];
+            {
+                auto lock = std::lock_guard(own.m_mutex);
+                if (own.m_begin < own.m_end) return own.m_begin++;
+            }
+
+            for (u32 offset = 1; offset < m_count; ++offset) {
+                auto& victim = m_ranges[(thread + offset) % m_count];
+                u64 begin, end;
+                {
+                    auto lock = std::lock_guard(victim.m_mutex);
+                    if (victim.m_begin == victim.m_end) continue;
+                    end = victim.m_end;
+                    begin = end - (end - victim.m_begin + 1) / 2;
+                    victim.m_end = begin;
+                }
+
+                auto lock = std::lock_guard(own.m_mutex);
+                own.m_begin = begin + 1;
+                own.m_end = end;
+                return begin;
+            }
+            return std::nullopt;
+        }
+    };
+}
+
+void interpreter::set_parallel_threads(u32 count) {
+    threads_ = count;
+}
+
+u32 interpreter::parallel_threads() {
+    if (auto count = threads_.load()) return count;
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ParallelFor::ParallelFor(const parser::Parallel& loop, Parent parent, Body body)
+    : m_loop(loop), m_parent(parent), m_body(std::move(body)) {}
+
+ParallelFor::~ParallelFor() = default;
+
+ExecStatus ParallelFor::fail(const scanner::Token& token, const char* message) {
+    m_parent.m_error.emplace(token, message);
+    return ExecStatus::Error;
+}
+
+ExecStatus ParallelFor::run(const LoxValue& start, const LoxValue& limit, const LoxValue& step) {
+    auto span = lox::trace::Span("parallel for");
+    auto start_number = std::get_if<float>(&start);
+    auto limit_number = std::get_if<float>(&limit);
+    auto step_number = std::get_if<float>(&step);
+    if (!start_number || !limit_number || !step_number)
+        return fail(m_loop.m_keyword, "The start, limit and step of a parallel loop must be numbers.");
+    if (!(*step_number > 0))
+        return fail(m_loop.m_keyword, "The step of a parallel loop must be greater than 0.");
+
+    m_start = *start_number;
+    m_step = *step_number;
+    auto steps = (static_cast<double>(*limit_number) - m_start) / m_step;
+    auto count = !(steps >= 0) ? 0.0 : m_loop.m_inclusive ? std::floor(steps) + 1 : std::ceil(steps);
+    if (count > MAX_ITERATIONS)
+        return fail(m_loop.m_keyword, "Too many iterations for a parallel loop.");
+    m_count = static_cast<u64>(count);
+    if (m_count == 0) return ExecStatus::Normal;
+
+    m_block_size = (m_count + MAX_BLOCKS - 1) / MAX_BLOCKS;
+    m_blocks.resize((m_count + m_block_size - 1) / m_block_size);
+    m_failed = m_blocks.size();
+
+    // A loop reached by a worker already has the pool's threads, so it runs on its own.
+    auto threads = in_parallel_worker() ? 1 : static_cast<u32>(std::min<u64>(parallel_threads(), m_blocks.size()));
+    m_queues = std::make_unique<WorkQueues>(threads, m_blocks.size());
+    m_memory = lox::MemoryAccount::current();
+    WorkerPool::shared().run(threads, [this](u32 index) { work(index); });
+    return finish();
+}
+
+void ParallelFor::work(u32 index) {
+    auto was_worker = std::exchange(in_parallel_worker_, true);
+    auto span = lox::trace::Span("parallel worker");
+    // Declared before the worker, so it outlives everything charged to it.
+    auto memory = lox::MemoryAccount(m_memory);
+    auto memory_scope = lox::MemoryAccount::Scope(memory);
+    auto output = std::ostringstream();
+    auto worker = Interpreter(m_parent.m_globals, m_parent.m_caches);
+    worker.set_output(output);
+    worker.m_fuel.draw_from(m_parent.m_budget);
+
+    while (auto block = m_queues->take(index)) {
+        // Blocks after one that failed would not have run had the loop been sequential.
+        if (*block > m_failed.load(std::memory_order_relaxed)) continue;
+        run_block(worker, output, *block);
+    }
+    in_parallel_worker_ = was_worker;
+}
+
+void ParallelFor::enter(Interpreter& worker) const {
+    auto& scopes = worker.m_scopes;
+    scopes.reset();
+    for (const auto& value : m_parent.m_scopes.frame())
+        scopes.push_value(value);
+    scopes.environment() = m_parent.m_scopes.environment();
+    scopes.push(m_loop.m_slot_count);
+    worker.m_return_value = {};
+}
+
+void ParallelFor::run_block(Interpreter& worker, std::ostringstream& output, u64 index) {
+    auto& block = m_blocks[index];
+    auto& scopes = worker.m_scopes;
+    enter(worker);
+    for (const auto& reduction : m_loop.m_reductions)
+        scopes[reduction.m_partial] = identity(reduction.m_operator);
+
+    auto first = index * m_block_size;
+    auto last = std::min(first + m_block_size, m_count);
+    for (auto iteration = first; iteration < last; ++iteration) {
+        // Each iteration has a variable of its own, as closures that capture it can tell.
+        if (m_loop.m_captured_count > 0)
+            scopes.environment() = worker.m_heap.environment(m_parent.m_scopes.environment(), m_loop.m_captured_count);
+        worker.local(m_loop.m_slot, m_loop.m_depth) = static_cast<float>(m_start + static_cast<double>(iteration) * m_step);
+
+        auto status = worker.m_fuel.step() ? m_body(worker) : worker.out_of_budget(m_loop.m_keyword.line());
+        if (status == ExecStatus::Error) [[unlikely]] {
+            block.m_error = std::move(worker.m_error);
+            worker.m_error.reset();
+            auto failed = m_failed.load();
+            while (index < failed && !m_failed.compare_exchange_weak(failed, index)) {}
+            break;
+        }
+    }
+
+    if (!block.m_error) {
+        for (const auto& reduction : m_loop.m_reductions)
+            block.m_partials.push_back(std::get<float>(scopes[reduction.m_partial]));
+    }
+    block.m_output = output.str();
+    output.str({});
+    worker.m_heap.free_all();
+}
+
+ExecStatus ParallelFor::finish() {
+    auto failed = m_failed.load();
+    for (u64 i = 0; i < m_blocks.size() && i <= failed; ++i)
+        m_parent.m_output << m_blocks[i].m_output;
+    if (failed < m_blocks.size()) {
+        m_parent.m_error = std::move(m_blocks[failed].m_error);
+        return ExecStatus::Error;
+    }
+
+    auto& scopes = m_parent.m_scopes;
+    for (u64 i = 0; i < m_loop.m_reductions.size(); ++i) {
+        const auto& reduction = m_loop.m_reductions[i];
+        auto operation = reduction.m_operator;
+        auto total = identity(operation);
+        for (const auto& block : m_blocks)
+            total = combine(operation, total, block.m_partials[i]);
+
+        if (reduction.m_slot == GLOBAL_SLOT) {
+            auto& globals = m_parent.m_globals;
+            auto slot = globals.slot(reduction.m_name.lexeme());
+            auto value = globals.get(slot);
+            if (!value) return fail(reduction.m_name, UNDEFINED_VARIABLE);
+            auto number = std::get_if<float>(value);
+            if (!number) return fail(reduction.m_name, NUMBER_OPERANDS);
+            if (!globals.assign(slot, combine(operation, *number, total)))
+                return fail(reduction.m_name, PARALLEL_ASSIGNMENT);
+            continue;
+        }
+
+        LoxValue* variable;
+        if (reduction.m_depth == NOT_CAPTURED) {
+            variable = &scopes[reduction.m_slot];
+        } else {
+            auto environment = scopes.enclosing(reduction.m_depth);
+            if (in_parallel_worker() && !environment->m_worker)
+                return fail(reduction.m_name, PARALLEL_ASSIGNMENT);
+            variable = &environment->values()[reduction.m_slot];
+        }
+        auto number = std::get_if<float>(variable);
+        if (!number) return fail(reduction.m_name, NUMBER_OPERANDS);
+        *variable = combine(operation, *number, total);
+    }
+    return ExecStatus::Normal;
+}
@@ -0,0 +1,137 @@
+#ifndef LOX_PARALLEL_FOR_HPP
+#define LOX_PARALLEL_FOR_HPP
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../lox.hpp"
+#include "../parser/statements.hpp"
+#include "Budget.hpp"
+#include "Environment.hpp"
+#include "ExecStatus.hpp"
+#include "InlineCache.hpp"
+#include "Object.hpp"
+#include "ScopeStack.hpp"
+
+namespace interpreter {
+    class Interpreter;
+    class WorkQueues;
+
+    /// @brief Set while this thread runs iterations of a `parallel for`.
+    inline thread_local bool in_parallel_worker_ = false;
+
+    /// @brief Whether this thread is running iterations of a `parallel for`, and so must
+    /// not change anything the other iterations can see: the globals, the variables
+    /// declared outside the loop, the fields of objects and the shared inline caches.
+    inline bool in_parallel_worker() {
+        return in_parallel_worker_;
+    }
+
+    /// @brief Sets how many threads, the calling one included, run each `parallel for`.
+    /// 0, the default, uses one per hardware thread.
+    void set_parallel_threads(u32 count);
+
+    u32 parallel_threads();
+
+    /// @brief Runs the iterations of one `parallel for` across the threads of a shared
+    /// pool, then carries out what they did as if the loop had run sequentially.
+    ///
+    /// The iterations are split into at most `MAX_BLOCKS` blocks of consecutive ones,
+    /// whose size depends only on the number of iterations. Each thread starts with an
+    /// even share of the blocks, runs them in order and, once out of its own, steals the
+    /// later half of another thread's. So that the result does not depend on which thread
+    /// ran what, each block keeps its own output and partial results, and those are
+    /// combined in block order once every block is done.
+    ///
+    /// Each thread runs its blocks in a worker `Interpreter` of its own, with a read-only
+    /// copy of the globals and the values of the frame the loop is in, and a heap that
+    /// never collects and is emptied after every block. Nothing a worker allocates can
+    /// outlive its block: the only values that leave it are numbers, text and errors.
+    /// Each worker charges what it allocates to a child of the account that was current
+    /// when the loop started, so the workers share the interpreter's memory limit.
+    ///
+    /// If an iteration fails, blocks after its own are skipped, the output of those
+    /// before it is written, and its error becomes the loop's.
+    class ParallelFor {
+    public:
+        /// @brief The interpreter that reached the loop.
+        struct Parent {
+            Environment& m_globals;
+            ScopeStack& m_scopes;
+
+            /// @brief The tree walker's inline caches, or `nullptr` on the closure backend.
+            const std::deque<InlineCache>* m_caches;
+
+            std::ostream& m_output;
+            std::optional<lox::RuntimeError>& m_error;
+
+            /// @brief The budget the workers take their steps from.
+            Budget& m_budget;
+        };
+
+        /// @brief Runs the loop's body once in `worker`, whose loop variable is set.
+        using Body = std::function<ExecStatus(Interpreter& worker)>;
+
+        static constexpr u64 MAX_BLOCKS = 1024;
+        static constexpr u64 MAX_ITERATIONS = 0xFFFF'FFFF;
+
+    private:
+        struct Block {
+            std::string m_output;
+
+            /// @brief The partial result of each of the loop's reductions over the block.
+            std::vector<float> m_partials;
+
+            std::optional<lox::RuntimeError> m_error;
+        };
+
+        const parser::Parallel& m_loop;
+        Parent m_parent;
+        Body m_body;
+
+        double m_start { 0 };
+        double m_step { 0 };
+        u64 m_count { 0 };
+        u64 m_block_size { 0 };
+        std::vector<Block> m_blocks;
+
+        /// @brief The first block that failed, or the number of blocks if none has.
+        std::atomic<u64> m_failed { 0 };
+
+        std::unique_ptr<WorkQueues> m_queues;
+
+        /// @brief The account the workers' accounts draw from.
+        lox::MemoryAccount* m_memory { nullptr };
+
+    public:
+        ParallelFor(const parser::Parallel& loop, Parent parent, Body body);
+        ~ParallelFor();
+
+        /// @brief Runs the iterations from `start` up to `limit` in steps of `step`. The
+        /// loop variable of iteration `k` is `start + k * step`.
+        ExecStatus run(const LoxValue& start, const LoxValue& limit, const LoxValue& step);
+
+    private:
+        /// @brief Runs blocks on the calling thread until there are none left to take.
+        void work(u32 index);
+
+        /// @brief Sets up `worker` to run a block, as if it had just entered the loop.
+        void enter(Interpreter& worker) const;
+
+        void run_block(Interpreter& worker, std::ostringstream& output, u64 index);
+
+        /// @brief Writes the blocks' output and applies their reductions, on the thread that
+        /// reached the loop.
+        ExecStatus finish();
+
+        [[gnu::cold, gnu::noinline]] ExecStatus fail(const scanner::Token& token, const char* message);
+    };
+}
+
+#endif
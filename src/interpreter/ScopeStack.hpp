@@ -0,0 +1,172 @@
+#ifndef LOX_SCOPE_STACK_HPP
+#define LOX_SCOPE_STACK_HPP
+
+#include <algorithm>
+#include <span>
+#include <vector>
+#include "../memory.hpp"
+#include "Object.hpp"
+#include "../util_types.hpp"
+
+namespace interpreter {
+    /// @brief Contiguous storage for the variables of every block and call currently being
+    /// executed. A block's locals occupy the slots the `Resolver` gave them, so entering a
+    /// block only moves the top of the stack up and leaving it moves the top back down. The
+    /// storage is kept between blocks, so it only allocates when nesting goes deeper than
+    /// ever before.
+    ///
+    /// Slots are numbered from the base of the current call's frame. A call pushes the
+    /// callee and its arguments onto the top of the stack and starts a frame there, so the
+    /// arguments are already in the slots of the parameters.
+    ///
+    /// Variables that a function captures live in `ObjEnvironment`s instead; the
+    /// innermost one of the code being executed is `environment()`.
+    class ScopeStack {
+    public:
+        /// @brief Calls nested deeper than this fail instead of overflowing the C++ stack.
+        static constexpr u32 MAX_FRAMES = 512;
+
+        /// @brief What a call saved of its caller, to restore once it returns.
+        struct Frame {
+            u64 m_base;
+            ObjEnvironment* m_environment;
+        };
+
+    private:
+        std::vector<LoxValue, lox::AccountingAllocator<LoxValue>> m_slots;
+        u64 m_top { 0 };
+        u64 m_base { 0 };
+
+        /// @brief `m_slots.data() + m_base`, kept so that reading a local costs one load.
+        LoxValue* m_frame { nullptr };
+
+        ObjEnvironment* m_environment { nullptr };
+        std::vector<Frame, lox::AccountingAllocator<Frame>> m_frames;
+
+    public:
+        ScopeStack() {
+            m_slots.resize(64);
+            m_frame = m_slots.data();
+        }
+
+        /// @brief Makes room for `slot_count` more variables, all `nil`. Clearing them keeps
+        /// the collector from seeing values left behind by an earlier block.
+        void push(u32 slot_count) {
+            auto first = m_top;
+            m_top += slot_count;
+            if (m_top > m_slots.size())
+                grow(m_top * 2);
+            std::fill(m_slots.begin() + first, m_slots.begin() + m_top, LoxValue {});
+        }
+
+        void pop(u32 slot_count) {
+            m_top -= slot_count;
+        }
+
+        /// @brief Pushes a callee or argument of a call about to be made, or a temporary the
+        /// collector must see. `value` is taken by copy, since it may be one of the slots,
+        /// which growing the stack moves.
+        void push_value(LoxValue value) {
+            if (m_top == m_slots.size())
+                grow(m_top * 2);
+            m_slots[m_top++] = value;
+        }
+
+        /// @brief Drops everything above `top`, e.g. the arguments of a native call.
+        void truncate(u64 top) {
+            m_top = top;
+        }
+
+        u64 top() const {
+            return m_top;
+        }
+
+        /// @brief Starts the frame of a call whose callee was pushed at `base`.
+        /// @return False if too many calls are already running.
+        bool enter(u64 base, ObjEnvironment* closure) {
+            if (m_frames.size() == MAX_FRAMES) return false;
+            m_frames.push_back(Frame { m_base, m_environment });
+            m_base = base;
+            m_frame = m_slots.data() + base;
+            m_environment = closure;
+            return true;
+        }
+
+        /// @brief Ends the current call, dropping its callee, arguments and locals.
+        void leave() {
+            auto frame = m_frames.back();
+            m_frames.pop_back();
+            m_top = m_base;
+            m_base = frame.m_base;
+            m_frame = m_slots.data() + m_base;
+            m_environment = frame.m_environment;
+        }
+
+        /// @brief Discards every scope, e.g. after a runtime error aborted a program midway.
+        void reset() {
+            m_top = 0;
+            m_base = 0;
+            m_frame = m_slots.data();
+            m_environment = nullptr;
+            m_frames.clear();
+        }
+
+        LoxValue& operator[](i32 slot) {
+            return m_frame[slot];
+        }
+
+        /// @brief The value at absolute position `position`, e.g. the callee of a call about to be made.
+        LoxValue& at(u64 position) {
+            return m_slots[position];
+        }
+
+        /// @brief The values starting at absolute position `first`, e.g. a native's arguments.
+        std::span<const LoxValue> values(u64 first, u64 count) const {
+            return std::span<const LoxValue>(m_slots.data() + first, count);
+        }
+
+        /// @brief The environment `depth` out from the innermost one.
+        ObjEnvironment* enclosing(i32 depth) const {
+            auto environment = m_environment;
+            for (; depth > 0; --depth)
+                environment = environment->m_enclosing;
+            return environment;
+        }
+
+        /// @brief A captured variable, `depth` environments out from the innermost one.
+        LoxValue& captured(i32 depth, i32 index) {
+            return enclosing(depth)->values()[index];
+        }
+
+        ObjEnvironment*& environment() {
+            return m_environment;
+        }
+
+        ObjEnvironment* environment() const {
+            return m_environment;
+        }
+
+        /// @brief The slots of the current call, from its callee up.
+        std::span<const LoxValue> frame() const {
+            return std::span<const LoxValue>(m_slots.data() + m_base, m_top - m_base);
+        }
+
+        /// @brief The slots of the blocks and calls currently being executed.
+        std::span<const LoxValue> live() const {
+            return std::span<const LoxValue>(m_slots.data(), m_top);
+        }
+
+        /// @brief What each running call saved of its caller, outermost first.
+        std::span<const Frame> frames() const {
+            return m_frames;
+        }
+
+    private:
+        void grow(u64 size) {
+            m_slots.resize(size);
+            m_frame = m_slots.data() + m_base;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef LOX_SHAPE_HPP
+#define LOX_SHAPE_HPP
+
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "../memory.hpp"
+#include "../util_types.hpp"
+
+namespace interpreter {
+    /// @brief The layout of an instance: which fields it has and at which index each one is
+    /// stored. Instances of the same class that gained the same fields in the same order
+    /// share one shape, so a property access can check the shape once and then index
+    /// straight into the fields.
+    ///
+    /// Each class starts its instances at a root shape of its own, so a shape also
+    /// identifies the class, and with it the methods, of every instance that has it.
+    /// Adding a field moves an instance to the child shape for that field, which is
+    /// created the first time any instance takes that transition.
+    ///
+    /// Shapes are owned by the `Heap` and never freed before it, so an inline cache can
+    /// compare against one without keeping it alive.
+    class Shape {
+    private:
+        const Shape* m_parent;
+
+        /// @brief The field this shape adds to its parent. The name belongs to the AST.
+        std::string_view m_name;
+
+        u32 m_field_count;
+        mutable std::vector<std::pair<std::string_view, Shape*>, lox::AccountingAllocator<std::pair<std::string_view, Shape*>>> m_transitions;
+
+    public:
+        static constexpr u32 NOT_FOUND = ~u32 { 0 };
+
+        /// @brief A root shape, with no fields.
+        Shape() : m_parent(nullptr), m_field_count(0) {}
+
+        Shape(const Shape& parent, std::string_view name)
+            : m_parent(&parent), m_name(name), m_field_count(parent.m_field_count + 1) {}
+
+        u32 field_count() const {
+            return m_field_count;
+        }
+
+        /// @return The index of field `name`, or `NOT_FOUND`.
+        u32 find(std::string_view name) const {
+            for (auto shape = this; shape->m_parent; shape = shape->m_parent) {
+                if (shape->m_name == name) return shape->m_field_count - 1;
+            }
+            return NOT_FOUND;
+        }
+
+        /// @return The shape this one becomes by adding field `name`, or `nullptr` if no
+        /// instance has done that yet.
+        Shape* transition(std::string_view name) const {
+            for (const auto& [field, shape] : m_transitions) {
+                if (field == name) return shape;
+            }
+            return nullptr;
+        }
+
+        void add_transition(std::string_view name, Shape* shape) const {
+            m_transitions.emplace_back(name, shape);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Collections.hpp"
+#include "Snapshot.hpp"
+
+using namespace interpreter;
+
+namespace {
+    constexpr char MAGIC[8] = "LOXSNAP";
+    constexpr u32 VERSION = 2;
+
+    /// @brief `Object` refers back to an array, list or map already in the snapshot, by the
+    /// order in which they were first written, so shared and cyclic ones stay that way.
+    enum class ValueTag : u8 { Nil, Number, Bool, String, Array, List, Map, Object };
+
+    template<typename T>
+    void write(std::ofstream& output, const T& value) {
+        output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void write_string(std::ofstream& output, std::string_view text) {
+        write(output, static_cast<u32>(text.size()));
+        output.write(text.data(), text.size());
+    }
+
+    /// @brief Writes values, giving each array, list and map a number the first time it
+    /// is written.
+    class Writer {
+    private:
+        std::ofstream& m_output;
+        std::unordered_map<const Obj*, u32> m_objects;
+
+        /// @brief Writes the tag for `object` if it was already written, or numbers it.
+        /// @return Whether its contents are still to be written.
+        bool first_time(const Obj* object, ValueTag tag) {
+            auto [position, added] = m_objects.try_emplace(object, static_cast<u32>(m_objects.size()));
+            if (!added) {
+                write(m_output, ValueTag::Object);
+                write(m_output, position->second);
+                return false;
+            }
+            write(m_output, tag);
+            return true;
+        }
+
+    public:
+        explicit Writer(std::ofstream& output) : m_output(output) {}
+
+        /// @return False if `value` is or holds a function, class or instance, which refer
+        /// to code that only exists in this process.
+        bool write_value(const LoxValue& value) {
+            if (std::holds_alternative<std::monostate>(value)) {
+                write(m_output, ValueTag::Nil);
+            } else if (auto number = std::get_if<float>(&value)) {
+                write(m_output, ValueTag::Number);
+                write(m_output, *number);
+            } else if (auto boolean = std::get_if<bool>(&value)) {
+                write(m_output, ValueTag::Bool);
+                write(m_output, *boolean);
+            } else if (auto text = std::get_if<ObjString*>(&value)) {
+                write(m_output, ValueTag::String);
+                write_string(m_output, (*text)->view());
+            } else if (auto array = std::get_if<ObjArray*>(&value)) {
+                if (!first_time(*array, ValueTag::Array)) return true;
+                write(m_output, (*array)->m_length);
+                m_output.write(reinterpret_cast<const char*>((*array)->m_data), (*array)->m_length * sizeof(float));
+            } else if (auto list = std::get_if<ObjList*>(&value)) {
+                if (!first_time(*list, ValueTag::List)) return true;
+                write(m_output, (*list)->m_count);
+                for (u64 i = 0; i < (*list)->m_count; ++i) {
+                    if (!write_value((*list)->m_items[i])) return false;
+                }
+            } else if (auto map = std::get_if<ObjMap*>(&value)) {
+                if (!first_time(*map, ValueTag::Map)) return true;
+                write(m_output, (*map)->m_count);
+                for (u32 i = 0; i < (*map)->m_used; ++i) {
+                    const auto& entry = (*map)->m_entries[i];
+                    if (std::holds_alternative<std::monostate>(entry.m_key)) continue;
+                    if (!write_value(entry.m_key) || !write_value(entry.m_value)) return false;
+                }
+            } else {
+                return false;
+            }
+            return true;
+        }
+    };
+
+    /// @brief Reads values out of the mapped file, refusing to read past its end.
+    class Reader {
+    private:
+        const char* m_position;
+        const char* m_end;
+
+        /// @brief The arrays, lists and maps read so far, in the order they were written.
+        std::vector<LoxValue> m_objects;
+
+    public:
+        Reader(const char* data, u64 size) : m_position(data), m_end(data + size) {}
+
+        template<typename T>
+        bool read(T& value) {
+            if (static_cast<u64>(m_end - m_position) < sizeof(T)) return false;
+            std::memcpy(&value, m_position, sizeof(T));
+            m_position += sizeof(T);
+            return true;
+        }
+
+        bool read_view(std::string_view& text) {
+            u32 size;
+            if (!read(size) || static_cast<u64>(m_end - m_position) < size) return false;
+            text = std::string_view(m_position, size);
+            m_position += size;
+            return true;
+        }
+
+        bool read(LoxValue& value, Heap& heap) {
+            ValueTag tag;
+            if (!read(tag)) return false;
+
+            switch (tag) {
+                case ValueTag::Nil: value = std::monostate {}; return true;
+                case ValueTag::Number: return read(value.emplace<float>());
+                case ValueTag::Bool: return read(value.emplace<bool>());
+                case ValueTag::String: {
+                    std::string_view text;
+                    if (!read_view(text)) return false;
+                    value = heap.string(text);
+                    return true;
+                }
+                case ValueTag::Array: {
+                    u64 length;
+                    if (!read(length) || static_cast<u64>(m_end - m_position) / sizeof(float) < length) return false;
+                    auto array = heap.array(length);
+                    if (!array) return false;
+                    std::memcpy(array->m_data, m_position, length * sizeof(float));
+                    m_position += length * sizeof(float);
+                    value = m_objects.emplace_back(array);
+                    return true;
+                }
+                case ValueTag::List: {
+                    // The list is numbered before its items are read, since they may refer to it.
+                    u64 count;
+                    auto list = heap.list({});
+                    if (!list || !read(count)) return false;
+                    m_objects.emplace_back(list);
+                    auto item = LoxValue();
+                    for (u64 i = 0; i < count; ++i) {
+                        if (!read(item, heap) || !list_append(heap, *list, item)) return false;
+                    }
+                    value = list;
+                    return true;
+                }
+                case ValueTag::Map: {
+                    u32 count;
+                    auto map = heap.map();
+                    if (!read(count)) return false;
+                    m_objects.emplace_back(map);
+                    auto key = LoxValue();
+                    auto item = LoxValue();
+                    for (u32 i = 0; i < count; ++i) {
+                        if (!read(key, heap) || !read(item, heap) || !map_set(heap, *map, key, item)) return false;
+                    }
+                    value = map;
+                    return true;
+                }
+                case ValueTag::Object: {
+                    u32 index;
+                    if (!read(index) || index >= m_objects.size()) return false;
+                    value = m_objects[index];
+                    return true;
+                }
+                default: return false;
+            }
+        }
+
+        bool at_end() const {
+            return m_position == m_end;
+        }
+    };
+
+    /// @brief A read-only mapping of a whole file that is unmapped when it goes out of scope.
+    class MappedFile {
+    private:
+        void* m_data { MAP_FAILED };
+        u64 m_size { 0 };
+
+    public:
+        MappedFile(const std::string& path) {
+            int descriptor = open(path.c_str(), O_RDONLY);
+            if (descriptor < 0) return;
+
+            struct stat status;
+            if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+                m_size = status.st_size;
+                m_data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            }
+            close(descriptor);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (is_open()) munmap(m_data, m_size);
+        }
+
+        bool is_open() const { return m_data != MAP_FAILED; }
+        const char* data() const { return static_cast<const char*>(m_data); }
+        u64 size() const { return m_size; }
+    };
+}
+
+std::string interpreter::save_snapshot(const Environment& globals, const std::string& path) {
+    auto output = std::ofstream(path, std::ios::binary | std::ios::trunc);
+    if (!output) return "Could not write snapshot '" + path + "'.";
+
+    output.write(MAGIC, sizeof(MAGIC));
+    write(output, VERSION);
+    // Natives are defined again by the interpreter that loads the snapshot, so the globals
+    // holding them under their own names are left out.
+    auto builtin = [&](u32 slot) {
+        auto native = std::get_if<ObjNative*>(&*globals.get(slot));
+        return native && globals.name(slot) == (*native)->m_name;
+    };
+    auto slots = std::vector<u32>();
+    for (u32 slot = 0; slot < globals.size(); ++slot) {
+        if (globals.get(slot) && !builtin(slot)) slots.push_back(slot);
+    }
+    std::ranges::sort(slots, {}, [&](u32 slot) { return globals.name(slot); });
+    write(output, static_cast<u32>(slots.size()));
+
+    auto writer = Writer(output);
+    for (auto slot : slots) {
+        write_string(output, globals.name(slot));
+        if (!writer.write_value(*globals.get(slot))) {
+            // A partial snapshot would load as an error anyway, so none is left behind.
+            output.close();
+            std::remove(path.c_str());
+            return "Could not write snapshot '" + path + "': global '" + std::string(globals.name(slot))
+                + "' holds a function, class or instance.";
+        }
+    }
+
+    output.flush();
+    if (!output) return "Could not write snapshot '" + path + "'.";
+    return {};
+}
+
+bool interpreter::load_snapshot(Environment& globals, Heap& heap, const std::string& path) {
+    auto file = MappedFile(path);
+    if (!file.is_open()) return false;
+
+    auto reader = Reader(file.data(), file.size());
+    char magic[sizeof(MAGIC)];
+    u32 version, count;
+    if (!reader.read(magic) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) return false;
+    if (!reader.read(version) || version != VERSION) return false;
+    if (!reader.read(count)) return false;
+
+    auto name = std::string_view();
+    auto value = LoxValue();
+    for (u32 i = 0; i < count; ++i) {
+        if (!reader.read_view(name) || !reader.read(value, heap)) return false;
+        globals.define(name, value);
+    }
+
+    return reader.at_end();
+}
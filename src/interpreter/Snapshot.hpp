@@ -0,0 +1,29 @@
+#ifndef LOX_SNAPSHOT_HPP
+#define LOX_SNAPSHOT_HPP
+
+#include <string>
+#include "Environment.hpp"
+#include "Heap.hpp"
+
+namespace interpreter {
+    /// @brief Writes every global and its value to `path`, so a later run can start from
+    /// this state without running the script that built it.
+    ///
+    /// The file is a header (`"LOXSNAP"`, a format version and the entry count) followed by
+    /// one record per global in name order: the name's length and bytes, a tag for the
+    /// value's type and the value itself. Numbers are stored as raw floats in the byte
+    /// order of the machine that wrote them. Arrays, lists and maps are written with their
+    /// contents the first time they are reached and by number after that, so globals that
+    /// share one still do when loaded. Functions, classes and instances cannot be saved.
+    /// @return Why the snapshot could not be written, naming the global that could not be
+    /// saved if that was the reason, or an empty string if it was.
+    std::string save_snapshot(const Environment& globals, const std::string& path);
+
+    /// @brief Maps the snapshot at `path` into memory and defines each global it holds,
+    /// copying strings, arrays, lists and maps onto `heap`.
+    /// @return Whether the file was a complete snapshot. Globals read before a problem
+    /// was found stay defined.
+    bool load_snapshot(Environment& globals, Heap& heap, const std::string& path);
+}
+
+#endif
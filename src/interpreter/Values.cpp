@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "Values.hpp"
+#include "ParallelFor.hpp"
+
+namespace {
+    /// @brief The lists and maps being printed on this thread, so one that holds itself
+    /// prints as `[...]` or `{...}` the second time round instead of forever.
+    thread_local std::vector<const interpreter::Obj*> printing_;
+
+    /// @brief Marks a list or map as being printed, for as long as it lives.
+    class Printing {
+    public:
+        const bool m_again;
+
+        explicit Printing(const interpreter::Obj* object)
+            : m_again(std::find(printing_.begin(), printing_.end(), object) != printing_.end()) {
+            if (!m_again) printing_.push_back(object);
+        }
+
+        ~Printing() {
+            if (!m_again) printing_.pop_back();
+        }
+    };
+}
+
+namespace interpreter {
+    bool is_truthy(const LoxValue& value) {
+        // Checked directly rather than with `std::visit`, which past 11 alternatives
+        // dispatches through a table of function pointers.
+        if (auto boolean = std::get_if<bool>(&value)) return *boolean;
+        return !std::holds_alternative<std::monostate>(value);
+    }
+
+    bool is_equal(const LoxValue& left, const LoxValue& right) {
+        return std::visit([](auto&& lv, auto&& rv) -> bool {
+            using LType = std::decay_t<decltype(lv)>;
+            using RType = std::decay_t<decltype(rv)>;
+
+            if constexpr (std::is_empty_v<LType> && std::is_empty_v<RType>)
+                return true;
+            else if constexpr (std::is_empty_v<LType>)
+                return false;
+            else if constexpr (std::is_same_v<LType, ObjString*> && std::is_same_v<RType, ObjString*>)
+                return lv == rv || lv->view() == rv->view();
+            else if constexpr (std::is_same_v<LType, RType>)
+                return lv == rv;
+            else
+                return false;
+            
+        }, left, right);
+    }
+
+    const char* addition_error(const LoxValue& left, const LoxValue& right) {
+        bool strings = std::holds_alternative<ObjString*>(left) && std::holds_alternative<ObjString*>(right);
+        return strings ? OUT_OF_MEMORY : ADDITION_OPERANDS;
+    }
+
+    std::string arity_error(u32 arity, u64 count) {
+        return "Expected " + std::to_string(arity) + " arguments but got " + std::to_string(count) + ".";
+    }
+
+    std::string undefined_property_error(std::string_view name) {
+        return "Undefined property '" + std::string(name) + "'.";
+    }
+
+    ObjFunction* ObjClass::find_method(std::string_view name) const {
+        for (auto klass = this; klass; klass = klass->m_superclass) {
+            for (u32 i = 0; i < klass->m_method_count; ++i) {
+                if (klass->methods()[i]->m_declaration->m_name.lexeme() == name) return klass->methods()[i];
+            }
+        }
+        return nullptr;
+    }
+
+    InlineCache::Entry lookup_property(InlineCache& cache, const ObjInstance& instance, std::string_view name) {
+        auto entry = InlineCache::Entry { instance.m_shape, instance.m_shape, nullptr, instance.m_shape->find(name) };
+        if (entry.m_index == Shape::NOT_FOUND)
+            entry.m_method = instance.m_class->find_method(name);
+
+        // The root of every shape belongs to one class, so a method found for this shape
+        // is the method for every instance that has it. The workers of a `parallel for`
+        // share the caches, so only read them.
+        if ((entry.m_index != Shape::NOT_FOUND || entry.m_method) && !in_parallel_worker())
+            cache.add(entry);
+        return entry;
+    }
+
+    InlineCache::Entry lookup_field(InlineCache& cache, Heap& heap, const ObjInstance& instance, std::string_view name) {
+        auto entry = InlineCache::Entry { instance.m_shape, instance.m_shape, nullptr, instance.m_shape->find(name) };
+        if (entry.m_index == Shape::NOT_FOUND) {
+            entry.m_next_shape = heap.transition(*instance.m_shape, name);
+            entry.m_index = entry.m_next_shape->field_count() - 1;
+        }
+        cache.add(entry);
+        return entry;
+    }
+
+    std::string stringify(const LoxValue& value) {
+        return std::visit([](auto&& v) -> std::string {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_empty_v<T>)
+                return std::string("nil");
+            else if constexpr (std::is_same_v<T, ObjString*>)
+                return std::string(v->view());
+            else if constexpr (std::is_same_v<T, ObjFunction*>)
+                return "<fn " + v->m_declaration->m_name.lexeme() + ">";
+            else if constexpr (std::is_same_v<T, ObjNative*>)
+                return std::string("<native fn>");
+            else if constexpr (std::is_same_v<T, ObjClass*>)
+                return v->m_declaration->m_name.lexeme();
+            else if constexpr (std::is_same_v<T, ObjInstance*>)
+                return v->m_class->m_declaration->m_name.lexeme() + " instance";
+            else if constexpr (std::is_same_v<T, ObjBoundMethod*>)
+                return "<fn " + v->m_method->m_declaration->m_name.lexeme() + ">";
+            else if constexpr (std::is_same_v<T, ObjArray*>) {
+                auto text = std::string("[");
+                for (u64 i = 0; i < v->m_length; ++i) {
+                    if (i > 0) text += ", ";
+                    text += stringify(v->m_data[i]);
+                }
+                return text + "]";
+            }
+            else if constexpr (std::is_same_v<T, ObjList*>) {
+                auto printing = Printing(v);
+                if (printing.m_again) return std::string("[...]");
+                auto text = std::string("[");
+                for (u64 i = 0; i < v->m_count; ++i) {
+                    if (i > 0) text += ", ";
+                    text += stringify(v->m_items[i]);
+                }
+                return text + "]";
+            }
+            else if constexpr (std::is_same_v<T, ObjMap*>) {
+                auto printing = Printing(v);
+                if (printing.m_again) return std::string("{...}");
+                auto text = std::string("{");
+                auto first = true;
+                for (u32 i = 0; i < v->m_used; ++i) {
+                    const auto& entry = v->m_entries[i];
+                    if (std::holds_alternative<std::monostate>(entry.m_key)) continue;
+                    if (!first) text += ", ";
+                    first = false;
+                    text += stringify(entry.m_key) + ": " + stringify(entry.m_value);
+                }
+                return text + "}";
+            }
+            else if constexpr (std::is_same_v<T, bool>)
+                return (v ? "true" : "false");
+            else if constexpr (std::is_same_v<T, float>)
+                return std::floor(v) == v ? std::to_string(int(v)) : std::to_string(v);
+            else
+                return std::to_string(v);
+        }, value);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef LOX_VALUES_HPP
+#define LOX_VALUES_HPP
+
+#include <optional>
+#include <string>
+#include "../memory.hpp"
+#include "Object.hpp"
+#include "Heap.hpp"
+#include "InlineCache.hpp"
+
+namespace interpreter {
+    inline constexpr const char* NUMBER_OPERAND = "Operand must be a number.";
+    inline constexpr const char* NUMBER_OPERANDS = "Operands must be numbers.";
+    inline constexpr const char* ADDITION_OPERANDS = "Operands must be two numbers or two strings.";
+    inline constexpr const char* DIVISION_BY_ZERO = "Division by 0.";
+    inline constexpr const char* UNDEFINED_VARIABLE = "Variable not defined.";
+    inline constexpr const char* UNASSIGNABLE_VARIABLE = "Variable does not exist.";
+    inline constexpr const char* OUT_OF_MEMORY = "Out of memory.";
+    inline constexpr const char* NOT_CALLABLE = "Can only call functions.";
+    inline constexpr const char* STACK_OVERFLOW = "Stack overflow.";
+    inline constexpr const char* NOT_AN_INSTANCE = "Only instances have properties.";
+    inline constexpr const char* NOT_AN_INSTANCE_FIELD = "Only instances have fields.";
+    inline constexpr const char* SUPERCLASS_NOT_A_CLASS = "Superclass must be a class.";
+    inline constexpr const char* PARALLEL_ASSIGNMENT = "Can't assign to a variable declared outside a parallel loop.";
+    inline constexpr const char* PARALLEL_FIELD = "Can't assign to a field inside a parallel loop.";
+
+    /// @brief Lox truthiness: `nil` and `false` are falsey, everything else is truthy.
+    bool is_truthy(const LoxValue& value);
+
+    /// @brief Lox equality: values of different types are never equal, and `nil` only equals `nil`.
+    bool is_equal(const LoxValue& left, const LoxValue& right);
+
+    /// @brief The number in a value that `parser::TypeInference` proved is one. The
+    /// compiler is told so, which lets it drop the check of the variant's index.
+    inline float as_number(const LoxValue& value) {
+        if (!std::holds_alternative<float>(value)) __builtin_unreachable();
+        return *std::get_if<float>(&value);
+    }
+
+    /// @brief Whether the interpreter running on this thread is within its memory limit.
+    inline bool within_memory_limit() {
+        auto account = lox::MemoryAccount::current();
+        return !account || account->within_limit();
+    }
+
+    /// @brief Adds two numbers or concatenates two strings. Defined here so the common
+    /// number case inlines into both backends.
+    /// @return The result, or `std::nullopt` if the operands are any other combination of
+    /// types or the concatenation would not fit in memory; `addition_error` says which.
+    inline std::optional<LoxValue> attempt_addition(const LoxValue& left, const LoxValue& right, Heap& heap) {
+        if (auto left_number = std::get_if<float>(&left)) {
+            if (auto right_number = std::get_if<float>(&right))
+                return *left_number + *right_number;
+            return std::nullopt;
+        }
+
+        if (auto left_string = std::get_if<ObjString*>(&left)) {
+            auto right_string = std::get_if<ObjString*>(&right);
+            if (!right_string) return std::nullopt;
+            if (auto joined = heap.concatenate(**left_string, **right_string))
+                return joined;
+        }
+
+        return std::nullopt;
+    }
+
+    /// @brief Why `attempt_addition` gave up on these operands.
+    const char* addition_error(const LoxValue& left, const LoxValue& right);
+
+    /// @brief The error for calling a function that takes `arity` arguments with `count`.
+    std::string arity_error(u32 arity, u64 count);
+
+    /// @brief The error for reading a property that is neither a field nor a method.
+    std::string undefined_property_error(std::string_view name);
+
+    /// @brief Where property `name` of `instance` is, found by the slow path of `find_property`.
+    InlineCache::Entry lookup_property(InlineCache& cache, const ObjInstance& instance, std::string_view name);
+
+    /// @brief Where property `name` of `instance` is: a field's index, or the method it names
+    /// if no field does. Neither is found if `m_method` is `nullptr` and `m_index` is `Shape::NOT_FOUND`.
+    inline InlineCache::Entry find_property(InlineCache& cache, const ObjInstance& instance, std::string_view name) {
+        if (auto entry = cache.find(instance.m_shape)) [[likely]] return *entry;
+        return lookup_property(cache, instance, name);
+    }
+
+    /// @brief Where assigning field `name` of `instance` stores it, by the slow path of `find_field`.
+    InlineCache::Entry lookup_field(InlineCache& cache, Heap& heap, const ObjInstance& instance, std::string_view name);
+
+    /// @brief Where assigning field `name` of `instance` stores it, and the shape that
+    /// leaves the instance with.
+    inline InlineCache::Entry find_field(InlineCache& cache, Heap& heap, const ObjInstance& instance, std::string_view name) {
+        if (auto entry = cache.find(instance.m_shape)) [[likely]] return *entry;
+        return lookup_field(cache, heap, instance, name);
+    }
+
+    /// @brief Stores `value` where `find_field` said, adding the field first if it is new.
+    /// @return False if adding the field took the interpreter over its memory limit.
+    inline bool store_field(ObjInstance& instance, const InlineCache::Entry& entry, const LoxValue& value, Heap& heap) {
+        if (entry.m_next_shape != instance.m_shape) [[unlikely]] {
+            heap.reshape(instance, entry.m_next_shape);
+            if (!within_memory_limit()) return false;
+        }
+        instance.m_fields[entry.m_index] = value;
+        return true;
+    }
+
+    /// @brief Converts a value to the text `print` writes for it.
+    std::string stringify(const LoxValue& value);
+}
+
+#endif
@@ -7,8 +7,9 @@ using scanner::Token;
 using scanner::TokenType;
 
 namespace lox {
-    static bool had_error_ = false;
-    static bool had_runtime_error_ = false;
+    static thread_local bool had_error_ = false;
+    static thread_local bool had_runtime_error_ = false;
+    static thread_local std::ostream* error_output_ = &std::cerr;
 
     bool had_error() {
         return had_error_;
@@ -18,8 +19,17 @@ namespace lox {
         return had_runtime_error_;
     }
 
+    void clear_errors() {
+        had_error_ = false;
+        had_runtime_error_ = false;
+    }
+
+    void set_error_output(std::ostream& output) {
+        error_output_ = &output;
+    }
+
     static void report(int line, const std::string& where, const std::string& message) {
-        std::cerr << "On line " << line << " at " << where << ": " << message << '\n';
+        *error_output_ << "On line " << line << " at " << where << ": " << message << '\n';
     }
 
     void error(int line, const std::string& message) {
@@ -33,9 +43,11 @@ namespace lox {
         } else {
             report(token.line(), " at '" + token.lexeme() + "'", message);
         }
+        had_error_ = true;
     }
 
     void runtime_error(const RuntimeError& error) {
-        std::cerr << error.what() << "\n";
+        *error_output_ << error.what() << "\n[line " << error.token().line() << "]\n";
+        had_runtime_error_ = true;
     }
 }
\ No newline at end of file
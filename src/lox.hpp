@@ -1,6 +1,7 @@
 #ifndef LOX_HPP
 #define LOX_HPP
 
+#include <ostream>
 #include <string>
 #include <stdexcept>
 #include "scanner/Token.hpp"
@@ -11,13 +12,27 @@ namespace lox {
     bool had_error();
     bool had_runtime_error();
 
+    /// @brief Forgets any reported errors, so the REPL can carry on after a bad line.
+    void clear_errors();
+
+    /// @brief Sends the errors reported on the calling thread to `output` instead of
+    /// standard error. Error state is kept per thread, so several programs can be run
+    /// side by side without seeing each other's errors.
+    void set_error_output(std::ostream& output);
+
+    /// @brief Describes an error that happened while running a program. These are not
+    /// thrown: the interpreter records one and unwinds by returning `ExecStatus::Error`.
     class RuntimeError : public std::runtime_error {
     private:
-        const scanner::Token m_token;
+        scanner::Token m_token;
 
     public:
         RuntimeError(const scanner::Token& token, const std::string& message)
             : std::runtime_error(message), m_token(token) {}
+
+        const scanner::Token& token() const {
+            return m_token;
+        }
     };
 
     void runtime_error(const RuntimeError& error);
@@ -1,22 +1,135 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <utility>
 #include "lox.hpp"
+#include "test_runner.hpp"
+#include "edit_replay.hpp"
+#include "bench_runner.hpp"
+#include "perf_counters.hpp"
+#include "pipeline.hpp"
+#include "trace.hpp"
 #include "scanner/Scanner.hpp"
 #include "parser/Parser.hpp"
+#include "parser/FlatAst.hpp"
 #include "interpreter/Interpreter.hpp"
+#include "interpreter/Kernels.hpp"
+#include "interpreter/ParallelFor.hpp"
+#include "interpreter/Snapshot.hpp"
 
 using scanner::Scanner;
 using parser::Parser;
+using parser::FlatAst;
 using interpreter::Interpreter;
 
 static auto lox_interpreter = Interpreter();
+static bool print_ast_stats = false;
+static std::string snapshot_output;
+static bool print_gc_stats = false;
+static bool print_perf_stats = false;
+static std::string trace_output;
+static u32 scan_threads = 1;
+static bool pipeline = false;
+
+/// @brief The labels of the phase profile. Work outside every phase, like reading the file, is
+/// charged to `NO_PHASE`, which is never entered and so not reported.
+enum Phase : u32 { NO_PHASE, SCAN_PHASE, PARSE_PHASE, EXECUTE_PHASE };
+
+/// @brief Where `--perf-stats` charges each phase of a run, and each kind of node.
+static std::unique_ptr<lox::perf::Profile> phase_profile;
+static std::unique_ptr<lox::perf::Profile> node_profile;
+
+/// @brief Prints how many nodes of each kind a program has, how much memory the
+/// pointer tree and the flat form of it take, and how many operations had their types proven.
+static void report_ast_stats(const std::vector<std::unique_ptr<parser::Statement>>& ast, const parser::TypeInference::Stats& types) {
+    auto start = std::chrono::steady_clock::now();
+    auto flat = FlatAst::flatten(ast);
+    auto elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start);
+
+    u64 counts[parser::NODE_KIND_COUNT] {};
+    for (auto kind : flat.kinds())
+        ++counts[static_cast<std::size_t>(kind)];
+
+    // Each tree node is its own heap block, so count the allocator's header as well.
+    constexpr u64 heap_header = 16;
+    u64 tree_bytes = 0;
+    for (std::size_t kind = 0; kind < parser::NODE_KIND_COUNT; ++kind) {
+        bool is_expr = parser::is_expr(static_cast<parser::NodeKind>(kind));
+        tree_bytes += counts[kind] * ((is_expr ? sizeof(parser::Expr) : sizeof(parser::Statement)) + heap_header);
+        std::cerr << parser::to_string(static_cast<parser::NodeKind>(kind)) << ": " << counts[kind] << '\n';
+    }
+
+    auto nodes = std::max<u64>(flat.size(), 1);
+    std::cerr << "nodes: " << flat.size() << '\n'
+              << "tree bytes: " << tree_bytes << " (" << tree_bytes / nodes << " per node)\n"
+              << "flat bytes: " << flat.memory_usage() << " (" << flat.memory_usage() / nodes << " per node)\n"
+              << "flatten time: " << elapsed.count() << "us\n";
+
+    auto typed_percent = types.m_binary_count ? 100.0 * types.m_typed_binary_count / types.m_binary_count : 0.0;
+    std::cerr << "typed binary: " << types.m_typed_binary_count << " of " << types.m_binary_count
+              << " (" << typed_percent << "%)\n";
+}
 
 static void run(const std::string& source) {
+    auto scanning = lox::perf::Profile::Scope(phase_profile.get(), SCAN_PHASE);
     auto scanner = Scanner(source);
-    auto parser = Parser(scanner.tokenize());
+    auto tokens = scan_threads > 1 ? scanner.tokenize_parallel(scan_threads) : scanner.tokenize();
+    scanning.end();
+
+    auto parsing = lox::perf::Profile::Scope(phase_profile.get(), PARSE_PHASE);
+    auto parser = Parser(std::move(tokens));
     auto ast = parser.parse();
-    lox_interpreter.interpret(ast);
+    parsing.end();
+    if (lox::had_error()) return;
+    if (print_ast_stats) report_ast_stats(ast, parser.type_stats());
+
+    auto executing = lox::perf::Profile::Scope(phase_profile.get(), EXECUTE_PHASE);
+    auto between_nodes = lox::perf::Profile::Scope(node_profile.get(), static_cast<u32>(parser::NODE_KIND_COUNT));
+    lox_interpreter.interpret(std::move(ast));
+}
+
+/// @brief Opens the counters `--perf-stats` reads, on the thread that runs the program.
+static void start_perf_stats() {
+    lox::perf::open();
+    phase_profile = std::make_unique<lox::perf::Profile>(std::vector<const char*> { "none", "scan", "parse", "execute" }, NO_PHASE);
+
+    // Work the interpreter does between nodes, like running the tasks a program started, is
+    // charged to "other", and work outside the interpreter to "none", which is not reported.
+    auto kinds = std::vector<const char*>();
+    for (std::size_t kind = 0; kind < parser::NODE_KIND_COUNT; ++kind)
+        kinds.push_back(parser::to_string(static_cast<parser::NodeKind>(kind)));
+    kinds.push_back("other");
+    kinds.push_back("none");
+    node_profile = std::make_unique<lox::perf::Profile>(std::move(kinds), static_cast<u32>(parser::NODE_KIND_COUNT) + 1);
+    lox_interpreter.set_profile(node_profile.get());
+}
+
+/// @brief Prints what each phase, and each kind of node the tree walker ran, was charged.
+static void report_perf_stats() {
+    if (!lox::perf::available(lox::perf::Cycles))
+        std::cerr << "CPU counters not available (" << lox::perf::unavailable_reason() << "), counting time only\n";
+    phase_profile->report(std::cerr, "phase");
+    std::cerr << '\n';
+    node_profile->report(std::cerr, "node");
+}
+
+static void report_gc_stats() {
+    const auto& heap = lox_interpreter.heap();
+    const auto& stats = heap.stats();
+    auto average = stats.m_collections ? stats.m_total_pause_us / stats.m_collections : 0.0;
+    std::cerr << "collections: " << stats.m_collections << '\n'
+              << "freed bytes: " << stats.m_freed_bytes << '\n'
+              << "heap bytes: " << heap.bytes() << '\n'
+              << "total pause: " << stats.m_total_pause_us << "us\n"
+              << "average pause: " << average << "us\n"
+              << "max pause: " << stats.m_max_pause_us << "us\n";
 }
 
 static void run_repl() {
@@ -28,31 +141,222 @@ static void run_repl() {
             break;
         }
         run(line);
+        lox::clear_errors();
     }
 }
 
 static void run_file(const std::string& path) {
-    std::ifstream input_file(path);
-    std::string line;
-
-    std::string source_code;
-    while (std::getline(input_file, line)) {
-        source_code += line;
+    std::ostringstream source_code;
+    {
+        auto span = lox::trace::Span("read file", path);
+        std::ifstream input_file(path, std::ios::binary);
+        source_code << input_file.rdbuf();
     }
 
-    run(source_code);
+    bool front_end_failed = false;
+    if (pipeline) {
+        front_end_failed = lox::run_pipelined(source_code.str(), lox_interpreter);
+    } else {
+        run(source_code.str());
+    }
+    if (print_gc_stats) report_gc_stats();
+    if (node_profile) report_perf_stats();
 
-    if (lox::had_error())
+    if (front_end_failed || lox::had_error())
         std::exit(65);
 
+    // Running out of budget gets the exit code `timeout` uses, so it can be told from a bug.
     if (lox::had_runtime_error())
-        std::exit(70);
+        std::exit(lox_interpreter.budget().ran_out() ? 124 : 70);
+
+    if (!snapshot_output.empty()) {
+        auto error = interpreter::save_snapshot(lox_interpreter.globals(), snapshot_output);
+        if (!error.empty()) {
+            std::cerr << error << '\n';
+            std::exit(74);
+        }
+    }
+}
+
+/// @brief Writes the trace on the way out, including when a program's errors end the
+/// process through `std::exit`.
+static void write_trace() {
+    if (!lox::trace::write(trace_output))
+        std::cerr << "Could not write trace '" << trace_output << "'.\n";
+}
+
+/// @brief Reads a byte count such as `4096`, `512K`, `64M` or `2G`.
+static std::optional<u64> parse_size(const std::string& text) {
+    u64 value = 0;
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end == text.data()) return std::nullopt;
+
+    auto suffix = std::string(end, text.data() + text.size());
+    if (suffix == "K") return value << 10;
+    if (suffix == "M") return value << 20;
+    if (suffix == "G") return value << 30;
+    if (suffix.empty()) return value;
+    return std::nullopt;
+}
+
+/// @brief Reads a whole argument as a number, rejecting signs `T` can't have and anything
+/// left over.
+template <typename T>
+static std::optional<T> parse_number(const std::string& text) {
+    T value {};
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (error != std::errc() || end == text.data() || end != text.data() + text.size()) return std::nullopt;
+    return value;
+}
+
+static void usage() {
+    std::cerr << "Usage: loxpp [--backend=tree|closure] [--ast-stats] [--max-memory=bytes]\n"
+              << "             [--max-steps=N] [--timeout=seconds]\n"
+              << "             [--gc-growth=factor] [--gc-stats] [--perf-stats] [--snapshot file]\n"
+              << "             [--trace=out.json] [--scan-threads=N | --pipeline] [--threads=N]\n"
+              << "             [--simd=avx2|sse2|scalar] [--allow-shell] [file.lox]\n"
+              << "       loxpp --write-snapshot file prelude.lox\n"
+              << "       loxpp [--backend=tree|closure] [--trace=out.json] [--allow-shell] --test directory\n"
+              << "       loxpp [--backend=tree|closure] [--iterations N] [--warmup M] [--json] --bench file.lox\n"
+              << "       loxpp --replay-edits edits.txt file.lox\n";
+    std::exit(64);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    std::string path;
+    std::string snapshot_input;
+    std::string test_directory;
+    std::string bench_script;
+    std::string edits_path;
+    auto bench_options = lox::BenchOptions();
+    auto timeout = std::optional<std::chrono::duration<double>>();
+    bool allow_shell = false;
+
+    for (int i = 1; i < argc; ++i) {
+        auto argument = std::string(argv[i]);
+        if (argument == "--backend=tree") {
+            lox_interpreter.set_backend(interpreter::Backend::TreeWalker);
+        } else if (argument == "--backend=closure") {
+            lox_interpreter.set_backend(interpreter::Backend::Closure);
+        } else if (argument == "--ast-stats") {
+            print_ast_stats = true;
+        } else if (argument.starts_with("--max-memory=")) {
+            auto limit = parse_size(argument.substr(std::string("--max-memory=").size()));
+            if (!limit) usage();
+            lox_interpreter.set_memory_limit(*limit);
+        } else if (argument.starts_with("--max-steps=")) {
+            auto steps = parse_number<u64>(argument.substr(std::string("--max-steps=").size()));
+            if (!steps) usage();
+            lox_interpreter.budget().set_max_steps(*steps);
+        } else if (argument.starts_with("--timeout=")) {
+            auto seconds = parse_number<double>(argument.substr(std::string("--timeout=").size()));
+            if (!seconds || !(*seconds > 0) || !std::isfinite(*seconds)) usage();
+            // Longer than anything could run, and short enough to count in nanoseconds.
+            timeout = std::chrono::duration<double>(std::min(*seconds, 1e9));
+        } else if (argument.starts_with("--gc-growth=")) {
+            auto factor = parse_number<double>(argument.substr(std::string("--gc-growth=").size()));
+            if (!factor || !(*factor > 1) || !std::isfinite(*factor)) usage();
+            lox_interpreter.heap().set_growth_factor(*factor);
+        } else if (argument == "--gc-stats") {
+            print_gc_stats = true;
+        } else if (argument == "--perf-stats") {
+            print_perf_stats = true;
+        } else if (argument.starts_with("--scan-threads=")) {
+            auto threads = parse_number<u32>(argument.substr(std::string("--scan-threads=").size()));
+            if (!threads || *threads == 0) usage();
+            scan_threads = *threads;
+        } else if (argument == "--pipeline") {
+            pipeline = true;
+        } else if (argument.starts_with("--threads=")) {
+            auto threads = parse_number<u32>(argument.substr(std::string("--threads=").size()));
+            if (!threads || *threads == 0) usage();
+            interpreter::set_parallel_threads(*threads);
+        } else if (argument.starts_with("--simd=")) {
+            if (!interpreter::set_array_kernels(argument.substr(std::string("--simd=").size()))) usage();
+        } else if (argument == "--allow-shell") {
+            allow_shell = true;
+        } else if (argument.starts_with("--trace=")) {
+            trace_output = argument.substr(std::string("--trace=").size());
+            if (trace_output.empty()) usage();
+        } else if (argument == "--snapshot" && i + 1 < argc) {
+            snapshot_input = argv[++i];
+        } else if (argument == "--write-snapshot" && i + 1 < argc) {
+            snapshot_output = argv[++i];
+        } else if (argument == "--test" && i + 1 < argc) {
+            test_directory = argv[++i];
+        } else if (argument == "--bench" && i + 1 < argc) {
+            bench_script = argv[++i];
+        } else if (argument == "--replay-edits" && i + 1 < argc) {
+            edits_path = argv[++i];
+        } else if (argument == "--iterations" && i + 1 < argc) {
+            auto iterations = parse_number<u32>(argv[++i]);
+            if (!iterations || *iterations == 0) usage();
+            bench_options.m_iterations = *iterations;
+        } else if (argument == "--warmup" && i + 1 < argc) {
+            auto warmup = parse_number<u32>(argv[++i]);
+            if (!warmup) usage();
+            bench_options.m_warmup = *warmup;
+        } else if (argument == "--json") {
+            bench_options.m_json = true;
+        } else if (argument.starts_with("--") || !path.empty()) {
+            usage();
+        } else {
+            path = argument;
+        }
+    }
+
+    if (!snapshot_output.empty() && path.empty())
+        usage();
+
+    // The pipeline scans as it parses, one declaration at a time, and never holds the whole
+    // AST, or keeps its phases apart.
+    if (pipeline && (path.empty() || scan_threads > 1 || print_ast_stats || print_perf_stats))
+        usage();
+
+    if (!trace_output.empty()) {
+        lox::trace::start();
+        std::atexit(write_trace);
+    }
+
+    // The clock starts once the arguments are read, so parsing counts toward the timeout.
+    if (timeout)
+        lox_interpreter.budget().set_timeout(std::chrono::duration_cast<std::chrono::nanoseconds>(*timeout));
+
+    // Everything from here on, including the ASTs, is charged to the interpreter.
+    auto memory_scope = lox::MemoryAccount::Scope(lox_interpreter.memory());
+
+    if (!test_directory.empty()) {
+        if (!path.empty()) usage();
+        return lox::run_tests(test_directory, lox_interpreter.backend(), allow_shell);
+    }
+
+    if (!bench_script.empty()) {
+        if (!path.empty()) usage();
+        bench_options.m_backend = lox_interpreter.backend();
+        return lox::run_bench(bench_script, bench_options);
+    }
+
+    if (!edits_path.empty()) {
+        if (path.empty()) usage();
+        return lox::replay_edits(edits_path, path);
+    }
+
+    if (print_perf_stats) {
+        if (path.empty()) usage();
+        start_perf_stats();
+    }
+
+    if (allow_shell)
+        lox_interpreter.allow_shell();
+
+    if (!snapshot_input.empty() && !interpreter::load_snapshot(lox_interpreter.globals(), lox_interpreter.heap(), snapshot_input)) {
+        std::cerr << "Could not read snapshot '" << snapshot_input << "'.\n";
+        std::exit(66);
+    }
+
+    if (path.empty()) {
         run_repl();
     } else {
-        run_file(argv[1]);
+        run_file(path);
     }
 }
\ No newline at end of file
@@ -0,0 +1,195 @@
+#ifndef LOX_MEMORY_HPP
+#define LOX_MEMORY_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include "util_types.hpp"
+
+namespace lox {
+    /// @brief Counts the bytes allocated on behalf of one interpreter: its values, strings,
+    /// globals, frame stack and the AST it was given. Reading the counters is just a load,
+    /// so embedders can poll them as often as they like.
+    ///
+    /// Allocations are charged to whichever account is current on the allocating thread
+    /// (see `Scope`), and given back to that same account when freed, wherever that
+    /// happens. An account must therefore outlive everything charged to it.
+    ///
+    /// An account is used by one thread at a time. Threads that work for the same
+    /// interpreter at once, like the workers of a `parallel for`, each get a child account
+    /// instead, which reserves bytes from its parent `RESERVATION` at a time and counts
+    /// against the parent's limit.
+    class MemoryAccount {
+    public:
+        static constexpr u64 UNLIMITED = std::numeric_limits<u64>::max();
+
+        /// @brief How many bytes a child account reserves from its parent at a time, so
+        /// the parent's shared counter is only touched once per this many.
+        static constexpr u64 RESERVATION = 64 << 10;
+
+        /// @brief Makes an account current on this thread until the scope ends.
+        class Scope {
+        private:
+            MemoryAccount* m_previous;
+
+        public:
+            Scope(MemoryAccount& account);
+            ~Scope();
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+        };
+
+    private:
+        u64 m_live { 0 };
+        u64 m_peak { 0 };
+        u64 m_limit { UNLIMITED };
+
+        /// @brief The account a child draws from, or `nullptr`.
+        MemoryAccount* m_parent { nullptr };
+
+        /// @brief The bytes a child has reserved from its parent.
+        u64 m_reserved { 0 };
+
+        /// @brief The bytes this account's children have reserved, which count as live.
+        std::atomic<u64> m_lent { 0 };
+
+    public:
+        MemoryAccount() = default;
+
+        /// @brief A child of `parent`, or of its parent if `parent` is a child itself, or an
+        /// account of its own if `parent` is `nullptr`.
+        explicit MemoryAccount(MemoryAccount* parent)
+            : m_parent(parent && parent->m_parent ? parent->m_parent : parent) {}
+
+        ~MemoryAccount() {
+            if (m_parent) m_parent->m_lent.fetch_sub(m_reserved, std::memory_order_relaxed);
+        }
+
+        MemoryAccount(const MemoryAccount&) = delete;
+        MemoryAccount& operator=(const MemoryAccount&) = delete;
+
+        /// @brief The account allocations on this thread are charged to, or `nullptr`.
+        static MemoryAccount* current();
+
+        u64 live_bytes() const { return m_live; }
+        u64 peak_bytes() const { return m_peak; }
+        u64 limit() const { return m_limit; }
+
+        /// @brief Sets the most bytes the interpreter may hold. Going over does not stop an
+        /// allocation; the interpreter checks `fits` before work that could grow without
+        /// bound and `within_limit` after, and raises a runtime error instead.
+        void set_limit(u64 bytes) { m_limit = bytes; }
+
+        bool within_limit() const {
+            if (m_parent) return m_parent->within_limit();
+            return m_live + m_lent.load(std::memory_order_relaxed) <= m_limit;
+        }
+
+        /// @return Whether another `bytes` could be allocated without going over the limit.
+        bool fits(u64 bytes) const {
+            if (m_parent) return m_live + bytes <= m_reserved || m_parent->fits(m_live + bytes - m_reserved);
+            auto used = m_live + m_lent.load(std::memory_order_relaxed);
+            return bytes <= m_limit && used <= m_limit - bytes;
+        }
+
+        void charge(u64 bytes) {
+            m_live += bytes;
+            if (m_live > m_peak) m_peak = m_live;
+            if (m_parent && m_live > m_reserved) [[unlikely]] reserve();
+        }
+
+        void release(u64 bytes) { m_live -= bytes; }
+
+    private:
+        /// @brief Reserves enough from the parent to cover what this child holds. Bytes are
+        /// only given back when the child goes, since its thread will likely need them again.
+        [[gnu::noinline]] void reserve() {
+            auto needed = (m_live - m_reserved + RESERVATION - 1) / RESERVATION * RESERVATION;
+            m_reserved += needed;
+            m_parent->m_lent.fetch_add(needed, std::memory_order_relaxed);
+        }
+    };
+
+    inline thread_local MemoryAccount* current_account_ = nullptr;
+
+    inline MemoryAccount* MemoryAccount::current() {
+        return current_account_;
+    }
+
+    inline MemoryAccount::Scope::Scope(MemoryAccount& account) : m_previous(current_account_) {
+        current_account_ = &account;
+    }
+
+    inline MemoryAccount::Scope::~Scope() {
+        current_account_ = m_previous;
+    }
+
+    /// @brief Precedes every accounted block, so it can be given back to the account
+    /// that paid for it. Its size keeps the block after it suitably aligned.
+    struct alignas(alignof(std::max_align_t)) AllocationHeader {
+        MemoryAccount* m_account;
+        u64 m_bytes;
+    };
+
+    /// @brief Allocates `bytes` and charges them, plus the header, to the current account.
+    inline void* allocate_accounted(u64 bytes) {
+        auto total = bytes + sizeof(AllocationHeader);
+        auto header = static_cast<AllocationHeader*>(::operator new(total));
+        header->m_account = current_account_;
+        header->m_bytes = total;
+        if (header->m_account) header->m_account->charge(total);
+        return header + 1;
+    }
+
+    inline void deallocate_accounted(void* memory) {
+        if (!memory) return;
+        auto header = static_cast<AllocationHeader*>(memory) - 1;
+        if (header->m_account) header->m_account->release(header->m_bytes);
+        ::operator delete(header);
+    }
+
+    /// @brief Like `allocate_accounted`, for a block aligned to `alignment`, a power of two
+    /// at least as large as the header. Free it with `deallocate_accounted_aligned`.
+    inline void* allocate_accounted_aligned(u64 bytes, u64 alignment) {
+        auto total = bytes + alignment;
+        auto block = static_cast<char*>(::operator new(total, std::align_val_t(alignment)));
+        auto header = reinterpret_cast<AllocationHeader*>(block + alignment) - 1;
+        header->m_account = current_account_;
+        header->m_bytes = total;
+        if (header->m_account) header->m_account->charge(total);
+        return block + alignment;
+    }
+
+    inline void deallocate_accounted_aligned(void* memory, u64 alignment) {
+        if (!memory) return;
+        auto header = static_cast<AllocationHeader*>(memory) - 1;
+        if (header->m_account) header->m_account->release(header->m_bytes);
+        ::operator delete(static_cast<char*>(memory) - alignment, std::align_val_t(alignment));
+    }
+
+    /// @brief A standard allocator that goes through `allocate_accounted`, for containers
+    /// that hold interpreter data.
+    template<typename T>
+    struct AccountingAllocator {
+        using value_type = T;
+
+        AccountingAllocator() = default;
+
+        template<typename U>
+        AccountingAllocator(const AccountingAllocator<U>&) {}
+
+        T* allocate(std::size_t count) {
+            return static_cast<T*>(allocate_accounted(count * sizeof(T)));
+        }
+
+        void deallocate(T* memory, std::size_t) {
+            deallocate_accounted(memory);
+        }
+
+        template<typename U>
+        bool operator==(const AccountingAllocator<U>&) const { return true; }
+    };
+}
+
+#endif
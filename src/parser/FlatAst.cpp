@@ -0,0 +1,345 @@
+#include <bit>
+#include "FlatAst.hpp"
+
+using namespace parser;
+
+using scanner::TokenType;
+
+const char* parser::to_string(NodeKind kind) {
+    switch (kind) {
+        case NodeKind::Literal:      return "Literal";
+        case NodeKind::Variable:     return "Variable";
+        case NodeKind::Unary:        return "Unary";
+        case NodeKind::Binary:       return "Binary";
+        case NodeKind::Ternary:      return "Ternary";
+        case NodeKind::Assign:       return "Assign";
+        case NodeKind::Grouping:     return "Grouping";
+        case NodeKind::Logical:      return "Logical";
+        case NodeKind::Call:         return "Call";
+        case NodeKind::Get:          return "Get";
+        case NodeKind::Set:          return "Set";
+        case NodeKind::Super:        return "Super";
+        case NodeKind::ListLiteral:  return "ListLiteral";
+        case NodeKind::Index:        return "Index";
+        case NodeKind::IndexSet:     return "IndexSet";
+        case NodeKind::ExprStmt:     return "ExprStmt";
+        case NodeKind::PrintStmt:    return "PrintStmt";
+        case NodeKind::VariableDecl: return "VariableDecl";
+        case NodeKind::Block:        return "Block";
+        case NodeKind::IfStmt:       return "IfStmt";
+        case NodeKind::WhileLoop:    return "WhileLoop";
+        case NodeKind::ForLoop:      return "ForLoop";
+        case NodeKind::FunctionDecl: return "FunctionDecl";
+        case NodeKind::ReturnStmt:   return "ReturnStmt";
+        case NodeKind::ClassDecl:    return "ClassDecl";
+        case NodeKind::ForInLoop:    return "ForInLoop";
+        default:                     return "UnknownNodeKind";
+    }
+}
+
+NodeIndex FlatAst::add_node(NodeKind kind, TokenType operation, u32 line, NodeIndex first, NodeIndex second, NodeIndex third) {
+    m_kinds.push_back(kind);
+    m_operators.push_back(operation);
+    m_lines.push_back(line);
+    m_first.push_back(first);
+    m_second.push_back(second);
+    m_third.push_back(third);
+    return m_kinds.size() - 1;
+}
+
+u32 FlatAst::add_literal(const LiteralValue& value) {
+    auto [entry, inserted] = m_literal_ids.try_emplace(value, m_literals.size());
+    if (inserted) m_literals.push_back(value);
+    return entry->second;
+}
+
+u32 FlatAst::add_name(const std::string& name) {
+    auto [entry, inserted] = m_name_ids.try_emplace(name, m_names.size());
+    if (inserted) m_names.push_back(name);
+    return entry->second;
+}
+
+u32 FlatAst::add_list(std::span<const NodeIndex> nodes) {
+    auto offset = static_cast<u32>(m_lists.size());
+    m_lists.insert(m_lists.end(), nodes.begin(), nodes.end());
+    return offset;
+}
+
+void FlatAst::set_roots(std::span<const NodeIndex> roots) {
+    m_roots_offset = add_list(roots);
+    m_root_count = roots.size();
+}
+
+void FlatAst::shrink_to_fit() {
+    m_kinds.shrink_to_fit();
+    m_operators.shrink_to_fit();
+    m_lines.shrink_to_fit();
+    m_first.shrink_to_fit();
+    m_second.shrink_to_fit();
+    m_third.shrink_to_fit();
+    m_literals.shrink_to_fit();
+    m_lists.shrink_to_fit();
+    m_literal_ids.clear();
+    m_name_ids.clear();
+}
+
+u64 FlatAst::memory_usage() const {
+    u64 bytes = m_kinds.capacity() * sizeof(NodeKind)
+        + m_operators.capacity() * sizeof(TokenType)
+        + m_lines.capacity() * sizeof(u32)
+        + (m_first.capacity() + m_second.capacity() + m_third.capacity()) * sizeof(NodeIndex)
+        + m_literals.capacity() * sizeof(LiteralValue)
+        + m_lists.capacity() * sizeof(NodeIndex);
+
+    for (const auto& name : m_names)
+        bytes += sizeof(std::string) + name.capacity();
+    return bytes;
+}
+
+namespace {
+    /// @brief Walks the pointer tree once, appending each node after its children.
+    class Flattener {
+    private:
+        FlatAst& m_ast;
+
+    public:
+        /// @brief Added to the line of every token, for trees whose lines count from
+        /// the start of their declaration.
+        u32 m_first_line { 0 };
+
+        Flattener(FlatAst& ast) : m_ast(ast) {}
+
+        NodeIndex flatten(const Statement* stmt) {
+            if (!stmt) return NO_NODE;
+            return std::visit([this](auto&& s) { return lower(s); }, stmt->m_stmt);
+        }
+
+        NodeIndex flatten(const Expr& expr) {
+            return std::visit([this](auto&& e) { return lower(e); }, expr.m_node);
+        }
+
+    private:
+        static NodeIndex slot(i32 slot) {
+            return std::bit_cast<NodeIndex>(slot);
+        }
+
+        u32 line(const scanner::Token& token) const {
+            return token.line() + m_first_line;
+        }
+
+        NodeIndex optional(const std::optional<std::unique_ptr<Expr>>& expr) {
+            return expr.has_value() ? flatten(*expr.value()) : NO_NODE;
+        }
+
+        NodeIndex lower(const Literal& literal) {
+            return m_ast.add_node(NodeKind::Literal, TokenType::Eof, 0, m_ast.add_literal(literal.m_value));
+        }
+
+        NodeIndex lower(const Variable& variable) {
+            const auto& name = variable.m_name;
+            return m_ast.add_node(NodeKind::Variable, name.type(), line(name), m_ast.add_name(name.lexeme()), slot(variable.m_slot));
+        }
+
+        NodeIndex lower(const Unary& unary) {
+            auto argument = flatten(*unary.m_argument);
+            const auto& operation = unary.m_operator;
+            return m_ast.add_node(NodeKind::Unary, operation.type(), line(operation), argument);
+        }
+
+        NodeIndex lower(const Binary& binary) {
+            auto left = flatten(*binary.m_left);
+            auto right = flatten(*binary.m_right);
+            const auto& operation = binary.m_operator;
+            return m_ast.add_node(NodeKind::Binary, operation.type(), line(operation), left, right);
+        }
+
+        NodeIndex lower(const Logical& logical) {
+            auto left = flatten(*logical.m_left);
+            auto right = flatten(*logical.m_right);
+            const auto& operation = logical.m_operator;
+            return m_ast.add_node(NodeKind::Logical, operation.type(), line(operation), left, right);
+        }
+
+        NodeIndex lower(const Ternary& ternary) {
+            auto condition = flatten(*ternary.m_condition);
+            auto success = flatten(*ternary.m_success);
+            auto failure = flatten(*ternary.m_failure);
+            return m_ast.add_node(NodeKind::Ternary, TokenType::QuestionMark, 0, condition, success, failure);
+        }
+
+        NodeIndex lower(const Assign& assign) {
+            auto value = flatten(*assign.m_value);
+            const auto& name = assign.m_name;
+            return m_ast.add_node(NodeKind::Assign, TokenType::Equal, line(name), value, m_ast.add_name(name.lexeme()), slot(assign.m_slot));
+        }
+
+        NodeIndex lower(const Call& call) {
+            auto callee = flatten(*call.m_callee);
+            auto arguments = std::vector<NodeIndex>();
+            arguments.reserve(call.m_arguments.size());
+            for (const auto& argument : call.m_arguments)
+                arguments.push_back(flatten(*argument));
+
+            const auto& paren = call.m_paren;
+            return m_ast.add_node(NodeKind::Call, paren.type(), line(paren), callee, m_ast.add_list(arguments), arguments.size());
+        }
+
+        NodeIndex lower(const Get& get) {
+            auto object = flatten(*get.m_object);
+            const auto& name = get.m_name;
+            return m_ast.add_node(NodeKind::Get, TokenType::Dot, line(name), object, m_ast.add_name(name.lexeme()));
+        }
+
+        NodeIndex lower(const Set& set) {
+            auto object = flatten(*set.m_object);
+            auto value = flatten(*set.m_value);
+            const auto& name = set.m_name;
+            return m_ast.add_node(NodeKind::Set, TokenType::Equal, line(name), object, m_ast.add_name(name.lexeme()), value);
+        }
+
+        NodeIndex lower(const Super& super) {
+            const auto& method = super.m_method;
+            return m_ast.add_node(NodeKind::Super, TokenType::Super, line(method), m_ast.add_name(method.lexeme()), slot(super.m_slot));
+        }
+
+        NodeIndex lower(const ListLiteral& list) {
+            auto elements = std::vector<NodeIndex>();
+            elements.reserve(list.m_elements.size());
+            for (const auto& element : list.m_elements)
+                elements.push_back(flatten(*element));
+
+            const auto& bracket = list.m_bracket;
+            return m_ast.add_node(NodeKind::ListLiteral, TokenType::LeftBracket, line(bracket), m_ast.add_list(elements), elements.size());
+        }
+
+        NodeIndex lower(const Index& index) {
+            auto object = flatten(*index.m_object);
+            auto position = flatten(*index.m_index);
+            return m_ast.add_node(NodeKind::Index, TokenType::LeftBracket, line(index.m_bracket), object, position);
+        }
+
+        NodeIndex lower(const IndexSet& set) {
+            auto object = flatten(*set.m_object);
+            auto position = flatten(*set.m_index);
+            auto value = flatten(*set.m_value);
+            return m_ast.add_node(NodeKind::IndexSet, TokenType::Equal, line(set.m_bracket), object, position, value);
+        }
+
+        NodeIndex lower(const Grouping& grouping) {
+            auto inner = flatten(*grouping.m_inner_expr);
+            return m_ast.add_node(NodeKind::Grouping, TokenType::LeftParen, 0, inner);
+        }
+
+        NodeIndex lower(const ExprStmt& stmt) {
+            auto expr = flatten(*stmt.m_expr);
+            return m_ast.add_node(NodeKind::ExprStmt, TokenType::Semicolon, 0, expr);
+        }
+
+        NodeIndex lower(const PrintStmt& stmt) {
+            auto expr = flatten(*stmt.m_expr);
+            return m_ast.add_node(NodeKind::PrintStmt, TokenType::Print, 0, expr);
+        }
+
+        NodeIndex lower(const VariableDecl& decl) {
+            auto initializer = optional(decl.m_initializer);
+            const auto& name = decl.m_name;
+            return m_ast.add_node(NodeKind::VariableDecl, TokenType::Var, line(name), initializer, m_ast.add_name(name.lexeme()), slot(decl.m_slot));
+        }
+
+        NodeIndex lower(const Block& block) {
+            auto statements = std::vector<NodeIndex>();
+            statements.reserve(block.m_statements.size());
+            for (const auto& stmt : block.m_statements)
+                statements.push_back(flatten(stmt.get()));
+
+            auto offset = m_ast.add_list(statements);
+            return m_ast.add_node(NodeKind::Block, TokenType::LeftBrace, 0, offset, statements.size(), block.m_slot_count);
+        }
+
+        NodeIndex lower(const IfStmt& stmt) {
+            auto condition = flatten(*stmt.m_condition);
+            auto then_clause = flatten(stmt.m_then_clause.get());
+            auto else_clause = stmt.m_else_clause.has_value() ? flatten(stmt.m_else_clause.value().get()) : NO_NODE;
+            return m_ast.add_node(NodeKind::IfStmt, TokenType::If, 0, condition, then_clause, else_clause);
+        }
+
+        NodeIndex lower(const WhileLoop& loop) {
+            auto condition = flatten(*loop.m_condition);
+            auto body = flatten(loop.m_body.get());
+            return m_ast.add_node(NodeKind::WhileLoop, TokenType::While, 0, condition, body);
+        }
+
+        NodeIndex lower(const ForLoop& loop) {
+            auto initializer = loop.m_initializer.has_value() ? flatten(loop.m_initializer.value().get()) : NO_NODE;
+            auto condition = optional(loop.m_condition);
+            auto update = optional(loop.m_update);
+            auto body = flatten(loop.m_body.get());
+
+            NodeIndex parts[] = { initializer, condition, update, body };
+            auto keyword = loop.m_parallel ? TokenType::Parallel : TokenType::For;
+            return m_ast.add_node(NodeKind::ForLoop, keyword, 0, m_ast.add_list(parts));
+        }
+
+        NodeIndex lower(const ForInLoop& loop) {
+            NodeIndex parts[] = { flatten(*loop.m_iterable), flatten(loop.m_body.get()) };
+            const auto& name = loop.m_name;
+            return m_ast.add_node(NodeKind::ForInLoop, TokenType::For, line(name), m_ast.add_list(parts), m_ast.add_name(name.lexeme()), slot(loop.m_scope->m_slot));
+        }
+
+        NodeIndex lower(const FunctionDecl& decl) {
+            auto parts = std::vector<NodeIndex> { static_cast<NodeIndex>(decl.m_function->m_params.size()), static_cast<NodeIndex>(decl.m_function->m_body.size()) };
+            for (const auto& param : decl.m_function->m_params)
+                parts.push_back(m_ast.add_name(param.lexeme()));
+            for (const auto& stmt : decl.m_function->m_body)
+                parts.push_back(flatten(stmt.get()));
+
+            const auto& name = decl.m_name;
+            return m_ast.add_node(NodeKind::FunctionDecl, TokenType::Fun, line(name), m_ast.add_list(parts), m_ast.add_name(name.lexeme()), slot(decl.m_slot));
+        }
+
+        NodeIndex lower(const ClassDecl& decl) {
+            const auto& klass = *decl.m_class;
+            auto parts = std::vector<NodeIndex> { optional(klass.m_superclass), static_cast<NodeIndex>(klass.m_methods.size()) };
+            for (const auto& method : klass.m_methods)
+                parts.push_back(lower(method));
+
+            const auto& name = decl.m_name;
+            return m_ast.add_node(NodeKind::ClassDecl, TokenType::Class, line(name), m_ast.add_list(parts), m_ast.add_name(name.lexeme()), slot(decl.m_slot));
+        }
+
+        NodeIndex lower(const ReturnStmt& stmt) {
+            auto value = optional(stmt.m_value);
+            return m_ast.add_node(NodeKind::ReturnStmt, TokenType::Return, line(stmt.m_keyword), value);
+        }
+    };
+}
+
+FlatAst FlatAst::flatten(const std::vector<std::unique_ptr<Statement>>& program) {
+    auto ast = FlatAst();
+    auto flattener = Flattener(ast);
+
+    auto roots = std::vector<NodeIndex>();
+    roots.reserve(program.size());
+    for (const auto& stmt : program)
+        roots.push_back(flattener.flatten(stmt.get()));
+
+    ast.set_roots(roots);
+    ast.shrink_to_fit();
+    return ast;
+}
+
+FlatAst FlatAst::flatten(std::span<const Statement* const> program, std::span<const u32> first_lines) {
+    auto ast = FlatAst();
+    auto flattener = Flattener(ast);
+
+    auto roots = std::vector<NodeIndex>();
+    roots.reserve(program.size());
+    for (u64 i = 0; i < program.size(); ++i) {
+        flattener.m_first_line = first_lines[i];
+        roots.push_back(flattener.flatten(program[i]));
+    }
+
+    ast.set_roots(roots);
+    ast.shrink_to_fit();
+    return ast;
+}
@@ -0,0 +1,157 @@
+#ifndef LOX_FLAT_AST_HPP
+#define LOX_FLAT_AST_HPP
+
+#include <limits>
+#include <map>
+#include <memory>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "statements.hpp"
+#include "../scanner/Token.hpp"
+#include "../util_types.hpp"
+
+namespace parser {
+    /// @brief Identifies a node in a `FlatAst`.
+    using NodeIndex = u32;
+
+    /// @brief Marks an optional child that is not there, e.g. a `for` loop without an update.
+    inline constexpr NodeIndex NO_NODE = std::numeric_limits<NodeIndex>::max();
+
+    enum class NodeKind : u8 {
+        Literal, Variable, Unary, Binary, Ternary, Assign, Grouping, Logical, Call, Get, Set, Super,
+        ListLiteral, Index, IndexSet,
+        ExprStmt, PrintStmt, VariableDecl, Block, IfStmt, WhileLoop, ForLoop, FunctionDecl, ReturnStmt, ClassDecl,
+        ForInLoop
+    };
+
+    inline constexpr std::size_t NODE_KIND_COUNT = static_cast<std::size_t>(NodeKind::ForInLoop) + 1;
+
+    /// @return Whether `kind` is a kind of expression. Expression kinds are listed first,
+    /// in the order of `Expr::Variant`.
+    inline bool is_expr(NodeKind kind) {
+        return kind < NodeKind::ExprStmt;
+    }
+
+    const char* to_string(NodeKind kind);
+
+    /// @return The kind of `expr`.
+    inline NodeKind kind_of(const Expr& expr) {
+        return static_cast<NodeKind>(expr.m_node.index());
+    }
+
+    /// @return The kind of `stmt`. Statement kinds are listed in the order of `Statement::Variant`.
+    inline NodeKind kind_of(const Statement& stmt) {
+        return static_cast<NodeKind>(static_cast<std::size_t>(NodeKind::ExprStmt) + stmt.m_stmt.index());
+    }
+
+    /// @brief An AST stored as parallel arrays instead of a tree of heap nodes. Every node
+    /// has a kind, an operator, a line and three 32-bit operands; literal values, names and
+    /// statement lists live in side tables the operands index into.
+    ///
+    /// Nodes are appended after their children, so indices increase in evaluation order
+    /// and a pass that does not care about nesting can simply loop over `0..size()`.
+    ///
+    /// It is a diagnostic form, lowered from the pointer tree after parsing: `--ast-stats`
+    /// counts and measures it, and `--replay-edits` compares programs through it. The
+    /// parser, the analyses and both backends all work on the pointer tree.
+    ///
+    /// What the operands mean for each kind:
+    /// - `Literal`: first = index into `literal()`.
+    /// - `Variable`: first = name, second = slot.
+    /// - `Unary`: first = argument.
+    /// - `Binary`, `Logical`: first = left, second = right.
+    /// - `Ternary`: condition, success, failure.
+    /// - `Assign`: first = value, second = name, third = slot.
+    /// - `Call`: first = callee, second = offset of the arguments in `list()`, third = their count.
+    /// - `Get`: first = object, second = name.
+    /// - `Set`: first = object, second = name, third = value.
+    /// - `Super`: first = method name, second = slot of `super`.
+    /// - `ListLiteral`: first = offset of the elements in `list()`, second = their count.
+    /// - `Index`: first = object, second = index.
+    /// - `IndexSet`: object, index, value.
+    /// - `Grouping`, `ExprStmt`, `PrintStmt`: first = inner expression.
+    /// - `VariableDecl`: first = initializer or `NO_NODE`, second = name, third = slot.
+    /// - `Block`: first = offset into `list()`, second = statement count, third = slot count.
+    /// - `IfStmt`: condition, then clause, else clause or `NO_NODE`.
+    /// - `WhileLoop`: first = condition, second = body.
+    /// - `ForLoop`: first = offset of 4 entries in `list()`: initializer, condition, update
+    ///   (each possibly `NO_NODE`) and body.
+    /// - `FunctionDecl`: first = offset in `list()` of the parameter count, the body's
+    ///   statement count, the parameters' names and the body; second = name, third = slot.
+    /// - `ReturnStmt`: first = value or `NO_NODE`.
+    /// - `ClassDecl`: first = offset in `list()` of the superclass or `NO_NODE`, the method
+    ///   count and the methods; second = name, third = slot.
+    /// - `ForInLoop`: first = offset of 2 entries in `list()`: the iterable and the body;
+    ///   second = name of the variable, third = its slot.
+    ///
+    /// Slots are stored as the bits of the `i32` the `Resolver` assigned.
+    class FlatAst {
+    private:
+        std::vector<NodeKind> m_kinds;
+        std::vector<scanner::TokenType> m_operators;
+        std::vector<u32> m_lines;
+        std::vector<NodeIndex> m_first;
+        std::vector<NodeIndex> m_second;
+        std::vector<NodeIndex> m_third;
+
+        std::vector<LiteralValue> m_literals;
+        std::map<LiteralValue, u32> m_literal_ids;
+        std::vector<std::string> m_names;
+        std::unordered_map<std::string, u32> m_name_ids;
+        std::vector<NodeIndex> m_lists;
+        u32 m_roots_offset { 0 };
+        u32 m_root_count { 0 };
+
+    public:
+        /// @brief Lowers a parsed program into flat form.
+        static FlatAst flatten(const std::vector<std::unique_ptr<Statement>>& program);
+
+        /// @brief Lowers top-level statements whose lines count from `first_lines`, one
+        /// for each, like those an `IncrementalParser` keeps.
+        static FlatAst flatten(std::span<const Statement* const> program, std::span<const u32> first_lines);
+
+        bool operator==(const FlatAst&) const = default;
+
+        u32 size() const { return m_kinds.size(); }
+
+        NodeKind kind(NodeIndex node) const { return m_kinds[node]; }
+        scanner::TokenType operation(NodeIndex node) const { return m_operators[node]; }
+        u32 line(NodeIndex node) const { return m_lines[node]; }
+        NodeIndex first(NodeIndex node) const { return m_first[node]; }
+        NodeIndex second(NodeIndex node) const { return m_second[node]; }
+        NodeIndex third(NodeIndex node) const { return m_third[node]; }
+
+        /// @brief The kind of every node, for passes that scan the whole program at once.
+        std::span<const NodeKind> kinds() const { return m_kinds; }
+
+        const LiteralValue& literal(u32 index) const { return m_literals[index]; }
+        const std::string& name(u32 index) const { return m_names[index]; }
+        std::span<const NodeIndex> list(u32 offset, u32 count) const {
+            return std::span<const NodeIndex>(m_lists).subspan(offset, count);
+        }
+
+        /// @brief The top-level statements of the program, in order.
+        std::span<const NodeIndex> roots() const { return list(m_roots_offset, m_root_count); }
+
+        /// @brief Bytes held by the node arrays and side tables.
+        u64 memory_usage() const;
+
+        /// @brief Releases the spare capacity and lookup tables left over from building.
+        /// Nodes can still be added afterwards, but literals and names are no longer shared.
+        void shrink_to_fit();
+
+        /// @brief Used by `flatten` to build the arrays.
+        NodeIndex add_node(NodeKind kind, scanner::TokenType operation, u32 line,
+            NodeIndex first = NO_NODE, NodeIndex second = NO_NODE, NodeIndex third = NO_NODE);
+
+        /// @brief Adds a value to the literal table, or finds the identical one already there.
+        u32 add_literal(const LiteralValue& value);
+        u32 add_name(const std::string& name);
+        u32 add_list(std::span<const NodeIndex> nodes);
+        void set_roots(std::span<const NodeIndex> roots);
+    };
+}
+
+#endif
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <iterator>
+#include "IncrementalParser.hpp"
+#include "Parser.hpp"
+#include "../scanner/Scanner.hpp"
+
+using namespace parser;
+
+using scanner::Token;
+using scanner::TokenType;
+
+IncrementalParser::IncrementalParser(const std::string& source) : m_declarations(parse(source)) {
+    if (m_declarations.empty()) {
+        m_declarations.emplace_back();
+        m_declarations.back().m_clean_end = true;
+    }
+}
+
+std::vector<IncrementalParser::Declaration> IncrementalParser::parse(const std::string& text) {
+    auto tokens = scanner::Scanner(text).tokenize();
+
+    // The parser takes the tokens, so remember where each one ends and what it was first.
+    auto token_ends = std::vector<u64>();
+    auto token_types = std::vector<TokenType>();
+    token_ends.reserve(tokens.size());
+    token_types.reserve(tokens.size());
+    for (const auto& token : tokens) {
+        token_ends.push_back(token->offset() + token->lexeme().size());
+        token_types.push_back(token->type());
+    }
+
+    auto parser = Parser(std::move(tokens));
+    auto statements = parser.parse();
+    const auto& declaration_ends = parser.declaration_ends();
+    const auto& declaration_errors = parser.declaration_errors();
+
+    auto declarations = std::vector<Declaration>();
+    u64 start = 0;
+    u64 line = 0;
+
+    if (statements.size() == declaration_ends.size()) {
+        declarations.reserve(statements.size() + 1);
+        for (u64 i = 0; i < statements.size(); ++i) {
+            auto last_token = declaration_ends[i] - 1;
+            auto end = token_ends[last_token];
+
+            auto& declaration = declarations.emplace_back();
+            declaration.m_text = text.substr(start, end - start);
+            declaration.m_newlines = std::count(declaration.m_text.begin(), declaration.m_text.end(), '\n');
+            // An error inside a nested block leaves a tree with a hole in it, which must
+            // not be reused or trusted to end where it seems to.
+            if (!declaration_errors[i]) declaration.m_statement = std::move(statements[i]);
+            if (declaration.m_statement && line > 0) shift_lines(*declaration.m_statement, -static_cast<i64>(line));
+            declaration.m_clean_end = declaration.m_statement
+                && (token_types[last_token] == TokenType::Semicolon || token_types[last_token] == TokenType::RightBrace);
+
+            start = end;
+            line += declaration.m_newlines;
+        }
+    }
+
+    // Whatever follows the last declaration is whitespace, comments or text that did not
+    // scan. It is kept on its own, and nothing after it can be trusted to parse alone.
+    if (start < text.size()) {
+        auto& trailing = declarations.emplace_back();
+        trailing.m_text = text.substr(start);
+        trailing.m_newlines = std::count(trailing.m_text.begin(), trailing.m_text.end(), '\n');
+    }
+
+    return declarations;
+}
+
+void IncrementalParser::edit(u64 offset, u64 length, const std::string& text) {
+    // Find the declaration holding the character before the edit, since the edit may
+    // extend its last token, then back up past any declaration that did not end cleanly.
+    u64 first = 0;
+    u64 position = 0;
+    auto anchor = offset > 0 ? offset - 1 : 0;
+    while (first + 1 < m_declarations.size() && position + m_declarations[first].m_text.size() <= anchor) {
+        position += m_declarations[first].m_text.size();
+        ++first;
+    }
+
+    while (first > 0 && !m_declarations[first - 1].m_clean_end) {
+        --first;
+        position -= m_declarations[first].m_text.size();
+    }
+
+    // The region runs at least up to the declaration holding the first untouched character,
+    // and takes in any after it that did not parse, like an `else` cut off from its `if`,
+    // since the edit may be what they were missing.
+    auto last = first;
+    auto region = m_declarations[first].m_text;
+    while (last + 1 < m_declarations.size() && position + region.size() <= offset + length)
+        region += m_declarations[++last].m_text;
+    while (last + 1 < m_declarations.size() && !m_declarations[last + 1].m_statement)
+        region += m_declarations[++last].m_text;
+
+    region.replace(offset - position, length, text);
+
+    m_last_edit = EditStats();
+    auto parsed = std::vector<Declaration>();
+    u64 absorb = 1;
+    while (true) {
+        m_last_edit.m_rescanned_bytes += region.size();
+        parsed = parse(region);
+
+        // A declaration that starts the region and does not parse, like an `else`, may
+        // belong to the one before it, so that one is taken in too.
+        if (first > 0 && !parsed.empty() && !parsed.front().m_statement) {
+            do {
+                region.insert(0, m_declarations[--first].m_text);
+            } while (first > 0 && !m_declarations[first - 1].m_clean_end);
+            continue;
+        }
+
+        bool clean = parsed.empty() || parsed.back().m_clean_end;
+        if (clean || last + 1 == m_declarations.size()) break;
+
+        // The edit reaches past the region, e.g. it opened a string. Take in more of the
+        // following declarations, doubling each time so a runaway edit stays linear.
+        for (u64 i = 0; i < absorb && last + 1 < m_declarations.size(); ++i)
+            region += m_declarations[++last].m_text;
+        absorb *= 2;
+    }
+
+    m_last_edit.m_reparsed_declarations = parsed.size();
+    auto replaced = m_declarations.begin() + first;
+    replaced = m_declarations.erase(replaced, replaced + (last - first + 1));
+    m_declarations.insert(replaced, std::make_move_iterator(parsed.begin()), std::make_move_iterator(parsed.end()));
+
+    if (m_declarations.empty()) {
+        m_declarations.emplace_back();
+        m_declarations.back().m_clean_end = true;
+    }
+
+    m_last_edit.m_reused_declarations = m_declarations.size() - parsed.size();
+}
+
+std::vector<IncrementalParser::TopLevel> IncrementalParser::program() const {
+    auto statements = std::vector<TopLevel>();
+    statements.reserve(m_declarations.size());
+    u64 line = 0;
+    for (const auto& declaration : m_declarations) {
+        if (declaration.m_statement) statements.push_back({ declaration.m_statement.get(), line });
+        line += declaration.m_newlines;
+    }
+    return statements;
+}
+
+std::string IncrementalParser::source() const {
+    auto text = std::string();
+    for (const auto& declaration : m_declarations)
+        text += declaration.m_text;
+    return text;
+}
+
+namespace {
+    /// @brief Visits every token stored in a tree and moves it by a fixed number of lines.
+    class LineShifter {
+    private:
+        i64 m_delta;
+
+    public:
+        LineShifter(i64 delta) : m_delta(delta) {}
+
+        void shift(Statement* stmt) {
+            if (stmt) std::visit([this](auto&& s) { shift_node(s); }, stmt->m_stmt);
+        }
+
+        void shift(Expr& expr) {
+            std::visit([this](auto&& e) { shift_node(e); }, expr.m_node);
+        }
+
+    private:
+        void shift(Token& token) {
+            token.set_line(token.line() + m_delta);
+        }
+
+        void shift(std::optional<std::unique_ptr<Expr>>& expr) {
+            if (expr.has_value()) shift(*expr.value());
+        }
+
+        void shift_node(Literal&) {}
+        void shift_node(Variable& variable) { shift(variable.m_name); }
+        void shift_node(Grouping& grouping) { shift(*grouping.m_inner_expr); }
+
+        void shift_node(Unary& unary) {
+            shift(unary.m_operator);
+            shift(*unary.m_argument);
+        }
+
+        void shift_node(Binary& binary) {
+            shift(binary.m_operator);
+            shift(*binary.m_left);
+            shift(*binary.m_right);
+        }
+
+        void shift_node(Logical& logical) {
+            shift(logical.m_operator);
+            shift(*logical.m_left);
+            shift(*logical.m_right);
+        }
+
+        void shift_node(Ternary& ternary) {
+            shift(*ternary.m_condition);
+            shift(*ternary.m_success);
+            shift(*ternary.m_failure);
+        }
+
+        void shift_node(Assign& assign) {
+            shift(assign.m_name);
+            shift(*assign.m_value);
+        }
+
+        void shift_node(Call& call) {
+            shift(call.m_paren);
+            shift(*call.m_callee);
+            for (auto& argument : call.m_arguments)
+                shift(*argument);
+        }
+
+        void shift_node(Get& get) {
+            shift(get.m_name);
+            shift(*get.m_object);
+        }
+
+        void shift_node(Set& set) {
+            shift(set.m_name);
+            shift(*set.m_object);
+            shift(*set.m_value);
+        }
+
+        void shift_node(Super& super) { shift(super.m_method); }
+
+        void shift_node(ListLiteral& list) {
+            shift(list.m_bracket);
+            for (auto& element : list.m_elements)
+                shift(*element);
+        }
+
+        void shift_node(Index& index) {
+            shift(index.m_bracket);
+            shift(*index.m_object);
+            shift(*index.m_index);
+        }
+
+        void shift_node(IndexSet& set) {
+            shift(set.m_bracket);
+            shift(*set.m_object);
+            shift(*set.m_index);
+            shift(*set.m_value);
+        }
+
+        void shift_node(ExprStmt& stmt) { shift(*stmt.m_expr); }
+        void shift_node(PrintStmt& stmt) { shift(*stmt.m_expr); }
+
+        void shift_node(VariableDecl& decl) {
+            shift(decl.m_name);
+            shift(decl.m_initializer);
+        }
+
+        void shift_node(Block& block) {
+            block.m_line += m_delta;
+            for (auto& stmt : block.m_statements)
+                shift(stmt.get());
+        }
+
+        void shift_node(IfStmt& stmt) {
+            shift(*stmt.m_condition);
+            shift(stmt.m_then_clause.get());
+            if (stmt.m_else_clause.has_value()) shift(stmt.m_else_clause.value().get());
+        }
+
+        void shift_node(WhileLoop& loop) {
+            loop.m_line += m_delta;
+            shift(*loop.m_condition);
+            shift(loop.m_body.get());
+        }
+
+        void shift_node(ForLoop& loop) {
+            loop.m_line += m_delta;
+            if (loop.m_initializer.has_value()) shift(loop.m_initializer.value().get());
+            shift(loop.m_condition);
+            shift(loop.m_update);
+            shift(loop.m_body.get());
+            if (loop.m_parallel) {
+                shift(loop.m_parallel->m_keyword);
+                for (auto& reduction : loop.m_parallel->m_reductions)
+                    shift(reduction.m_name);
+            }
+        }
+
+        void shift_node(ForInLoop& loop) {
+            shift(loop.m_name);
+            shift(*loop.m_iterable);
+            shift(loop.m_body.get());
+        }
+
+        void shift_node(FunctionDecl& decl) {
+            shift(decl.m_name);
+            for (auto& param : decl.m_function->m_params)
+                shift(param);
+            for (auto& stmt : decl.m_function->m_body)
+                shift(stmt.get());
+        }
+
+        void shift_node(ClassDecl& decl) {
+            shift(decl.m_name);
+            shift(decl.m_class->m_superclass);
+            for (auto& method : decl.m_class->m_methods)
+                shift_node(method);
+        }
+
+        void shift_node(ReturnStmt& stmt) {
+            shift(stmt.m_keyword);
+            shift(stmt.m_value);
+        }
+    };
+}
+
+void IncrementalParser::shift_lines(Statement& stmt, i64 delta) {
+    LineShifter(delta).shift(&stmt);
+}
@@ -0,0 +1,82 @@
+#ifndef LOX_INCREMENTAL_PARSER_HPP
+#define LOX_INCREMENTAL_PARSER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "statements.hpp"
+#include "../util_types.hpp"
+
+namespace parser {
+    /// @brief Keeps a parsed program up to date while its source is edited, for tools
+    /// that would otherwise re-run the whole front end on every keystroke.
+    ///
+    /// The source is held as a sequence of top-level declarations, each owning its text
+    /// (including the whitespace and comments in front of it) and its syntax tree. An edit
+    /// re-scans and re-parses only the declarations it touches, and those next to them that
+    /// failed to parse. A region is widened to the next declaration while it does not end
+    /// cleanly on a `;` or `}`, which covers edits that open a block, a string or a comment
+    /// swallowing the code after it, and to the previous one while it starts with one that
+    /// does not parse, which covers an `else` cut off from its `if`.
+    /// Every other declaration keeps its tree untouched. The lines in each tree count from
+    /// the line its declaration starts on, so an edit that adds or removes lines moves the
+    /// declarations after it without visiting them; `program` says where each one starts.
+    class IncrementalParser {
+    public:
+        /// @brief A top-level statement, whose tokens' lines count from `m_first_line`.
+        struct TopLevel {
+            const Statement* m_statement;
+            u64 m_first_line;
+        };
+
+        /// @brief What the last call to `edit` had to redo.
+        struct EditStats {
+            u64 m_rescanned_bytes { 0 };
+            u64 m_reparsed_declarations { 0 };
+            u64 m_reused_declarations { 0 };
+        };
+
+    private:
+        struct Declaration {
+            std::string m_text;
+            u64 m_newlines { 0 };
+
+            /// @brief Null for trailing whitespace or a declaration with syntax errors.
+            std::unique_ptr<Statement> m_statement;
+
+            /// @brief Whether the text ends on a complete declaration, so the text after
+            /// it can be parsed without looking back.
+            bool m_clean_end { false };
+        };
+
+        std::vector<Declaration> m_declarations;
+        EditStats m_last_edit;
+
+    public:
+        explicit IncrementalParser(const std::string& source);
+
+        /// @brief Replaces `length` bytes starting at `offset` with `text`, then brings the
+        /// program up to date. Syntax errors are reported through `lox::error` as usual.
+        void edit(u64 offset, u64 length, const std::string& text);
+
+        /// @brief The current top-level statements, in order, and the lines they start on.
+        /// Declarations with syntax errors are left out.
+        std::vector<TopLevel> program() const;
+
+        /// @brief The whole current source text.
+        std::string source() const;
+
+        const EditStats& last_edit() const {
+            return m_last_edit;
+        }
+
+    private:
+        /// @brief Scans and parses `text` into declarations.
+        static std::vector<Declaration> parse(const std::string& text);
+
+        /// @brief Moves every token in a tree down by `delta` lines.
+        static void shift_lines(Statement& stmt, i64 delta);
+    };
+}
+
+#endif
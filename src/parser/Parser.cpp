@@ -1,4 +1,7 @@
+#include <array>
+#include <charconv>
 #include <memory>
+#include <utility>
 #include "Parser.hpp"
 #include "../lox.hpp"
 
@@ -6,44 +9,92 @@ using namespace parser;
 
 std::vector<std::unique_ptr<Statement>> Parser::program() {
     auto statements = std::vector<std::unique_ptr<Statement>>();
-    while (!is_at_end())
+    while (!is_at_end()) {
+        auto errors = m_errors;
         statements.push_back(declaration());
+        m_declaration_ends.push_back(m_position);
+        m_declaration_errors.push_back(m_errors != errors);
+    }
 
     return statements;
 }
 
+std::unique_ptr<Statement> Parser::next_declaration() {
+    auto errors = m_errors;
+    auto stmt = declaration();
+    m_declaration_ends.push_back(m_position);
+    m_declaration_errors.push_back(m_errors != errors);
+    if (!stmt) return nullptr;
+
+    auto program = std::vector<std::unique_ptr<Statement>>();
+    program.push_back(std::move(stmt));
+    Resolver().resolve(program);
+    m_inference.infer_declaration(*program.front());
+    return std::move(program.front());
+}
+
+void Parser::scan_ahead() {
+    if (!m_scanner->tokenize_some(m_tokens, SCAN_BATCH)) m_scanner = nullptr;
+}
+
 std::unique_ptr<Statement> Parser::statement() {
-    if (match({ TokenType::Print }))
+    if (match(TokenType::Print))
         return print_statement();
 
-    if (match({ TokenType::LeftBrace }))
+    if (match(TokenType::LeftBrace))
         return block();
 
-    if (match({ TokenType::If }))
+    if (match(TokenType::If))
         return if_stmt();
 
-    if (match({ TokenType::While }))
+    if (match(TokenType::While))
         return while_loop();
 
-    if (match({ TokenType::For }))
+    if (match(TokenType::For))
         return for_loop();
 
+    if (match(TokenType::Parallel))
+        return parallel_for();
+
+    if (match(TokenType::Return))
+        return return_stmt();
+
     return expr_statement();
 }
 
-std::unique_ptr<Statement> Parser::block() {
+std::vector<std::unique_ptr<Statement>> Parser::block_statements() {
     auto statements = std::vector<std::unique_ptr<Statement>>();
-    
-    while (!match({ TokenType::RightBrace }))
+    while (!check(TokenType::RightBrace) && !is_at_end())
         statements.push_back(declaration());
 
-    return std::make_unique<Statement>(
+    consume(TokenType::RightBrace, "Expected '}'.");
+    return statements;
+}
+
+std::unique_ptr<Statement> Parser::block() {
+    auto line = previous().line();
+    return make_stmt(
         Block {
-            std::move(statements)
+            block_statements(),
+            line
         }
     );
 }
 
+std::unique_ptr<Statement> Parser::return_stmt() {
+    const auto& keyword = previous();
+
+    std::optional<std::unique_ptr<Expr>> value {};
+    if (!check(TokenType::Semicolon))
+        value = expr();
+
+    consume(TokenType::Semicolon, "Expected ';'.");
+    return make_stmt(ReturnStmt {
+        keyword,
+        std::move(value)
+    });
+}
+
 std::unique_ptr<Statement> Parser::if_stmt() {
     consume(TokenType::LeftParen, "Expected '('.");
     auto condition = expr();
@@ -51,10 +102,10 @@ std::unique_ptr<Statement> Parser::if_stmt() {
     auto then_clause = statement();
 
     std::optional<std::unique_ptr<Statement>> else_clause {};
-    if (match({ TokenType::Else }))
+    if (match(TokenType::Else))
         else_clause = statement();
 
-    return std::make_unique<Statement>(
+    return make_stmt(
         IfStmt {
             std::move(condition),
             std::move(then_clause),
@@ -66,7 +117,7 @@ std::unique_ptr<Statement> Parser::if_stmt() {
 std::unique_ptr<Statement> Parser::expr_statement() {
     auto expression = expr();
     consume(TokenType::Semicolon, "Expected ';'.");
-    return std::make_unique<Statement>(
+    return make_stmt(
         ExprStmt {
             std::move(expression)
         }
@@ -76,7 +127,7 @@ std::unique_ptr<Statement> Parser::expr_statement() {
 std::unique_ptr<Statement> Parser::print_statement() {
     auto expression = expr();
     consume(TokenType::Semicolon, "Expected ';'.");
-    return std::make_unique<Statement>(
+    return make_stmt(
         PrintStmt {
             std::move(expression)
         }
@@ -84,27 +135,31 @@ std::unique_ptr<Statement> Parser::print_statement() {
 }
 
 std::unique_ptr<Statement> Parser::while_loop() {
+    auto line = previous().line();
     consume(TokenType::LeftParen, "Expected '('.");
     auto condition = expr();
 
     consume(TokenType::RightParen, "Expected ')'.");
     auto body = statement();
     
-    return std::make_unique<Statement>(
+    return make_stmt(
         WhileLoop {
             std::move(condition),
-            std::move(body)
+            std::move(body),
+            line
         }
     );
 }
 
 std::unique_ptr<Statement> Parser::for_loop() {
+    auto line = previous().line();
     consume(TokenType::LeftParen, "Expected '('.");
+    if (starts_for_in()) return for_in_loop();
 
     std::optional<std::unique_ptr<Statement>> initializer;
-    if (match({ TokenType::Semicolon }))
+    if (match(TokenType::Semicolon))
         initializer = {};
-    else if (match({ TokenType::Var }))
+    else if (match(TokenType::Var))
         initializer = variable_decl();
     else
         initializer = expr_statement();
@@ -121,239 +176,333 @@ std::unique_ptr<Statement> Parser::for_loop() {
 
     auto body = statement();
 
-    return std::make_unique<Statement>(ForLoop { 
+    return make_stmt(ForLoop { 
         std::move(initializer), 
         std::move(condition), 
         std::move(update), 
-        std::move(body) 
+        std::move(body),
+        line
     });
 }
 
-std::unique_ptr<Expr> Parser::expr() {
-    return assign();
-}
-
-std::unique_ptr<Expr> Parser::assign() {
-    auto left = ternary();
-
-    if (match({ TokenType::Equal })) {
-        auto equals = previous();
-        auto right = assign();
-        if (std::holds_alternative<Variable>(left->m_node)) {
-            auto name = std::get<Variable>(left->m_node).m_name;
-            return std::make_unique<Expr>(Assign {
-                name,
-                std::move(right)
-            });
-        }
-        error(equals, "Invalid assignment.");
-    }
-
-    return left;
-}
-
-std::unique_ptr<Expr> Parser::ternary() {
-    auto condition = logic_or();
-    if (!match({ TokenType::QuestionMark })) return condition;
-
-    auto operator_1 = previous();
-
-    auto success = expr();
-    consume(TokenType::Colon, "Expected ':'.");
-
-    auto operator_2 = previous();
+std::unique_ptr<Statement> Parser::for_in_loop() {
+    advance();
+    const auto& name = advance();
+    advance();
+    auto iterable = expr();
+    consume(TokenType::RightParen, "Expected ')'.");
+    auto body = statement();
 
-    auto failure = expr();
-    return std::make_unique<Expr>(Ternary {
-        std::move(condition),
-        std::move(success),
-        std::move(failure)
+    return make_stmt(ForInLoop {
+        name,
+        std::move(iterable),
+        std::move(body)
     });
 }
 
-std::unique_ptr<Expr> Parser::logic_or() {
-    auto left = logic_and();
-
-    while (match({ TokenType::Or })) {
-        auto or_token = previous();
-        auto right = logic_and();
-        left = std::make_unique<Expr>(Logical {
-            std::move(left),
-            or_token,
-            std::move(right)
-        });
-    }
+std::unique_ptr<Statement> Parser::parallel_for() {
+    const auto& keyword = previous();
+    consume(TokenType::For, "Expected 'for' after 'parallel'.");
+    auto statement = for_loop();
+    auto counted = std::get_if<ForLoop>(&statement->m_stmt);
+
+    // The iterations are counted before any of them run, so the loop must count a
+    // variable of its own up to a limit.
+    auto counts_up = [counted]() {
+        if (!counted) return false;
+        const auto& loop = *counted;
+        auto variable = loop.m_initializer.has_value() && loop.m_initializer.value()
+            ? std::get_if<VariableDecl>(&loop.m_initializer.value()->m_stmt) : nullptr;
+        if (!variable || !variable->m_initializer.has_value()) return false;
+
+        auto names_variable = [variable](const Expr& expr) {
+            auto read = std::get_if<Variable>(&expr.m_node);
+            return read && read->m_name.lexeme() == variable->m_name.lexeme();
+        };
+
+        auto condition = loop.m_condition.has_value() ? std::get_if<Binary>(&loop.m_condition.value()->m_node) : nullptr;
+        if (!condition || !names_variable(*condition->m_left)) return false;
+        if (condition->m_operator.type() != TokenType::Less && condition->m_operator.type() != TokenType::LessEqual) return false;
+
+        auto update = loop.m_update.has_value() ? std::get_if<Assign>(&loop.m_update.value()->m_node) : nullptr;
+        if (!update || update->m_name.lexeme() != variable->m_name.lexeme()) return false;
+        auto increment = std::get_if<Binary>(&update->m_value->m_node);
+        return increment && increment->m_operator.type() == TokenType::Plus && names_variable(*increment->m_left);
+    };
+
+    if (!counts_up())
+        throw error(keyword, "Expected a loop of the form 'for (var i = start; i < limit; i = i + step)' after 'parallel'.");
+
+    auto& loop = *counted;
+    loop.m_parallel.reset(new Parallel { keyword });
+    loop.m_parallel->m_inclusive = std::get<Binary>(loop.m_condition.value()->m_node).m_operator.type() == TokenType::LessEqual;
+    return statement;
+}
 
-    return left;
+std::unique_ptr<Expr> Parser::expr() {
+    return parse_precedence(Precedence::Assignment);
 }
 
-std::unique_ptr<Expr> Parser::logic_and() {
-    auto left = equality();
+const ParseRule& Parser::rule(TokenType type) {
+    static const auto rules = [] {
+        auto table = std::array<ParseRule, static_cast<std::size_t>(TokenType::Eof) + 1> {};
+        auto set = [&table](TokenType type, ParseRule rule) {
+            table[static_cast<std::size_t>(type)] = rule;
+        };
+
+        set(TokenType::Number,       { &Parser::literal });
+        set(TokenType::String,       { &Parser::literal });
+        set(TokenType::True,         { &Parser::literal });
+        set(TokenType::False,        { &Parser::literal });
+        set(TokenType::Nil,          { &Parser::literal });
+        set(TokenType::Identifier,   { &Parser::variable });
+        set(TokenType::This,         { &Parser::this_expr });
+        set(TokenType::Super,        { &Parser::super_expr });
+        set(TokenType::LeftParen,    { &Parser::grouping, &Parser::call, Precedence::Call });
+        set(TokenType::Dot,          { nullptr, &Parser::dot, Precedence::Call });
+        set(TokenType::LeftBracket,  { &Parser::list_literal, &Parser::index, Precedence::Call });
+        set(TokenType::Bang,         { &Parser::unary, nullptr, Precedence::None, Precedence::Unary });
+        set(TokenType::Minus,        { &Parser::unary, &Parser::binary, Precedence::Term, Precedence::Unary });
+
+        set(TokenType::Equal,        { nullptr, &Parser::assign, Precedence::Assignment });
+        set(TokenType::QuestionMark, { nullptr, &Parser::ternary, Precedence::Ternary });
+        set(TokenType::Or,           { nullptr, &Parser::logical, Precedence::Or });
+        set(TokenType::And,          { nullptr, &Parser::logical, Precedence::And });
+        set(TokenType::EqualEqual,   { nullptr, &Parser::binary, Precedence::Equality });
+        set(TokenType::BangEqual,    { nullptr, &Parser::binary, Precedence::Equality });
+        set(TokenType::Comma,        { nullptr, &Parser::binary, Precedence::Compound, Precedence::Primary, true });
+        set(TokenType::Less,         { nullptr, &Parser::binary, Precedence::Comparison, Precedence::Primary, true });
+        set(TokenType::LessEqual,    { nullptr, &Parser::binary, Precedence::Comparison, Precedence::Primary, true });
+        set(TokenType::Greater,      { nullptr, &Parser::binary, Precedence::Comparison, Precedence::Primary, true });
+        set(TokenType::GreaterEqual, { nullptr, &Parser::binary, Precedence::Comparison, Precedence::Primary, true });
+        set(TokenType::Plus,         { nullptr, &Parser::binary, Precedence::Term });
+        set(TokenType::Star,         { nullptr, &Parser::binary, Precedence::Factor, Precedence::Primary, true });
+        set(TokenType::Slash,        { nullptr, &Parser::binary, Precedence::Factor, Precedence::Primary, true });
+        return table;
+    }();
+
+    return rules[static_cast<std::size_t>(type)];
+}
 
-    while (match({ TokenType::And })) {
-        auto and_token = previous();
-        auto right = equality();
-        left = std::make_unique<Expr>(Logical {
-            std::move(left),
-            and_token,
-            std::move(right)
-        });
+void Parser::validate_operand(Precedence precedence) {
+    // An operand that starts with a comma, comparison or factor operator, at a level that
+    // operator could have applied at, is missing its left-hand side.
+    const auto& leading = rule(peek().type());
+    if (leading.m_rejects_missing_operand && precedence <= leading.m_precedence) {
+        advance();
+        throw error(peek(), "Expected an expression.");
     }
-
-    return left;
 }
 
-std::unique_ptr<Expr> Parser::validate_equality() {
-    if (match({ TokenType::EqualEqual, TokenType::BangEqual }))
-        throw error(peek(), "Expected an expression");
+std::unique_ptr<Expr> Parser::parse_precedence(Precedence precedence) {
+    validate_operand(precedence);
 
-    return equality();
-}
+    const auto& prefix = rule(peek().type());
+    if (prefix.m_prefix == nullptr || prefix.m_prefix_precedence < precedence)
+        throw error(peek(), "Expected an expression.");
 
-std::unique_ptr<Expr> Parser::equality() {
-    auto left = validate_compound();
+    advance();
+    auto left = (this->*prefix.m_prefix)();
 
-    while (match({ TokenType::BangEqual, TokenType::EqualEqual })) {
-        auto& operation = previous();
-        auto right = validate_compound();
-        left = std::make_unique<Expr>(Binary {
-            operation,
-            std::move(left), 
-            std::move(right)
-        });
+    while (true) {
+        const auto& infix = rule(peek().type());
+        if (infix.m_infix == nullptr || infix.m_precedence < precedence) break;
+        if (!m_allow_comma && peek().type() == TokenType::Comma) break;
+        advance();
+        left = (this->*infix.m_infix)(std::move(left));
     }
 
     return left;
 }
 
-std::unique_ptr<Expr> Parser::validate_compound() {
-    if (match({ TokenType::Comma })) throw error(peek(), "Expected an expression.");
-    return compound();
+/// @brief The precedence the right operand of a left-associative operator is parsed at.
+static Precedence next(Precedence precedence) {
+    return static_cast<Precedence>(static_cast<int>(precedence) + 1);
 }
 
-std::unique_ptr<Expr> Parser::compound() {
-    auto left = validate_comparison();
+std::unique_ptr<Expr> Parser::literal() {
+    const auto& token = previous();
+    switch (token.type()) {
+        case TokenType::True: return make_expr(Literal { true });
+        case TokenType::False: return make_expr(Literal { false });
+        case TokenType::Nil: return make_expr(Literal { std::monostate {} });
+
+        case TokenType::Number: {
+            const auto& lexeme = token.lexeme();
+            double number = 0;
+            std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), number);
+            return make_expr(Literal { float(number) });
+        }
 
-    while (match({ TokenType::Comma })) {
-        auto& operation = previous();
-        auto right = validate_comparison();
-        left = std::make_unique<Expr>(Binary {
-            operation,
-            std::move(left), 
-            std::move(right)
-        });
+        default: {
+            const auto& lexeme = token.lexeme();
+            return make_expr(Literal { lexeme.substr(1, lexeme.length() - 2) });
+        }
     }
-
-    return left;
 }
 
-std::unique_ptr<Expr> Parser::validate_comparison() {
-    if (match({ TokenType::Less, TokenType::LessEqual, TokenType::Greater, TokenType::GreaterEqual }))
-        throw error(peek(), "Expected an expression.");
-    
-    return comparison();
+std::unique_ptr<Expr> Parser::variable() {
+    return make_expr(Variable { previous() });
 }
 
-std::unique_ptr<Expr> Parser::comparison() {
-    auto left = term();
+std::unique_ptr<Expr> Parser::this_expr() {
+    // `this` is a variable that every method declares, so it resolves like one.
+    if (m_classes.empty())
+        error(previous(), "Can't use 'this' outside of a class.");
+    return make_expr(Variable { previous() });
+}
 
-    while (match({ TokenType::Less, TokenType::LessEqual, TokenType::Greater, TokenType::GreaterEqual })) {
-        auto& operation = previous();
-        auto right = term();
-        left = std::make_unique<Expr>(Binary {
-            operation,
-            std::move(left), 
-            std::move(right)
-        });
-    }
+std::unique_ptr<Expr> Parser::super_expr() {
+    const auto& keyword = previous();
+    if (m_classes.empty())
+        error(keyword, "Can't use 'super' outside of a class.");
+    else if (!m_classes.back())
+        error(keyword, "Can't use 'super' in a class with no superclass.");
 
-    return left;
+    consume(TokenType::Dot, "Expected '.' after 'super'.");
+    const auto& method = consume(TokenType::Identifier, "Expected a superclass method name.");
+    return make_expr(Super { method });
 }
 
-std::unique_ptr<Expr> Parser::validate_term() {
-    if (match({ TokenType::Plus, TokenType::Minus })) throw error(peek(), "Expected an expression.");
-    return term();
+std::unique_ptr<Expr> Parser::grouping() {
+    auto allow_comma = std::exchange(m_allow_comma, true);
+    auto inner = expr();
+    m_allow_comma = allow_comma;
+    consume(TokenType::RightParen, "Expected ')' after expression.");
+    return make_expr(Grouping {
+        std::move(inner)
+    });
 }
 
-std::unique_ptr<Expr> Parser::term() {
-    auto left = validate_factor();
-
-    while (match({ TokenType::Plus, TokenType::Minus })) {
-        auto& operation = previous();
-        auto right = validate_factor();
-        left = std::make_unique<Expr>(Binary {
-            operation,
-            std::move(left), 
-            std::move(right)
-        });
-    }
+std::unique_ptr<Expr> Parser::unary() {
+    const auto& operation = previous();
+    auto argument = parse_precedence(Precedence::Call);
+    return make_expr(Unary { operation, std::move(argument) });
+}
 
-    return left;
+std::unique_ptr<Expr> Parser::binary(std::unique_ptr<Expr> left) {
+    const auto& operation = previous();
+    auto right = parse_precedence(next(rule(operation.type()).m_precedence));
+    return make_expr(Binary {
+        operation,
+        std::move(left),
+        std::move(right)
+    });
 }
 
-std::unique_ptr<Expr> Parser::validate_factor() {
-    if (match({ TokenType::Star, TokenType::Slash })) throw error(peek(), "Expected an expression.");
-    return factor();
+std::unique_ptr<Expr> Parser::logical(std::unique_ptr<Expr> left) {
+    const auto& operation = previous();
+    auto right = parse_precedence(next(rule(operation.type()).m_precedence));
+    return make_expr(Logical {
+        std::move(left),
+        operation,
+        std::move(right)
+    });
 }
 
-std::unique_ptr<Expr> Parser::factor() {
-    auto left = unary();
+std::unique_ptr<Expr> Parser::ternary(std::unique_ptr<Expr> condition) {
+    auto success = expr();
+    consume(TokenType::Colon, "Expected ':'.");
+    auto failure = expr();
+    return make_expr(Ternary {
+        std::move(condition),
+        std::move(success),
+        std::move(failure)
+    });
+}
 
-    while (match({ TokenType::Star, TokenType::Slash })) {
-        auto& operation = previous();
-        auto right = unary();
-        left = std::make_unique<Expr>(Binary {
-            operation,
-            std::move(left), 
-            std::move(right)
+std::unique_ptr<Expr> Parser::assign(std::unique_ptr<Expr> target) {
+    const auto& equals = previous();
+    auto value = parse_precedence(Precedence::Assignment);
+
+    auto variable = std::get_if<Variable>(&target->m_node);
+    if (variable && variable->m_name.type() == TokenType::Identifier) {
+        // The assignment takes the target's place, so the target no longer counts.
+        --m_nodes;
+        return make_expr(Assign {
+            variable->m_name,
+            std::move(value)
         });
     }
 
-    return left;
-}
+    if (auto get = std::get_if<Get>(&target->m_node)) {
+        --m_nodes;
+        return make_expr(Set {
+            std::move(get->m_object),
+            get->m_name,
+            std::move(value)
+        });
+    }
 
-std::unique_ptr<Expr> Parser::unary() {
-    if (match({ TokenType::Bang, TokenType::Minus })) {
-        auto& operation = previous();
-        auto argument = primary();
-        return std::make_unique<Expr>(Unary { operation, std::move(argument) });
+    if (auto index = std::get_if<Index>(&target->m_node)) {
+        --m_nodes;
+        return make_expr(IndexSet {
+            std::move(index->m_object),
+            index->m_bracket,
+            std::move(index->m_index),
+            std::move(value)
+        });
     }
 
-    return primary();
+    error(equals, "Invalid assignment.");
+    return target;
 }
 
-std::unique_ptr<Expr> Parser::primary() {
-    if (match({ TokenType::True })) 
-        return std::make_unique<Expr>(Literal { true });
-    
-    if (match({ TokenType::False }))
-        return std::make_unique<Expr>(Literal { false });
+std::unique_ptr<Expr> Parser::call(std::unique_ptr<Expr> callee) {
+    auto arguments = std::vector<std::unique_ptr<Expr>>();
+    auto allow_comma = std::exchange(m_allow_comma, false);
+    if (!check(TokenType::RightParen)) {
+        do {
+            if (arguments.size() == MAX_PARAMETERS)
+                error(peek(), "Can't have more than 255 arguments.");
+            arguments.push_back(expr());
+        } while (match(TokenType::Comma));
+    }
+    m_allow_comma = allow_comma;
 
-    if (match({ TokenType::Nil }))
-        return std::make_unique<Expr>(Literal { std::monostate {} });
+    const auto& paren = consume(TokenType::RightParen, "Expected ')' after arguments.");
+    return make_expr(Call {
+        std::move(callee),
+        paren,
+        std::move(arguments)
+    });
+}
 
-    if (match({ TokenType::Number }))
-        return std::make_unique<Expr>(Literal { float(std::stod(previous().lexeme())) });
+std::unique_ptr<Expr> Parser::dot(std::unique_ptr<Expr> object) {
+    const auto& name = consume(TokenType::Identifier, "Expected a property name after '.'.");
+    return make_expr(Get {
+        std::move(object),
+        name
+    });
+}
 
-    if (match({ TokenType::String })) {
-        auto& lexeme = previous().lexeme();
-        return std::make_unique<Expr>(Literal { lexeme.substr(1, lexeme.length() - 2) });
+std::unique_ptr<Expr> Parser::list_literal() {
+    auto elements = std::vector<std::unique_ptr<Expr>>();
+    auto allow_comma = std::exchange(m_allow_comma, false);
+    if (!check(TokenType::RightBracket)) {
+        do {
+            elements.push_back(expr());
+        } while (match(TokenType::Comma));
     }
+    m_allow_comma = allow_comma;
 
-    if (match({ TokenType::Identifier }))
-        return std::make_unique<Expr>(Variable { previous() });
-
-    if (match({ TokenType::LeftParen }))
-        return grouping();
-
-    throw error(peek(), "Expected an expression.");
+    const auto& bracket = consume(TokenType::RightBracket, "Expected ']' after the elements.");
+    return make_expr(ListLiteral {
+        bracket,
+        std::move(elements)
+    });
 }
 
-std::unique_ptr<Expr> Parser::grouping() {
-    auto inner = expr();
-    consume(TokenType::RightParen, "Expected ')' after expression.");
-    return std::make_unique<Expr>(Grouping {
-        std::move(inner)
+std::unique_ptr<Expr> Parser::index(std::unique_ptr<Expr> object) {
+    auto allow_comma = std::exchange(m_allow_comma, true);
+    auto position = expr();
+    m_allow_comma = allow_comma;
+
+    const auto& bracket = consume(TokenType::RightBracket, "Expected ']' after the index.");
+    return make_expr(Index {
+        std::move(object),
+        bracket,
+        std::move(position)
     });
 }
 
@@ -364,8 +513,8 @@ void Parser::synchronize() {
 
         switch (peek().type()) {
             case TokenType::Class: case TokenType::For: case TokenType::Fun:
-            case TokenType::If: case TokenType::Print: case TokenType::Return:
-            case TokenType::Var: case TokenType::While:
+            case TokenType::If: case TokenType::Parallel: case TokenType::Print:
+            case TokenType::Return: case TokenType::Var: case TokenType::While:
                 return;
                 
             default: break;
@@ -379,21 +528,86 @@ std::unique_ptr<Statement> Parser::variable_decl() {
     auto name = consume(TokenType::Identifier, "Expected an identifier.");
 
     std::optional<std::unique_ptr<Expr>> initializer {};
-    if (match({ TokenType::Equal }))
+    if (match(TokenType::Equal))
         initializer = expr();
 
     consume(TokenType::Semicolon, "Expected ';'.");
-    return std::make_unique<Statement>(VariableDecl {
+    return make_stmt(VariableDecl {
         name,
         std::move(initializer)
     });
 }
 
+std::unique_ptr<Statement> Parser::function_decl() {
+    return make_stmt(function(FunctionKind::Function));
+}
+
+FunctionDecl Parser::function(FunctionKind kind) {
+    const auto& name = consume(TokenType::Identifier, kind == FunctionKind::Function ? "Expected a function name." : "Expected a method name.");
+    if (kind == FunctionKind::Method && name.lexeme() == "init")
+        kind = FunctionKind::Initializer;
+    consume(TokenType::LeftParen, "Expected '('.");
+
+    auto params = std::vector<scanner::Token>();
+    if (!check(TokenType::RightParen)) {
+        do {
+            if (params.size() == MAX_PARAMETERS)
+                error(peek(), "Can't have more than 255 parameters.");
+            params.push_back(consume(TokenType::Identifier, "Expected a parameter name."));
+        } while (match(TokenType::Comma));
+    }
+
+    consume(TokenType::RightParen, "Expected ')'.");
+    consume(TokenType::LeftBrace, "Expected '{'.");
+    auto body = block_statements();
+
+    return FunctionDecl {
+        name,
+        std::move(params),
+        std::move(body),
+        kind
+    };
+}
+
+std::unique_ptr<Statement> Parser::class_decl() {
+    const auto& name = consume(TokenType::Identifier, "Expected a class name.");
+
+    std::optional<std::unique_ptr<Expr>> superclass {};
+    if (match(TokenType::Less)) {
+        const auto& superclass_name = consume(TokenType::Identifier, "Expected a superclass name.");
+        if (superclass_name.lexeme() == name.lexeme())
+            error(superclass_name, "A class can't inherit from itself.");
+        superclass = make_expr(Variable { superclass_name });
+    }
+
+    consume(TokenType::LeftBrace, "Expected '{'.");
+    m_classes.push_back(superclass.has_value());
+    auto methods = std::vector<FunctionDecl>();
+    while (!check(TokenType::RightBrace) && !is_at_end()) {
+        // Methods are nodes too, though not statements of their own.
+        methods.push_back(function(FunctionKind::Method));
+        ++m_nodes;
+    }
+    m_classes.pop_back();
+    consume(TokenType::RightBrace, "Expected '}'.");
+
+    return make_stmt(ClassDecl {
+        name,
+        std::move(superclass),
+        std::move(methods)
+    });
+}
+
 std::unique_ptr<Statement> Parser::declaration() {
+    auto class_depth = m_classes.size();
     try {
-        if (match({ TokenType::Var })) return variable_decl();
+        if (match(TokenType::Var)) return variable_decl();
+        if (match(TokenType::Fun)) return function_decl();
+        if (match(TokenType::Class)) return class_decl();
         return statement();
     } catch(const ParseError& error) {
+        m_allow_comma = true;
+        m_classes.resize(class_depth);
         synchronize();
         return nullptr;
     }
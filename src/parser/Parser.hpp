@@ -6,9 +6,54 @@
 #include <vector>
 #include <memory>
 #include "statements.hpp"
+#include "Resolver.hpp"
+#include "TypeInference.hpp"
+#include "../scanner/Scanner.hpp"
 #include "../scanner/Token.hpp"
+#include "../trace.hpp"
 
 namespace parser {
+    /// @brief How tightly an operator binds, from loosest to tightest.
+    enum class Precedence {
+        None,
+        Assignment,     // =
+        Ternary,        // ?:
+        Or,             // or
+        And,            // and
+        Equality,       // == !=
+        Compound,       // ,
+        Comparison,     // < <= > >=
+        Term,           // + -
+        Factor,         // * /
+        Unary,          // ! -
+        Call,           // () . []
+        Primary
+    };
+
+    class Parser;
+
+    /// @brief One row of the Pratt parser's table: how a token parses at the start of an
+    /// expression (`m_prefix`) and after a complete left operand (`m_infix`).
+    struct ParseRule {
+        using PrefixFn = std::unique_ptr<Expr> (Parser::*)();
+        using InfixFn = std::unique_ptr<Expr> (Parser::*)(std::unique_ptr<Expr>);
+
+        PrefixFn m_prefix { nullptr };
+        InfixFn m_infix { nullptr };
+
+        /// @brief The precedence of the infix operator.
+        Precedence m_precedence { Precedence::None };
+
+        /// @brief The tightest precedence an operand may be parsed at and still start with
+        /// this token's prefix rule. Prefix operators only apply up to `Unary`, so `- -x`
+        /// is rejected just as it always has been.
+        Precedence m_prefix_precedence { Precedence::Primary };
+
+        /// @brief Whether finding this infix operator where an operand should start gets
+        /// the dedicated "missing left operand" error, e.g. `* 2` or `1 == < 2`.
+        bool m_rejects_missing_operand { false };
+    };
+
     /// @brief Creates an abstract syntax tree from a list of tokens so long as the
     /// list of tokens forms a valid string in the Lox grammar.
     class Parser {
@@ -21,20 +66,97 @@ namespace parser {
         };
 
     private:
+        /// @brief How many tokens past the current one the parser looks at, at most.
+        static constexpr u64 LOOKAHEAD = 2;
+
+        /// @brief How many tokens to ask the scanner for at a time, when parsing them as
+        /// they are scanned.
+        static constexpr u64 SCAN_BATCH = 256;
+
         std::vector<std::unique_ptr<scanner::Token>> m_tokens;
         u64 m_position { 0 };
+        std::vector<u64> m_declaration_ends;
+        std::vector<bool> m_declaration_errors;
+        u64 m_errors { 0 };
+
+        /// @brief How many nodes the parser has made, for the trace.
+        u64 m_nodes { 0 };
+
+        /// @brief The scanner still producing the tokens, when they are parsed as they are
+        /// scanned, or null once it has produced them all.
+        scanner::Scanner* m_scanner { nullptr };
+
+        /// @brief Whether a comma may continue the expression being parsed. Inside an
+        /// argument list it separates the arguments instead, until a grouping allows it again.
+        bool m_allow_comma { true };
+
+        /// @brief For each class whose body is being parsed, innermost last, whether it has
+        /// a superclass. Decides where `this` and `super` may appear.
+        std::vector<bool> m_classes;
+
+        TypeInference::Stats m_type_stats;
+
+        /// @brief What `next_declaration` has learned of the globals so far.
+        TypeInference m_inference;
 
     public:
         Parser(std::vector<std::unique_ptr<scanner::Token>> tokens) : m_tokens(std::move(tokens)) {}
 
+        /// @brief Parses the tokens of `scanner` while it is still producing them, asking
+        /// it for more only as the parser reaches them.
+        explicit Parser(scanner::Scanner& scanner) : m_scanner(&scanner) {
+            scan_ahead();
+        }
+
         std::vector<std::unique_ptr<Statement>> parse() {
+            auto span = lox::trace::Span("parse");
             try {
-                return program();
+                auto statements = program();
+                {
+                    auto resolve_span = lox::trace::Span("resolve");
+                    Resolver().resolve(statements);
+                }
+                {
+                    auto infer_span = lox::trace::Span("infer types");
+                    auto inference = TypeInference();
+                    inference.infer(statements);
+                    m_type_stats = inference.stats();
+                }
+                lox::trace::counter("AST nodes", m_nodes);
+                return statements;
             } catch (const ParseError& parse_error) {
                 return {};
             }
         }
 
+        /// @brief Parses the next top-level declaration, then resolves it and infers its
+        /// types on its own, for running a program while the rest of it is still being
+        /// parsed. What it proves of the globals carries over to the declarations after it.
+        /// @return The declaration, or null if it had a syntax error.
+        std::unique_ptr<Statement> next_declaration();
+
+        /// @brief Whether every declaration has been parsed.
+        bool done() const {
+            return is_at_end();
+        }
+
+        /// @brief How much of the program `parse` returned had its types proven.
+        const TypeInference::Stats& type_stats() const {
+            return m_type_stats;
+        }
+
+        /// @brief For each top-level declaration `parse` returned, the index of the token
+        /// just past its end.
+        const std::vector<u64>& declaration_ends() const {
+            return m_declaration_ends;
+        }
+
+        /// @brief For each top-level declaration `parse` returned, whether a syntax error
+        /// was reported inside it. One whose error was in a nested block still has a tree.
+        const std::vector<bool>& declaration_errors() const {
+            return m_declaration_errors;
+        }
+
     private:
         bool is_at_end() const {
             return peek().type() == TokenType::Eof;
@@ -50,62 +172,94 @@ namespace parser {
 
         const scanner::Token& advance() {
             if (!is_at_end()) m_position++;
+            if (m_scanner && m_position + LOOKAHEAD >= m_tokens.size()) scan_ahead();
             return previous();
         }
 
+        /// @brief Adds the scanner's next batch of tokens to `m_tokens`.
+        void scan_ahead();
+
         bool check(TokenType type) const {
             if (is_at_end()) return false;
             return peek().type() == type;
         }
 
-        bool match(std::initializer_list<TokenType> types) {
-            for (const auto type : types) {
-                if (check(type)) {
-                    advance();
-                    return true;
-                }
-            }
-            return false;
+        /// @brief Whether the tokens after a loop's `(` are `var name in`. `in` is only a
+        /// keyword there, so it can still name a variable anywhere else.
+        bool starts_for_in() const {
+            if (!check(TokenType::Var) || m_position + 2 >= m_tokens.size()) return false;
+            const auto& name = *m_tokens[m_position + 1];
+            const auto& keyword = *m_tokens[m_position + 2];
+            return name.type() == TokenType::Identifier && keyword.type() == TokenType::Identifier && keyword.lexeme() == "in";
         }
 
-        scanner::Token consume(TokenType type, const std::string& message) {
+        bool match(TokenType type) {
+            if (!check(type)) return false;
+            advance();
+            return true;
+        }
+
+        const scanner::Token& consume(TokenType type, const std::string& message) {
             if (check(type)) return advance();
             throw error(peek(), message);
         }
 
         ParseError error(const scanner::Token& token, const std::string& message) {
+            ++m_errors;
             lox::error(token, message);
             return ParseError(message);
         }
 
+        /// @brief Makes a node, counting it for the trace.
+        template <typename T>
+        std::unique_ptr<Expr> make_expr(T&& node) {
+            ++m_nodes;
+            return std::make_unique<Expr>(std::forward<T>(node));
+        }
+
+        template <typename T>
+        std::unique_ptr<Statement> make_stmt(T&& node) {
+            ++m_nodes;
+            return std::make_unique<Statement>(std::forward<T>(node));
+        }
+
         std::vector<std::unique_ptr<Statement>> program();
         std::unique_ptr<Statement> declaration();
         std::unique_ptr<Statement> variable_decl();
+        std::unique_ptr<Statement> function_decl();
+        std::unique_ptr<Statement> class_decl();
+        FunctionDecl function(FunctionKind kind);
         std::unique_ptr<Statement> statement();
         std::unique_ptr<Statement> expr_statement();
         std::unique_ptr<Statement> print_statement();
         std::unique_ptr<Statement> block();
+        std::vector<std::unique_ptr<Statement>> block_statements();
+        std::unique_ptr<Statement> return_stmt();
         std::unique_ptr<Statement> while_loop();
         std::unique_ptr<Statement> for_loop();
+        std::unique_ptr<Statement> for_in_loop();
+        std::unique_ptr<Statement> parallel_for();
         std::unique_ptr<Statement> if_stmt();
         std::unique_ptr<Expr> expr();
-        std::unique_ptr<Expr> assign();
-        std::unique_ptr<Expr> ternary();
-        std::unique_ptr<Expr> logic_or();
-        std::unique_ptr<Expr> logic_and();
-        std::unique_ptr<Expr> validate_equality();
-        std::unique_ptr<Expr> equality();
-        std::unique_ptr<Expr> validate_compound();
-        std::unique_ptr<Expr> compound();
-        std::unique_ptr<Expr> validate_comparison();
-        std::unique_ptr<Expr> comparison();
-        std::unique_ptr<Expr> validate_term();
-        std::unique_ptr<Expr> term();
-        std::unique_ptr<Expr> validate_factor();
-        std::unique_ptr<Expr> factor();
-        std::unique_ptr<Expr> unary();
-        std::unique_ptr<Expr> primary();
+        std::unique_ptr<Expr> parse_precedence(Precedence precedence);
+        void validate_operand(Precedence precedence);
+
+        std::unique_ptr<Expr> literal();
+        std::unique_ptr<Expr> variable();
+        std::unique_ptr<Expr> this_expr();
+        std::unique_ptr<Expr> super_expr();
         std::unique_ptr<Expr> grouping();
+        std::unique_ptr<Expr> unary();
+        std::unique_ptr<Expr> binary(std::unique_ptr<Expr> left);
+        std::unique_ptr<Expr> logical(std::unique_ptr<Expr> left);
+        std::unique_ptr<Expr> ternary(std::unique_ptr<Expr> condition);
+        std::unique_ptr<Expr> assign(std::unique_ptr<Expr> target);
+        std::unique_ptr<Expr> call(std::unique_ptr<Expr> callee);
+        std::unique_ptr<Expr> dot(std::unique_ptr<Expr> object);
+        std::unique_ptr<Expr> list_literal();
+        std::unique_ptr<Expr> index(std::unique_ptr<Expr> object);
+
+        static const ParseRule& rule(TokenType type);
         void synchronize();
     };
 }    
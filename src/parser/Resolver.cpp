@@ -0,0 +1,459 @@
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include "Resolver.hpp"
+
+using namespace parser;
+using scanner::TokenType;
+
+namespace {
+    /// @brief Collects the statements in `stmt` shaped like `x = x + e;`, `x = x - e;` or
+    /// `x = x * e;`, leaving out those in the functions and classes it declares.
+    void find_reductions(Statement& stmt, std::vector<Assign*>& found) {
+        if (auto expr_stmt = std::get_if<ExprStmt>(&stmt.m_stmt)) {
+            auto assign = std::get_if<Assign>(&expr_stmt->m_expr->m_node);
+            auto binary = assign ? std::get_if<Binary>(&assign->m_value->m_node) : nullptr;
+            if (!binary) return;
+
+            auto type = binary->m_operator.type();
+            if (type != TokenType::Plus && type != TokenType::Minus && type != TokenType::Star) return;
+            auto read = std::get_if<Variable>(&binary->m_left->m_node);
+            if (read && read->m_name.lexeme() == assign->m_name.lexeme()) found.push_back(assign);
+        } else if (auto block = std::get_if<Block>(&stmt.m_stmt)) {
+            for (auto& inner : block->m_statements) {
+                if (inner) find_reductions(*inner, found);
+            }
+        } else if (auto if_stmt = std::get_if<IfStmt>(&stmt.m_stmt)) {
+            find_reductions(*if_stmt->m_then_clause, found);
+            if (if_stmt->m_else_clause.has_value())
+                find_reductions(*if_stmt->m_else_clause.value(), found);
+        } else if (auto while_loop = std::get_if<WhileLoop>(&stmt.m_stmt)) {
+            find_reductions(*while_loop->m_body, found);
+        } else if (auto for_loop = std::get_if<ForLoop>(&stmt.m_stmt)) {
+            find_reductions(*for_loop->m_body, found);
+        } else if (auto for_in = std::get_if<ForInLoop>(&stmt.m_stmt)) {
+            find_reductions(*for_in->m_body, found);
+        }
+    }
+}
+
+void Resolver::resolve(std::vector<std::unique_ptr<Statement>>& program) {
+    for (auto& stmt : program) {
+        if (stmt) resolve(*stmt);
+    }
+
+    // Every variable has a slot so far, which is only right if none of them are captured.
+    if (m_captured.empty()) return;
+
+    for (auto node : m_captured)
+        ++m_environment_sizes[m_owners.at(node)];
+
+    m_finding_captures = false;
+    for (auto& stmt : program) {
+        if (stmt) resolve(*stmt);
+    }
+}
+
+void Resolver::resolve(Statement& stmt) {
+    std::visit([this](auto&& s) { resolve_stmt(s); }, stmt.m_stmt);
+}
+
+void Resolver::resolve(Expr& expr) {
+    // Outside of any block every name is a global, which is what nodes default to.
+    if (m_scopes.empty()) return;
+    std::visit([this](auto&& e) { resolve_expr(e); }, expr.m_node);
+}
+
+void Resolver::begin_scope(const void* owner) {
+    auto& scope = m_scopes.emplace_back(Scope { owner, {}, m_function_depth });
+    scope.m_has_environment = m_environment_sizes.contains(owner);
+}
+
+u32 Resolver::end_scope() {
+    auto slot_count = m_scopes.back().m_names.size() - m_scopes.back().m_captured_count;
+    m_scopes.pop_back();
+    return slot_count;
+}
+
+std::pair<i32, i32> Resolver::declare(const std::string& name, const void* node) {
+    if (m_scopes.empty()) return { GLOBAL_SLOT, NOT_CAPTURED };
+
+    // Redeclaring a name in the same block reuses its slot, just like redefining it
+    // in an environment overwrites the old value.
+    auto& scope = m_scopes.back();
+    for (const auto& declared : scope.m_names) {
+        if (declared.m_name == name) return { declared.m_slot, declared.m_depth };
+    }
+
+    auto& declared = scope.m_names.emplace_back(Declaration { name, node, 0, NOT_CAPTURED });
+    if (!m_finding_captures && m_captured.contains(node)) {
+        declared.m_slot = scope.m_captured_count++;
+        declared.m_depth = 0;
+    } else {
+        declared.m_slot = m_next_slot++;
+    }
+    return { declared.m_slot, declared.m_depth };
+}
+
+std::pair<i32, i32> Resolver::lookup(const std::string& name) {
+    i32 depth = 0;
+    for (auto scope = m_scopes.rbegin(); scope != m_scopes.rend(); ++scope) {
+        for (const auto& declared : scope->m_names) {
+            if (declared.m_name != name) continue;
+            if (declared.m_depth != NOT_CAPTURED) return { declared.m_slot, depth };
+
+            // Only reachable while finding captures: after that, a variable used from
+            // another function is always in an environment.
+            if (scope->m_function != m_function_depth) {
+                m_captured.insert(declared.m_node);
+                m_owners.emplace(declared.m_node, scope->m_owner);
+            }
+            return { declared.m_slot, NOT_CAPTURED };
+        }
+
+        if (scope->m_has_environment) ++depth;
+    }
+    return { GLOBAL_SLOT, NOT_CAPTURED };
+}
+
+void Resolver::resolve_stmt(ExprStmt& stmt) {
+    resolve(*stmt.m_expr);
+}
+
+void Resolver::resolve_stmt(PrintStmt& stmt) {
+    resolve(*stmt.m_expr);
+}
+
+void Resolver::resolve_stmt(VariableDecl& decl) {
+    // The initializer is resolved first so that `var x = x;` still refers to the outer `x`.
+    if (decl.m_initializer.has_value())
+        resolve(*decl.m_initializer.value());
+
+    std::tie(decl.m_slot, decl.m_depth) = declare(decl.m_name.lexeme(), &decl);
+}
+
+void Resolver::resolve_stmt(Block& block) {
+    begin_scope(&block);
+    for (auto& stmt : block.m_statements) {
+        if (stmt) resolve(*stmt);
+    }
+
+    block.m_captured_count = m_scopes.back().m_captured_count;
+    block.m_slot_count = end_scope();
+    m_next_slot -= block.m_slot_count;
+}
+
+void Resolver::resolve_stmt(IfStmt& stmt) {
+    resolve(*stmt.m_condition);
+    resolve(*stmt.m_then_clause);
+    if (stmt.m_else_clause.has_value())
+        resolve(*stmt.m_else_clause.value());
+}
+
+void Resolver::resolve_stmt(WhileLoop& loop) {
+    resolve(*loop.m_condition);
+    resolve(*loop.m_body);
+}
+
+void Resolver::resolve_stmt(ForLoop& loop) {
+    if (loop.m_parallel) {
+        resolve_parallel(loop);
+        return;
+    }
+
+    if (loop.m_initializer.has_value() && loop.m_initializer.value())
+        resolve(*loop.m_initializer.value());
+    if (loop.m_condition.has_value())
+        resolve(*loop.m_condition.value());
+    if (loop.m_update.has_value())
+        resolve(*loop.m_update.value());
+    resolve(*loop.m_body);
+}
+
+void Resolver::resolve_stmt(ForInLoop& loop) {
+    resolve(*loop.m_iterable);
+
+    auto& scope = *loop.m_scope;
+    begin_scope(&scope);
+    std::tie(scope.m_slot, scope.m_depth) = declare(loop.m_name.lexeme(), &loop);
+    scope.m_iterable_slot = declare(" iterable", nullptr).first;
+    resolve(*loop.m_body);
+
+    scope.m_captured_count = m_scopes.back().m_captured_count;
+    scope.m_slot_count = end_scope();
+    m_next_slot -= scope.m_slot_count;
+}
+
+void Resolver::resolve_parallel(ForLoop& loop) {
+    auto& parallel = *loop.m_parallel;
+    auto& variable = std::get<VariableDecl>(loop.m_initializer.value()->m_stmt);
+    auto& condition = std::get<Binary>(loop.m_condition.value()->m_node);
+    auto& update = std::get<Assign>(loop.m_update.value()->m_node);
+    auto& increment = std::get<Binary>(update.m_value->m_node);
+    if (m_parallel && m_finding_captures)
+        lox::error(parallel.m_keyword, "Can't nest a parallel loop inside another.");
+
+    // The start, limit and step are evaluated once, before the first iteration.
+    resolve(*variable.m_initializer.value());
+    resolve(*condition.m_right);
+    resolve(*increment.m_right);
+
+    // Every name the body might reduce is looked up from outside the loop. Those the
+    // body turns out to declare for itself are dropped once it has been resolved.
+    auto candidates = std::vector<Assign*>();
+    find_reductions(*loop.m_body, candidates);
+    parallel.m_reductions.clear();
+    for (auto candidate : candidates) {
+        const auto& operation = std::get<Binary>(candidate->m_value->m_node).m_operator;
+        auto type = operation.type() == TokenType::Star ? TokenType::Star : TokenType::Plus;
+        const auto& name = candidate->m_name.lexeme();
+        auto reduction = std::ranges::find_if(parallel.m_reductions, [&name](const Reduction& r) { return r.m_name.lexeme() == name; });
+        if (reduction == parallel.m_reductions.end()) {
+            auto [slot, depth] = lookup(name);
+            parallel.m_reductions.push_back(Reduction { candidate->m_name, slot, depth, 0, type });
+        } else if (reduction->m_operator != type && m_finding_captures) {
+            lox::error(operation, "Can't both add to and multiply '" + name + "' in a parallel loop.");
+        }
+    }
+
+    begin_scope(&parallel);
+    std::tie(variable.m_slot, variable.m_depth) = declare(variable.m_name.lexeme(), &variable);
+    parallel.m_slot = variable.m_slot;
+    parallel.m_depth = variable.m_depth;
+
+    // The partial results go under names no variable can have.
+    for (auto& reduction : parallel.m_reductions)
+        reduction.m_partial = declare(" " + reduction.m_name.lexeme(), nullptr).first;
+
+    for (auto read : { &std::get<Variable>(condition.m_left->m_node), &std::get<Variable>(increment.m_left->m_node) })
+        std::tie(read->m_slot, read->m_depth) = std::pair(variable.m_slot, variable.m_depth);
+    std::tie(update.m_slot, update.m_depth) = std::pair(variable.m_slot, variable.m_depth);
+
+    auto enclosing = std::exchange(m_parallel, ParallelBody {
+        &parallel, m_scopes.size() - 1, m_function_depth,
+        { candidates.begin(), candidates.end() }, std::vector<bool>(parallel.m_reductions.size()), {}
+    });
+    resolve(*loop.m_body);
+    auto body = std::exchange(m_parallel, std::move(enclosing)).value();
+
+    // Each block of iterations sees its own partial result, so none of them can see the
+    // variable's value as it would be at that point in a sequential loop.
+    for (auto read : body.m_shared_reads) {
+        const auto& name = read->m_name.lexeme();
+        for (u64 i = 0; i < parallel.m_reductions.size(); ++i) {
+            if (body.m_used[i] && parallel.m_reductions[i].m_name.lexeme() == name && m_finding_captures)
+                lox::error(read->m_name, "Can't read '" + name + "' inside the parallel loop that reduces it.");
+        }
+    }
+
+    for (u64 i = parallel.m_reductions.size(); i-- > 0;) {
+        if (!body.m_used[i]) parallel.m_reductions.erase(parallel.m_reductions.begin() + i);
+    }
+
+    parallel.m_captured_count = m_scopes.back().m_captured_count;
+    parallel.m_slot_count = end_scope();
+    m_next_slot -= parallel.m_slot_count;
+}
+
+std::optional<u64> Resolver::scope_of(const std::string& name) const {
+    for (auto scope = m_scopes.size(); scope-- > 0;) {
+        for (const auto& declared : m_scopes[scope].m_names) {
+            if (declared.m_name == name) return scope;
+        }
+    }
+    return std::nullopt;
+}
+
+bool Resolver::is_shared(const std::string& name) const {
+    auto scope = scope_of(name);
+    return !scope || *scope < m_parallel->m_scope;
+}
+
+void Resolver::resolve_shared_assign(Assign& assign) {
+    auto& body = *m_parallel;
+    auto& reductions = body.m_loop->m_reductions;
+    const auto& name = assign.m_name.lexeme();
+    auto reduction = std::ranges::find_if(reductions, [&name](const Reduction& r) { return r.m_name.lexeme() == name; });
+    if (!body.m_candidates.contains(&assign) || reduction == reductions.end()) {
+        if (m_finding_captures)
+            lox::error(assign.m_name, "Can't assign to a variable declared outside a parallel loop, except to reduce it, as in 'x = x + y;'.");
+        resolve(*assign.m_value);
+        std::tie(assign.m_slot, assign.m_depth) = lookup(name);
+        return;
+    }
+
+    // Both the read and the write of the reduced variable become ones of its partial result.
+    auto& binary = std::get<Binary>(assign.m_value->m_node);
+    auto& read = std::get<Variable>(binary.m_left->m_node);
+    resolve(*binary.m_right);
+    assign.m_slot = read.m_slot = reduction->m_partial;
+    assign.m_depth = read.m_depth = NOT_CAPTURED;
+    body.m_used[reduction - reductions.begin()] = true;
+}
+
+void Resolver::resolve_stmt(FunctionDecl& decl) {
+    // Declared before the body is resolved, so the function can call itself.
+    std::tie(decl.m_slot, decl.m_depth) = declare(decl.m_name.lexeme(), &decl);
+    resolve_function(decl);
+}
+
+void Resolver::resolve_function(FunctionDecl& decl) {
+    auto& function = *decl.m_function;
+    auto enclosing_slot = m_next_slot;
+    auto enclosing_kind = std::exchange(m_function_kind, function.m_kind);
+    ++m_function_depth;
+    begin_scope(&decl);
+
+    // Slot 0 of a frame holds the callee, and argument `i` arrives in slot `i + 1`. A
+    // method's receiver replaces its callee, so that is where `this` lives.
+    function.m_captured_params.clear();
+    if (function.m_kind != FunctionKind::Function) {
+        m_next_slot = 0;
+        auto [slot, depth] = declare("this", &function);
+        if (depth != NOT_CAPTURED)
+            function.m_captured_params.emplace_back(0, slot);
+    }
+
+    for (u32 i = 0; i < function.m_params.size(); ++i) {
+        const auto& param = function.m_params[i];
+        for (const auto& declared : m_scopes.back().m_names) {
+            if (declared.m_name == param.lexeme() && m_finding_captures)
+                lox::error(param, "Already a parameter with this name.");
+        }
+
+        m_next_slot = i + 1;
+        auto [slot, depth] = declare(param.lexeme(), &param);
+        if (depth != NOT_CAPTURED)
+            function.m_captured_params.emplace_back(i + 1, slot);
+    }
+    m_next_slot = function.m_params.size() + 1;
+
+    for (auto& stmt : function.m_body) {
+        if (stmt) resolve(*stmt);
+    }
+
+    function.m_frame_size = m_next_slot;
+    function.m_captured_count = m_scopes.back().m_captured_count;
+    end_scope();
+    --m_function_depth;
+    m_function_kind = enclosing_kind;
+    m_next_slot = enclosing_slot;
+}
+
+void Resolver::resolve_stmt(ReturnStmt& stmt) {
+    if (m_parallel && m_parallel->m_function == m_function_depth && m_finding_captures)
+        lox::error(stmt.m_keyword, "Can't return from inside a parallel loop.");
+    else if (m_function_depth == 0 && m_finding_captures)
+        lox::error(stmt.m_keyword, "Can't return from top-level code.");
+    else if (m_function_kind == FunctionKind::Initializer && stmt.m_value.has_value() && m_finding_captures)
+        lox::error(stmt.m_keyword, "Can't return a value from an initializer.");
+
+    if (stmt.m_value.has_value())
+        resolve(*stmt.m_value.value());
+}
+
+void Resolver::resolve_stmt(ClassDecl& decl) {
+    std::tie(decl.m_slot, decl.m_depth) = declare(decl.m_name.lexeme(), &decl);
+
+    auto& klass = *decl.m_class;
+    if (!klass.m_superclass.has_value()) {
+        for (auto& method : klass.m_methods)
+            resolve_function(method);
+        return;
+    }
+
+    // Methods find their superclass through a `super` declared in a scope of its own,
+    // so each class declaration binds the superclass it was declared with.
+    resolve(*klass.m_superclass.value());
+    begin_scope(&klass);
+    std::tie(klass.m_super_slot, klass.m_super_depth) = declare("super", &klass);
+    for (auto& method : klass.m_methods)
+        resolve_function(method);
+
+    klass.m_captured_count = m_scopes.back().m_captured_count;
+    klass.m_slot_count = end_scope();
+    m_next_slot -= klass.m_slot_count;
+}
+
+void Resolver::resolve_expr(Literal&) {}
+
+void Resolver::resolve_expr(Variable& identifier) {
+    std::tie(identifier.m_slot, identifier.m_depth) = lookup(identifier.m_name.lexeme());
+    if (m_parallel && is_shared(identifier.m_name.lexeme()))
+        m_parallel->m_shared_reads.push_back(&identifier);
+}
+
+void Resolver::resolve_expr(Unary& unary) {
+    resolve(*unary.m_argument);
+}
+
+void Resolver::resolve_expr(Binary& binary) {
+    resolve(*binary.m_left);
+    resolve(*binary.m_right);
+}
+
+void Resolver::resolve_expr(Ternary& ternary) {
+    resolve(*ternary.m_condition);
+    resolve(*ternary.m_success);
+    resolve(*ternary.m_failure);
+}
+
+void Resolver::resolve_expr(Assign& assign) {
+    if (m_parallel) {
+        auto scope = scope_of(assign.m_name.lexeme());
+        if (!scope || *scope < m_parallel->m_scope) {
+            resolve_shared_assign(assign);
+            return;
+        }
+        if (*scope == m_parallel->m_scope && m_finding_captures)
+            lox::error(assign.m_name, "Can't assign to the variable of a parallel loop.");
+    }
+
+    resolve(*assign.m_value);
+    std::tie(assign.m_slot, assign.m_depth) = lookup(assign.m_name.lexeme());
+}
+
+void Resolver::resolve_expr(Grouping& grouping) {
+    resolve(*grouping.m_inner_expr);
+}
+
+void Resolver::resolve_expr(Logical& logical) {
+    resolve(*logical.m_left);
+    resolve(*logical.m_right);
+}
+
+void Resolver::resolve_expr(Call& call) {
+    resolve(*call.m_callee);
+    for (auto& argument : call.m_arguments)
+        resolve(*argument);
+}
+
+void Resolver::resolve_expr(Get& get) {
+    resolve(*get.m_object);
+}
+
+void Resolver::resolve_expr(Set& set) {
+    resolve(*set.m_value);
+    resolve(*set.m_object);
+}
+
+void Resolver::resolve_expr(Super& super) {
+    std::tie(super.m_slot, super.m_depth) = lookup("super");
+    std::tie(super.m_this_slot, super.m_this_depth) = lookup("this");
+}
+
+void Resolver::resolve_expr(ListLiteral& list) {
+    for (auto& element : list.m_elements)
+        resolve(*element);
+}
+
+void Resolver::resolve_expr(Index& index) {
+    resolve(*index.m_object);
+    resolve(*index.m_index);
+}
+
+void Resolver::resolve_expr(IndexSet& set) {
+    resolve(*set.m_object);
+    resolve(*set.m_index);
+    resolve(*set.m_value);
+}
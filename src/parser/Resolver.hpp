@@ -0,0 +1,139 @@
+#ifndef LOX_RESOLVER_HPP
+#define LOX_RESOLVER_HPP
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include <memory>
+#include <optional>
+#include "statements.hpp"
+
+namespace parser {
+    /// @brief Assigns every variable declared inside a block or function a fixed slot on
+    /// the interpreter's frame stack, and points each use of that variable at its slot.
+    /// Variables declared outside of any block are left as globals.
+    ///
+    /// A variable used by a function nested inside the one declaring it must outlive its
+    /// frame, so it goes in an environment instead of a slot. Which variables those are is
+    /// only known once the inner functions have been seen, so a program with any of them
+    /// is resolved twice: the first pass finds the captured variables, and the second
+    /// gives them environment indices.
+    class Resolver {
+    private:
+        struct Declaration {
+            std::string m_name;
+
+            /// @brief The node that first declared the name: a `VariableDecl`, a `FunctionDecl`,
+            /// a `ClassDecl`, a parameter's token, or the `Function` or `Class` that declares
+            /// `this` or `super`.
+            const void* m_node;
+
+            i32 m_slot;
+            i32 m_depth;
+        };
+
+        struct Scope {
+            /// @brief The `Block`, `FunctionDecl` or other node that opened the scope.
+            const void* m_owner;
+            std::vector<Declaration> m_names;
+            u32 m_function;
+            u32 m_captured_count { 0 };
+            bool m_has_environment { false };
+        };
+
+        /// @brief The scopes enclosing the code being resolved, innermost last.
+        std::vector<Scope> m_scopes;
+        u32 m_next_slot { 0 };
+
+        /// @brief How many function bodies enclose the code being resolved.
+        u32 m_function_depth { 0 };
+
+        /// @brief The kind of the innermost function being resolved.
+        FunctionKind m_function_kind { FunctionKind::Function };
+
+        /// @brief What is known of the `parallel for` whose body is being resolved.
+        struct ParallelBody {
+            Parallel* m_loop;
+
+            /// @brief The index in `m_scopes` of the loop's own scope. Variables declared in
+            /// the scopes before it are shared by every iteration.
+            u64 m_scope;
+            u32 m_function;
+
+            /// @brief The statements of the body shaped like reductions, and which of the
+            /// loop's reductions one of them turned out to update.
+            std::unordered_set<const Assign*> m_candidates;
+            std::vector<bool> m_used;
+
+            /// @brief Every read of a shared variable, none of which may read a reduced one.
+            std::vector<const Variable*> m_shared_reads;
+        };
+
+        std::optional<ParallelBody> m_parallel;
+
+        bool m_finding_captures { true };
+        std::unordered_set<const void*> m_captured;
+        std::unordered_map<const void*, const void*> m_owners;
+        std::unordered_map<const void*, u32> m_environment_sizes;
+
+    public:
+        void resolve(std::vector<std::unique_ptr<Statement>>& program);
+
+    private:
+        void resolve(Statement& stmt);
+        void resolve(Expr& expr);
+        void begin_scope(const void* owner);
+        u32 end_scope();
+        std::pair<i32, i32> declare(const std::string& name, const void* node);
+        std::pair<i32, i32> lookup(const std::string& name);
+        void resolve_function(FunctionDecl& decl);
+
+        /// @brief Resolves a `parallel for`. Its body may read any variable, but the only
+        /// variables declared outside it that it may assign are reductions, and it may not
+        /// assign its loop variable or return.
+        void resolve_parallel(ForLoop& loop);
+
+        /// @return The index in `m_scopes` of the innermost scope declaring `name`, or
+        /// nothing if it is a global.
+        std::optional<u64> scope_of(const std::string& name) const;
+
+        /// @brief Whether `name` is declared outside the `parallel for` being resolved.
+        bool is_shared(const std::string& name) const;
+
+        /// @brief Resolves an assignment to a variable declared outside the `parallel for`
+        /// being resolved, which must be a reduction.
+        void resolve_shared_assign(Assign& assign);
+
+        void resolve_stmt(ExprStmt& stmt);
+        void resolve_stmt(PrintStmt& stmt);
+        void resolve_stmt(VariableDecl& decl);
+        void resolve_stmt(Block& block);
+        void resolve_stmt(IfStmt& stmt);
+        void resolve_stmt(WhileLoop& loop);
+        void resolve_stmt(ForLoop& loop);
+        void resolve_stmt(FunctionDecl& decl);
+        void resolve_stmt(ReturnStmt& stmt);
+        void resolve_stmt(ClassDecl& decl);
+        void resolve_stmt(ForInLoop& loop);
+
+        void resolve_expr(Literal& literal);
+        void resolve_expr(Variable& identifier);
+        void resolve_expr(Unary& unary);
+        void resolve_expr(Binary& binary);
+        void resolve_expr(Ternary& ternary);
+        void resolve_expr(Assign& assign);
+        void resolve_expr(Grouping& grouping);
+        void resolve_expr(Logical& logical);
+        void resolve_expr(Call& call);
+        void resolve_expr(Get& get);
+        void resolve_expr(Set& set);
+        void resolve_expr(Super& super);
+        void resolve_expr(ListLiteral& list);
+        void resolve_expr(Index& index);
+        void resolve_expr(IndexSet& set);
+    };
+}
+
+#endif
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include "TypeInference.hpp"
+
+using namespace parser;
+
+using scanner::Token;
+using scanner::TokenType;
+
+void TypeInference::infer(std::vector<std::unique_ptr<Statement>>& program) {
+    for (auto& stmt : program) {
+        if (stmt) infer(*stmt);
+    }
+
+    m_stats.m_binary_count = m_binaries.size();
+    m_stats.m_typed_binary_count = std::ranges::count_if(m_binaries, [](const Binary* binary) {
+        return binary->m_operand_type != StaticType::Unknown;
+    });
+}
+
+StaticType TypeInference::variable_type(const Token& name, i32 slot, i32 depth) const {
+    if (depth != NOT_CAPTURED) return StaticType::Unknown;
+
+    if (slot == GLOBAL_SLOT) {
+        auto global = m_state.m_globals.find(name.lexeme());
+        return global == m_state.m_globals.end() ? StaticType::Unknown : global->second;
+    }
+
+    if (static_cast<u64>(slot) >= m_state.m_slots.size()) return StaticType::Unknown;
+    return m_state.m_slots[slot];
+}
+
+void TypeInference::set_variable_type(const Token& name, i32 slot, i32 depth, StaticType type) {
+    if (depth != NOT_CAPTURED) return;
+
+    // Unknown globals are left out, so the map only holds what calls have yet to clear.
+    if (slot == GLOBAL_SLOT) {
+        if (type == StaticType::Unknown)
+            m_state.m_globals.erase(name.lexeme());
+        else
+            m_state.m_globals[name.lexeme()] = type;
+        return;
+    }
+
+    if (static_cast<u64>(slot) >= m_state.m_slots.size())
+        m_state.m_slots.resize(slot + 1, StaticType::Unknown);
+    m_state.m_slots[slot] = type;
+}
+
+void TypeInference::refine(const Expr& expr, StaticType type) {
+    if (auto variable = std::get_if<Variable>(&expr.m_node))
+        set_variable_type(variable->m_name, variable->m_slot, variable->m_depth, type);
+}
+
+void TypeInference::join(const State& state) {
+    // A slot only one of the states has is one the other knows nothing about.
+    auto& slots = m_state.m_slots;
+    slots.resize(std::max(slots.size(), state.m_slots.size()), StaticType::Unknown);
+    for (u64 slot = 0; slot < slots.size(); ++slot) {
+        auto other = slot < state.m_slots.size() ? state.m_slots[slot] : StaticType::Unknown;
+        if (slots[slot] != other) slots[slot] = StaticType::Unknown;
+    }
+
+    std::erase_if(m_state.m_globals, [&](const auto& global) {
+        auto other = state.m_globals.find(global.first);
+        return other == state.m_globals.end() || other->second != global.second;
+    });
+}
+
+void TypeInference::infer_function(Function& function) {
+    auto enclosing = std::exchange(m_state, State());
+    for (auto& stmt : function.m_body) {
+        if (stmt) infer(*stmt);
+    }
+    m_state = std::move(enclosing);
+}
+
+void TypeInference::visit(ExprStmt& stmt) {
+    infer(*stmt.m_expr);
+}
+
+void TypeInference::visit(PrintStmt& stmt) {
+    infer(*stmt.m_expr);
+}
+
+void TypeInference::visit(VariableDecl& decl) {
+    auto type = decl.m_initializer.has_value() ? infer(*decl.m_initializer.value()) : StaticType::Nil;
+    set_variable_type(decl.m_name, decl.m_slot, decl.m_depth, type);
+}
+
+void TypeInference::visit(Block& block) {
+    for (auto& stmt : block.m_statements) {
+        if (stmt) infer(*stmt);
+    }
+}
+
+void TypeInference::visit(IfStmt& stmt) {
+    infer(*stmt.m_condition);
+    auto skipped = m_state;
+    infer(*stmt.m_then_clause);
+
+    if (stmt.m_else_clause.has_value()) {
+        auto then_state = std::exchange(m_state, std::move(skipped));
+        infer(*stmt.m_else_clause.value());
+        join(then_state);
+    } else {
+        join(skipped);
+    }
+}
+
+void TypeInference::visit(WhileLoop& loop) {
+    // Once a pass over the loop leaves the types at its start unchanged, that pass saw
+    // every type an iteration can, and its annotations stand.
+    while (true) {
+        auto start = m_state;
+        infer(*loop.m_condition);
+        auto exit = m_state;
+        infer(*loop.m_body);
+        join(start);
+        if (m_state == start) {
+            m_state = std::move(exit);
+            return;
+        }
+    }
+}
+
+void TypeInference::visit(ForLoop& loop) {
+    if (auto parallel = loop.m_parallel.get()) {
+        infer_parallel(loop, *parallel);
+        return;
+    }
+
+    if (loop.m_initializer.has_value() && loop.m_initializer.value())
+        infer(*loop.m_initializer.value());
+
+    // Without a condition the body never runs.
+    if (!loop.m_condition.has_value()) return;
+
+    while (true) {
+        auto start = m_state;
+        infer(*loop.m_condition.value());
+        auto exit = m_state;
+        infer(*loop.m_body);
+        if (loop.m_update.has_value())
+            infer(*loop.m_update.value());
+        join(start);
+        if (m_state == start) {
+            m_state = std::move(exit);
+            return;
+        }
+    }
+}
+
+void TypeInference::visit(ForInLoop& loop) {
+    infer(*loop.m_iterable);
+
+    // The elements can be of any type, so the loop variable is unknown in every pass.
+    const auto& scope = *loop.m_scope;
+    while (true) {
+        auto start = m_state;
+        set_variable_type(loop.m_name, scope.m_slot, scope.m_depth, StaticType::Unknown);
+        infer(*loop.m_body);
+        join(start);
+        if (m_state == start) return;
+    }
+}
+
+void TypeInference::infer_parallel(ForLoop& loop, const Parallel& parallel) {
+    auto& variable = std::get<VariableDecl>(loop.m_initializer.value()->m_stmt);
+    auto& increment = std::get<Binary>(std::get<Assign>(loop.m_update.value()->m_node).m_value->m_node);
+    infer(*variable.m_initializer.value());
+    infer(*std::get<Binary>(loop.m_condition.value()->m_node).m_right);
+    infer(*increment.m_right);
+
+    // Iterations may run in any order, and none of them can assign what the others see,
+    // so each starts from the state before the loop with its loop variable and partial
+    // results, which are all numbers.
+    auto before = m_state;
+    while (true) {
+        auto start = m_state;
+        set_variable_type(variable.m_name, parallel.m_slot, parallel.m_depth, StaticType::Number);
+        for (const auto& reduction : parallel.m_reductions)
+            set_variable_type(reduction.m_name, reduction.m_partial, NOT_CAPTURED, StaticType::Number);
+        infer(*loop.m_body);
+        join(start);
+        if (m_state == start) break;
+    }
+
+    m_state = std::move(before);
+    for (const auto& reduction : parallel.m_reductions)
+        set_variable_type(reduction.m_name, reduction.m_slot, reduction.m_depth, StaticType::Unknown);
+}
+
+void TypeInference::visit(FunctionDecl& decl) {
+    set_variable_type(decl.m_name, decl.m_slot, decl.m_depth, StaticType::Unknown);
+    infer_function(*decl.m_function);
+}
+
+void TypeInference::visit(ReturnStmt& stmt) {
+    if (stmt.m_value.has_value())
+        infer(*stmt.m_value.value());
+}
+
+void TypeInference::visit(ClassDecl& decl) {
+    auto& klass = *decl.m_class;
+    if (klass.m_superclass.has_value())
+        infer(*klass.m_superclass.value());
+    set_variable_type(decl.m_name, decl.m_slot, decl.m_depth, StaticType::Unknown);
+    for (auto& method : klass.m_methods)
+        infer_function(*method.m_function);
+}
+
+StaticType TypeInference::visit(Literal& literal) {
+    return std::visit([](auto&& value) {
+        using T = std::decay_t<decltype(value)>;
+        if constexpr (std::is_same_v<T, float>) return StaticType::Number;
+        else if constexpr (std::is_same_v<T, bool>) return StaticType::Bool;
+        else if constexpr (std::is_same_v<T, LoxString>) return StaticType::String;
+        else return StaticType::Nil;
+    }, literal.m_value);
+}
+
+StaticType TypeInference::visit(Variable& identifier) {
+    return variable_type(identifier.m_name, identifier.m_slot, identifier.m_depth);
+}
+
+StaticType TypeInference::visit(Unary& unary) {
+    unary.m_operand_type = infer(*unary.m_argument);
+    switch (unary.m_operator.type()) {
+        case TokenType::Minus:
+            refine(*unary.m_argument, StaticType::Number);
+            return StaticType::Number;
+        case TokenType::Bang:
+            return StaticType::Bool;
+        default:
+            return StaticType::Unknown;
+    }
+}
+
+StaticType TypeInference::visit(Binary& binary) {
+    m_binaries.insert(&binary);
+    auto left = infer(*binary.m_left);
+    auto right = infer(*binary.m_right);
+    binary.m_operand_type = left == right ? left : StaticType::Unknown;
+
+    // A successful operation proves its operands' types. The left one is only refined
+    // when the right one cannot have assigned it since it was read.
+    auto refine_operands = [&](StaticType type) {
+        const auto& node = binary.m_right->m_node;
+        if (std::holds_alternative<Literal>(node) || std::holds_alternative<Variable>(node))
+            refine(*binary.m_left, type);
+        refine(*binary.m_right, type);
+    };
+
+    switch (binary.m_operator.type()) {
+        case TokenType::Plus: {
+            auto type = StaticType::Unknown;
+            if (left == StaticType::Number || right == StaticType::Number) type = StaticType::Number;
+            else if (left == StaticType::String || right == StaticType::String) type = StaticType::String;
+            if (type != StaticType::Unknown) refine_operands(type);
+            return type;
+        }
+
+        case TokenType::Minus:
+        case TokenType::Star:
+        case TokenType::Slash:
+            refine_operands(StaticType::Number);
+            return StaticType::Number;
+
+        case TokenType::Less:
+        case TokenType::LessEqual:
+        case TokenType::Greater:
+        case TokenType::GreaterEqual:
+            refine_operands(StaticType::Number);
+            return StaticType::Bool;
+
+        case TokenType::EqualEqual:
+        case TokenType::BangEqual:
+            return StaticType::Bool;
+
+        default:
+            return StaticType::Unknown;
+    }
+}
+
+StaticType TypeInference::visit(Ternary& ternary) {
+    infer(*ternary.m_condition);
+    auto skipped = m_state;
+    auto success = infer(*ternary.m_success);
+    auto success_state = std::exchange(m_state, std::move(skipped));
+    auto failure = infer(*ternary.m_failure);
+    join(success_state);
+    return success == failure ? success : StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(Assign& assign) {
+    auto type = infer(*assign.m_value);
+    set_variable_type(assign.m_name, assign.m_slot, assign.m_depth, type);
+    return type;
+}
+
+StaticType TypeInference::visit(Grouping& grouping) {
+    return infer(*grouping.m_inner_expr);
+}
+
+StaticType TypeInference::visit(Logical& logical) {
+    // Either operand may be the result, and the right one may not run at all.
+    auto left = infer(*logical.m_left);
+    auto skipped = m_state;
+    auto right = infer(*logical.m_right);
+    join(skipped);
+    return left == right ? left : StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(Call& call) {
+    infer(*call.m_callee);
+    for (auto& argument : call.m_arguments)
+        infer(*argument);
+
+    // The callee may assign any global. Clearing a map costs as much as its buckets,
+    // however few globals it holds, so a large one is replaced rather than cleared.
+    if (!m_state.m_globals.empty()) m_state.m_globals = {};
+    return StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(Get& get) {
+    infer(*get.m_object);
+    return StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(Set& set) {
+    infer(*set.m_object);
+    return infer(*set.m_value);
+}
+
+StaticType TypeInference::visit(Super&) {
+    return StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(ListLiteral& list) {
+    for (auto& element : list.m_elements)
+        infer(*element);
+    return StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(Index& index) {
+    infer(*index.m_object);
+    infer(*index.m_index);
+    return StaticType::Unknown;
+}
+
+StaticType TypeInference::visit(IndexSet& set) {
+    infer(*set.m_object);
+    infer(*set.m_index);
+    return infer(*set.m_value);
+}
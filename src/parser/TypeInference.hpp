@@ -0,0 +1,124 @@
+#ifndef LOX_TYPE_INFERENCE_HPP
+#define LOX_TYPE_INFERENCE_HPP
+
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "statements.hpp"
+
+namespace parser {
+    /// @brief Proves the types of the operands of `Unary` and `Binary` nodes where it can,
+    /// so the interpreter can apply the operation without checking them first. Runs after
+    /// the `Resolver`, whose slots it uses to tell variables apart.
+    ///
+    /// Variables in a frame's slots are tracked throughout their function: nothing else
+    /// can assign them. Globals are tracked until the next call, which may assign any of
+    /// them, and captured variables are never tracked. The analysis follows the order statements
+    /// run in: an assignment sets a variable's type, the paths of a branch are joined
+    /// where they meet, and a loop is analysed until the types at its start stop changing.
+    ///
+    /// An operation that fails stops the program, so one that succeeded also tells what
+    /// its variable operands held: after `n < 2`, `n` is a number.
+    class TypeInference : public Statement::Visitor<TypeInference, void>, public Expr::Visitor<TypeInference, StaticType> {
+    public:
+        struct Stats {
+            u64 m_binary_count { 0 };
+
+            /// @brief How many `Binary` nodes have both operands' types proven.
+            u64 m_typed_binary_count { 0 };
+        };
+
+    private:
+        /// @brief What is known at one point of the code being analysed. Variables that
+        /// are missing are unknown.
+        struct State {
+            /// @brief The type of each slot of the frame being analysed, by slot.
+            std::vector<StaticType> m_slots;
+
+            /// @brief The globals assigned since the last call, by name.
+            std::unordered_map<std::string_view, StaticType> m_globals;
+
+            bool operator==(const State&) const = default;
+        };
+
+        State m_state;
+
+        /// @brief Every `Binary` node seen. A loop body is analysed more than once, so
+        /// they are counted at the end rather than as they are reached.
+        std::unordered_set<const Binary*> m_binaries;
+
+        Stats m_stats;
+
+    public:
+        /// @brief Annotates every function and top-level statement in `program`.
+        void infer(std::vector<std::unique_ptr<Statement>>& program);
+
+        /// @brief Annotates the next top-level statement of a program handed over one
+        /// declaration at a time, starting from what the ones before it left known of the
+        /// globals. Leaves `stats` as it was.
+        void infer_declaration(Statement& stmt) {
+            infer(stmt);
+        }
+
+        const Stats& stats() const {
+            return m_stats;
+        }
+
+        void visit(ExprStmt& stmt);
+        void visit(PrintStmt& stmt);
+        void visit(VariableDecl& decl);
+        void visit(Block& block);
+        void visit(IfStmt& stmt);
+        void visit(WhileLoop& loop);
+        void visit(ForLoop& loop);
+        void visit(FunctionDecl& decl);
+        void visit(ReturnStmt& stmt);
+        void visit(ClassDecl& decl);
+        void visit(ForInLoop& loop);
+
+        StaticType visit(Literal& literal);
+        StaticType visit(Variable& identifier);
+        StaticType visit(Unary& unary);
+        StaticType visit(Binary& binary);
+        StaticType visit(Ternary& ternary);
+        StaticType visit(Assign& assign);
+        StaticType visit(Grouping& grouping);
+        StaticType visit(Logical& logical);
+        StaticType visit(Call& call);
+        StaticType visit(Get& get);
+        StaticType visit(Set& set);
+        StaticType visit(Super& super);
+        StaticType visit(ListLiteral& list);
+        StaticType visit(Index& index);
+        StaticType visit(IndexSet& set);
+
+    private:
+        void infer(Statement& stmt) {
+            visit_stmt(stmt);
+        }
+
+        StaticType infer(Expr& expr) {
+            return visit_expr(expr);
+        }
+
+        StaticType variable_type(const scanner::Token& name, i32 slot, i32 depth) const;
+        void set_variable_type(const scanner::Token& name, i32 slot, i32 depth, StaticType type);
+
+        /// @brief Marks the variable `expr` reads, if it is one, as holding `type`.
+        void refine(const Expr& expr, StaticType type);
+
+        /// @brief Makes the current state what either `state` or the current state may hold.
+        void join(const State& state);
+
+        /// @brief Analyses a `parallel for`, whose iterations run apart from each other.
+        void infer_parallel(ForLoop& loop, const Parallel& parallel);
+
+        /// @brief Analyses the body of `function` in a frame of its own, where the callee
+        /// and the parameters are unknown.
+        void infer_function(Function& function);
+    };
+}
+
+#endif
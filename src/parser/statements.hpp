@@ -1,37 +1,74 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <limits>
 #include <string>
 #include <sstream>
 #include <variant>
 #include <optional>
 #include <memory>
+#include <vector>
 #include <type_traits>
+#include <utility>
 #include "../lox.hpp"
+#include "../memory.hpp"
 #include "../scanner/Token.hpp"
+#include "../util_types.hpp"
 
 namespace parser {
     struct Expr;
 
-    using LoxValue = std::variant<std::monostate, float, bool, std::string>;
+    /// @brief The text of a string literal, charged to the interpreter's `lox::MemoryAccount`.
+    using LoxString = std::basic_string<char, std::char_traits<char>, lox::AccountingAllocator<char>>;
+
+    /// @brief The value written in a literal. The interpreter turns it into a runtime
+    /// value, moving strings onto its garbage-collected heap.
+    using LiteralValue = std::variant<std::monostate, float, bool, LoxString>;
 
     struct Literal {
-        LoxValue m_value;
+        LiteralValue m_value;
         Literal(std::monostate value) : m_value(value) {}
         Literal(float value) : m_value(value) {}
         Literal(bool value) : m_value(value) {}
-        Literal(const std::string& value) : m_value(value) {}
-        Literal(std::string&& value) : m_value(std::move(value)) {}
+        Literal(const std::string& value) : m_value(LoxString(value.data(), value.size())) {}
     };
 
+    /// @brief The slot of a variable that is not inside any block, and so lives in the
+    /// global `Environment` rather than on the interpreter's frame stack.
+    inline constexpr i32 GLOBAL_SLOT = -1;
+
+    /// @brief The depth of a variable that lives in its frame's slot. A variable that a
+    /// function captures lives in an environment instead: its depth is how many
+    /// environments out from the innermost one it is, and its slot is its index there.
+    inline constexpr i32 NOT_CAPTURED = -1;
+
+    /// @brief The cache of a global access or property access that has not run yet. See
+    /// `Variable::m_global` and `Get::m_cache`.
+    inline constexpr u32 NO_CACHE = std::numeric_limits<u32>::max();
+
     struct Variable {
         scanner::Token m_name;
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
+
+        /// @brief For a global, its slot in the interpreter's `Environment`, found the
+        /// first time the access runs.
+        mutable u32 m_global { NO_CACHE };
+
         Variable(const scanner::Token& name) : m_name(name) {}
     };
 
+    /// @brief The type of value an expression is proven to produce, if `TypeInference`
+    /// could prove one.
+    enum class StaticType : u8 { Unknown, Number, Bool, String, Nil };
+
     struct Unary {
         scanner::Token m_operator;
         std::unique_ptr<Expr> m_argument;
+
+        /// @brief The proven type of the argument.
+        StaticType m_operand_type { StaticType::Unknown };
+
         Unary(const scanner::Token& operation, std::unique_ptr<Expr> argument)
             : m_operator(operation), m_argument(std::move(argument)) {}
     };
@@ -40,6 +77,11 @@ namespace parser {
         scanner::Token m_operator;
         std::unique_ptr<Expr> m_left;
         std::unique_ptr<Expr> m_right;
+
+        /// @brief The type both operands are proven to have, or `Unknown` if they are not
+        /// proven to have the same one.
+        StaticType m_operand_type { StaticType::Unknown };
+
         Binary(const scanner::Token& operation, std::unique_ptr<Expr> left, std::unique_ptr<Expr> right)
             : m_operator(operation), m_left(std::move(left)), m_right(std::move(right)) {}
     };
@@ -55,6 +97,12 @@ namespace parser {
     struct Assign {
         scanner::Token m_name;
         std::unique_ptr<Expr> m_value;
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
+
+        /// @brief See `Variable::m_global`.
+        mutable u32 m_global { NO_CACHE };
+
         Assign(const scanner::Token& name, std::unique_ptr<Expr> value)
             : m_name(name), m_value(std::move(value)) {}
     };
@@ -76,14 +124,97 @@ namespace parser {
         ) : m_left(std::move(left)), m_operator(token), m_right(std::move(right)) {}
     };
 
+    struct Call {
+        std::unique_ptr<Expr> m_callee;
+        scanner::Token m_paren;
+        std::vector<std::unique_ptr<Expr>> m_arguments;
+
+        Call(
+            std::unique_ptr<Expr> callee,
+            const scanner::Token& paren,
+            std::vector<std::unique_ptr<Expr>>&& arguments
+        ) : m_callee(std::move(callee)), m_paren(paren), m_arguments(std::move(arguments)) {}
+    };
+
+    struct Get {
+        std::unique_ptr<Expr> m_object;
+        scanner::Token m_name;
+
+        /// @brief Which of the interpreter's inline caches remembers where this property
+        /// was found, assigned the first time the access runs.
+        mutable u32 m_cache { NO_CACHE };
+
+        Get(std::unique_ptr<Expr> object, const scanner::Token& name)
+            : m_object(std::move(object)), m_name(name) {}
+    };
+
+    struct Set {
+        std::unique_ptr<Expr> m_object;
+        scanner::Token m_name;
+        std::unique_ptr<Expr> m_value;
+
+        /// @brief See `Get::m_cache`.
+        mutable u32 m_cache { NO_CACHE };
+
+        Set(std::unique_ptr<Expr> object, const scanner::Token& name, std::unique_ptr<Expr> value)
+            : m_object(std::move(object)), m_name(name), m_value(std::move(value)) {}
+    };
+
+    /// @brief `super.method`. `super` and `this` are resolved like variables.
+    struct Super {
+        scanner::Token m_method;
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
+        i32 m_this_slot { GLOBAL_SLOT };
+        i32 m_this_depth { NOT_CAPTURED };
+        Super(const scanner::Token& method) : m_method(method) {}
+    };
+
+    /// @brief `[a, b, c]`, which makes a new list of the elements.
+    struct ListLiteral {
+        /// @brief The closing bracket, where errors are reported.
+        scanner::Token m_bracket;
+        std::vector<std::unique_ptr<Expr>> m_elements;
+
+        ListLiteral(const scanner::Token& bracket, std::vector<std::unique_ptr<Expr>>&& elements)
+            : m_bracket(bracket), m_elements(std::move(elements)) {}
+    };
+
+    /// @brief `object[index]`: an element of a list or an array, or the value of a key in a map.
+    struct Index {
+        std::unique_ptr<Expr> m_object;
+
+        /// @brief The closing bracket, where errors are reported.
+        scanner::Token m_bracket;
+        std::unique_ptr<Expr> m_index;
+
+        Index(std::unique_ptr<Expr> object, const scanner::Token& bracket, std::unique_ptr<Expr> index)
+            : m_object(std::move(object)), m_bracket(bracket), m_index(std::move(index)) {}
+    };
+
+    /// @brief `object[index] = value`. See `Index`.
+    struct IndexSet {
+        std::unique_ptr<Expr> m_object;
+        scanner::Token m_bracket;
+        std::unique_ptr<Expr> m_index;
+        std::unique_ptr<Expr> m_value;
+
+        IndexSet(std::unique_ptr<Expr> object, const scanner::Token& bracket, std::unique_ptr<Expr> index, std::unique_ptr<Expr> value)
+            : m_object(std::move(object)), m_bracket(bracket), m_index(std::move(index)), m_value(std::move(value)) {}
+    };
+
     struct Expr {
-        using Variant = std::variant<Literal, Variable, Unary, Binary, Ternary, Assign, Grouping, Logical>;
+        using Variant = std::variant<Literal, Variable, Unary, Binary, Ternary, Assign, Grouping, Logical, Call, Get, Set, Super,
+                                     ListLiteral, Index, IndexSet>;
         Variant m_node;
 
         template <typename T>
         Expr(T&& expr) : m_node(std::forward<T>(expr)) {}
 
-        template <typename T>
+        static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+        static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
+
+        template <typename Derived, typename R>
         class Visitor;
     };
 
@@ -102,14 +233,26 @@ namespace parser {
     struct VariableDecl {
         scanner::Token m_name;
         std::optional<std::unique_ptr<Expr>> m_initializer;
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
         VariableDecl(const scanner::Token& name, std::optional<std::unique_ptr<Expr>> initializer)
             : m_name(name), m_initializer(std::move(initializer)) {}
     };
 
     struct Block {
         std::vector<std::unique_ptr<Statement>> m_statements;
-        Block(std::vector<std::unique_ptr<Statement>>&& statements)
-            : m_statements(std::move(statements)) {}
+        u32 m_slot_count { 0 };
+
+        /// @brief How many of the block's variables are captured. If any are, entering the
+        /// block creates an environment to hold them.
+        u32 m_captured_count { 0 };
+
+        /// @brief The line of the `{`, where going over the memory limit inside the block is
+        /// reported. See `WhileLoop::m_line`.
+        int m_line;
+
+        Block(std::vector<std::unique_ptr<Statement>>&& statements, int line)
+            : m_statements(std::move(statements)), m_line(line) {}
     };
 
     struct IfStmt {
@@ -127,8 +270,54 @@ namespace parser {
     struct WhileLoop {
         std::unique_ptr<Expr> m_condition;
         std::unique_ptr<Statement> m_body;
-        WhileLoop(std::unique_ptr<Expr> condition, std::unique_ptr<Statement> body) 
-            : m_condition(std::move(condition)), m_body(std::move(body)) {}
+
+        /// @brief The line of the `while`, where running out of budget inside the loop is reported.
+        int m_line;
+
+        WhileLoop(std::unique_ptr<Expr> condition, std::unique_ptr<Statement> body, int line)
+            : m_condition(std::move(condition)), m_body(std::move(body)), m_line(line) {}
+    };
+
+    /// @brief A variable declared outside a `parallel for` that its body updates with
+    /// `x = x + e;`, `x = x - e;` or `x = x * e;`. Each block of iterations accumulates
+    /// into a slot of the loop's own, and the blocks' results are combined into the
+    /// variable in iteration order once the loop ends.
+    struct Reduction {
+        scanner::Token m_name;
+
+        /// @brief Where the variable is, seen from outside the loop.
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
+
+        /// @brief The slot in the loop's scope that the updates are redirected to.
+        i32 m_partial { 0 };
+
+        /// @brief `Plus` for sums and differences, `Star` for products.
+        scanner::TokenType m_operator { scanner::TokenType::Plus };
+    };
+
+    /// @brief What makes a `ForLoop` a `parallel for`. The parser only accepts one of the
+    /// form `for (var i = start; i < limit; i = i + step)`, or with `<=`, so its iterations
+    /// can be counted before any of them run. See `Resolver` for what the body may do.
+    struct Parallel {
+        scanner::Token m_keyword;
+
+        /// @brief Whether the condition is `<=`, which includes the limit.
+        bool m_inclusive { false };
+
+        /// @brief Where the loop variable is, like a `VariableDecl`'s.
+        i32 m_slot { 0 };
+        i32 m_depth { NOT_CAPTURED };
+
+        /// @brief The size of the loop's own scope, which holds the loop variable and the
+        /// partial results of the reductions. See `Block::m_captured_count`.
+        u32 m_slot_count { 0 };
+        u32 m_captured_count { 0 };
+
+        std::vector<Reduction> m_reductions;
+
+        static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+        static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
     };
 
     struct ForLoop {
@@ -136,65 +325,198 @@ namespace parser {
         std::optional<std::unique_ptr<Expr>> m_condition;
         std::optional<std::unique_ptr<Expr>> m_update;
         std::unique_ptr<Statement> m_body;
+
+        /// @brief Set for a `parallel for`, kept apart like `FunctionDecl::m_function`.
+        std::unique_ptr<Parallel> m_parallel;
+
+        /// @brief The line of the `for`. See `WhileLoop::m_line`.
+        int m_line;
+
         ForLoop(
             std::optional<std::unique_ptr<Statement>> initializer,
             std::optional<std::unique_ptr<Expr>> condition, 
             std::optional<std::unique_ptr<Expr>> update,
-            std::unique_ptr<Statement> body
+            std::unique_ptr<Statement> body,
+            int line
         ) : m_initializer(std::move(initializer)),
             m_condition(std::move(condition)), 
             m_update(std::move(update)),
-            m_body(std::move(body)) {}
+            m_body(std::move(body)),
+            m_line(line) {}
+    };
+
+    /// @brief Where a `ForInLoop` keeps its variable, and the size of the scope it opens
+    /// for it, like a `Block`'s. Kept apart like `Parallel`.
+    struct LoopScope {
+        i32 m_slot { 0 };
+        i32 m_depth { NOT_CAPTURED };
+
+        /// @brief The slot holding the list, map or array being looped over, which keeps
+        /// it reachable while the body runs.
+        i32 m_iterable_slot { 0 };
+
+        u32 m_slot_count { 0 };
+        u32 m_captured_count { 0 };
+
+        static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+        static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
+    };
+
+    /// @brief `for (var name in iterable) body`, which runs the body once for each element
+    /// of a list or an array, or for each key of a map in the order they were added.
+    /// Each iteration has a variable of its own, as closures that capture it can tell.
+    struct ForInLoop {
+        scanner::Token m_name;
+        std::unique_ptr<Expr> m_iterable;
+        std::unique_ptr<Statement> m_body;
+        std::unique_ptr<LoopScope> m_scope;
+
+        ForInLoop(const scanner::Token& name, std::unique_ptr<Expr> iterable, std::unique_ptr<Statement> body)
+            : m_name(name), m_iterable(std::move(iterable)), m_body(std::move(body)), m_scope(new LoopScope) {}
+    };
+
+    /// @brief The most parameters a function can have, and so the most arguments a call can pass.
+    inline constexpr u32 MAX_PARAMETERS = 255;
+
+    enum class FunctionKind : u8 { Function, Method, Initializer };
+
+    /// @brief What a call needs of a function declaration. It is kept apart from
+    /// `FunctionDecl` so that every `Statement` stays as small as the others need.
+    struct Function {
+        FunctionKind m_kind { FunctionKind::Function };
+        std::vector<scanner::Token> m_params;
+        std::vector<std::unique_ptr<Statement>> m_body;
+
+        /// @brief The size of a call's frame: the callee in slot 0, or `this` for a method,
+        /// the arguments in the slots after it, then the variables declared directly in the body.
+        u32 m_frame_size { 0 };
+
+        /// @brief How many parameters and body variables are captured. See `Block::m_captured_count`.
+        u32 m_captured_count { 0 };
+
+        /// @brief The frame slot and environment index of each captured parameter, which
+        /// is copied into the environment when the call starts.
+        std::vector<std::pair<u32, u32>> m_captured_params;
+
+        static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+        static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
+    };
+
+    struct FunctionDecl {
+        scanner::Token m_name;
+
+        /// @brief Where the function itself is stored, like a `VariableDecl`.
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
+
+        std::unique_ptr<Function> m_function;
+
+        FunctionDecl(
+            const scanner::Token& name,
+            std::vector<scanner::Token>&& params,
+            std::vector<std::unique_ptr<Statement>>&& body,
+            FunctionKind kind = FunctionKind::Function
+        ) : m_name(name), m_function(new Function { kind, std::move(params), std::move(body) }) {}
+    };
+
+    /// @brief The methods and superclass of a class declaration. See `Function`.
+    struct Class {
+        std::optional<std::unique_ptr<Expr>> m_superclass;
+        std::vector<FunctionDecl> m_methods;
+
+        /// @brief A class with a superclass declares `super` in a scope around its methods.
+        /// This is where it is stored, and the size of that scope, like a `Block`'s.
+        i32 m_super_slot { GLOBAL_SLOT };
+        i32 m_super_depth { NOT_CAPTURED };
+        u32 m_slot_count { 0 };
+        u32 m_captured_count { 0 };
+
+        static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+        static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
+    };
+
+    struct ClassDecl {
+        scanner::Token m_name;
+
+        /// @brief Where the class itself is stored, like a `VariableDecl`.
+        i32 m_slot { GLOBAL_SLOT };
+        i32 m_depth { NOT_CAPTURED };
+
+        std::unique_ptr<Class> m_class;
+
+        ClassDecl(
+            const scanner::Token& name,
+            std::optional<std::unique_ptr<Expr>> superclass,
+            std::vector<FunctionDecl>&& methods
+        ) : m_name(name), m_class(new Class { std::move(superclass), std::move(methods) }) {}
+    };
+
+    struct ReturnStmt {
+        scanner::Token m_keyword;
+        std::optional<std::unique_ptr<Expr>> m_value;
+        ReturnStmt(const scanner::Token& keyword, std::optional<std::unique_ptr<Expr>> value)
+            : m_keyword(keyword), m_value(std::move(value)) {}
     };
 
     struct Statement {
-        using Variant = std::variant<ExprStmt, PrintStmt, VariableDecl, Block, IfStmt, WhileLoop, ForLoop>;
+        using Variant = std::variant<ExprStmt, PrintStmt, VariableDecl, Block, IfStmt, WhileLoop, ForLoop, FunctionDecl, ReturnStmt, ClassDecl,
+                                     ForInLoop>;
         Variant m_stmt;
 
         template <typename T>
         Statement(T&& stmt) : m_stmt(std::forward<T>(stmt)) {}
 
-        template <typename T>
+        static void* operator new(std::size_t size) { return lox::allocate_accounted(size); }
+        static void operator delete(void* memory) { lox::deallocate_accounted(memory); }
+
+        template <typename Derived, typename R>
         class Visitor;
     };
 
-    template <typename R>
+    /// @brief Dispatches each kind of statement to `Derived::visit`, resolved at compile
+    /// time rather than through a virtual call, so a visit can inline into the jump that
+    /// `std::visit` makes for the statement's kind. `Derived` must have a `visit` for
+    /// every kind of statement it is given: taking a `const` node for passes that only
+    /// read the tree, or a mutable one for passes that annotate it.
+    template <typename Derived, typename R>
     class Statement::Visitor {
     public:
         R visit_stmt(const Statement& stmt) {
             return std::visit([this](auto&& v) -> R {
-                return visit(v);
+                return static_cast<Derived*>(this)->visit(v);
             }, stmt.m_stmt);
         }
 
-        virtual ~Visitor() = default;
-        virtual R visit(const ExprStmt& stmt) = 0;
-        virtual R visit(const PrintStmt& stmt) = 0;
-        virtual R visit(const Block& block) = 0;
-        virtual R visit(const VariableDecl& decl) = 0;
-        virtual R visit(const IfStmt& stmt) = 0;
-        virtual R visit(const WhileLoop& loop) = 0;
-        virtual R visit(const ForLoop& loop) = 0;
-    };
+        R visit_stmt(Statement& stmt) {
+            return std::visit([this](auto&& v) -> R {
+                return static_cast<Derived*>(this)->visit(v);
+            }, stmt.m_stmt);
+        }
 
+    protected:
+        Visitor() = default;
+        ~Visitor() = default;
+    };
 
-    template <typename R>
+    /// @brief Dispatches each kind of expression to `Derived::visit`. See `Statement::Visitor`.
+    template <typename Derived, typename R>
     class Expr::Visitor {
     public:
         R visit_expr(const Expr& expr) {
             return std::visit([this](auto&& v) -> R {
-                return visit(v);
+                return static_cast<Derived*>(this)->visit(v);
+            }, expr.m_node);
+        }
+
+        R visit_expr(Expr& expr) {
+            return std::visit([this](auto&& v) -> R {
+                return static_cast<Derived*>(this)->visit(v);
             }, expr.m_node);
         }
 
-        virtual R visit(const Literal& literal) = 0;
-        virtual R visit(const Variable& identifier) = 0;
-        virtual R visit(const Unary& expr) = 0;
-        virtual R visit(const Binary& expr) = 0;
-        virtual R visit(const Ternary& expr) = 0;
-        virtual R visit(const Assign& assign) = 0;
-        virtual R visit(const Grouping& grouping) = 0;
-        virtual R visit(const Logical& logical) = 0;
+    protected:
+        Visitor() = default;
+        ~Visitor() = default;
     };
 }
 #endif
\ No newline at end of file
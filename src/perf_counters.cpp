@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <numeric>
+#include <ostream>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "perf_counters.hpp"
+
+using namespace lox::perf;
+
+namespace {
+    struct EventConfig {
+        Event m_event;
+        u32 m_type;
+        u64 m_config;
+    };
+
+    constexpr u64 read_misses(u64 cache) {
+        return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    }
+
+    constexpr EventConfig CPU_EVENTS[] = {
+        { Cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { Instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { BranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { L1dMisses, PERF_TYPE_HW_CACHE, read_misses(PERF_COUNT_HW_CACHE_L1D) },
+        { LlcMisses, PERF_TYPE_HW_CACHE, read_misses(PERF_COUNT_HW_CACHE_LL) },
+    };
+
+    /// @brief The first counter opened. The others join its group, so one read gets
+    /// them all, counted over exactly the same stretch.
+    int leader_ = -1;
+    std::vector<int> fds_;
+
+    /// @brief The events in the group, in the order a read of the group lists them.
+    std::vector<Event> opened_;
+
+    std::string unavailable_reason_ = "not opened";
+    std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+
+    /// @brief Closes the counters when the process ends.
+    struct Closer {
+        ~Closer() {
+            for (auto fd : fds_) close(fd);
+        }
+    } closer_;
+
+    int open_event(const EventConfig& config) {
+        auto attributes = perf_event_attr {};
+        attributes.type = config.m_type;
+        attributes.size = sizeof(attributes);
+        attributes.config = config.m_config;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        attributes.read_format = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, leader_, 0));
+    }
+}
+
+const char* lox::perf::to_string(Event event) {
+    switch (event) {
+        case Time:         return "time (us)";
+        case Cycles:       return "cycles";
+        case Instructions: return "instructions";
+        case BranchMisses: return "branch misses";
+        case L1dMisses:    return "L1d misses";
+        case LlcMisses:    return "LLC misses";
+    }
+    return "?";
+}
+
+bool lox::perf::open() {
+    origin_ = std::chrono::steady_clock::now();
+    if (leader_ >= 0) return true;
+
+    // A machine may count some events and not others, so each is tried on its own.
+    for (const auto& config : CPU_EVENTS) {
+        auto fd = open_event(config);
+        if (fd < 0) {
+            if (leader_ < 0) unavailable_reason_ = std::strerror(errno);
+            continue;
+        }
+        if (leader_ < 0) leader_ = fd;
+        fds_.push_back(fd);
+        opened_.push_back(config.m_event);
+    }
+
+    if (leader_ < 0) return false;
+    unavailable_reason_.clear();
+    return true;
+}
+
+bool lox::perf::available(Event event) {
+    return event == Time || std::find(opened_.begin(), opened_.end(), event) != opened_.end();
+}
+
+const std::string& lox::perf::unavailable_reason() {
+    return unavailable_reason_;
+}
+
+Counts lox::perf::read() noexcept {
+    auto counts = Counts {};
+    counts[Time] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count();
+    if (leader_ < 0) return counts;
+
+    // The group reads as how many events it has, then the count of each.
+    u64 values[1 + EVENT_COUNT] {};
+    if (::read(leader_, values, sizeof(values)) <= 0) return counts;
+    for (u64 i = 0; i < std::min<u64>(values[0], opened_.size()); ++i)
+        counts[opened_[i]] = values[1 + i];
+    return counts;
+}
+
+Profile::Profile(std::vector<const char*> labels, u32 current)
+    : m_labels(std::move(labels)), m_totals(m_labels.size()), m_entries(m_labels.size()), m_current(current) {
+    // The cheapest of a few pairs of reads, since one may be interrupted.
+    m_overhead.fill(~u64(0));
+    auto last = read();
+    for (int i = 0; i < 16; ++i) {
+        auto now = read();
+        for (std::size_t event = 0; event < EVENT_COUNT; ++event)
+            m_overhead[event] = std::min(m_overhead[event], now[event] - last[event]);
+        last = now;
+    }
+    m_last = read();
+}
+
+void Profile::charge() {
+    auto now = read();
+    auto& total = m_totals[m_current];
+    for (std::size_t event = 0; event < EVENT_COUNT; ++event) {
+        auto counted = now[event] - m_last[event];
+        total[event] += counted > m_overhead[event] ? counted - m_overhead[event] : 0;
+    }
+    m_last = now;
+}
+
+void Profile::report(std::ostream& output, const char* heading) const {
+    auto order = std::vector<u32>(m_labels.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](u32 a, u32 b) {
+        return m_totals[a][Time] > m_totals[b][Time];
+    });
+
+    auto events = std::vector<Event>();
+    for (std::size_t event = 0; event < EVENT_COUNT; ++event) {
+        if (available(static_cast<Event>(event))) events.push_back(static_cast<Event>(event));
+    }
+    bool ipc = available(Cycles) && available(Instructions);
+
+    auto flags = output.flags();
+    output << std::left << std::setw(16) << heading << std::right << std::setw(12) << "count";
+    for (auto event : events)
+        output << std::setw(16) << to_string(event);
+    if (ipc) output << std::setw(8) << "IPC";
+    output << '\n';
+
+    for (auto label : order) {
+        const auto& total = m_totals[label];
+        if (m_entries[label] == 0) continue;
+
+        output << std::left << std::setw(16) << m_labels[label] << std::right << std::setw(12) << m_entries[label];
+        for (auto event : events) {
+            if (event == Time)
+                output << std::setw(16) << std::fixed << std::setprecision(1) << total[Time] / 1000.0;
+            else
+                output << std::setw(16) << total[event];
+        }
+        if (ipc) {
+            auto cycles = std::max<u64>(total[Cycles], 1);
+            output << std::setw(8) << std::fixed << std::setprecision(2) << static_cast<double>(total[Instructions]) / cycles;
+        }
+        output << '\n';
+    }
+    output.flags(flags);
+}
@@ -0,0 +1,111 @@
+#ifndef LOX_PERF_COUNTERS_HPP
+#define LOX_PERF_COUNTERS_HPP
+
+#include <array>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+#include "util_types.hpp"
+
+namespace lox::perf {
+    /// @brief What is counted. Time is always counted; the rest come from the CPU's own
+    /// counters, which containers and virtual machines often keep from a process.
+    enum Event : u8 { Time, Cycles, Instructions, BranchMisses, L1dMisses, LlcMisses };
+
+    inline constexpr std::size_t EVENT_COUNT = static_cast<std::size_t>(LlcMisses) + 1;
+
+    using Counts = std::array<u64, EVENT_COUNT>;
+
+    const char* to_string(Event event);
+
+    /// @brief Opens the CPU's counters for the calling thread, and only that thread:
+    /// work done on other threads, such as the workers of a `parallel for`, is not counted.
+    /// @return False if none of them could be opened.
+    bool open();
+
+    /// @brief Whether `event` is being counted. `Time` always is.
+    bool available(Event event);
+
+    /// @return Why the CPU's counters could not be opened, or an empty string if they were.
+    const std::string& unavailable_reason();
+
+    /// @return Everything counted on this thread since `open`. Events that are not
+    /// available read as 0.
+    Counts read() noexcept;
+
+    /// @brief Attributes counts to one of a fixed set of labels: everything counted while
+    /// a label is current is charged to it, and nothing else is, so a label that encloses
+    /// others, like a loop enclosing its body, is charged only for its own work.
+    ///
+    /// Each change of label reads the counters, which costs a system call when the CPU's
+    /// counters are open. What one read costs is measured when the profile is made and
+    /// taken off every charge, so the reads themselves barely show, but a profiled run is
+    /// still far slower than a normal one.
+    class Profile {
+    private:
+        std::vector<const char*> m_labels;
+        std::vector<Counts> m_totals;
+        std::vector<u64> m_entries;
+        u32 m_current;
+        Counts m_last;
+
+        /// @brief What two reads in a row count, which is charged to nothing.
+        Counts m_overhead;
+
+    public:
+        /// @param labels The name of each label. Counting starts with `labels[current]`.
+        Profile(std::vector<const char*> labels, u32 current);
+
+        Profile(const Profile&) = delete;
+        Profile& operator=(const Profile&) = delete;
+
+        /// @brief Charges what was counted so far, then makes `label` current.
+        /// @return The label that was current, to give to `leave`.
+        u32 enter(u32 label) {
+            charge();
+            ++m_entries[label];
+            return std::exchange(m_current, label);
+        }
+
+        /// @brief Charges what was counted so far, then makes `previous` current again.
+        void leave(u32 previous) {
+            charge();
+            m_current = previous;
+        }
+
+        /// @brief Writes a table of what each label that was ever entered was charged, those
+        /// charged the most time first, under the column heading `heading`.
+        void report(std::ostream& output, const char* heading) const;
+
+        /// @brief Makes a label current for its own lifetime, or until `end`. Does nothing
+        /// if the profile is `nullptr`.
+        class Scope {
+        private:
+            Profile* m_profile;
+            u32 m_previous { 0 };
+
+        public:
+            Scope(Profile* profile, u32 label) : m_profile(profile) {
+                if (m_profile) m_previous = m_profile->enter(label);
+            }
+
+            ~Scope() {
+                end();
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            void end() {
+                if (m_profile) m_profile->leave(m_previous);
+                m_profile = nullptr;
+            }
+        };
+
+    private:
+        [[gnu::noinline]] void charge();
+    };
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "pipeline.hpp"
+#include "lox.hpp"
+#include "spsc_queue.hpp"
+#include "trace.hpp"
+#include "scanner/Scanner.hpp"
+#include "parser/Parser.hpp"
+
+using parser::Statement;
+
+namespace {
+    /// @brief How many declarations the front end may get ahead of the program running.
+    constexpr u64 QUEUE_CAPACITY = 1024;
+}
+
+bool lox::run_pipelined(const std::string& source, interpreter::Interpreter& lox_interpreter) {
+    // A null declaration marks the end: ones with syntax errors are never sent.
+    auto queue = SpscQueue<std::unique_ptr<Statement>>(QUEUE_CAPACITY);
+    bool front_end_failed = false;
+
+    // The front end runs without a memory account: the interpreter's is only ever
+    // changed from the thread running the program, so the trees go uncharged.
+    auto front_end = std::jthread([&] {
+        auto span = trace::Span("front end");
+        auto scanner = scanner::Scanner(source);
+        auto parser = parser::Parser(scanner);
+        while (!parser.done()) {
+            auto declaration = parser.next_declaration();
+            if (declaration && !had_error()) queue.push(std::move(declaration));
+        }
+        front_end_failed = had_error();
+        queue.push(nullptr);
+    });
+
+    // Whatever has arrived by the time the last part finishes runs as the next part.
+    auto ended = false;
+    while (!ended) {
+        auto part = std::vector<std::unique_ptr<Statement>>();
+        for (auto declaration = queue.pop();;) {
+            if (!declaration) {
+                ended = true;
+                break;
+            }
+            part.push_back(std::move(declaration));
+            auto next = queue.try_pop();
+            if (!next) break;
+            declaration = std::move(*next);
+        }
+
+        if (!part.empty()) lox_interpreter.interpret_part(std::move(part));
+        if (had_runtime_error()) break;
+    }
+
+    // The front end still reports every error in the rest of the source, so the exit
+    // code does not depend on how far it had got.
+    if (!ended) {
+        while (queue.pop()) {}
+    }
+    front_end.join();
+
+    if (!front_end_failed) lox_interpreter.finish();
+    return front_end_failed;
+}
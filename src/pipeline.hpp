@@ -0,0 +1,21 @@
+#ifndef LOX_PIPELINE_HPP
+#define LOX_PIPELINE_HPP
+
+#include <string>
+#include "interpreter/Interpreter.hpp"
+
+namespace lox {
+    /// @brief Runs `source` while it is still being scanned and parsed. A front-end thread
+    /// scans, parses, resolves and infers the types of one top-level declaration at a
+    /// time and hands each over through an `SpscQueue` as soon as it is done; the calling
+    /// thread runs whatever has arrived, so the first statements run no matter how long
+    /// the rest of the file is.
+    ///
+    /// The declarations before the first one with an error still run, and nothing after
+    /// it does. The front end always carries on to the end of the source, reporting every
+    /// error as it would have, so a program with one still exits with 65.
+    /// @return Whether the front end reported an error.
+    bool run_pipelined(const std::string& source, interpreter::Interpreter& lox_interpreter);
+}
+
+#endif
@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <iterator>
 #include <string>
 #include <memory>
+#include <thread>
 #include <vector>
 #include <map>
 #include "Scanner.hpp"
 #include "../lox.hpp"
+#include "../trace.hpp"
 
 using namespace scanner;
 
@@ -17,6 +23,7 @@ std::map<std::string, TokenType> Scanner::keywords {
     { "if", TokenType::If },
     { "nil", TokenType::Nil },
     { "or", TokenType::Or },
+    { "parallel", TokenType::Parallel },
     { "print", TokenType::Print },
     { "return", TokenType::Return },
     { "super", TokenType::Super },
@@ -27,17 +34,161 @@ std::map<std::string, TokenType> Scanner::keywords {
 };
 
 std::vector<std::unique_ptr<Token>> Scanner::tokenize() {
+    auto span = lox::trace::Span("scan");
+    scan_tokens();
+    add_token(TokenType::Eof);
+    lox::trace::counter("tokens", m_tokens.size());
+    return std::move(m_tokens);
+}
+
+bool Scanner::tokenize_some(std::vector<std::unique_ptr<Token>>& tokens, u64 count) {
+    while (!is_at_end() && m_tokens.size() < count) {
+        scan_token();
+        m_start = m_current;
+    }
+
+    bool more = !is_at_end();
+    if (!more) add_token(TokenType::Eof);
+    std::ranges::move(m_tokens, std::back_inserter(tokens));
+    m_tokens.clear();
+    return more;
+}
+
+void Scanner::scan_tokens() {
     while (!is_at_end()) {
         scan_token();
         m_start = m_current;
     }
+}
+
+namespace {
+    /// @brief What the quick pass learns of one chunk.
+    struct ChunkSummary {
+        u64 m_begin;
+        u64 m_lines { 0 };
+
+        /// @brief Whether the chunk ends inside a string literal, if it starts outside one
+        /// or inside one respectively.
+        bool m_ends_in_string[2] {};
+    };
+
+    /// @brief Follows only what can hide a line break from the scanner: string literals,
+    /// and the `//` comments that could hide a quote.
+    ChunkSummary summarise(const std::string& source, u64 begin, u64 end) {
+        auto summary = ChunkSummary { begin };
+        for (int starts_in_string = 0; starts_in_string < 2; ++starts_in_string) {
+            bool in_string = starts_in_string;
+            bool in_comment = false;
+            for (auto i = begin; i < end; ++i) {
+                auto ch = source[i];
+                if (in_comment) {
+                    in_comment = ch != '\n';
+                } else if (ch == '"') {
+                    in_string = !in_string;
+                } else if (!in_string && ch == '/' && i + 1 < end && source[i + 1] == '/') {
+                    in_comment = true;
+                }
+            }
+            summary.m_ends_in_string[starts_in_string] = in_string;
+        }
+        summary.m_lines = std::count(source.begin() + begin, source.begin() + end, '\n');
+        return summary;
+    }
+
+    /// @brief Runs `work(i)` for every `i` below `count` on up to `thread_count` new
+    /// threads, handing the indices out one at a time. The calling thread only waits, so
+    /// its error state is left alone.
+    template <typename Work>
+    void parallel_for(u64 count, u32 thread_count, const Work& work) {
+        auto next = std::atomic<u64>(0);
+        auto worker = [&] {
+            for (auto i = next++; i < count; i = next++)
+                work(i);
+        };
+
+        auto threads = std::vector<std::jthread>();
+        for (u64 i = 0; i < std::min<u64>(thread_count, count); ++i)
+            threads.emplace_back(worker);
+    }
+}
+
+std::vector<std::unique_ptr<Token>> Scanner::tokenize_parallel(u32 thread_count, u64 min_chunk_bytes) {
+    auto length = m_source.length();
+    auto chunk_bytes = std::max<u64>(min_chunk_bytes, length / std::max<u32>(thread_count, 1));
+    if (thread_count <= 1 || chunk_bytes >= length) return tokenize();
+
+    auto span = lox::trace::Span("scan");
+
+    // Cut after the first line break at or past each multiple of the chunk size.
+    auto boundaries = std::vector<u64> { 0 };
+    while (boundaries.back() + chunk_bytes < length) {
+        auto line_break = m_source.find('\n', boundaries.back() + chunk_bytes);
+        if (line_break == std::string::npos || line_break + 1 == length) break;
+        boundaries.push_back(line_break + 1);
+    }
+    boundaries.push_back(length);
+
+    auto summaries = std::vector<ChunkSummary>(boundaries.size() - 1);
+    parallel_for(summaries.size(), thread_count, [&](u64 i) {
+        summaries[i] = summarise(m_source, boundaries[i], boundaries[i + 1]);
+    });
+
+    // Chain the summaries to find which chunks really start outside a string, and the
+    // line each of those starts on.
+    struct Chunk {
+        u64 m_begin;
+        u64 m_end;
+        u64 m_first_line;
+    };
+    auto chunks = std::vector<Chunk>();
+    bool in_string = false;
+    u64 line = m_line;
+    for (u64 i = 0; i < summaries.size(); ++i) {
+        if (!in_string)
+            chunks.push_back(Chunk { boundaries[i], boundaries[i + 1], line });
+        else
+            chunks.back().m_end = boundaries[i + 1];
+        in_string = summaries[i].m_ends_in_string[in_string];
+        line += summaries[i].m_lines;
+    }
+
+    auto tokens = std::vector<std::vector<std::unique_ptr<Token>>>(chunks.size());
+    auto failed = std::atomic<bool>(false);
+    parallel_for(chunks.size(), thread_count, [&](u64 i) {
+        auto chunk_span = lox::trace::Span("scan chunk");
+        // Errors go to this worker thread's own error state, and are thrown away.
+        auto errors = std::ostream(nullptr);
+        lox::set_error_output(errors);
+        lox::clear_errors();
+
+        auto scanner = Scanner(m_source, chunks[i].m_first_line, chunks[i].m_begin, chunks[i].m_end);
+        scanner.scan_tokens();
+        tokens[i] = std::move(scanner.m_tokens);
+
+        if (lox::had_error()) failed = true;
+        lox::clear_errors();
+        lox::set_error_output(std::cerr);
+    });
+
+    if (failed) return tokenize();
+
+    u64 count = 0;
+    for (const auto& chunk : tokens)
+        count += chunk.size();
+    m_tokens.reserve(count + 1);
+    for (auto& chunk : tokens)
+        std::move(chunk.begin(), chunk.end(), std::back_inserter(m_tokens));
+
+    m_line = line;
+    m_start = m_current = length;
     add_token(TokenType::Eof);
+    lox::trace::counter("tokens", m_tokens.size());
     return std::move(m_tokens);
 }
 
 void Scanner::add_token(TokenType type) {
     auto lexeme = m_source.substr(m_start, m_current - m_start);
-    auto token = std::make_unique<Token>(type, m_line, lexeme);
+    auto token = std::make_unique<Token>(type, m_line, lexeme, m_start);
     m_tokens.push_back(std::move(token));
 }
 
@@ -71,6 +222,8 @@ void Scanner::scan_token() {
         case ')': add_token(TokenType::RightParen); break;
         case '{': add_token(TokenType::LeftBrace); break;
         case '}': add_token(TokenType::RightBrace); break;
+        case '[': add_token(TokenType::LeftBracket); break;
+        case ']': add_token(TokenType::RightBracket); break;
         case ',': add_token(TokenType::Comma); break;
         case ';': add_token(TokenType::Semicolon); break;
         case '.': add_token(TokenType::Dot); break;
@@ -120,7 +273,7 @@ void Scanner::number() {
         while (!is_at_end() && is_digit(peek())) advance();
     }
     auto lexeme = m_source.substr(m_start, m_current - m_start);
-    m_tokens.push_back(std::make_unique<Token>(TokenType::Number, m_line, lexeme));
+    m_tokens.push_back(std::make_unique<Token>(TokenType::Number, m_line, lexeme, m_start));
 }
 
 void Scanner::string() {
@@ -135,7 +288,7 @@ void Scanner::string() {
     }
     advance();
     auto lexeme = m_source.substr(m_start, m_current - m_start);
-    m_tokens.push_back(std::make_unique<Token>(TokenType::String, m_line, lexeme));
+    m_tokens.push_back(std::make_unique<Token>(TokenType::String, m_line, lexeme, m_start));
 }
 
 void Scanner::identifier() {
@@ -143,9 +296,9 @@ void Scanner::identifier() {
         advance();
     
     auto lexeme = m_source.substr(m_start, m_current - m_start);
-    if (keywords.count(lexeme) != 0) {
-        auto keyword = keywords[lexeme];
-        add_token(keyword);
+    auto keyword = keywords.find(lexeme);
+    if (keyword != keywords.end()) {
+        add_token(keyword->second);
         return;
     }
 
@@ -12,21 +12,62 @@
 namespace scanner {
     /// @brief Transforms raw source code in text form into a series of tokens.
     class Scanner {
+    public:
+        /// @brief The least `tokenize_parallel` gives each thread to scan, so that small
+        /// sources are not split into chunks too small to be worth a thread.
+        static constexpr u64 MIN_CHUNK_BYTES = 1 << 20;
+
     private:
         const std::string& m_source;
         std::vector<std::unique_ptr<Token>> m_tokens;
         u64 m_line { 0 };
         u64 m_current { 0 };
         u64 m_start { 0 };
+
+        /// @brief Where scanning stops: the end of the source, or of the chunk being scanned.
+        u64 m_end;
         static std::map<std::string, TokenType> keywords;
 
     public:
-        Scanner(const std::string& source) : m_source(source) {}
+        /// @param first_line The line number `source` starts on, for scanning part of a file.
+        Scanner(const std::string& source, u64 first_line = 0)
+            : m_source(source), m_line(first_line), m_end(source.length()) {}
+
         std::vector<std::unique_ptr<Token>> tokenize();
 
+        /// @brief Scans on from where the last call stopped until at least `count` more
+        /// tokens are ready or the source runs out, and moves them onto the end of
+        /// `tokens`, for parsing while the rest of the source is still being scanned.
+        /// Together, the calls produce exactly the tokens `tokenize` would.
+        /// @return False once the last call has added the `Eof` token.
+        bool tokenize_some(std::vector<std::unique_ptr<Token>>& tokens, u64 count);
+
+        /// @brief Produces exactly the tokens `tokenize` would, but splits the source into
+        /// chunks at line breaks and scans them on up to `thread_count` threads.
+        ///
+        /// A line break inside a string literal cannot start a chunk. A quick pass over
+        /// each chunk, run in parallel, records whether the chunk ends inside a string for
+        /// either state it could start in, and how many lines it has. Chaining those
+        /// results gives each chunk its true starting state, and chunks that would start
+        /// inside a string are joined to the one before. Each chunk is then scanned
+        /// knowing its first line, so the token arrays only need concatenating. `//`
+        /// comments end at a line break, so they never cross a chunk boundary.
+        ///
+        /// Errors are reported on the calling thread, in order: if any chunk has one, the
+        /// whole source is scanned again with `tokenize`.
+        /// @param min_chunk_bytes See `MIN_CHUNK_BYTES`.
+        std::vector<std::unique_ptr<Token>> tokenize_parallel(u32 thread_count, u64 min_chunk_bytes = MIN_CHUNK_BYTES);
+
     private:
+        /// @brief Scans the `[begin, end)` part of `source`, which starts on `first_line`.
+        Scanner(const std::string& source, u64 first_line, u64 begin, u64 end)
+            : m_source(source), m_line(first_line), m_current(begin), m_start(begin), m_end(end) {}
+
+        /// @brief Scans up to `m_end`, without adding the `Eof` token.
+        void scan_tokens();
+
         bool is_at_end() const {
-            return m_current >= m_source.length();
+            return m_current >= m_end;
         }
 
         /// @brief Get the next character in the input and move ahead by 1 character.
@@ -5,8 +5,8 @@
 #include "../util_types.hpp"
 
 namespace scanner {
-    enum class TokenType {
-        LeftParen, RightParen, LeftBrace, RightBrace,
+    enum class TokenType : u8 {
+        LeftParen, RightParen, LeftBrace, RightBrace, LeftBracket, RightBracket,
         Comma, Dot, Minus, Plus, Semicolon, Slash, Star,
         QuestionMark, Colon,
     
@@ -18,7 +18,7 @@ namespace scanner {
         Identifier, String, Number,
     
         And, Class, Else, False, Fun, For, If, Nil, Or,
-        Print, Return, Super, This, True, Var, While,
+        Parallel, Print, Return, Super, This, True, Var, While,
     
         Eof
     };
@@ -29,6 +29,8 @@ namespace scanner {
             case TokenType::RightParen:   return os << "RightParen";
             case TokenType::LeftBrace:    return os << "LeftBrace";
             case TokenType::RightBrace:   return os << "RightBrace";
+            case TokenType::LeftBracket:  return os << "LeftBracket";
+            case TokenType::RightBracket: return os << "RightBracket";
             case TokenType::Comma:        return os << "Comma";
             case TokenType::Dot:          return os << "Dot";
             case TokenType::Minus:        return os << "Minus";
@@ -61,6 +63,7 @@ namespace scanner {
             case TokenType::If:           return os << "If";
             case TokenType::Nil:          return os << "Nil";
             case TokenType::Or:           return os << "Or";
+            case TokenType::Parallel:     return os << "Parallel";
             case TokenType::Print:        return os << "Print";
             case TokenType::Return:       return os << "Return";
             case TokenType::Super:        return os << "Super";
@@ -83,10 +86,11 @@ namespace scanner {
         TokenType m_type;
         u64 m_line;
         std::string m_lexeme;
+        u64 m_offset;
 
     public:
-        Token(TokenType type, u64 line, const std::string& lexeme)
-            : m_type(type), m_line(line), m_lexeme(lexeme) {}
+        Token(TokenType type, u64 line, const std::string& lexeme, u64 offset = 0)
+            : m_type(type), m_line(line), m_lexeme(lexeme), m_offset(offset) {}
 
         TokenType type() const {
             return m_type;
@@ -99,6 +103,16 @@ namespace scanner {
         const std::string& lexeme() const {
             return m_lexeme;
         }
+
+        /// @brief The position of the first character of the token in the scanned source.
+        u64 offset() const {
+            return m_offset;
+        }
+
+        /// @brief Moves the token to another line, for when the text above it has changed.
+        void set_line(u64 line) {
+            m_line = line;
+        }
     };
 
     inline std::ostream& operator<<(std::ostream& stream, const Token& token) {
@@ -0,0 +1,96 @@
+#ifndef LOX_SPSC_QUEUE_HPP
+#define LOX_SPSC_QUEUE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <optional>
+#include <utility>
+#include "util_types.hpp"
+
+namespace lox {
+    /// @brief A bounded queue between exactly one thread that pushes and one that pops,
+    /// without locks. Items live in a ring whose size is a power of two; the producer
+    /// only writes `m_tail` and the consumer only writes `m_head`, each on a cache line
+    /// of its own, and each side keeps a copy of the other's counter that it reloads only
+    /// when the ring looks full or empty.
+    ///
+    /// `push` and `pop` wait for room or for an item with `std::atomic::wait`, which
+    /// sleeps in the kernel rather than spinning, so a side that gets far ahead of the
+    /// other costs nothing while it waits.
+    template<typename T>
+    class SpscQueue {
+    private:
+        std::unique_ptr<T[]> m_items;
+        u64 m_mask;
+
+        /// @brief How many items have been popped. Written by the consumer.
+        alignas(64) std::atomic<u64> m_head { 0 };
+
+        /// @brief The producer's copy of `m_head`.
+        u64 m_known_head { 0 };
+
+        /// @brief How many items have been pushed. Written by the producer.
+        alignas(64) std::atomic<u64> m_tail { 0 };
+
+        /// @brief The consumer's copy of `m_tail`.
+        u64 m_known_tail { 0 };
+
+    public:
+        /// @param capacity At least how many items the queue holds before `push` waits.
+        explicit SpscQueue(u64 capacity)
+            : m_items(std::make_unique<T[]>(std::bit_ceil(std::max<u64>(capacity, 2)))),
+              m_mask(std::bit_ceil(std::max<u64>(capacity, 2)) - 1) {}
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        /// @return False, leaving `item` as it was, if the queue is full.
+        bool try_push(T& item) {
+            auto tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_known_head > m_mask) {
+                m_known_head = m_head.load(std::memory_order_acquire);
+                if (tail - m_known_head > m_mask) return false;
+            }
+
+            m_items[tail & m_mask] = std::move(item);
+            m_tail.store(tail + 1, std::memory_order_release);
+            m_tail.notify_one();
+            return true;
+        }
+
+        /// @brief Pushes `item`, waiting for the consumer to make room if the queue is full.
+        void push(T item) {
+            while (!try_push(item)) {
+                auto tail = m_tail.load(std::memory_order_relaxed);
+                m_head.wait(tail - m_mask - 1, std::memory_order_acquire);
+            }
+        }
+
+        /// @return The oldest item, or nothing if the queue is empty.
+        std::optional<T> try_pop() {
+            auto head = m_head.load(std::memory_order_relaxed);
+            if (head == m_known_tail) {
+                m_known_tail = m_tail.load(std::memory_order_acquire);
+                if (head == m_known_tail) return std::nullopt;
+            }
+
+            auto item = std::move(m_items[head & m_mask]);
+            m_head.store(head + 1, std::memory_order_release);
+            m_head.notify_one();
+            return item;
+        }
+
+        /// @brief Pops the oldest item, waiting for the producer to push one if the queue
+        /// is empty.
+        T pop() {
+            while (true) {
+                if (auto item = try_pop()) return std::move(*item);
+                m_tail.wait(m_head.load(std::memory_order_relaxed), std::memory_order_acquire);
+            }
+        }
+    };
+}
+
+#endif
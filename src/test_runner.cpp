@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "test_runner.hpp"
+#include "lox.hpp"
+#include "trace.hpp"
+#include "scanner/Scanner.hpp"
+#include "parser/Parser.hpp"
+
+namespace fs = std::filesystem;
+
+using interpreter::Backend;
+using interpreter::Interpreter;
+
+namespace {
+    struct ScriptResult {
+        bool m_passed { false };
+        int m_exit_code { 0 };
+        int m_expected_exit_code { 0 };
+        std::string m_output;
+        std::string m_errors;
+        std::optional<std::string> m_expected;
+        std::optional<std::string> m_expected_errors;
+        double m_milliseconds { 0 };
+    };
+
+    std::string read_file(const fs::path& path) {
+        auto input = std::ifstream(path, std::ios::binary);
+        auto contents = std::ostringstream();
+        contents << input.rdbuf();
+        return contents.str();
+    }
+
+    /// @return The contents of the file next to `script` with the extension `extension`,
+    /// or nothing if there is none.
+    std::optional<std::string> read_sibling(const fs::path& script, const char* extension) {
+        auto path = fs::path(script).replace_extension(extension);
+        if (!fs::exists(path)) return std::nullopt;
+        return read_file(path);
+    }
+
+    /// @brief Runs one script with the same exit codes as `loxpp file`, capturing what
+    /// it prints and the errors it reports.
+    ScriptResult run_script(const fs::path& path, Backend backend, bool allow_shell) {
+        auto path_string = path.string();
+        auto span = lox::trace::Span("script", path_string);
+        auto result = ScriptResult();
+        auto output = std::ostringstream();
+        auto errors = std::ostringstream();
+        auto start = std::chrono::steady_clock::now();
+
+        lox::clear_errors();
+        lox::set_error_output(errors);
+
+        // The interpreter comes first so it outlives the AST charged to its memory account.
+        auto lox_interpreter = Interpreter();
+        lox_interpreter.set_backend(backend);
+        lox_interpreter.set_output(output);
+        if (allow_shell) lox_interpreter.allow_shell();
+        auto memory_scope = lox::MemoryAccount::Scope(lox_interpreter.memory());
+
+        auto source = read_file(path);
+        auto parser = parser::Parser(scanner::Scanner(source).tokenize());
+        auto ast = parser.parse();
+        if (!lox::had_error())
+            lox_interpreter.interpret(std::move(ast));
+
+        result.m_exit_code = lox::had_error() ? 65 : lox::had_runtime_error() ? 70 : 0;
+        lox::set_error_output(std::cerr);
+        lox::clear_errors();
+
+        result.m_output = output.str();
+        result.m_errors = errors.str();
+
+        // A script is expected to run without errors unless it says otherwise.
+        result.m_expected = read_sibling(path, ".expected");
+        result.m_expected_errors = read_sibling(path, ".expected_err");
+        if (auto exit_code = read_sibling(path, ".expected_exit"))
+            result.m_expected_exit_code = std::atoi(exit_code->c_str());
+        result.m_passed = result.m_exit_code == result.m_expected_exit_code
+            && (!result.m_expected || result.m_output == *result.m_expected)
+            && (!result.m_expected_errors || result.m_errors == *result.m_expected_errors);
+
+        result.m_milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    void report(const fs::path& script, const ScriptResult& result) {
+        if (result.m_passed)
+            std::cout << "[ \033[92mPASSED\033[0m ] ";
+        else
+            std::cout << "[ \033[91mFAILED\033[0m ] ";
+        std::cout << script.string() << " (" << result.m_milliseconds << " ms)\n";
+
+        if (result.m_passed) return;
+        if (result.m_exit_code != result.m_expected_exit_code) {
+            std::cout << "\tExit code: " << result.m_exit_code << ", expected " << result.m_expected_exit_code << '\n'
+                      << result.m_errors;
+        }
+        if (result.m_expected && result.m_output != *result.m_expected)
+            std::cout << "\tExpected:\n" << *result.m_expected << "\tFound:\n" << result.m_output;
+        if (result.m_expected_errors && result.m_errors != *result.m_expected_errors)
+            std::cout << "\tExpected errors:\n" << *result.m_expected_errors << "\tFound:\n" << result.m_errors;
+    }
+}
+
+int lox::run_tests(const std::string& directory, Backend backend, bool allow_shell) {
+    auto scripts = std::vector<fs::path>();
+    auto error = std::error_code();
+    for (auto entry = fs::recursive_directory_iterator(directory, error); !error && entry != fs::end(entry); entry.increment(error)) {
+        if (entry->is_regular_file() && entry->path().extension() == ".lox")
+            scripts.push_back(entry->path());
+    }
+
+    if (error) {
+        std::cerr << "Could not read test directory '" << directory << "'.\n";
+        return 66;
+    }
+    std::sort(scripts.begin(), scripts.end());
+
+    // Scripts are handed out one at a time, so a slow one only holds up its own thread.
+    auto results = std::vector<ScriptResult>(scripts.size());
+    auto next = std::atomic<u64>(0);
+    auto worker = [&] {
+        for (auto i = next++; i < scripts.size(); i = next++)
+            results[i] = run_script(scripts[i], backend, allow_shell);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto thread_count = std::clamp<u64>(std::thread::hardware_concurrency(), 1, std::max<u64>(scripts.size(), 1));
+    auto threads = std::vector<std::jthread>();
+    for (u64 i = 1; i < thread_count; ++i)
+        threads.emplace_back(worker);
+    worker();
+    threads.clear();
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+
+    u64 failed = 0;
+    for (u64 i = 0; i < scripts.size(); ++i) {
+        report(scripts[i], results[i]);
+        if (!results[i].m_passed) ++failed;
+    }
+
+    std::cout << "Ran " << scripts.size() << " scripts in " << elapsed.count() << " ms on "
+              << thread_count << (thread_count == 1 ? " thread.\n" : " threads.\n")
+              << "\033[92mPassed\033[0m: " << scripts.size() - failed << '\n'
+              << "\033[91mFailed\033[0m: " << failed << '\n';
+    return failed == 0 ? 0 : 1;
+}
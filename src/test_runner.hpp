@@ -0,0 +1,18 @@
+#ifndef LOX_TEST_RUNNER_HPP
+#define LOX_TEST_RUNNER_HPP
+
+#include <string>
+#include "interpreter/Interpreter.hpp"
+
+namespace lox {
+    /// @brief Runs every `.lox` file under `directory` in this process, spread over one
+    /// thread per core, each with its own interpreter. A script passes when it exits with 0,
+    /// or the code in a `.expected_exit` file next to it, and what it prints and the errors
+    /// it reports match its `.expected` and `.expected_err` files exactly, where it has them.
+    /// Prints a line with the result and time of every script, and why the failures failed.
+    /// @param allow_shell Whether the scripts can run commands with `shell`.
+    /// @return The exit code for `loxpp --test`: 0 if every script passed, 1 otherwise.
+    int run_tests(const std::string& directory, interpreter::Backend backend, bool allow_shell);
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace.hpp"
+
+namespace {
+    enum class Phase : char { Complete = 'X', Counter = 'C' };
+
+    struct Event {
+        const char* m_name;
+        Phase m_phase;
+        u64 m_start;
+
+        /// @brief The duration of a `Complete` event, or the value of a `Counter`.
+        u64 m_value;
+        std::string m_detail;
+    };
+
+    /// @brief The events of one thread. Only that thread appends to it; buffers are
+    /// owned by `buffers_` so they outlive threads that finish before `write`.
+    struct Buffer {
+        u32 m_thread;
+        std::vector<Event> m_events;
+    };
+
+    std::chrono::steady_clock::time_point origin_;
+    std::mutex buffers_mutex_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
+    thread_local Buffer* buffer_ = nullptr;
+
+    Buffer& buffer() {
+        if (!buffer_) [[unlikely]] {
+            auto lock = std::lock_guard(buffers_mutex_);
+            auto& added = buffers_.emplace_back(std::make_unique<Buffer>(Buffer { static_cast<u32>(buffers_.size()), {} }));
+            added->m_events.reserve(4096);
+            buffer_ = added.get();
+        }
+        return *buffer_;
+    }
+
+    void write_escaped(std::ofstream& output, std::string_view text) {
+        for (auto c : text) {
+            if (c == '"' || c == '\\')
+                output << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                output << ' ';
+            else
+                output << c;
+        }
+    }
+
+    /// @brief Writes a time in nanoseconds as the microseconds the format expects.
+    void write_time(std::ofstream& output, u64 nanoseconds) {
+        output << nanoseconds / 1000 << '.' << static_cast<char>('0' + nanoseconds / 100 % 10)
+               << static_cast<char>('0' + nanoseconds / 10 % 10) << static_cast<char>('0' + nanoseconds % 10);
+    }
+}
+
+void lox::trace::start() {
+    origin_ = std::chrono::steady_clock::now();
+    enabled_ = true;
+}
+
+u64 lox::trace::now() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin_).count();
+}
+
+void lox::trace::complete(const char* name, u64 start, u64 end, std::string_view detail) noexcept {
+    buffer().m_events.push_back(Event { name, Phase::Complete, start, end - start, std::string(detail) });
+}
+
+void lox::trace::counter(const char* name, u64 value) noexcept {
+    if (!enabled()) return;
+    buffer().m_events.push_back(Event { name, Phase::Counter, now(), value, {} });
+}
+
+bool lox::trace::write(const std::string& path) {
+    auto output = std::ofstream(path, std::ios::trunc);
+    if (!output) return false;
+
+    auto lock = std::lock_guard(buffers_mutex_);
+    output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const auto& buffer : buffers_) {
+        for (const auto& event : buffer->m_events) {
+            output << (first ? "\n" : ",\n") << "{\"name\":\"";
+            write_escaped(output, event.m_name);
+            output << "\",\"ph\":\"" << static_cast<char>(event.m_phase) << "\",\"pid\":1,\"tid\":" << buffer->m_thread << ",\"ts\":";
+            write_time(output, event.m_start);
+
+            if (event.m_phase == Phase::Complete) {
+                output << ",\"dur\":";
+                write_time(output, event.m_value);
+                if (!event.m_detail.empty()) {
+                    output << ",\"args\":{\"detail\":\"";
+                    write_escaped(output, event.m_detail);
+                    output << "\"}";
+                }
+            } else {
+                output << ",\"args\":{\"value\":" << event.m_value << '}';
+            }
+            output << '}';
+            first = false;
+        }
+    }
+    output << "\n]}\n";
+
+    output.flush();
+    return static_cast<bool>(output);
+}
@@ -0,0 +1,63 @@
+#ifndef LOX_TRACE_HPP
+#define LOX_TRACE_HPP
+
+#include <string>
+#include <string_view>
+#include "util_types.hpp"
+
+namespace lox::trace {
+    /// @brief Whether events are being recorded. Only `start` sets it, before any work
+    /// begins, so every thread can read it without synchronising.
+    inline bool enabled_ = false;
+
+    inline bool enabled() {
+        return enabled_;
+    }
+
+    /// @brief Starts recording. Timestamps are measured from this call.
+    void start();
+
+    /// @brief Writes every event recorded so far, from every thread, to `path` in the
+    /// Chrome trace-event format that `chrome://tracing` and Perfetto open.
+    /// @return False if the file could not be written.
+    bool write(const std::string& path);
+
+    /// @return Nanoseconds since `start`.
+    [[gnu::cold]] u64 now() noexcept;
+
+    /// @brief Records a duration event. `name` must outlive the trace; `detail` is copied.
+    /// These are kept out of line and `noexcept` so that a span costs the code it sits in
+    /// no more than its check of `enabled`.
+    [[gnu::cold, gnu::noinline]] void complete(const char* name, u64 start, u64 end, std::string_view detail = {}) noexcept;
+
+    /// @brief Records the value of counter `name` at this moment.
+    [[gnu::cold, gnu::noinline]] void counter(const char* name, u64 value) noexcept;
+
+    /// @brief Records a duration event covering its own lifetime, nested inside any span
+    /// still open on the same thread. Costs one load and a branch when tracing is off.
+    ///
+    /// Each thread appends to a buffer of its own, so spans on different threads never
+    /// contend; the buffers are only gathered up by `write`.
+    class Span {
+    private:
+        const char* m_name;
+        std::string_view m_detail;
+        u64 m_start { 0 };
+
+    public:
+        /// @param detail Shown as the event's argument. It must outlive the span.
+        explicit Span(const char* name, std::string_view detail = {})
+            : m_name(enabled() ? name : nullptr), m_detail(detail) {
+            if (m_name) [[unlikely]] m_start = now();
+        }
+
+        ~Span() {
+            if (m_name) [[unlikely]] complete(m_name, m_start, now(), m_detail);
+        }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+    };
+}
+
+#endif
@@ -6,6 +6,9 @@ import tempfile
 LOX_PATH = "./bin"
 SUCCESS_CODE = 0
 
+# Assertions run on each backend, unless they name one themselves.
+BACKENDS = ["--backend=tree", "--backend=closure"]
+
 ALL_TESTS = []
 FAILED_TESTS = []
 
@@ -20,7 +23,7 @@ def run_tests():
         test()
 
 
-def lox_execute(lox_code):
+def lox_execute(lox_code, arguments=()):
     lox_executable = f"{LOX_PATH}/loxpp"
 
     # Create a temporary file with the Lox code
@@ -30,7 +33,7 @@ def lox_execute(lox_code):
 
     try:
         result = subprocess.run(
-            [lox_executable, tmp_path],
+            [lox_executable, *arguments, tmp_path],
             text=True,
             capture_output=True
         )
@@ -40,19 +43,33 @@ def lox_execute(lox_code):
 
 
 
-def lox_evaluate(lox_expr):
-    return lox_execute(f"print ({lox_expr});")
+def lox_evaluate(lox_expr, arguments=()):
+    return lox_execute(f"print ({lox_expr});", arguments)
+
+
+def backend_arguments(arguments):
+    if any(argument.startswith("--backend=") for argument in arguments):
+        return [list(arguments)]
+    return [[backend, *arguments] for backend in BACKENDS]
 
 
 def lox_assert(lox_expr, expected_output, message=""):
-    real_output = lox_evaluate(lox_expr)
+    for arguments in backend_arguments(()):
+        check(f"{lox_expr} ({arguments[0]})", lox_evaluate(lox_expr, arguments), expected_output)
+
+
+def lox_assert_program(lox_code, expected_output, arguments=()):
+    for arguments in backend_arguments(arguments):
+        check(f"{lox_code} ({' '.join(arguments)})", lox_execute(lox_code, arguments), expected_output)
+
 
+def check(lox_code, real_output, expected_output):
     if real_output == expected_output:
         print("[ \033[92mPASSED\033[0m ]")
         return
     
     current_function = inspect.currentframe().f_code.co_name
-    FAILED_TESTS.append(lox_expr)
+    FAILED_TESTS.append(lox_code)
 
     print(f"[ \033[91mFAILED\033[0m ]")
     print(f"\tExpected: {expected_output}")
@@ -1,4 +1,10 @@
-from lox_test import test, lox_assert, run_tests
+import os
+import random
+import re
+import subprocess
+import tempfile
+
+from lox_test import LOX_PATH, test, check, lox_assert, lox_assert_program, run_tests
 
 @test
 def test_expressions():
@@ -8,5 +14,347 @@ def test_expressions():
     lox_assert("false ? \"hello\" : nil", "nil")
 
 
+@test
+def test_runtime_errors():
+    lox_assert("\"con\" + \"cat\"", "concat")
+    lox_assert("1 / 0", "Division by 0.\n[line 0]")
+    lox_assert("-\"text\"", "Operand must be a number.\n[line 0]")
+    lox_assert("1 < nil", "Operands must be numbers.\n[line 0]")
+
+
+@test
+def test_calls():
+    lox_assert("clock() >= 0", "true")
+    lox_assert("clock(1)", "Expected 0 arguments but got 1.\n[line 0]")
+    lox_assert("\"text\"()", "Can only call functions.\n[line 0]")
+
+
+@test
+def test_properties():
+    lox_assert("true.field", "Only instances have properties.\n[line 0]")
+    lox_assert("clock.field = 1", "Only instances have fields.\n[line 0]")
+
+    # The receiver of a `super` call is pushed just as the scope stack grows.
+    classes = "class A { m(x) { return x; } } class B < A { m(x) { return super.m(x) + 1; } }"
+    locals = " ".join(f"var v{i} = {i};" for i in range(1, 63))
+    lox_assert_program(f"{classes} {{ {locals} print B().m(1); }}", "2")
+
+
+@test
+def test_globals():
+    lox_assert("undefined", "Variable not defined.\n[line 0]")
+    lox_assert("undefined = 1", "Variable does not exist.\n[line 0]")
+
+
+@test
+def test_parallel():
+    loop = "parallel for (var i = 0; i < 4; i = i + 1) "
+    lox_assert_program("var x = 0; " + loop + "{ x = 1; }",
+                       "On line 0 at  at 'x': Can't assign to a variable declared outside a parallel loop, except to reduce it, as in 'x = x + y;'.")
+    lox_assert_program("var x = 0; " + loop + "{ x = x + i; print x; }",
+                       "On line 0 at  at 'x': Can't read 'x' inside the parallel loop that reduces it.")
+    lox_assert_program(loop + "{ i = 0; }", "On line 0 at  at 'i': Can't assign to the variable of a parallel loop.")
+    lox_assert_program("var g = 0; fun set() { g = 1; } " + loop + "{ set(); }",
+                       "Can't assign to a variable declared outside a parallel loop.\n[line 0]")
+    lox_assert_program("class A {} var a = A(); " + loop + "{ a.field = i; }",
+                       "Can't assign to a field inside a parallel loop.\n[line 0]")
+    lox_assert_program("var x = 0; " + loop + "{ x = x + i; } print x;", "6")
+
+    # Every worker's allocations count toward the memory limit, not just the first thread's.
+    doubling = "{ if (i == 1) { var s = \"aaaaaaaaaaaaaaaa\"; var n = 0; while (n < 24) { s = s + s; n = n + 1; } print n; } }"
+    lox_assert_program("parallel for (var i = 0; i < 2; i = i + 1) " + doubling, "Out of memory.\n[line 0]",
+                       ["--max-memory=8M", "--threads=2"])
+
+
+@test
+def test_garbage_collection():
+    # Garbage made before the first collection is collected before it reaches a small limit.
+    program = """
+        fun make(n) { fun f() { return n; } return f; }
+        var kept = 0;
+        for (var i = 0; i < 20000; i = i + 1) {
+            var l = [i, "item " + "number"];
+            kept = kept + make(1)();
+        }
+        print kept;
+    """
+    lox_assert_program(program, "20000", ["--max-memory=600K"])
+
+    # Live objects that a collection can't free end the program, rather than making it
+    # collect again at every statement.
+    lox_assert_program("class A {} var l = []; for (var i = 0; i < 200000; i = i + 1) { append(l, A()); }",
+                       "Out of memory.\n[line 0]", ["--max-memory=16M"])
+    lox_assert_program("class A {} var l = [];\nwhile (true) {\n  append(l, A());\n}",
+                       "Out of memory.\n[line 2]", ["--max-memory=16M", "--timeout=30"])
+    # Bound methods and closures are checked as they're made, so a loop that only makes
+    # those fails at the line that makes them.
+    lox_assert_program("class A { m() {} } var l = []; var a = A();\nwhile (true) append(l, a.m);",
+                       "Out of memory.\n[line 1]", ["--max-memory=16M", "--timeout=30"])
+    lox_assert_program("fun make(x) { fun f() { return x; } return f; } var l = [];\nwhile (true)\n  append(l, make(1));",
+                       "Out of memory.\n[line 2]", ["--max-memory=16M", "--timeout=30"])
+
+
+@test
+def test_tasks():
+    lox_assert_program("fun f(x) {} spawn(f);", "Expected a function that takes no arguments.\n[line 0]")
+    lox_assert_program("readfile(1, clock);", "The path must be a string.\n[line 0]")
+    lox_assert_program("shell(\"echo\", clock);", "Expected a function that takes one argument.\n[line 0]",
+                       ["--allow-shell"])
+    lox_assert_program("fun f(x) {} parallel for (var i = 0; i < 2; i = i + 1) spawn(f);",
+                       "Can't start a task inside a parallel loop.\n[line 0]")
+    lox_assert_program("fun f() { print nil + 1; } fun g() { print 1; } spawn(f); spawn(g);",
+                       "Operands must be two numbers or two strings.\n[line 0]")
+
+    # Scripts can only run commands when asked to.
+    lox_assert_program("shell(\"echo hi\", clock);", "Variable not defined.\n[line 0]")
+
+    # The first command waits on a pipe that only the second command's function writes to,
+    # so it can only finish if the second is read while the first is still running.
+    with tempfile.TemporaryDirectory() as directory:
+        fifo = os.path.join(directory, "fifo")
+        os.mkfifo(fifo)
+        program = (f"fun show(text) {{ print text; }} fun ignore(text) {{}} "
+                   f"fun release(text) {{ print text; shell(\"echo > {fifo}\", ignore); }} "
+                   f"shell(\"read line < {fifo}; echo slow\", show); shell(\"echo fast\", release);")
+        lox_assert_program(program, "fast\n\nslow", ["--allow-shell", "--timeout=10"])
+
+
+@test
+def test_arrays():
+    lox_assert("array(2.5)", "The length of an array must be a whole number from 0 to 16777216.\n[line 0]")
+    lox_assert("get(array(2), 2)", "The index must be a whole number less than the array's length.\n[line 0]")
+    lox_assert("add(array(2), array(3))", "The arrays must have the same length.\n[line 0]")
+    lox_assert("sum(nil)", "Expected an array.\n[line 0]")
+    lox_assert_program("var a = array(4); parallel for (var i = 0; i < 4; i = i + 1) set(a, i, 1);",
+                       "Can't change an array created outside a parallel loop.\n[line 0]")
+    lox_assert_program("var a = array(100000);", "Out of memory.\n[line 0]", ["--max-memory=64K"])
+
+    # The kernels picked for this CPU and the fallbacks give the same results, for the
+    # elements filling whole vectors and for those left over.
+    program = ("var a = array(19); for (var i = 0; i < 19; i = i + 1) set(a, i, i - 9); "
+               "var b = fill(array(19), 3); print sum(a); print dot(a, b); print min(a); print max(a); "
+               "print scale(add(mul(a, b), b), 2);")
+    expected = "0\n0\n-9\n9\n[-48, -42, -36, -30, -24, -18, -12, -6, 0, 6, 12, 18, 24, 30, 36, 42, 48, 54, 60]"
+    for arguments in [[], ["--simd=sse2"], ["--simd=scalar"]]:
+        lox_assert_program(program, expected, arguments)
+
+@test
+def test_collections():
+    lox_assert("[1, 2][2]", "The index must be a whole number less than the list's length.\n[line 0]")
+    lox_assert("nil[0]", "Only lists, maps and arrays can be indexed.\n[line 0]")
+    lox_assert("map()[nil] = 1", "A map key can't be nil or NaN.\n[line 0]")
+    lox_assert("pop([])", "Can't pop from an empty list.\n[line 0]")
+    lox_assert_program("for (var x in 1) print x;", "Can only loop over lists, maps and arrays.\n[line 0]")
+    lox_assert_program("var l = [0]; parallel for (var i = 0; i < 4; i = i + 1) l[0] = i;",
+                       "Can't change a list created outside a parallel loop.\n[line 0]")
+    lox_assert_program("var l = []; for (var i = 0; i < 100000; i = i + 1) append(l, i);",
+                       "Out of memory.\n[line 0]", ["--max-memory=64K"])
+
+    # Maps keep the order keys were added in, and a list or map holding itself prints once.
+    lox_assert_program("var m = map(); m[\"a\"] = 1; m[2] = [3]; m[true] = m; remove(m, 2); m[2] = nil; print m;",
+                       "{a: 1, true: {...}, 2: nil}")
+    lox_assert_program("var l = [1]; append(l, l); print l; print length(l);", "[1, [...]]\n2")
+
+@test
+def test_pipeline():
+    lox_assert_program("fun f() { return g(); } fun g() { return 1; } print f();", "1", ["--pipeline"])
+    lox_assert_program("print nil + 1; print 2;", "Operands must be two numbers or two strings.\n[line 0]", ["--pipeline"])
+
+    # Declarations before a syntax error run once they are parsed, unless the whole
+    # program has to parse first.
+    program = "print \"ran\"; var x = ; print 1;"
+    lox_assert_program(program, "ran", ["--pipeline"])
+    lox_assert_program(program, "On line 0 at  at ';': Expected an expression.")
+
+@test
+def test_scan_threads():
+    # Scanning in chunks gives the same tokens as scanning in one go: the same program, the
+    # same nodes and the same line numbers. The file is cut a little past each megabyte, so
+    # with 4 threads one cut is between statements and one is inside a string that spans
+    # lines; the comments hide a quote and the strings hide a comment.
+    def statement(i):
+        return [f"total = total + {i % 7}; // a \"quote in a comment\n",
+                f"s = \"text // not a comment {i}\";\n",
+                f"if (total < -{i}) {{ print \"never\"; }}\n"][i % 3]
+
+    parts = ["var total = 0;\nvar s = \"\";\n"]
+    size = len(parts[0])
+
+    def add(part):
+        nonlocal size
+        parts.append(part)
+        size += len(part)
+
+    while size < (2 << 20) - 20000:
+        add(statement(len(parts)))
+    add("s = \"" + "\n".join(f"line {i} of a long string" for i in range(2000)) + "\";\n")
+    while size < 3 << 20:
+        add(statement(len(parts)))
+    add("print total; print s; print nil + 1;\n")
+    text = "".join(parts)
+
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "large.lox")
+        with open(path, "w") as file:
+            file.write(text)
+
+        def run(threads):
+            result = subprocess.run([f"{LOX_PATH}/loxpp", "--ast-stats", f"--scan-threads={threads}", path],
+                                    text=True, capture_output=True)
+            lines = (result.stdout + result.stderr).splitlines()
+            return "\n".join(line for line in lines if "time" not in line)
+
+        expected = run(1)
+        # Lines count from 0, and the error is on the last one.
+        check(path, str(expected.endswith(f"[line {text.count(chr(10)) - 1}]")), "True")
+        for threads in [2, 4]:
+            check(f"--scan-threads={threads} {path}", run(threads), expected)
+
+@test
+def test_budget():
+    lox_assert_program("while (true) {}", "Out of steps.\n[line 0]", ["--max-steps=1000"])
+    lox_assert_program("while (true) {}", "Out of time.\n[line 0]", ["--timeout=0.1"])
+    lox_assert_program("fun f() { f(); f(); } f();", "Out of steps.\n[line 0]", ["--max-steps=100"])
+    lox_assert_program("parallel for (var i = 0; i < 4; i = i + 1) while (true) {}",
+                       "Out of steps.\n[line 0]", ["--max-steps=100000"])
+    lox_assert_program("for (var i = 0; i < 10; i = i + 1) {} print 1;", "1", ["--max-steps=11"])
+    lox_assert_program("var s = 0; for (var x in [1, 2, 3]) s = s + x; print s;", "Out of steps.\n[line 0]",
+                       ["--max-steps=2"])
+
+    # Waiting on a read counts toward the timeout, even a read of a pipe nothing ever writes to.
+    with tempfile.TemporaryDirectory() as directory:
+        fifo = os.path.join(directory, "fifo")
+        os.mkfifo(fifo)
+        lox_assert_program(f"fun show(text) {{ print text; }} readfile(\"{fifo}\", show);",
+                           "Out of time.\n[line 0]", ["--timeout=0.2"])
+
+@test
+def test_options():
+    # A number with anything after it, a sign its option can't take, or a value out of range is a
+    # usage error, not whatever prefix of it parses.
+    for arguments in [["--threads=4x"], ["--scan-threads=-1"], ["--gc-growth=2x"], ["--gc-growth=inf"],
+                      ["--iterations", "-1", "--bench"], ["--warmup", "4294967296", "--bench"],
+                      ["--max-steps=10s"]]:
+        result = subprocess.run([f"{LOX_PATH}/loxpp", *arguments, "scripts/test1.lox"], capture_output=True)
+        check(" ".join(arguments), str(result.returncode), "64")
+
+@test
+def test_snapshots():
+    with tempfile.TemporaryDirectory() as directory:
+        snapshot = os.path.join(directory, "prelude.snap")
+
+        # Arrays, lists and maps come back with their contents, and still shared or cyclic.
+        prelude = ("var n = 3; var s = \"text\"; var b = true; var z = nil; var a = array(3); set(a, 1, 2); "
+                   "var l = [1, \"two\", [3]]; append(l, l); var m = map(); m[\"list\"] = l; m[l] = a; var same = l;")
+        lox_assert_program(prelude, "", ["--write-snapshot", snapshot])
+        program = ("print n; print s; print b; print z; print a; print l; print m[\"list\"] == l; print m[l]; "
+                   "print l[3] == l; append(same, 5); print length(l);")
+        expected = "3\ntext\ntrue\nnil\n[0, 2, 0]\n[1, two, [3], [...]]\ntrue\n[0, 2, 0]\ntrue\n5"
+        lox_assert_program(program, expected, ["--snapshot", snapshot])
+
+        # A global that can't be saved is named, and no snapshot is left behind.
+        os.remove(snapshot)
+        lox_assert_program("var l = [clock]; fun f() {}",
+                           f"Could not write snapshot '{snapshot}': global 'f' holds a function, class or instance.",
+                           ["--write-snapshot", snapshot])
+        check(snapshot, str(os.path.exists(snapshot)), "False")
+
+@test
+def test_test_runner():
+    def write(path, text):
+        with open(path, "w") as file:
+            file.write(text)
+
+    def run_tests(directory):
+        result = subprocess.run([f"{LOX_PATH}/loxpp", "--test", directory], text=True, capture_output=True)
+        return result.returncode, result.stdout
+
+    # Printing what was expected isn't enough: the script must also end as expected, and a
+    # failure shows the error it reported.
+    with tempfile.TemporaryDirectory() as directory:
+        script = os.path.join(directory, "error.lox")
+        write(script, "print 1; print nil + 1;")
+        write(script.replace(".lox", ".expected"), "1\n")
+        code, output = run_tests(directory)
+        check("--test " + script, str(code), "1")
+        check("--test " + script, str("Operands must be two numbers or two strings." in output), "True")
+
+        write(script.replace(".lox", ".expected_exit"), "70\n")
+        write(script.replace(".lox", ".expected_err"), "Operands must be two numbers or two strings.\n[line 0]\n")
+        check("--test " + script, str(run_tests(directory)[0]), "0")
+
+        write(script.replace(".lox", ".expected_err"), "Undefined.\n[line 0]\n")
+        check("--test " + script, str(run_tests(directory)[0]), "1")
+
+def random_edits(source, count, seed):
+    """Edits of the kinds an editor makes: many leave the text broken until the next one
+    mends it, and the rest insert or change whole statements."""
+    generator = random.Random(seed)
+    fragments = ["{", "}", "(", ")", "\"", "/", "*", ";", "var ", " ", "\n", "fun ", "x", "//"]
+    statements = ["print 1;\n", "var inserted = \"text\";\n", "fun added(a) {\n  return a + 1;\n}\n", "\n", "// note\n"]
+    edits = []
+
+    def apply(offset, length, text):
+        nonlocal source
+        edits.append((offset, length, text))
+        source = source[:offset] + text + source[offset + length:]
+
+    while len(edits) < count:
+        kind = generator.randrange(4)
+        # Whole statements go before lines that look like the start of a top-level one.
+        line_starts = [0] + [match.end() for match in re.finditer("[;}]\n(?=[a-z])", source)]
+        if kind == 0:
+            digits = [match.start() for match in re.finditer("[0-9]", source)]
+            if digits:
+                apply(generator.choice(digits), 1, str(generator.randrange(10)))
+        elif kind == 1:
+            apply(generator.choice(line_starts), 0, generator.choice(statements))
+        elif kind == 2:
+            # Type something that breaks the text, then take it back.
+            offset = generator.randrange(len(source) + 1)
+            text = "".join(generator.choice(fragments) for _ in range(generator.randint(1, 3)))
+            apply(offset, 0, text)
+            apply(offset, len(text), "")
+        else:
+            # Cut a stretch, then paste it back.
+            offset = generator.randrange(len(source) + 1)
+            length = min(generator.randint(1, 40), len(source) - offset)
+            removed = source[offset:offset + length]
+            apply(offset, length, "")
+            apply(offset, 0, removed)
+
+    return edits[:count]
+
+
+@test
+def test_incremental_parsing():
+    # After every edit that leaves a script that parses, the incremental parser's program
+    # matches a full parse of the edited text, line numbers included.
+    with tempfile.TemporaryDirectory() as directory:
+        for seed, script in enumerate(sorted(os.listdir("scripts"))):
+            if not script.endswith(".lox"):
+                continue
+            path = os.path.join("scripts", script)
+            with open(path) as file:
+                edits = random_edits(file.read(), 400, seed)
+
+            edits_path = os.path.join(directory, script + ".edits")
+            with open(edits_path, "w") as file:
+                for offset, length, text in edits:
+                    escaped = text.replace("\\", "\\\\").replace("\n", "\\n")
+                    file.write(f"{offset} {length} {escaped}\n")
+
+            result = subprocess.run([f"{LOX_PATH}/loxpp", "--replay-edits", edits_path, path], text=True, capture_output=True)
+            checked = re.search("checked ([0-9]+)", result.stdout)
+            check(path, str(result.returncode), "0")
+            check(path, str(checked is not None and int(checked.group(1)) >= 100), "True")
+
+@test
+def test_perf_stats():
+    # The counts go to stderr, and don't change what the program prints.
+    program = "fun f(n) { return n * 2; } print f(21);"
+    lox_assert_program(program, "42", ["--perf-stats"])
+
+
 if __name__ == "__main__":
     run_tests()